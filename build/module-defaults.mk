@@ -23,6 +23,11 @@ else
 CFLAGS += -DRELEASE_BUILD
 endif
 
+# Per-subsystem heap accounting, see services/inc/alloc_trace.h
+ifeq ("$(USE_ALLOC_TRACE)","y")
+CFLAGS += -DALLOC_TRACE_ENABLED=1
+endif
+
 ifdef SPARK_TEST_DRIVER
 CFLAGS += -DSPARK_TEST_DRIVER=$(SPARK_TEST_DRIVER)
 endif
@@ -26,6 +26,7 @@
 #include "device_keys.h"
 #include "message_channel.h"
 #include "buffer_message_channel.h"
+#include "dtls_record_packer.h"
 
 #include "mbedtls/ssl.h"
 #include "mbedtls/ssl_internal.h"
@@ -103,6 +104,13 @@ private:
 	bool move_session;
 	const uint8_t* device_id;
 
+	/**
+	 * Outgoing records are packed only while an application message is being
+	 * written. Handshake messages are always sent as is.
+	 */
+	DtlsRecordPacker packer;
+	bool packing_records;
+
     void init();
     void dispose();
 
@@ -121,8 +129,11 @@ private:
 
 	void reset_session();
 
+	int flush_records();
+	int close_records();
+
  public:
-	DTLSMessageChannel() : coap_state(nullptr), move_session(false) {}
+	DTLSMessageChannel() : coap_state(nullptr), move_session(false), packing_records(false) {}
 
 	ProtocolError init(const uint8_t* core_private, size_t core_private_len,
 		const uint8_t* core_public, size_t core_public_len,
@@ -160,8 +171,7 @@ private:
 
 	virtual AppStateDescriptor cached_app_state_descriptor() const override;
 
-	virtual void reset() override {
-	}
+	virtual void reset() override;
 };
 
 
@@ -173,6 +173,13 @@ struct Channel
 		 * Save session - saves the session to persistent store.
 		 */
 		SAVE_SESSION = 4,
+
+		/**
+		 * Pack several outgoing records into a single datagram. The argument
+		 * is a pointer to a `size_t` specifying the maximum datagram size, or
+		 * 0 to disable packing.
+		 */
+		PACK_RECORDS = 5,
 	};
 
 
@@ -44,6 +44,7 @@ inline uint8_t decode_uint8(unsigned char* buf) {
 
 #define RESPONSE_CODE(x,y)  (x<<5 | y)
 
+class CoapMessageDecoder;
 
 
 class Messages
@@ -52,6 +53,12 @@ public:
 	static const size_t MAX_GOODBYE_MESSAGE_SIZE;
 
 	static CoAPMessageType::Enum decodeType(const uint8_t* buf, size_t length);
+	static CoAPMessageType::Enum decodeType(const CoapMessageDecoder& d);
+	/**
+	 * Returns the single-byte parameter of a request, such as the DESCRIBE flags, or -1 if the
+	 * request has no parameter.
+	 */
+	static int requestParameter(const CoapMessageDecoder& d);
 	static size_t describe_post_header(uint8_t buf[], size_t buffer_size, uint16_t message_id, uint8_t desc_flags);
 	static size_t hello(uint8_t* buf, message_id_t message_id, uint16_t flags, uint16_t platform_id, uint16_t system_version,
 			uint16_t product_id, uint16_t product_version, const uint8_t* device_id, size_t device_id_len,
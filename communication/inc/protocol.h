@@ -13,9 +13,12 @@
 #include "publisher.h"
 #include "subscriptions.h"
 #include "variables.h"
+#include "coap_defs.h"
 #include "hal_platform.h"
 #include "timesyncmanager.h"
 
+#include <memory>
+
 namespace particle
 {
 
@@ -121,6 +124,22 @@ class Protocol
 	message_handle_t app_describe_msg_id;
 	message_handle_t system_describe_msg_id;
 
+	/**
+	 * Describe payload generated last, together with the flags and application state checksums
+	 * it was generated for. The cache is kept across sessions and is rebuilt only when the
+	 * checksums change, e.g. when a function or variable is registered or a module is updated.
+	 */
+	struct DescribeCache
+	{
+		std::unique_ptr<char[]> data;
+		size_t size = 0;
+		int flags = 0;
+		uint32_t app_crc = 0;
+		uint32_t system_crc = 0;
+	};
+
+	DescribeCache describe_cache;
+
 	/**
 	 * Completion handlers for messages with confirmable delivery.
 	 */
@@ -151,7 +170,11 @@ protected:
 		/**
 		 * Support for compressed/combined OTA updates.
 		 */
-		COMPRESSED_OTA = 0x10
+		COMPRESSED_OTA = 0x10,
+		/**
+		 * Support for delta OTA updates.
+		 */
+		DELTA_OTA = 0x20
 	};
 
 	/**
@@ -203,7 +226,7 @@ protected:
 		return next_token++;
 	}
 
-	ProtocolError handle_key_change(Message& message);
+	ProtocolError handle_key_change(const CoapMessageDecoder& d, Message& message);
 
 	/**
 	 * Send the hello message over the channel.
@@ -272,7 +295,12 @@ protected:
 #endif // !HAL_PLATFORM_OTA_PROTOCOL_V3
 		else
 		{
-			ProtocolError error = pinger.process(callbacks.millis() - last_message_millis, [this] {
+			ProtocolError error = publisher.process(channel, callbacks.millis());
+			if (error)
+			{
+				return error;
+			}
+			error = pinger.process(callbacks.millis() - last_message_millis, [this] {
 				return ping();
 			});
 			if (error)
@@ -293,6 +321,8 @@ protected:
 	 * @arg \p DESCRIBE_APPLICATION
 	 * @arg \p DESCRIBE_METRICS
 	 * @arg \p DESCRIBE_SYSTEM
+	 * @param app_crc Checksum of the application description (see compute_describe_checksums())
+	 * @param system_crc Checksum of the system description
 	 *
 	 * @returns \s ProtocolError result value
 	 * @retval \p particle::protocol::NO_ERROR
@@ -300,7 +330,7 @@ protected:
 	 * @sa particle::protocol::ProtocolError
 	 */
 	ProtocolError generate_and_send_description(MessageChannel& channel, Message& message,
-												size_t header_size, int desc_flags);
+												size_t header_size, int desc_flags, uint32_t app_crc, uint32_t system_crc);
 
 	/**
 	 * Produces a describe message and transmits it as a separate response.
@@ -334,6 +364,19 @@ protected:
 	 */
 	static void copy_and_init(void* target, size_t target_size, const void* source, size_t source_size);
 
+	/**
+	 * Returns the block size for a block-wise transfer of data that would otherwise be limited to
+	 * `max_data_size` bytes per message.
+	 */
+	size_t get_block_size(size_t max_data_size) const
+	{
+		if (max_transmit_message_size) {
+			// The runtime limits don't account for the options specific to block-wise transfers
+			max_data_size = (max_data_size > MAX_BLOCK_OPTIONS_SIZE) ? max_data_size - MAX_BLOCK_OPTIONS_SIZE : 0;
+		}
+		return coapBlockSize(max_data_size);
+	}
+
 	void init(const SparkCallbacks &callbacks, const SparkDescriptor &descriptor);
 
 	/**
@@ -394,6 +437,15 @@ public:
 		}
 	}
 
+	void set_delta_ota_enabled(bool enabled)
+	{
+		if (enabled) {
+			protocol_flags |= ProtocolFlag::DELTA_OTA;
+		} else {
+			protocol_flags &= ~ProtocolFlag::DELTA_OTA;
+		}
+	}
+
 	void set_system_version(uint16_t version)
 	{
 		system_version = version;
@@ -409,11 +461,27 @@ public:
 		ota_chunk_size = size;
 	}
 
+	void set_ota_receive_window_size(size_t size)
+	{
+#if HAL_PLATFORM_OTA_PROTOCOL_V3
+		firmwareUpdate.receiveWindowSize(size);
+#endif
+	}
+
 	void set_max_transmit_message_size(size_t size)
 	{
 		max_transmit_message_size = size;
 	}
 
+	/**
+	 * Sets the maximum size of a datagram into which the outgoing records are packed,
+	 * or 0 to send each record in a separate datagram.
+	 */
+	ProtocolError set_record_packing(size_t max_datagram_size)
+	{
+		return channel.command(MessageChannel::PACK_RECORDS, &max_datagram_size);
+	}
+
 	size_t get_max_transmit_message_size() const
 	{
 		return max_transmit_message_size;
@@ -442,6 +510,31 @@ public:
 		return MAX_FUNCTION_ARG_LENGTH;
 	}
 
+	/**
+	 * Returns the size of the blocks in which event data larger than `get_max_event_data_size()`
+	 * is sent, or 0 if such events cannot be sent.
+	 */
+	size_t get_event_block_size() const {
+		return get_block_size(get_max_event_data_size());
+	}
+
+	/**
+	 * Returns the maximum size of the blocks in which a variable value is sent when the server
+	 * requests it block-wise.
+	 */
+	size_t get_variable_block_size() const {
+		return get_block_size(get_max_variable_value_size());
+	}
+
+	/**
+	 * Returns the number of milliseconds until an application event can be published without
+	 * being rate limited.
+	 */
+	system_tick_t get_publish_delay()
+	{
+		return publisher.next_event_delay(false /* is_system_event */, callbacks.millis());
+	}
+
 	void set_handlers(CommunicationsHandlers& handlers)
 	{
 		copy_and_init(&this->handlers, sizeof(this->handlers), &handlers, handlers.size);
@@ -531,6 +624,20 @@ public:
 
 	void build_describe_message(Appender& appender, int desc_flags);
 
+	/**
+	 * Produces a describe message, reusing the cached payload if the description hasn't changed.
+	 *
+	 * @param app_crc Checksum of the application description (see compute_describe_checksums()).
+	 * @param system_crc Checksum of the system description.
+	 */
+	void build_cached_describe_message(BufferAppender& appender, int desc_flags, uint32_t app_crc, uint32_t system_crc);
+
+	/**
+	 * Computes the checksums of the descriptions requested by `desc_flags`. A checksum that is
+	 * not requested or can't be computed is set to 0.
+	 */
+	void compute_describe_checksums(int desc_flags, uint32_t* app_crc, uint32_t* system_crc);
+
 	inline bool add_event_handler(const char *event_name, EventHandler handler)
 	{
 		return add_event_handler(event_name, handler, NULL,
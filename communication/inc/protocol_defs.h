@@ -20,7 +20,7 @@ namespace particle { namespace protocol {
 #define PRODUCT_FIRMWARE_VERSION (0xffff)
 #endif
 
-#define MAX_SUBSCRIPTIONS (6)       // 2 system and 4 application
+#define MAX_SUBSCRIPTIONS (64)      // system and application handlers, allocated on demand
 
 enum ProtocolError
 {
@@ -100,9 +100,48 @@ const size_t MAX_FUNCTION_ARG_LENGTH = 864;
 const size_t MAX_VARIABLE_VALUE_LENGTH = 864;
 #endif
 
+// Maximum size of event data that can be sent using a block-wise transfer (RFC 7959)
+#ifndef MAX_BLOCKWISE_EVENT_DATA_LENGTH
+#if HAL_PLATFORM_GEN >= 3
+#define MAX_BLOCKWISE_EVENT_DATA_LENGTH 16384
+#else
+#define MAX_BLOCKWISE_EVENT_DATA_LENGTH 4096
+#endif
+#endif
+
 // Timeout in milliseconds given to receive an acknowledgement for a published event
 const unsigned SEND_EVENT_ACK_TIMEOUT = 20000;
 
+// Name of the event carrying a batch of events published with the BATCH flag
+#ifndef PUBLISH_BATCH_EVENT_NAME
+#define PUBLISH_BATCH_EVENT_NAME "batch"
+#endif
+
+// Maximum time in milliseconds a batched event is held back before the batch is sent
+#ifndef PUBLISH_BATCH_MAX_DELAY
+#define PUBLISH_BATCH_MAX_DELAY 1000
+#endif
+
+// Maximum number of application events that can be published in a burst
+#ifndef PUBLISH_RATE_LIMIT_BURST
+#define PUBLISH_RATE_LIMIT_BURST 4
+#endif
+
+// Time in milliseconds it takes to regain the budget for one application event (4 events per second)
+#ifndef PUBLISH_RATE_LIMIT_PERIOD
+#define PUBLISH_RATE_LIMIT_PERIOD 250
+#endif
+
+// Maximum number of system events that can be published in a burst
+#ifndef PUBLISH_SYSTEM_RATE_LIMIT_BURST
+#define PUBLISH_SYSTEM_RATE_LIMIT_BURST 255
+#endif
+
+// Time in milliseconds it takes to regain the budget for one system event (255 events per ~65 seconds)
+#ifndef PUBLISH_SYSTEM_RATE_LIMIT_PERIOD
+#define PUBLISH_SYSTEM_RATE_LIMIT_PERIOD 257
+#endif
+
 /**
  * Maximum possible size of a CoAP message carrying a cloud event.
  */
@@ -118,6 +157,11 @@ const size_t MAX_FUNCTION_CALL_MESSAGE_SIZE = 4 /* Header */ + 1 /* Token */ + (
  */
 const size_t MAX_VARIABLE_VALUE_MESSAGE_SIZE = 4 /* Header */ + 1 /* Token */ + 1 /* Payload marker */ +
         MAX_VARIABLE_VALUE_LENGTH /* Payload data */;
+/**
+ * Maximum size of the options added to a message sent as part of a block-wise transfer: a Block1
+ * or Block2 option, and a Size1 or Size2 option.
+ */
+const size_t MAX_BLOCK_OPTIONS_SIZE = 2 * (1 /* Option header */ + 1 /* Extended delta */ + 4 /* Option value */);
 
 #ifndef PROTOCOL_BUFFER_SIZE
 #define PROTOCOL_BUFFER_SIZE MBEDTLS_SSL_MAX_CONTENT_LEN
@@ -157,7 +201,11 @@ enum Enum
     MAX_TRANSMIT_MESSAGE_SIZE = 7, ///< Maximum size of of outgoing CoAP message (set).
     MAX_EVENT_DATA_SIZE = 8, ///< Maximum size of event data (get).
     MAX_VARIABLE_VALUE_SIZE = 9, ///< Maximum size of a variable value (get).
-    MAX_FUNCTION_ARGUMENT_SIZE = 10 ///< Maximum size of a function call argument (get).
+    MAX_FUNCTION_ARGUMENT_SIZE = 10, ///< Maximum size of a function call argument (get).
+    PUBLISH_DELAY = 11, ///< Time in milliseconds until an event can be published without being rate limited (get).
+    OTA_RECEIVE_WINDOW_SIZE = 12, ///< Size of the receiver window for OTA updates in bytes (set).
+    DELTA_OTA = 13, ///< Enable/disable support for delta OTA updates (set).
+    RECORD_PACKING = 14 ///< Maximum size of a datagram into which the outgoing records are packed, or 0 to disable packing (set).
 };
 
 }
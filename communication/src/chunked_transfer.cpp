@@ -101,7 +101,9 @@ ProtocolError ChunkedTransfer::handle_update_begin(
             channel.create(updateReady);
             // updateReady will have the maximum capacity
             int offset = updateReady.capacity() - chunk_bitmap_size();
-            bitmap = queue+offset; // this relies on the fact that we know the channels use a static buffer
+            // this relies on the fact that we know the channels use a static buffer
+            const uintptr_t addr = (uintptr_t)(queue + offset) & ~(uintptr_t)(sizeof(BitmapWord) - 1);
+            bitmap = (BitmapWord*)addr;
 
             // when not in fast OTA mode, the chunk missing buffer is set to 1 since the protocol
             // handles missing chunks one by one. Also we don't know the actual size of the file to
@@ -329,15 +331,17 @@ ProtocolError ChunkedTransfer::send_missing_chunks(MessageChannel& channel, size
     buf[5] = 'c';
     buf[6] = 0xff; // payload marker
 
-    while ((idx = next_chunk_missing(chunk_index_t(idx)))
-            != NO_CHUNKS_MISSING && sent < count)
+    while (sent < count && (idx = next_chunk_missing(idx)) != NO_CHUNKS_MISSING)
     {
-        buf[(sent * 2) + 7] = idx >> 8;
-        buf[(sent * 2) + 8] = idx & 0xFF;
+        // request the whole run of missing chunks without rescanning the bitmap
+        const chunk_index_t end = next_chunk_received(idx);
+        for (; idx < end && sent < count; idx++, sent++)
+        {
+            buf[(sent * 2) + 7] = idx >> 8;
+            buf[(sent * 2) + 8] = idx & 0xFF;
 
-        missed_chunk_index = idx;
-        idx++;
-        sent++;
+            missed_chunk_index = idx;
+        }
     }
 
     if (sent > 0)
@@ -374,19 +378,15 @@ void ChunkedTransfer::cancel()
 
 chunk_index_t ChunkedTransfer::next_chunk_missing(chunk_index_t start)
 {
-    chunk_index_t chunk = NO_CHUNKS_MISSING;
-    chunk_index_t chunks = file.chunk_count(chunk_size);
-    chunk_index_t idx = start;
-    for (; idx < chunks; idx++)
-    {
-        if (!is_chunk_received(idx))
-        {
-            //serial_dump("next missing chunk %d from %d", idx, start);
-            chunk = idx;
-            break;
-        }
-    }
-    return chunk;
+    const chunk_index_t chunks = file.chunk_count(chunk_size);
+    const size_t idx = findBit(chunk_bitmap(), chunks, start, false /* value */);
+    return (idx < chunks) ? idx : NO_CHUNKS_MISSING;
+}
+
+chunk_index_t ChunkedTransfer::next_chunk_received(chunk_index_t start)
+{
+    const chunk_index_t chunks = file.chunk_count(chunk_size);
+    return findBit(chunk_bitmap(), chunks, start, true /* value */);
 }
 
 void ChunkedTransfer::set_chunks_received(uint8_t value)
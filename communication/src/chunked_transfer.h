@@ -28,6 +28,7 @@
 #include "message_channel.h"
 #include "system_tick_hal.h"
 #include "messages.h"
+#include "bitmap_util.h"
 
 namespace particle
 {
@@ -87,7 +88,10 @@ private:
 	unsigned short chunk_index;
 	unsigned short chunk_size;
 
-	uint8_t* bitmap;
+	/**
+	 * Bitmap of received chunks, stored as 32-bit words.
+	 */
+	BitmapWord* bitmap;
 
 	Callbacks* callbacks;
 
@@ -100,10 +104,10 @@ protected:
 
 	unsigned chunk_bitmap_size()
 	{
-		return (file.chunk_count(chunk_size) + 7) / 8;
+		return bitmapWordCount(file.chunk_count(chunk_size)) * sizeof(BitmapWord);
 	}
 
-	uint8_t* chunk_bitmap()
+	BitmapWord* chunk_bitmap()
 	{
 		return bitmap;
 	}
@@ -111,15 +115,22 @@ protected:
 	inline void flag_chunk_received(chunk_index_t idx)
 	{
 		//    serial_dump("flagged chunk %d", idx);
-		chunk_bitmap()[idx >> 3] |= uint8_t(1 << (idx & 7));
+		setBit(chunk_bitmap(), idx);
 	}
 
 	inline bool is_chunk_received(chunk_index_t idx)
 	{
-		return (chunk_bitmap()[idx >> 3] & uint8_t(1 << (idx & 7)));
+		return testBit(chunk_bitmap(), idx);
 	}
 
+	/**
+	 * Returns the index of the first missing chunk starting from `start`, or `NO_CHUNKS_MISSING`.
+	 */
 	chunk_index_t next_chunk_missing(chunk_index_t start);
+	/**
+	 * Returns the index of the first received chunk starting from `start`, or the number of chunks.
+	 */
+	chunk_index_t next_chunk_received(chunk_index_t start);
 	void set_chunks_received(uint8_t value);
 public:
 
@@ -22,6 +22,10 @@
 #include "messages.h"
 #include "communication_diagnostic.h"
 
+#include <algorithm>
+#include <limits>
+#include <new>
+
 namespace particle { namespace protocol {
 
 uint16_t CoAPMessage::message_count = 0;
@@ -68,25 +72,161 @@ void CoAPMessageStore::message_timeout(CoAPMessage& msg, Channel& channel)
  */
 void CoAPMessageStore::process(system_tick_t time, Channel& channel)
 {
-	CoAPMessage* msg = head;
-	CoAPMessage* prev = nullptr;
-	while (msg!=nullptr)
+	const system_tick_t tick = time >> WHEEL_SHIFT;
+	const system_tick_t elapsed = (tick - wheel_tick) & (std::numeric_limits<system_tick_t>::max() >> WHEEL_SHIFT);
+	// The slot that was processed last is visited again, since it may contain messages that expire later within that slot.
+	// If the time has gone backwards, or more than one revolution has passed, all slots are visited
+	const size_t slots = (elapsed < WHEEL_SIZE) ? elapsed + 1 : WHEEL_SIZE;
+	const system_tick_t first = wheel_tick;
+	wheel_tick = tick;
+	for (size_t i = 0; i < slots; ++i)
 	{
-		if (time_has_passed(time, msg->get_timeout()) && !retransmit(msg, channel, time))
+		const size_t slot = slot_for_tick(first + i);
+		CoAPMessage* msg = wheel[slot];
+		while (msg!=nullptr)
 		{
-			remove(msg, prev);
-			message_timeout(*msg, channel);
+			if (!time_has_passed(time, msg->get_timeout()))
+			{
+				msg = msg->get_next();
+			}
+			else if (retransmit(msg, channel, time))
+			{
+				CoAPMessage* const next = msg->get_next();
+				unschedule(*msg);
+				schedule(*msg);
+				msg = next;
+			}
+			else
+			{
+				remove(*msg);
+				message_timeout(*msg, channel);
+				delete msg;
+				// The timeout notification may have added or removed other messages, including the
+				// ones in this slot, so the slot is scanned again from its head
+				msg = wheel[slot];
+			}
+		}
+	}
+}
+
+ProtocolError CoAPMessageStore::add(CoAPMessage& message)
+{
+	// trying to add exactly the same message
+	if (from_id(message.get_id())==&message)
+		return NO_ERROR;
+
+	clear_message(message.get_id());
+	if (message.get_next() || message.get_prev())
+		return INVALID_STATE;
+	if ((count+1)*4 > index_size*3 && !grow_index())
+		return INSUFFICIENT_STORAGE;
+	index[index_pos(message.get_id())] = &message;
+	++count;
+	if (message.get_type()==CoAPType::CON)
+		++confirmable_count;
+	schedule(message);
+	return NO_ERROR;
+}
+
+void CoAPMessageStore::remove(CoAPMessage& message)
+{
+	index_remove(index_pos(message.get_id()));
+	unschedule(message);
+	--count;
+	if (message.get_type()==CoAPType::CON)
+		--confirmable_count;
+}
+
+void CoAPMessageStore::clear()
+{
+	for (size_t i = 0; i < index_size; ++i)
+	{
+		CoAPMessage* msg = index[i];
+		if (msg)
+		{
+			msg->removed();
 			delete msg;
-			msg = (prev==nullptr) ? head : prev->get_next();
 		}
-		else
+	}
+	delete[] index;
+	index = nullptr;
+	index_size = 0;
+	count = 0;
+	confirmable_count = 0;
+	std::fill(wheel, wheel + WHEEL_SIZE, nullptr);
+}
+
+bool CoAPMessageStore::grow_index()
+{
+	const size_t size = index_size ? index_size*2 : MIN_INDEX_SIZE;
+	CoAPMessage** const table = new(std::nothrow) CoAPMessage*[size]();
+	if (!table)
+		return false;
+	CoAPMessage** const old_table = index;
+	const size_t old_size = index_size;
+	index = table;
+	index_size = size;
+	for (size_t i = 0; i < old_size; ++i)
+	{
+		if (old_table[i])
+			index[index_pos(old_table[i]->get_id())] = old_table[i];
+	}
+	delete[] old_table;
+	return true;
+}
+
+/**
+ * Removes the entry at the given position of the index. Subsequent entries of the same probe
+ * sequence are shifted back, so that lookups never need to skip over deleted entries.
+ */
+void CoAPMessageStore::index_remove(size_t pos)
+{
+	const size_t mask = index_size-1;
+	index[pos] = nullptr;
+	size_t i = pos;
+	for (;;)
+	{
+		i = (i+1) & mask;
+		if (!index[i])
+			break;
+		const size_t home = index[i]->get_id() & mask;
+		// the entry can be moved if the hole lies between its home position and its current position
+		if (((i - home) & mask) >= ((i - pos) & mask))
 		{
-			prev = msg;
-			msg = msg->get_next();
+			index[pos] = index[i];
+			index[i] = nullptr;
+			pos = i;
 		}
 	}
 }
 
+void CoAPMessageStore::schedule(CoAPMessage& message)
+{
+	// Messages that are already due are put into the slot that will be processed next
+	const system_tick_t tick = time_has_passed(wheel_tick << WHEEL_SHIFT, message.get_timeout()) ?
+			wheel_tick : (message.get_timeout() >> WHEEL_SHIFT);
+	const size_t slot = slot_for_tick(tick);
+	CoAPMessage* const head = wheel[slot];
+	message.set_slot(slot);
+	message.set_prev(nullptr);
+	message.set_next(head);
+	if (head)
+		head->set_prev(&message);
+	wheel[slot] = &message;
+}
+
+void CoAPMessageStore::unschedule(CoAPMessage& message)
+{
+	CoAPMessage* const prev = message.get_prev();
+	CoAPMessage* const next = message.get_next();
+	if (prev)
+		prev->set_next(next);
+	else
+		wheel[message.get_slot()] = next;
+	if (next)
+		next->set_prev(prev);
+	message.removed();
+}
 
 /**
  * Registers that this message has been sent from the application.
@@ -116,7 +256,12 @@ ProtocolError CoAPMessageStore::send(Message& msg, system_tick_t time)
 		{
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
 		}
-		add(*coapmsg);
+		const ProtocolError error = add(*coapmsg);
+		if (error)
+		{
+			delete coapmsg;
+			return error;
+		}
 	}
 	return NO_ERROR;
 }
@@ -170,22 +315,16 @@ ProtocolError CoAPMessageStore::receive(Message& msg, Channel& channel, system_t
 			// the timeout here is ideally purely academic since the application will respond immediately with an ACK/RESET
 			// which will be stored in place of this message, with it's own timeout.
 			coapmsg->set_expiration(time+CoAPMessage::MAX_TRANSMIT_SPAN);
-			add(*coapmsg);
+			const ProtocolError error = add(*coapmsg);
+			if (error)
+			{
+				delete coapmsg;
+				return error;
+			}
 		}
 	}
 	// else it's a NON message - pass through
 	return NO_ERROR;
 }
 
-bool CoAPMessageStore::has_unacknowledged_requests() const
-{
-	// TODO: Use a message counter
-	for (const CoAPMessage* msg = head; msg != nullptr; msg = msg->get_next()) {
-		if (is_confirmable((uint8_t*)msg->get_data()))
-			return true;
-	}
-
-	return false;
-}
-
 }}
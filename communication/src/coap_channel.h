@@ -20,6 +20,7 @@
 
 #include "message_channel.h"
 #include "coap.h"
+#include "coap_message_pool.h"
 #include "timer_hal.h"
 #include "stdlib.h"
 #include "service_debug.h"
@@ -104,10 +105,11 @@ public:
 
 private:
 	/**
-	 * Messages are stored as a singly-linked list.
-	 * This pointer is the next message in the list, or nullptr if this is the last message in the list.
+	 * Messages that expire at around the same time are stored as a doubly-linked list.
+	 * These pointers are the next and previous messages in the list, or nullptr at either end.
 	 */
 	CoAPMessage* next;
+	CoAPMessage* prev;
 
 	/**
 	 * The time when the system will resend this message or give up sending
@@ -126,8 +128,11 @@ private:
 	 */
 	uint8_t transmit_count;
 
-	// padding
-	// uint8_t reserved;
+	/**
+	 * The timer wheel slot of the message store this message is scheduled in.
+	 */
+	uint8_t slot;
+
 	std::function<void(Delivery)>* delivered;
 
 	/**
@@ -171,10 +176,28 @@ public:
 	static const uint8_t NSTART = 1;
 
 
-	CoAPMessage(message_id_t id_) : next(nullptr), timeout(0), id(id_), transmit_count(0), delivered(nullptr), send_time(0), data_len(0) {
+	CoAPMessage(message_id_t id_) : next(nullptr), prev(nullptr), timeout(0), id(id_), transmit_count(0), slot(0), delivered(nullptr), send_time(0), data_len(0) {
 		message_count++;
 	}
 
+	/**
+	 * CoAPMessage instances are allocated from a pool, falling back to the heap when the pool is exhausted.
+	 */
+	static void* operator new(size_t size) noexcept
+	{
+		return CoAPMessagePool::allocate(size);
+	}
+
+	static void* operator new(size_t size, void* ptr) noexcept
+	{
+		return ptr;
+	}
+
+	static void operator delete(void* ptr)
+	{
+		CoAPMessagePool::free(ptr);
+	}
+
 	/**
 	 * Create a new CoAPMessage from the given Message instance. The returned CoAPMessage is dynamically allocated
 	 * and has an independent lifetime from the Message
@@ -183,7 +206,7 @@ public:
 	static CoAPMessage* create(Message& msg, size_t data_len = 0)
 	{
 		size_t len = data_len && data_len<msg.length() ? data_len : msg.length();
-		uint8_t* memory = new uint8_t[sizeof(CoAPMessage)+len];
+		void* memory = CoAPMessagePool::allocate(sizeof(CoAPMessage)+len);
 		if (memory) {
 			CoAPMessage* coapmsg = new (memory)CoAPMessage(msg.get_id());		// in-place new
 			coapmsg->set_data(msg.buf(), len);
@@ -201,9 +224,13 @@ public:
 
 	inline CoAPMessage* get_next() const { return next; }
 	inline void set_next(CoAPMessage* next) { this->next = next; }
+	inline CoAPMessage* get_prev() const { return prev; }
+	inline void set_prev(CoAPMessage* prev) { this->prev = prev; }
 	inline bool matches(message_id_t id) const { return this->id==id; }
 	inline message_id_t get_id() const { return id; }
-	inline void removed() { next = nullptr; }
+	inline uint8_t get_slot() const { return slot; }
+	inline void set_slot(uint8_t slot) { this->slot = slot; }
+	inline void removed() { next = nullptr; prev = nullptr; }
 	inline system_tick_t get_timeout() const { return timeout; }
 
 	inline void set_delivered_handler(std::function<void(Delivery)>* handler) { this->delivered = handler; }
@@ -325,62 +352,129 @@ inline bool time_has_passed(system_tick_t now, system_tick_t tick)
 
 /**
  * A mix-in class that provides message resending for reliable delivery of messages.
+ *
+ * Messages are looked up by ID via an open-addressing hash table, and scheduled for
+ * retransmission via a timer wheel, so that processing only visits the messages that
+ * may have timed out since the last call.
  */
 class CoAPMessageStore
 {
 	LOG_CATEGORY("comm.coap");
 
 	/**
-	 * The head of the list of messages.
+	 * The number of slots in the timer wheel. Must be a power of two.
 	 */
-	CoAPMessage* head;
+	static const size_t WHEEL_SIZE = 32;
 
 	/**
-	 * Retrieves the message with the given ID and the previous message.
-	 * If no message exists with the given id, nullptr is returned.
+	 * Each slot of the timer wheel spans 2^WHEEL_SHIFT milliseconds, so the whole wheel spans
+	 * about a minute. Messages expiring further in the future stay in their slot for more than
+	 * one revolution of the wheel.
+	 */
+	static const unsigned WHEEL_SHIFT = 11;
+
+	/**
+	 * The initial size of the message index. Must be a power of two.
+	 */
+	static const size_t MIN_INDEX_SIZE = 8;
+
+	/**
+	 * The slots of the timer wheel. Each slot is the head of the list of messages whose
+	 * timeout falls into that slot.
+	 */
+	CoAPMessage* wheel[WHEEL_SIZE];
+
+	/**
+	 * The timer wheel tick that was processed last.
+	 */
+	system_tick_t wheel_tick;
+
+	/**
+	 * Messages keyed by message ID, using linear probing. The table is allocated on demand
+	 * and its size is either 0 or a power of two.
+	 */
+	CoAPMessage** index;
+	size_t index_size;
+
+	/**
+	 * The number of messages in the store.
+	 */
+	size_t count;
+
+	/**
+	 * The number of confirmable messages in the store.
 	 */
-	CoAPMessage* for_id(message_id_t id, CoAPMessage*& prev) const
+	size_t confirmable_count;
+
+	static inline size_t slot_for_tick(system_tick_t tick)
 	{
-		prev = nullptr;
-		CoAPMessage* next = head;
-		while (next)
-		{
-			if (next->matches(id))
-				return next;
-			prev = next;
-			next = next->get_next();
-		}
-		return nullptr;
+		return tick & (WHEEL_SIZE-1);
+	}
+
+	/**
+	 * Returns the position of the message with the given ID in the index,
+	 * or the position of an empty entry if no such message exists.
+	 */
+	size_t index_pos(message_id_t id) const
+	{
+		const size_t mask = index_size-1;
+		// Message IDs are allocated sequentially, so they are used as is
+		size_t pos = id & mask;
+		while (index[pos] && !index[pos]->matches(id))
+			pos = (pos+1) & mask;
+		return pos;
 	}
 
 	/**
-	 * Removes a message given the message to remove and the previous entry in the list.
+	 * Retrieves the message with the given ID.
+	 * If no message exists with the given id, nullptr is returned.
 	 */
-	void remove(CoAPMessage* message, CoAPMessage* previous)
+	CoAPMessage* for_id(message_id_t id) const
 	{
-		if (previous)
-			previous->set_next(message->get_next());
-		else
-			head = message->get_next();
-		message->removed();
+		return index_size ? index[index_pos(id)] : nullptr;
 	}
 
+	bool grow_index();
+	void index_remove(size_t pos);
+
+	/**
+	 * Links the message into the timer wheel slot corresponding to its timeout.
+	 */
+	void schedule(CoAPMessage& message);
+
+	/**
+	 * Unlinks the message from its timer wheel slot.
+	 */
+	void unschedule(CoAPMessage& message);
+
+	/**
+	 * Removes the message from the index and the timer wheel.
+	 */
+	void remove(CoAPMessage& message);
+
 	void message_timeout(CoAPMessage& msg, Channel& channel);
 
 public:
 
-	CoAPMessageStore() : head(nullptr) {}
+	CoAPMessageStore() : wheel(), wheel_tick(0), index(nullptr), index_size(0), count(0), confirmable_count(0) {}
 
 	~CoAPMessageStore() {
 		clear();
 	}
 
+	// This class is non-copyable
+	CoAPMessageStore(const CoAPMessageStore&) = delete;
+	CoAPMessageStore& operator=(const CoAPMessageStore&) = delete;
+
 	bool has_messages() const
 	{
-		return head!=nullptr;
+		return count!=0;
 	}
 
-	bool has_unacknowledged_requests() const;
+	bool has_unacknowledged_requests() const
+	{
+		return confirmable_count!=0;
+	}
 
 	/**
 	 * Retrieves the current confirmable message that is still
@@ -389,9 +483,7 @@ public:
 	 */
 	CoAPMessage* from_id(message_id_t id) const
 	{
-		CoAPMessage* prev;
-		CoAPMessage* next = for_id(id, prev);
-		return next;
+		return for_id(id);
 	}
 
 	ProtocolError add(CoAPMessage* message)
@@ -402,19 +494,7 @@ public:
 	/**
 	 * Adds a message to this message store.
 	 */
-	ProtocolError add(CoAPMessage& message)
-	{
-		// trying to add exactly the same message
-		if (from_id(message.get_id())==&message)
-			return NO_ERROR;
-
-		clear_message(message.get_id());
-		if (message.get_next())
-			return INVALID_STATE;
-		message.set_next(head);
-		head = &message;
-		return NO_ERROR;
-	}
+	ProtocolError add(CoAPMessage& message);
 
 	/**
 	 * Removes a message from the store with the given id.
@@ -423,10 +503,9 @@ public:
 	 */
 	CoAPMessage* remove(message_id_t msg_id)
 	{
-		CoAPMessage* prev;
-		CoAPMessage* msg = for_id(msg_id, prev);
+		CoAPMessage* msg = for_id(msg_id);
 		if (msg) {
-			remove(msg, prev);
+			remove(*msg);
 		}
 		return msg;
 	}
@@ -472,13 +551,7 @@ public:
 	/**
 	 * Removes all knowledge of any messages.
 	 */
-	void clear()
-	{
-		while (head!=nullptr)
-		{
-			delete remove(head->get_id());
-		}
-	}
+	void clear();
 
 };
 
@@ -60,6 +60,46 @@ CoapCode coapCodeForSystemError(int error) {
     }
 }
 
+int encodeCoapBlockOption(unsigned num, bool more, size_t size) {
+    if (num > MAX_COAP_BLOCK_NUMBER || size < MIN_COAP_BLOCK_SIZE || size > MAX_COAP_BLOCK_SIZE || (size & (size - 1))) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    // Block size is encoded as a 3-bit exponent: size = 2 ^ (SZX + 4)
+    unsigned szx = 0;
+    while ((MIN_COAP_BLOCK_SIZE << szx) < size) {
+        ++szx;
+    }
+    return (num << 4) | (more ? 0x08 : 0) | szx;
+}
+
+int decodeCoapBlockOption(unsigned val, unsigned* num, bool* more, size_t* size) {
+    const unsigned szx = val & 0x07;
+    if (szx == 7 || (val >> 4) > MAX_COAP_BLOCK_NUMBER) { // SZX 7 is reserved
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    if (num) {
+        *num = val >> 4;
+    }
+    if (more) {
+        *more = val & 0x08;
+    }
+    if (size) {
+        *size = MIN_COAP_BLOCK_SIZE << szx;
+    }
+    return 0;
+}
+
+size_t coapBlockSize(size_t maxSize) {
+    if (maxSize < MIN_COAP_BLOCK_SIZE) {
+        return 0;
+    }
+    size_t size = MAX_COAP_BLOCK_SIZE;
+    while (size > maxSize) {
+        size >>= 1;
+    }
+    return size;
+}
+
 } // namespace protocol
 
 } // namespace particle
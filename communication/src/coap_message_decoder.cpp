@@ -80,6 +80,8 @@ int readOption(unsigned* opt, const char** optData, size_t* optSize, unsigned pr
 } // namespace
 
 CoapMessageDecoder::CoapMessageDecoder() :
+        optCount_(0),
+        optsIndexed_(true),
         token_(),
         type_(CoapType::CON),
         id_(0),
@@ -117,9 +119,24 @@ int CoapMessageDecoder::decode(const char* data, size_t size) {
     offs += tokenSize;
     // Options
     size_t optsOffs = offs;
+    size_t optCount = 0;
+    bool optsIndexed = true;
+    unsigned opt = 0;
     while (size - offs > 0 && *(data + offs) != (char)0xff) {
-        offs += CHECK(readOption(nullptr /* opt */, nullptr /* optData */, nullptr /* optSize */, 0 /* prevOpt */,
-                data + offs, size - offs));
+        const char* optData = nullptr;
+        size_t optSize = 0;
+        offs += CHECK(readOption(&opt, &optData, &optSize, opt, data + offs, size - offs));
+        if (optsIndexed) {
+            const size_t dataOffs = optData - (data + optsOffs);
+            if (optCount < MAX_INDEXED_COAP_OPTIONS && opt <= 0xffff && dataOffs + optSize <= 0xffff) {
+                auto& e = optIndex_[optCount++];
+                e.opt = opt;
+                e.offs = dataOffs;
+                e.size = optSize;
+            } else {
+                optsIndexed = false;
+            }
+        }
     }
     const size_t optsSize = offs - optsOffs;
     // Payload
@@ -130,6 +147,8 @@ int CoapMessageDecoder::decode(const char* data, size_t size) {
     payload_ = (payloadSize_ > 0) ? data + offs : nullptr;
     optsSize_ = optsSize;
     opts_ = (optsSize_ > 0) ? data + optsOffs : nullptr;
+    optCount_ = optsIndexed ? optCount : 0;
+    optsIndexed_ = optsIndexed;
     tokenSize_ = tokenSize;
     memcpy(token_, data + tokenOffs, tokenSize_);
     code_ = code;
@@ -139,13 +158,40 @@ int CoapMessageDecoder::decode(const char* data, size_t size) {
 }
 
 CoapOptionIterator CoapMessageDecoder::findOption(unsigned opt) const {
-    auto it = options();
-    while (it.next()) {
-        if (it.option() == opt) {
-            break;
+    if (!optsIndexed_) {
+        auto it = options();
+        while (it.next()) {
+            if (it.option() == opt) {
+                break;
+            }
         }
+        return it;
+    }
+    const auto end = optIndex_ + optCount_;
+    const auto e = std::lower_bound(optIndex_, end, opt, [](const OptionIndexEntry& e, unsigned opt) {
+        return e.opt < opt;
+    });
+    if (e == end || e->opt != opt) {
+        return CoapOptionIterator();
+    }
+    // Position the iterator at the option found so that the options that follow it can be
+    // iterated over as usual
+    const size_t nextOffs = e->offs + e->size;
+    if (nextOffs < optsSize_) {
+        return CoapOptionIterator(opts_ + nextOffs, optsSize_ - nextOffs, e->opt, opts_ + e->offs, e->size);
+    }
+    return CoapOptionIterator(nullptr, 0, e->opt, opts_ + e->offs, e->size);
+}
+
+int CoapMessageDecoder::block(CoapOption opt, unsigned* num, bool* more, size_t* size) const {
+    const auto it = findOption(opt);
+    if (!it) {
+        return SYSTEM_ERROR_NOT_FOUND;
+    }
+    if (it.size() > 3) { // RFC 7959, 2.2. Structure of a Block Option
+        return SYSTEM_ERROR_BAD_DATA;
     }
-    return it;
+    return decodeCoapBlockOption(it.toUInt(), num, more, size);
 }
 
 bool CoapOptionIterator::next() {
@@ -27,6 +27,11 @@ namespace protocol {
 
 class CoapOptionIterator;
 
+/**
+ * Maximum number of options of a message that can be looked up without re-parsing the message.
+ */
+const size_t MAX_INDEXED_COAP_OPTIONS = 16;
+
 /**
  * A class for decoding CoAP messages.
  */
@@ -53,11 +58,28 @@ public:
     bool hasOption(unsigned opt) const;
     bool hasOptions() const;
 
+    // Decodes a Block1 or Block2 option (RFC 7959). Returns SYSTEM_ERROR_NOT_FOUND if the message
+    // doesn't have the option
+    int block(CoapOption opt, unsigned* num, bool* more, size_t* size) const;
+
     // TODO: Add convenience methods for decoding URI path and query options
 
     int decode(const char* data, size_t size);
 
 private:
+    // Location of an option in the source buffer
+    struct OptionIndexEntry {
+        uint16_t opt; // Option number
+        uint16_t offs; // Offset of the option data relative to the start of the options
+        uint16_t size; // Size of the option data
+    };
+
+    // Options are indexed in the order of their appearance in the message, which is also the
+    // ascending order of their numbers. If a message has too many options to be indexed, they
+    // are looked up by iterating over the message
+    OptionIndexEntry optIndex_[MAX_INDEXED_COAP_OPTIONS];
+    size_t optCount_;
+    bool optsIndexed_;
     // We want all fields that identify the message, such as the ID and token, to remain valid
     // even if the data in the source buffer is not valid anymore
     char token_[MAX_COAP_TOKEN_SIZE];
@@ -99,6 +121,7 @@ private:
     unsigned opt_;
 
     CoapOptionIterator(const char* data, size_t size);
+    CoapOptionIterator(const char* nextOpt, size_t bufSize, unsigned opt, const char* optData, size_t optSize);
 
     void reset();
 
@@ -173,6 +196,15 @@ inline CoapOptionIterator::CoapOptionIterator(const char* data, size_t size) :
         opt_(0) {
 }
 
+inline CoapOptionIterator::CoapOptionIterator(const char* nextOpt, size_t bufSize, unsigned opt, const char* optData,
+        size_t optSize) :
+        nextOpt_(nextOpt),
+        optData_(optData),
+        bufSize_(bufSize),
+        optSize_(optSize),
+        opt_(opt) {
+}
+
 inline unsigned CoapOptionIterator::option() const {
     return opt_;
 }
@@ -166,6 +166,18 @@ CoapMessageEncoder& CoapMessageEncoder::option(unsigned opt, unsigned val) {
     return *this;
 }
 
+CoapMessageEncoder& CoapMessageEncoder::block(CoapOption opt, unsigned num, bool more, size_t size) {
+    if (error_) {
+        return *this;
+    }
+    const int val = encodeCoapBlockOption(num, more, size);
+    if (val < 0) {
+        error_ = val;
+        return *this;
+    }
+    return option(opt, (unsigned)val);
+}
+
 CoapMessageEncoder& CoapMessageEncoder::payload(const char* data, size_t size) {
     if (error_) {
         return *this;
@@ -55,6 +55,9 @@ public:
     template<typename... ArgsT>
     CoapMessageEncoder& option(CoapOption opt, ArgsT&&... args);
 
+    // Encodes a Block1 or Block2 option (RFC 7959)
+    CoapMessageEncoder& block(CoapOption opt, unsigned num, bool more, size_t size);
+
     // TODO: Add convenience methods for encoding URI path and query options
 
     CoapMessageEncoder& payload(const char* data, size_t size);
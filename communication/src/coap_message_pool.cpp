@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "coap_message_pool.h"
+
+#include "coap_channel.h"
+#include "communication_diagnostic.h"
+
+#include <new>
+#include <cstdint>
+
+namespace particle {
+
+namespace protocol {
+
+namespace {
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+template<size_t DataSize, size_t Count>
+class Bucket {
+public:
+    static const size_t BLOCK_SIZE = (sizeof(CoAPMessage) + DataSize + alignof(FreeBlock) - 1) / alignof(FreeBlock) *
+            alignof(FreeBlock);
+
+    constexpr Bucket() :
+            storage_(),
+            free_(nullptr),
+            used_(0) {
+    }
+
+    void* allocate(size_t size) {
+        if (size > BLOCK_SIZE) {
+            return nullptr;
+        }
+        if (free_) {
+            FreeBlock* const b = free_;
+            free_ = b->next;
+            return b;
+        }
+        // Blocks that have never been allocated are not on the free list
+        if (used_ < Count) {
+            return storage_ + BLOCK_SIZE * used_++;
+        }
+        return nullptr;
+    }
+
+    bool free(void* ptr) {
+        if (!contains(ptr)) {
+            return false;
+        }
+        const auto b = static_cast<FreeBlock*>(ptr);
+        b->next = free_;
+        free_ = b;
+        return true;
+    }
+
+    bool contains(const void* ptr) const {
+        const auto p = (const uint8_t*)ptr;
+        return p >= storage_ && p < storage_ + sizeof(storage_);
+    }
+
+private:
+    alignas(FreeBlock) uint8_t storage_[BLOCK_SIZE * Count];
+    FreeBlock* free_;
+    size_t used_;
+};
+
+template<size_t DataSize>
+class Bucket<DataSize, 0> {
+public:
+    void* allocate(size_t size) {
+        return nullptr;
+    }
+
+    bool free(void* ptr) {
+        return false;
+    }
+
+    bool contains(const void* ptr) const {
+        return false;
+    }
+};
+
+Bucket<CoAPMessagePool::SMALL_DATA_SIZE, COAP_MESSAGE_POOL_SMALL_COUNT> g_smallBucket;
+Bucket<CoAPMessagePool::MEDIUM_DATA_SIZE, COAP_MESSAGE_POOL_MEDIUM_COUNT> g_mediumBucket;
+Bucket<CoAPMessagePool::LARGE_DATA_SIZE, COAP_MESSAGE_POOL_LARGE_COUNT> g_largeBucket;
+
+} // unnamed
+
+void* CoAPMessagePool::allocate(size_t size) {
+    void* ptr = g_smallBucket.allocate(size);
+    if (!ptr) {
+        ptr = g_mediumBucket.allocate(size);
+        if (!ptr) {
+            ptr = g_largeBucket.allocate(size);
+        }
+    }
+    if (ptr) {
+        ++g_coapPoolHitCounter;
+        return ptr;
+    }
+    ++g_coapPoolMissCounter;
+    return ::operator new(size, std::nothrow);
+}
+
+void CoAPMessagePool::free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (!g_smallBucket.free(ptr) && !g_mediumBucket.free(ptr) && !g_largeBucket.free(ptr)) {
+        ::operator delete(ptr);
+    }
+}
+
+bool CoAPMessagePool::contains(const void* ptr) {
+    return g_smallBucket.contains(ptr) || g_mediumBucket.contains(ptr) || g_largeBucket.contains(ptr);
+}
+
+} // namespace protocol
+
+} // namespace particle
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+#include <cstddef>
+
+/**
+ * Number of blocks in the pool bucket for messages of up to `PROTOCOL_BUFFER_SIZE / 64` bytes,
+ * such as acknowledgements and the headers of received requests.
+ */
+#ifndef COAP_MESSAGE_POOL_SMALL_COUNT
+#define COAP_MESSAGE_POOL_SMALL_COUNT 8
+#endif
+
+/**
+ * Number of blocks in the pool bucket for messages of up to `PROTOCOL_BUFFER_SIZE / 4` bytes,
+ * such as typical events.
+ */
+#ifndef COAP_MESSAGE_POOL_MEDIUM_COUNT
+#define COAP_MESSAGE_POOL_MEDIUM_COUNT 4
+#endif
+
+/**
+ * Number of blocks in the pool bucket for messages of up to `PROTOCOL_BUFFER_SIZE` bytes.
+ */
+#ifndef COAP_MESSAGE_POOL_LARGE_COUNT
+#define COAP_MESSAGE_POOL_LARGE_COUNT 1
+#endif
+
+namespace particle {
+
+namespace protocol {
+
+/**
+ * A fixed-capacity pool of memory blocks for `CoAPMessage` instances.
+ *
+ * Blocks are statically allocated in three buckets, each block holding the message header and up
+ * to a fraction of `PROTOCOL_BUFFER_SIZE` bytes of message data.
+ * An allocation is served from the smallest bucket that fits it and has a free block, or from
+ * the heap if all suitable buckets are exhausted.
+ *
+ * This class is not thread-safe and is meant to be used by the protocol thread only.
+ */
+class CoAPMessagePool {
+public:
+    static const size_t SMALL_DATA_SIZE = PROTOCOL_BUFFER_SIZE / 64;
+    static const size_t MEDIUM_DATA_SIZE = PROTOCOL_BUFFER_SIZE / 4;
+    static const size_t LARGE_DATA_SIZE = PROTOCOL_BUFFER_SIZE;
+
+    /**
+     * Allocates a block of memory.
+     *
+     * @param size Block size.
+     * @return Pointer to the block or `nullptr` if the memory cannot be allocated.
+     */
+    static void* allocate(size_t size);
+    /**
+     * Frees a block of memory allocated with `allocate()`.
+     *
+     * @param ptr Pointer to the block.
+     */
+    static void free(void* ptr);
+
+    /**
+     * Returns `true` if the block was allocated from the pool rather than the heap.
+     */
+    static bool contains(const void* ptr);
+};
+
+} // namespace protocol
+
+} // namespace particle
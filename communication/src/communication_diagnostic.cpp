@@ -5,3 +5,5 @@ particle::SimpleUnsignedIntegerDiagnosticData g_unacknowledgedMessageCounter(DIA
 particle::SimpleUnsignedIntegerDiagnosticData g_trasmittedMessageCounter(DIAG_ID_CLOUD_TRANSMITTED_MESSAGES, DIAG_NAME_CLOUD_TRANSMITTED_MESSAGES);
 particle::SimpleUnsignedIntegerDiagnosticData g_retransmittedMessageCounter(DIAG_ID_CLOUD_RETRANSMITTED_MESSAGES, DIAG_NAME_CLOUD_RETRANSMITTED_MESSAGES);
 particle::SimpleUnsignedIntegerDiagnosticData g_coapRoundTripMSec(DIAG_ID_CLOUD_COAP_ROUND_TRIP, DIAG_NAME_CLOUD_COAP_ROUND_TRIP);
+particle::SimpleUnsignedIntegerDiagnosticData g_coapPoolHitCounter(DIAG_ID_CLOUD_COAP_POOL_HITS, DIAG_NAME_CLOUD_COAP_POOL_HITS);
+particle::SimpleUnsignedIntegerDiagnosticData g_coapPoolMissCounter(DIAG_ID_CLOUD_COAP_POOL_MISSES, DIAG_NAME_CLOUD_COAP_POOL_MISSES);
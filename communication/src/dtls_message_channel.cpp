@@ -269,11 +269,32 @@ ProtocolError DTLSMessageChannel::init(
 
 inline int DTLSMessageChannel::send(const uint8_t* data, size_t len)
 {
+	if (packing_records) {
+		return packer.send(data, len, [this](const uint8_t* data, size_t len) {
+			return callbacks.send(data, len, callbacks.tx_context);
+		});
+	}
 	return callbacks.send(data, len, callbacks.tx_context);
 }
 
+int DTLSMessageChannel::flush_records()
+{
+	return packer.flush([this](const uint8_t* data, size_t len) {
+		return callbacks.send(data, len, callbacks.tx_context);
+	});
+}
+
+int DTLSMessageChannel::close_records()
+{
+	return packer.close([this](const uint8_t* data, size_t len) {
+		return callbacks.send(data, len, callbacks.tx_context);
+	});
+}
+
 void DTLSMessageChannel::reset_session()
 {
+	// Send the records packed so far, e.g. a Goodbye message, before the session is reset
+	close_records();
 	cancel_move_session();
 	mbedtls_ssl_session_reset(&ssl_context);
 	sessionPersist.clear(callbacks.save);
@@ -376,6 +397,7 @@ ProtocolError DTLSMessageChannel::setup_context()
 ProtocolError DTLSMessageChannel::establish()
 {
 	int ret = 0;
+	packer.reset();
 	// LOG(INFO,"setup context");
 	ProtocolError error = setup_context();
 	if (error) {
@@ -455,6 +477,11 @@ ProtocolError DTLSMessageChannel::receive(Message& message)
 	if (ssl_context.state != MBEDTLS_SSL_HANDSHAKE_OVER)
 		return INVALID_STATE;
 
+	// Send the records packed since the last call
+	if (flush_records() < 0) {
+		return IO_ERROR_SOCKET_SEND_FAILED;
+	}
+
 	create(message);
 	uint8_t* buf = message.buf();
 	size_t len = message.capacity();
@@ -518,6 +545,10 @@ ProtocolError DTLSMessageChannel::send(Message& message)
 	}
 
 	if (message.send_direct()) {
+		// Preserve the order of the outgoing datagrams
+		if (flush_records() < 0) {
+			return IO_ERROR_SOCKET_SEND_FAILED;
+		}
 		// send unencrypted
 		int bytes = this->send(message.buf(), message.length());
 		return bytes < 0 ? IO_ERROR_GENERIC_SEND : NO_ERROR;
@@ -529,7 +560,9 @@ ProtocolError DTLSMessageChannel::send(Message& message)
 	LOG_PRINT(TRACE, "\r\n");
 #endif
 
+	packing_records = packer.isEnabled();
 	int ret = mbedtls_ssl_write(&ssl_context, message.buf(), message.length());
+	packing_records = false;
 	if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
 		LOG(ERROR, "mbedtls_ssl_write() failed: -0x%x", -ret);
 		if (ret == MBEDTLS_ERR_NET_SEND_FAILED) {
@@ -550,7 +583,7 @@ bool DTLSMessageChannel::is_unreliable()
 
 ProtocolError DTLSMessageChannel::command(Command command, void* arg)
 {
-	LOG(INFO,"session cmd (CLS,DIS,MOV,LOD,SAV): %d", command);
+	LOG(INFO,"session cmd (CLS,DIS,MOV,LOD,SAV,PCK): %d", command);
 	switch (command)
 	{
 	case CLOSE:
@@ -572,10 +605,25 @@ ProtocolError DTLSMessageChannel::command(Command command, void* arg)
 	case SAVE_SESSION:
 		sessionPersist.save(callbacks.save);
 		break;
+
+	case PACK_RECORDS: {
+		flush_records();
+		const size_t size = arg ? *(const size_t*)arg : 0;
+		if (packer.init(size) < 0) {
+			return NO_MEMORY;
+		}
+		break;
+	}
 	}
 	return NO_ERROR;
 }
 
+void DTLSMessageChannel::reset()
+{
+	// The channel is reset when the protocol is disconnected
+	close_records();
+}
+
 AppStateDescriptor DTLSMessageChannel::cached_app_state_descriptor() const
 {
 	return sessionPersist.app_state_descriptor();
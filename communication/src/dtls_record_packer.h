@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "system_error.h"
+
+#include <memory>
+#include <new>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+namespace particle {
+
+namespace protocol {
+
+/**
+ * Packs several outgoing DTLS records into a single datagram (RFC 6347, 4.1.1).
+ *
+ * The records are buffered until the next record doesn't fit in the datagram or the buffered
+ * records are flushed explicitly.
+ */
+class DtlsRecordPacker {
+public:
+    DtlsRecordPacker() :
+            bufSize_(0),
+            size_(0) {
+    }
+
+    /**
+     * Enables or disables packing.
+     *
+     * Any buffered records are discarded.
+     *
+     * @param maxDatagramSize Maximum size of a datagram, or 0 to disable packing.
+     * @return 0 on success, otherwise a negative result code defined by `system_error_t`.
+     */
+    int init(size_t maxDatagramSize) {
+        buf_.reset();
+        bufSize_ = 0;
+        size_ = 0;
+        if (maxDatagramSize > 0) {
+            buf_.reset(new(std::nothrow) uint8_t[maxDatagramSize]);
+            if (!buf_) {
+                return SYSTEM_ERROR_NO_MEMORY;
+            }
+            bufSize_ = maxDatagramSize;
+        }
+        return 0;
+    }
+
+    /**
+     * Sends a record.
+     *
+     * @param data Record data.
+     * @param size Record size.
+     * @param send Function sending a datagram. Has the same semantics as this method.
+     * @return Number of bytes sent or buffered, 0 if the operation would block, or a negative
+     *         result code on an error.
+     */
+    template<typename SendFn>
+    int send(const uint8_t* data, size_t size, SendFn send) {
+        if (!buf_) {
+            return send(data, size);
+        }
+        if (size_ + size > bufSize_) {
+            if (size_ > 0) {
+                const int r = flush(send);
+                if (r <= 0) {
+                    return r; // The buffered records couldn't be sent
+                }
+            }
+            if (size > bufSize_) {
+                return send(data, size);
+            }
+        }
+        memcpy(buf_.get() + size_, data, size);
+        size_ += size;
+        return size;
+    }
+
+    /**
+     * Sends the buffered records.
+     *
+     * @param send Function sending a datagram.
+     * @return Number of bytes sent, 0 if there are no buffered records or the operation would
+     *         block, or a negative result code on an error. The buffered records are discarded on
+     *         an error.
+     */
+    template<typename SendFn>
+    int flush(SendFn send) {
+        if (!size_) {
+            return 0;
+        }
+        const int r = send(buf_.get(), size_);
+        if (r != 0) {
+            size_ = 0;
+        }
+        return r;
+    }
+
+    /**
+     * Sends the buffered records before the session is closed.
+     *
+     * Unlike `flush()`, this method discards the buffered records if the operation would block.
+     *
+     * @param send Function sending a datagram.
+     * @return Number of bytes sent, 0 if there are no buffered records or the operation would
+     *         block, or a negative result code on an error.
+     */
+    template<typename SendFn>
+    int close(SendFn send) {
+        const int r = flush(send);
+        size_ = 0;
+        return r;
+    }
+
+    /**
+     * Discards the buffered records.
+     */
+    void reset() {
+        size_ = 0;
+    }
+
+    bool isEnabled() const {
+        return (bool)buf_;
+    }
+
+    size_t bufferedSize() const {
+        return size_;
+    }
+
+private:
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t bufSize_;
+    size_t size_;
+};
+
+} // namespace protocol
+
+} // namespace particle
@@ -30,8 +30,11 @@
 
 #include "sha256.h"
 #include "endian_util.h"
+#include "bitmap_util.h"
 #include "check.h"
 
+#include <algorithm>
+
 // JSON classes are not available on platforms where the system part containing the comms library
 // is not linked with Wiring
 #include "spark_wiring_json.h"
@@ -56,7 +59,8 @@ enum OtaCoapOption {
     FILE_SHA256 = 2061,
     CHUNK_SIZE = 2065,
     DISCARD_DATA = 2069,
-    CANCEL_UPDATE = 2073
+    CANCEL_UPDATE = 2073,
+    ACK_RANGES = 2077
 };
 
 inline unsigned trailingOneBits(uint32_t v) {
@@ -83,7 +87,7 @@ ProtocolError FirmwareUpdate::responseAck(Message* msg) {
     if (!updating_) {
         return ProtocolError::INVALID_STATE;
     }
-    if (finishRespId_ < 0 && errorRespId_ < 0) {
+    if (startRespId_ < 0 && finishRespId_ < 0 && errorRespId_ < 0) {
         return ProtocolError::NO_ERROR;
     }
     CoapMessageDecoder d;
@@ -96,7 +100,10 @@ ProtocolError FirmwareUpdate::responseAck(Message* msg) {
         LOG(ERROR, "Invalid message type");
         return ProtocolError::INTERNAL;
     }
-    if (d.id() == finishRespId_) {
+    if (d.id() == startRespId_) {
+        startRespId_ = -1;
+        updateRtt(millis() - startRespTime_);
+    } else if (d.id() == finishRespId_) {
         finishRespId_ = -1;
         stats_.updateFinishTime = millis();
         LOG(INFO, "Update time: %u", (unsigned)(stats_.updateFinishTime - stats_.updateStartTime));
@@ -110,6 +117,10 @@ ProtocolError FirmwareUpdate::responseAck(Message* msg) {
         LOG(INFO, "Chunk ACKs sent: %u", stats_.sentChunkAcks);
         LOG(INFO, "Duplicate chunks: %u", stats_.duplicateChunks);
         LOG(INFO, "Out-of-order chunks: %u", stats_.outOfOrderChunks);
+        LOG(INFO, "Window stalls: %u", stats_.windowStalls);
+        LOG(INFO, "Window stall time: %u", (unsigned)stats_.windowStallTime);
+        LOG(INFO, "Window throughput (min/max): %u/%u", stats_.minWindowThroughput, stats_.maxWindowThroughput);
+        LOG(INFO, "Round-trip time: %u", (unsigned)stats_.rtt);
         LOG(INFO, "Applying firmware update");
         r = callbacks_->finish_firmware_update(0);
         if (r < 0) {
@@ -132,7 +143,7 @@ ProtocolError FirmwareUpdate::process() {
     if (!updating_) {
         return ProtocolError::NO_ERROR;
     }
-    if (unackChunks_ > 0 && millis() - lastChunkTime_ >= OTA_CHUNK_ACK_DELAY) {
+    if (unackChunks_ > 0 && millis() - lastChunkTime_ >= ackDelay_) {
         // Send an UpdateAck
         Message msg;
         int r = channel_->create(msg);
@@ -157,8 +168,7 @@ ProtocolError FirmwareUpdate::process() {
             LOG(ERROR, "Failed to send message: %d", (int)r);
             return (ProtocolError)r;
         }
-        unackChunks_ = 0;
-        ++stats_.sentChunkAcks;
+        chunkAckSent();
     }
     if (stateLogChunks_ < chunkIndex_ && millis() - stateLogTime_ >= TRANSFER_STATE_LOG_INTERVAL) {
         const size_t bytesLeft = fileSize_ - fileOffset_;
@@ -289,7 +299,8 @@ int FirmwareUpdate::handleStartRequest(const CoapMessageDecoder& d, CoapMessageE
     size_t fileSize = 0;
     size_t chunkSize = 0;
     bool discardData = false;
-    CHECK(decodeStartRequest(d, &fileSize, &fileHash, &chunkSize, &discardData));
+    bool ackRanges = false;
+    CHECK(decodeStartRequest(d, &fileSize, &fileHash, &chunkSize, &discardData, &ackRanges));
     if (validateOnly) {
         return 0;
     }
@@ -313,6 +324,7 @@ int FirmwareUpdate::handleStartRequest(const CoapMessageDecoder& d, CoapMessageE
     LOG(INFO, "Starting firmware update");
     fileSize_ = fileSize;
     chunkSize_ = chunkSize;
+    sackRanges_ = ackRanges;
     FirmwareUpdateFlags flags;
     if (discardData) {
         flags |= FirmwareUpdateFlag::DISCARD_DATA;
@@ -325,11 +337,16 @@ int FirmwareUpdate::handleStartRequest(const CoapMessageDecoder& d, CoapMessageE
     stats_.processingTime += millis() - t1;
     transferSize_ = fileSize_ - fileOffset_;
     chunkCount_ = (transferSize_ + chunkSize_ - 1) / chunkSize_;
-    windowSize_ = OTA_RECEIVE_WINDOW_SIZE / chunkSize_;
+    windowSize_ = std::max(recvWindowSize_ / chunkSize_, (size_t)1);
+    ackWindowEdge_ = windowSize_;
     LOG(INFO, "Start offset: %u", (unsigned)fileOffset_);
     LOG(INFO, "Chunk count: %u", (unsigned)chunkCount_);
     LOG(TRACE, "Window size (chunks): %u", (unsigned)windowSize_);
+    if (sackRanges_) {
+        LOG(TRACE, "Using selective acknowledgement ranges");
+    }
     lastChunkTime_ = millis(); // ACK for the first chunk will be delayed
+    startRespTime_ = lastChunkTime_;
     updating_ = true;
     e->type(d.type());
     e->code(CoapCode::CREATED);
@@ -337,6 +354,10 @@ int FirmwareUpdate::handleStartRequest(const CoapMessageDecoder& d, CoapMessageE
     e->token(d.token(), d.tokenSize());
     e->option(OtaCoapOption::WINDOW_SIZE, (unsigned)windowSize_);
     e->option(OtaCoapOption::FILE_SIZE, (unsigned)fileOffset_);
+    if (sackRanges_) {
+        e->option(OtaCoapOption::ACK_RANGES);
+    }
+    *respId = &startRespId_;
     return 0;
 }
 
@@ -386,6 +407,8 @@ int FirmwareUpdate::handleFinishRequest(const CoapMessageDecoder& d, CoapMessage
         w.name("ooo_chunks").value(stats_.outOfOrderChunks);
         w.name("sent_acks").value(stats_.sentChunkAcks);
         w.name("proc_time").value((unsigned)stats_.processingTime);
+        w.name("stall_time").value((unsigned)stats_.windowStallTime);
+        w.name("rtt").value((unsigned)stats_.rtt);
         w.endObject();
         if (w.dataSize() > 0 && w.dataSize() <= e->maxPayloadSize()) {
             e->payloadSize(w.dataSize());
@@ -429,6 +452,7 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
         SYSTEM_ERROR_MESSAGE("Invalid chunk size: %u", (unsigned)size);
         return SYSTEM_ERROR_PROTOCOL;
     }
+    updateStallState(index, chunkTime);
     bool isDupChunk = false;
     if (index <= chunkIndex_) {
         isDupChunk = true;
@@ -441,20 +465,21 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
         const size_t wordIndex = index / 32;
         const unsigned bitIndex = index % 32;
         uint32_t w = chunks_[wordIndex];
-        if (w & (1 << bitIndex)) {
+        if (w & ((uint32_t)1 << bitIndex)) {
             isDupChunk = true;
         } else {
-            w |= (1 << bitIndex);
+            w |= ((uint32_t)1 << bitIndex);
             chunks_[wordIndex] = w;
             const size_t offs = fileOffset_ + index * chunkSize_; // Chunk offset in the file
             if (index == 0) {
                 // Shift the receiver window
+                const size_t words = (windowSize_ + 31) / 32;
                 unsigned bits = 0;
                 while ((bits = trailingOneBits(chunks_[0]))) {
-                    for (size_t i = 0; i < OTA_CHUNK_BITMAP_ELEMENTS; ++i) {
-                        chunks_[i] >>= bits;
-                        if (i < OTA_CHUNK_BITMAP_ELEMENTS - 1) {
-                            chunks_[i] |= chunks_[i + 1] << (32 - bits);
+                    for (size_t i = 0; i < words; ++i) {
+                        chunks_[i] = (bits < 32) ? chunks_[i] >> bits : 0;
+                        if (i < words - 1) {
+                            chunks_[i] |= (bits < 32) ? chunks_[i + 1] << (32 - bits) : chunks_[i + 1];
                         }
                     }
                     fileOffset_ += bits * chunkSize_;
@@ -464,8 +489,8 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
                 if (fileOffset_ > fileSize_) {
                     fileOffset_ = fileSize_;
                 }
-            } else if ((bitIndex > 0 && !(w & (1 << (bitIndex - 1)))) ||
-                    (bitIndex == 0 && wordIndex > 0 && !(chunks_[wordIndex - 1] & (1 << 31)))) {
+            } else if ((bitIndex > 0 && !(w & ((uint32_t)1 << (bitIndex - 1)))) ||
+                    (bitIndex == 0 && wordIndex > 0 && !(chunks_[wordIndex - 1] & ((uint32_t)1 << 31)))) {
                 ++stats_.outOfOrderChunks;
             }
             const auto t1 = millis();
@@ -477,7 +502,7 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
         ++stats_.duplicateChunks;
     }
     bool hasGaps = false;
-    for (size_t i = 0; i < OTA_CHUNK_BITMAP_ELEMENTS; ++i) {
+    for (size_t i = 0; i < (windowSize_ + 31) / 32; ++i) {
         // If some bits are still set in the bitmap, then there's a gap in the sequence of received chunks
         if (chunks_[i]) {
             hasGaps = true;
@@ -486,17 +511,20 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
     }
     ++unackChunks_;
     if (isDupChunk || hasGaps || hasGaps != hasGaps_ || chunkIndex_ == chunkCount_ || unackChunks_ >= OTA_CHUNK_ACK_COUNT ||
-            millis() - lastChunkTime_ >= OTA_CHUNK_ACK_DELAY) {
+            millis() - lastChunkTime_ >= ackDelay_) {
         // Send an UpdateAck
         initChunkAck(e);
-        unackChunks_ = 0;
-        ++stats_.sentChunkAcks;
+        chunkAckSent();
     }
     hasGaps_ = hasGaps;
     lastChunkTime_ = chunkTime;
     if (!stats_.transferStartTime) {
         stats_.transferStartTime = chunkTime;
     }
+    if (stats_.receivedChunks == 1) {
+        windowStartTime_ = chunkTime;
+    }
+    updateThroughput(chunkTime);
     if (chunkIndex_ == chunkCount_ && !stats_.transferFinishTime) {
         stats_.transferFinishTime = millis();
     }
@@ -511,7 +539,7 @@ int FirmwareUpdate::handleChunkRequest(const CoapMessageDecoder& d, CoapMessageE
 }
 
 int FirmwareUpdate::decodeStartRequest(const CoapMessageDecoder& d, size_t* fileSize, const char** fileHash,
-        size_t* chunkSize, bool* discardData) {
+        size_t* chunkSize, bool* discardData, bool* ackRanges) {
     if (d.type() != CoapType::CON) {
         SYSTEM_ERROR_MESSAGE("Invalid message type");
         return SYSTEM_ERROR_PROTOCOL;
@@ -524,6 +552,7 @@ int FirmwareUpdate::decodeStartRequest(const CoapMessageDecoder& d, size_t* file
     bool hasFileHash = false;
     bool hasChunkSize = false;
     bool hasDiscardData = false;
+    bool hasAckRanges = false;
     auto it = d.options();
     while (it.next()) {
         switch (it.option()) {
@@ -565,6 +594,15 @@ int FirmwareUpdate::decodeStartRequest(const CoapMessageDecoder& d, size_t* file
             hasDiscardData = true;
             break;
         }
+        case OtaCoapOption::ACK_RANGES: {
+            if (it.size() != 0) {
+                SYSTEM_ERROR_MESSAGE("Invalid option size");
+                return SYSTEM_ERROR_PROTOCOL;
+            }
+            *ackRanges = true;
+            hasAckRanges = true;
+            break;
+        }
         default:
             break;
         }
@@ -579,6 +617,9 @@ int FirmwareUpdate::decodeStartRequest(const CoapMessageDecoder& d, size_t* file
     if (!hasDiscardData) {
         *discardData = false;
     }
+    if (!hasAckRanges) {
+        *ackRanges = false;
+    }
     return 0;
 }
 
@@ -653,19 +694,110 @@ int FirmwareUpdate::decodeChunkRequest(const CoapMessageDecoder& d, const char**
 }
 
 void FirmwareUpdate::initChunkAck(CoapMessageEncoder* e) {
-    size_t payloadSize = 0;
-    for (int i = OTA_CHUNK_BITMAP_ELEMENTS - 1; i >= 0; --i) {
-        if (chunks_[i]) {
-            payloadSize = (i + 1) * sizeof(uint32_t);
-            break;
-        }
-    }
     e->type(CoapType::NON);
     e->code(CoapCode::POST);
     e->id(0); // Will be set by the message channel
     e->option(CoapOption::URI_PATH, "A");
     e->option(OtaCoapOption::CHUNK_INDEX, chunkIndex_);
-    e->payload((const char*)chunks_, payloadSize);
+    if (sackRanges_) {
+        const size_t size = encodeAckRanges(e->payloadData(), e->maxPayloadSize());
+        e->payloadSize(size);
+    } else {
+        size_t payloadSize = 0;
+        for (int i = (windowSize_ + 31) / 32 - 1; i >= 0; --i) {
+            if (chunks_[i]) {
+                payloadSize = (i + 1) * sizeof(uint32_t);
+                break;
+            }
+        }
+        e->payload((const char*)chunks_, payloadSize);
+    }
+}
+
+void FirmwareUpdate::chunkAckSent() {
+    unackChunks_ = 0;
+    ++stats_.sentChunkAcks;
+    ackWindowEdge_ = chunkIndex_ + windowSize_;
+    if (stallStartTime_ && !stallAckTime_ && ackWindowEdge_ > stallEdge_) {
+        stallAckTime_ = millis();
+    }
+}
+
+size_t FirmwareUpdate::encodeAckRanges(char* buf, size_t size) const {
+    // Each range is encoded as a pair of 16-bit values: index of the first received chunk relative
+    // to the Chunk-Index option and the number of chunks in the range
+    size_t n = 0;
+    unsigned ranges = 0;
+    unsigned pos = 0;
+    while (ranges < OTA_MAX_SACK_RANGES && n + 4 <= size) {
+        pos = findBit(chunks_, windowSize_, pos, true /* value */);
+        if (pos >= windowSize_) {
+            break;
+        }
+        const unsigned end = findBit(chunks_, windowSize_, pos, false /* value */);
+        const uint16_t v[2] = { nativeToLittleEndian<uint16_t>(pos + 1), nativeToLittleEndian<uint16_t>(end - pos) };
+        memcpy(buf + n, v, sizeof(v));
+        n += sizeof(v);
+        ++ranges;
+        pos = end;
+    }
+    return n;
+}
+
+void FirmwareUpdate::updateStallState(unsigned index, system_tick_t time) {
+    if (stallStartTime_) {
+        if (index > stallEdge_) {
+            // The server has received an UpdateAck that moved the receiver window
+            stats_.windowStallTime += time - stallStartTime_;
+            if (stallAckTime_) {
+                updateRtt(time - stallAckTime_);
+            }
+            stallStartTime_ = 0;
+            stallAckTime_ = 0;
+        }
+    } else if (index == ackWindowEdge_ && index < chunkCount_) {
+        // The server has sent all chunks within the advertised receiver window
+        ++stats_.windowStalls;
+        stallStartTime_ = time;
+        stallEdge_ = index;
+    }
+}
+
+void FirmwareUpdate::updateThroughput(system_tick_t time) {
+    const unsigned chunks = chunkIndex_ - windowStartIndex_;
+    if (chunks < windowSize_) {
+        return;
+    }
+    const system_tick_t dt = time - windowStartTime_;
+    if (dt > 0) {
+        const uint64_t bytes = (uint64_t)chunks * chunkSize_;
+        const unsigned t = bytes * 1000 / dt;
+        stats_.windowThroughput = t;
+        if (!stats_.minWindowThroughput || t < stats_.minWindowThroughput) {
+            stats_.minWindowThroughput = t;
+        }
+        if (t > stats_.maxWindowThroughput) {
+            stats_.maxWindowThroughput = t;
+        }
+    }
+    windowStartIndex_ = chunkIndex_;
+    windowStartTime_ = time;
+}
+
+void FirmwareUpdate::updateRtt(system_tick_t rtt) {
+    rtt = std::max(rtt, (system_tick_t)1);
+    if (!stats_.rtt) {
+        stats_.rtt = rtt;
+    } else {
+        stats_.rtt = (stats_.rtt * 7 + rtt) / 8;
+    }
+    if (OTA_CHUNK_ACK_DELAY > 0) {
+        ackDelay_ = std::min(std::max(stats_.rtt / 4, OTA_MIN_CHUNK_ACK_DELAY), OTA_MAX_CHUNK_ACK_DELAY);
+    }
+}
+
+void FirmwareUpdate::receiveWindowSize(size_t size) {
+    recvWindowSize_ = std::min(std::max(size, MIN_OTA_CHUNK_SIZE), OTA_MAX_RECEIVE_WINDOW_SIZE);
 }
 
 int FirmwareUpdate::sendErrorResponse(Message* msg, int error, CoapType type, int id, const char* token,
@@ -741,6 +873,11 @@ void FirmwareUpdate::reset() {
     memset(chunks_, 0, sizeof(chunks_));
     stats_ = FirmwareUpdateStats();
     lastChunkTime_ = 0;
+    ackDelay_ = OTA_CHUNK_ACK_DELAY;
+    startRespTime_ = 0;
+    stallStartTime_ = 0;
+    stallAckTime_ = 0;
+    windowStartTime_ = 0;
     stateLogTime_ = 0;
     fileSize_ = 0;
     fileOffset_ = 0;
@@ -751,9 +888,14 @@ void FirmwareUpdate::reset() {
     chunkIndex_ = 0;
     unackChunks_ = 0;
     stateLogChunks_ = 0;
+    ackWindowEdge_ = 0;
+    stallEdge_ = 0;
+    windowStartIndex_ = 0;
+    startRespId_ = -1;
     finishRespId_ = -1;
     errorRespId_ = -1;
     hasGaps_ = false;
+    sackRanges_ = false;
 }
 
 } // namespace protocol
@@ -66,28 +66,48 @@ const size_t MAX_OTA_CHUNK_SIZE = (MBEDTLS_SSL_MAX_CONTENT_LEN - OTA_CHUNK_COAP_
 static_assert(MAX_OTA_CHUNK_SIZE >= MIN_OTA_CHUNK_SIZE, "Invalid MAX_OTA_CHUNK_SIZE");
 
 /**
- * Size of the receiver window in bytes.
+ * Default size of the receiver window in bytes.
+ *
+ * Received chunks get consumed immediately, so the receiver window can be relatively large. The
+ * window size can be changed at runtime via `FirmwareUpdate::receiveWindowSize()`.
+ */
+const size_t OTA_RECEIVE_WINDOW_SIZE = 256 * 1024;
+
+/**
+ * Maximum size of the receiver window in bytes.
  *
- * Received chunks get consumed immediately, so the receiver window can be relatively large.
  * This parameter affects the size of the chunk bitmap maintained by the protocol implementation.
  */
-const size_t OTA_RECEIVE_WINDOW_SIZE = 128 * 1024;
+const size_t OTA_MAX_RECEIVE_WINDOW_SIZE = 512 * 1024;
 
 static_assert(OTA_RECEIVE_WINDOW_SIZE > MAX_OTA_CHUNK_SIZE, "Invalid OTA_RECEIVE_WINDOW_SIZE");
+static_assert(OTA_MAX_RECEIVE_WINDOW_SIZE >= OTA_RECEIVE_WINDOW_SIZE, "Invalid OTA_MAX_RECEIVE_WINDOW_SIZE");
 
 /**
  * Size of the chunk bitmap in 32-bit words.
  */
-const size_t OTA_CHUNK_BITMAP_ELEMENTS = (OTA_RECEIVE_WINDOW_SIZE / MIN_OTA_CHUNK_SIZE + 31) / 32;
+const size_t OTA_CHUNK_BITMAP_ELEMENTS = (OTA_MAX_RECEIVE_WINDOW_SIZE / MIN_OTA_CHUNK_SIZE + 31) / 32;
 
 /**
- * Acknowledgement delay in milliseconds.
+ * Initial acknowledgement delay in milliseconds.
  *
- * SCTP recommends using a delay of 200ms with 500ms being the absolute maximum. Setting this
- * parameter to 0 disables delayed acknowledgements.
+ * SCTP recommends using a delay of 200ms with 500ms being the absolute maximum. Once the round-trip
+ * time is measured, the delay is set to a quarter of the RTT, limited to the range between
+ * `OTA_MIN_CHUNK_ACK_DELAY` and `OTA_MAX_CHUNK_ACK_DELAY`. Setting this parameter to 0 disables
+ * delayed acknowledgements.
  */
 const system_tick_t OTA_CHUNK_ACK_DELAY = 200;
 
+/**
+ * Minimum acknowledgement delay in milliseconds.
+ */
+const system_tick_t OTA_MIN_CHUNK_ACK_DELAY = 20;
+
+/**
+ * Maximum acknowledgement delay in milliseconds.
+ */
+const system_tick_t OTA_MAX_CHUNK_ACK_DELAY = 500;
+
 /**
  * Minimum number of chunks to receive before generating an acknowledgement.
  *
@@ -95,6 +115,16 @@ const system_tick_t OTA_CHUNK_ACK_DELAY = 200;
  */
 const unsigned OTA_CHUNK_ACK_COUNT = 2;
 
+/**
+ * Maximum number of chunk ranges reported in a selective acknowledgement.
+ *
+ * Ranges are only used if the server requested them in the UpdateStart request, otherwise the
+ * received chunks are reported as a bitmap.
+ */
+const unsigned OTA_MAX_SACK_RANGES = 16;
+
+static_assert(OTA_MAX_RECEIVE_WINDOW_SIZE / MIN_OTA_CHUNK_SIZE <= 0xffff, "Invalid OTA_MAX_RECEIVE_WINDOW_SIZE");
+
 /**
  * Maximum time to wait for the next chunk before timing out the transfer.
  */
@@ -118,6 +148,12 @@ struct FirmwareUpdateStats {
     unsigned sentChunkAcks; // Number of sent acknowledgements
     unsigned outOfOrderChunks; // Number of chunks received out of order
     unsigned duplicateChunks; // Number of duplicate chunks received
+    unsigned windowStalls; // Number of times the server ran out of the receiver window
+    system_tick_t windowStallTime; // Total time the server was blocked by the receiver window
+    unsigned windowThroughput; // Throughput over the last full receiver window (bytes per second)
+    unsigned minWindowThroughput; // Minimum throughput over a full receiver window (bytes per second)
+    unsigned maxWindowThroughput; // Maximum throughput over a full receiver window (bytes per second)
+    system_tick_t rtt; // Smoothed round-trip time
 };
 
 /**
@@ -139,6 +175,15 @@ public:
 
     const FirmwareUpdateStats& stats() const;
 
+    /**
+     * Set the size of the receiver window in bytes.
+     *
+     * The size is limited to `OTA_MAX_RECEIVE_WINDOW_SIZE` and takes effect when the next update
+     * is started.
+     */
+    void receiveWindowSize(size_t size);
+    size_t receiveWindowSize() const;
+
     bool isRunning() const;
 
     void reset();
@@ -152,6 +197,11 @@ private:
     const SparkCallbacks* callbacks_; // System callbacks
     MessageChannel* channel_; // Message channel
     system_tick_t lastChunkTime_; // Time when the last chunk was received
+    system_tick_t ackDelay_; // Acknowledgement delay
+    system_tick_t startRespTime_; // Time when the UpdateStart response was sent
+    system_tick_t stallStartTime_; // Time when the server ran out of the receiver window
+    system_tick_t stallAckTime_; // Time when the receiver window was moved after a stall
+    system_tick_t windowStartTime_; // Time when the throughput measurement for the current window started
     system_tick_t stateLogTime_; // Time when the transfer state was last logged
     size_t fileSize_; // File size
     size_t fileOffset_; // Current offset in the file
@@ -159,12 +209,18 @@ private:
     size_t chunkSize_; // Chunk size
     size_t chunkCount_; // Total number of chunks to transfer
     size_t windowSize_; // Size of the receiver window in chunks
+    size_t recvWindowSize_; // Configured size of the receiver window in bytes
     unsigned chunkIndex_; // Number of cumulatively acknowledged chunks
     unsigned unackChunks_; // Number or chunks received since the last acknowledgement
     unsigned stateLogChunks_; // Number of cumulatively acknowledged chunks at the time when the transfer state was last logged
+    unsigned ackWindowEdge_; // Index of the last chunk within the receiver window advertised to the server
+    unsigned stallEdge_; // Right edge of the receiver window at the time of the last stall
+    unsigned windowStartIndex_; // Number of cumulatively acknowledged chunks when the current window started
+    int startRespId_; // Message ID of the UpdateStart response
     int finishRespId_; // Message ID of the UpdateFinish response
     int errorRespId_; // Message ID of the last confirmable error response sent to the server
     bool hasGaps_; // Whether the sequence of received chunks has gaps
+    bool sackRanges_; // Whether the received chunks are reported as ranges
     bool updating_; // Whether an update is in progress
 
     ProtocolError handleRequest(Message* msg, RequestHandlerFn handler);
@@ -174,12 +230,18 @@ private:
     int handleChunkRequest(const CoapMessageDecoder& d, CoapMessageEncoder* e, int** respId, bool validateOnly);
 
     static int decodeStartRequest(const CoapMessageDecoder& d, size_t* fileSize, const char** fileHash, size_t* chunkSize,
-            bool* discardData);
+            bool* discardData, bool* ackRanges);
     static int decodeFinishRequest(const CoapMessageDecoder& d, bool* cancelUpdate, bool* discardData);
     static int decodeChunkRequest(const CoapMessageDecoder& d, const char** chunkData, size_t* chunkSize,
             unsigned* chunkIndex);
 
     void initChunkAck(CoapMessageEncoder* e);
+    void chunkAckSent();
+    size_t encodeAckRanges(char* buf, size_t size) const;
+
+    void updateStallState(unsigned index, system_tick_t time);
+    void updateThroughput(system_tick_t time);
+    void updateRtt(system_tick_t rtt);
 
     int sendErrorResponse(Message* msg, int error, CoapType type, int id, const char* token, size_t tokenSize);
     int sendEmptyAck(Message* msg, CoapType type, CoapMessageId id);
@@ -192,6 +254,7 @@ private:
 inline FirmwareUpdate::FirmwareUpdate() :
         callbacks_(nullptr),
         channel_(nullptr),
+        recvWindowSize_(OTA_RECEIVE_WINDOW_SIZE),
         updating_(false) {
     reset();
 }
@@ -216,6 +279,10 @@ inline const FirmwareUpdateStats& FirmwareUpdate::stats() const {
     return stats_;
 }
 
+inline size_t FirmwareUpdate::receiveWindowSize() const {
+    return recvWindowSize_;
+}
+
 inline bool FirmwareUpdate::isRunning() const {
     return updating_;
 }
@@ -24,6 +24,9 @@
 #include "message_channel.h"
 #include "messages.h"
 #include "spark_descriptor.h"
+#include "coap_message_decoder.h"
+
+#include <algorithm>
 
 
 namespace particle
@@ -46,60 +49,37 @@ class Functions
     }
 
 public:
-    ProtocolError handle_function_call(token_t token, message_id_t message_id, Message& message, MessageChannel& channel,
+    ProtocolError handle_function_call(token_t token, message_id_t message_id, const CoapMessageDecoder& decoder,
+            Message& message, MessageChannel& channel,
             int (*call_function)(const char *function_key, const char *arg, SparkDescriptor::FunctionResultCallback callback, void* reserved))
     {
-        // copy the function key
+        // The first Uri-Path option contains the message type, the second one contains the function key
         char function_key[MAX_FUNCTION_KEY_LENGTH+1]; // add one for null terminator
         memset(function_key, 0, sizeof(function_key));
-        uint8_t* queue = message.buf();
-        uint8_t queue_offset = 8;
-        size_t function_key_length = queue[7] & 0x0F;
-        if (function_key_length == MAX_OPTION_DELTA_LENGTH+1)
-        {
-            function_key_length = MAX_OPTION_DELTA_LENGTH+1 + queue[8];
-            queue_offset++;
-        }
-        // else if (function_key_length == MAX_OPTION_DELTA_LENGTH+2)
-        // {
-        //     // MAX_OPTION_DELTA_LENGTH+2 not supported and not required for function_key_length
-        // }
-        // allocated memory bounds check
-        if (function_key_length > MAX_FUNCTION_KEY_LENGTH)
-        {
-            function_key_length = MAX_FUNCTION_KEY_LENGTH;
-            // already memset to 0 (null terminator padded to end)
-        }
-        memcpy(function_key, queue + queue_offset, function_key_length);
-
-        // How long is the argument?
-        size_t q_index = queue_offset + function_key_length;
-        size_t function_arg_length = queue[q_index] & 0x0F;
-        if (function_arg_length == MAX_OPTION_DELTA_LENGTH+1)
-        {
-            ++q_index;
-            function_arg_length = MAX_OPTION_DELTA_LENGTH+1 + queue[q_index];
-        }
-        else if (function_arg_length == MAX_OPTION_DELTA_LENGTH+2)
+        auto it = decoder.findOption(CoapOption::URI_PATH);
+        if (it.next() && it.option() == CoapOption::URI_PATH)
         {
-            ++q_index;
-            function_arg_length = queue[q_index] << 8;
-            ++q_index;
-            function_arg_length |= queue[q_index];
-            function_arg_length += 269;
+            // allocated memory bounds check
+            const size_t function_key_length = std::min(it.size(), MAX_FUNCTION_KEY_LENGTH);
+            memcpy(function_key, it.data(), function_key_length);
         }
 
+        // The argument is passed in the Uri-Query option
         bool has_function = true;
-        // allocated memory bounds check
-        if (function_arg_length > MAX_FUNCTION_ARG_LENGTH)
+        size_t function_arg_length = 0;
+        it = decoder.findOption(CoapOption::URI_QUERY);
+        if (it)
         {
-            function_arg_length = MAX_FUNCTION_ARG_LENGTH;
-            has_function = false;
-            // in case we got here due to inconceivable error, memset with null terminators
-            memset(function_arg, 0, sizeof(function_arg));
+            function_arg_length = it.size();
+            // allocated memory bounds check
+            if (function_arg_length > MAX_FUNCTION_ARG_LENGTH)
+            {
+                function_arg_length = MAX_FUNCTION_ARG_LENGTH;
+                has_function = false;
+            }
+            // save a copy of the argument
+            memcpy(function_arg, it.data(), function_arg_length);
         }
-        // save a copy of the argument
-        memcpy(function_arg, queue + q_index + 1, function_arg_length);
         function_arg[function_arg_length] = 0; // null terminate string
 
         Message response;
@@ -19,6 +19,7 @@
 
 #include "messages.h"
 
+#include "coap_message_decoder.h"
 #include "appender.h"
 
 namespace particle {
@@ -32,22 +33,9 @@ const unsigned GOODBYE_SYSTEM_RESET_REASON_FLAG = 0x02;
 const unsigned GOODBYE_SLEEP_DURATION_FLAG = 0x04;
 const unsigned GOODBYE_NETWORK_DISCONNECT_REASON_FLAG = 0x08;
 
-} // unnamed
-
-CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
+CoAPMessageType::Enum decodeMessageType(unsigned code, CoapType type, char path, int param)
 {
-    if (length<4)
-        return CoAPMessageType::ERROR;
-
-    char path = 0;
-    // 4 bytes for CoAP header
-    // 1 byte for the option length
-    // plus length of token
-	size_t path_idx = 5 + (buf[0] & 0x0F);
-    if (path_idx<length)
-		 path = buf[path_idx];
-
-	switch (CoAP::code(buf))
+	switch (code)
 	{
 	case CoAPCode::GET:
 		switch (path)
@@ -95,7 +83,7 @@ CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
 			return CoAPMessageType::UPDATE_DONE;
 		case 's':
 			// todo - use a single message SIGNAL and decode the rest of the message to determine desired state
-			if (buf[8])
+			if (param > 0)
 				return CoAPMessageType::SIGNAL_START;
 			else
 				return CoAPMessageType::SIGNAL_STOP;
@@ -104,14 +92,10 @@ CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
 		}
 		break;
 	case CoAPCode::EMPTY:
-		switch (CoAP::type(buf))
-		{
-		case CoAPType::CON:
+		if (type == CoapType::CON)
 			return CoAPMessageType::PING;
-		default:
+		else
 			return CoAPMessageType::EMPTY_ACK;
-		}
-		break;
 	// todo - we should look at the original request (via the token) to determine the type of the response.
 	case CoAPCode::CONTENT:
 		return CoAPMessageType::TIME;
@@ -121,6 +105,45 @@ CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
 	return CoAPMessageType::ERROR;
 }
 
+} // unnamed
+
+CoAPMessageType::Enum Messages::decodeType(const uint8_t* buf, size_t length)
+{
+    if (length<4)
+        return CoAPMessageType::ERROR;
+
+    char path = 0;
+    // 4 bytes for CoAP header
+    // 1 byte for the option length
+    // plus length of token
+	size_t path_idx = 5 + (buf[0] & 0x0F);
+    if (path_idx<length)
+		 path = buf[path_idx];
+
+	return decodeMessageType(buf[1], (CoapType)((buf[0] >> 4) & 0x03), path, (length > 8) ? buf[8] : 0);
+}
+
+CoAPMessageType::Enum Messages::decodeType(const CoapMessageDecoder& d)
+{
+	char path = 0;
+	auto it = d.findOption(CoapOption::URI_PATH);
+	if (it && it.size() > 0)
+		path = it.data()[0];
+	return decodeMessageType(d.code(), d.type(), path, requestParameter(d));
+}
+
+int Messages::requestParameter(const CoapMessageDecoder& d)
+{
+	// The parameter is the first byte of the option that follows the Uri-Path option with the
+	// message type, or the first byte of the payload if there's no such option
+	auto it = d.findOption(CoapOption::URI_PATH);
+	if (it && it.next() && it.size() > 0)
+		return (uint8_t)it.data()[0];
+	if (d.payloadSize() > 0)
+		return (uint8_t)d.payload()[0];
+	return -1;
+}
+
 size_t Messages::hello(uint8_t* buf, message_id_t message_id, uint16_t flags, uint16_t platform_id, uint16_t system_version,
 		uint16_t product_id, uint16_t product_version, const uint8_t* device_id, size_t device_id_len,
 		uint16_t max_message_size, uint32_t max_binary_size, uint16_t ota_chunk_size, bool confirmable)
@@ -30,6 +30,7 @@ LOG_SOURCE_CATEGORY("comm.protocol")
 #include "chunked_transfer.h"
 #include "subscriptions.h"
 #include "functions.h"
+#include "coap_message_decoder.h"
 
 namespace particle { namespace protocol {
 
@@ -43,7 +44,9 @@ enum HelloFlag {
 	HELLO_FLAG_GOODBYE_SUPPORT = 0x10,
 	HELLO_FLAG_DEVICE_INITIATED_DESCRIBE = 0x20,
 	HELLO_FLAG_COMPRESSED_OTA = 0x40,
-	HELLO_FLAG_OTA_PROTOCOL_V3 = 0x80
+	HELLO_FLAG_OTA_PROTOCOL_V3 = 0x80,
+	HELLO_FLAG_DELTA_OTA = 0x100,
+	HELLO_FLAG_BLOCKWISE_TRANSFER = 0x200
 };
 
 } // namespace
@@ -67,16 +70,26 @@ ProtocolError Protocol::handle_received_message(Message& message,
 	last_message_millis = callbacks.millis();
 	pinger.message_received();
 	uint8_t* queue = message.buf();
-	message_type = Messages::decodeType(queue, message.length());
+	// Decode the message once; the option index built by the decoder is shared by all the handlers
+	CoapMessageDecoder d;
+	const int r = d.decode((const char*)queue, message.length());
+	if (r < 0) {
+		LOG(ERROR, "Failed to decode message: %d", r);
+		message_type = CoAPMessageType::ERROR;
+		return NO_ERROR; // drop it on the floor
+	}
+	message_type = Messages::decodeType(d);
 	// todo - not all requests/responses have tokens. These device requests do not use tokens:
 	// Update Done, ChunkMissed, event, ping, hello
 	token_t token = 0;
-	size_t token_len = CoAP::token(queue, &token);
+	size_t token_len = d.tokenSize();
 	if (token_len > 0 && token_len != sizeof(token_t)) {
 		LOG(ERROR, "Unsupported token length: %u", (unsigned)token_len);
 		token_len = 0;
+	} else if (token_len > 0) {
+		token = d.token()[0];
 	}
-	message_id_t msg_id = CoAP::message_id(queue);
+	message_id_t msg_id = d.id();
 	CoAPCode::Enum code = CoAP::code(queue);
 	CoAPType::Enum type = CoAP::type(queue);
 	if (CoAPType::is_reply(type)) {
@@ -106,13 +119,13 @@ ProtocolError Protocol::handle_received_message(Message& message,
 	{
 	case CoAPMessageType::DESCRIBE:
 	{
-		// 4 bytes header, 1 byte token, 2 bytes Uri-Path
-		// 2 bytes optional single character Uri-Query for describe flags
+		// Optional single character Uri-Query for describe flags
 		int descriptor_type = DESCRIBE_DEFAULT;
-		if (message.length() > 8 && queue[8] <= DESCRIBE_MAX) {
-			descriptor_type = queue[8];
-		} else if (message.length() > 8) {
-			LOG(WARN, "Invalid DESCRIBE flags: 0x%02x", (unsigned)queue[8]);
+		const int flags = Messages::requestParameter(d);
+		if (flags >= 0 && flags <= DESCRIBE_MAX) {
+			descriptor_type = flags;
+		} else if (flags >= 0) {
+			LOG(WARN, "Invalid DESCRIBE flags: 0x%02x", (unsigned)flags);
 		}
 		LOG(INFO, "Received DESCRIBE request; flags: 0x%02x", (unsigned)descriptor_type);
 		error = send_description_response(token, msg_id, descriptor_type);
@@ -125,7 +138,7 @@ ProtocolError Protocol::handle_received_message(Message& message,
 			LOG(ERROR, "Missing request token");
 			return ProtocolError::MISSING_REQUEST_TOKEN;
 		}
-		return functions.handle_function_call(token, msg_id, message, channel,
+		return functions.handle_function_call(token, msg_id, d, message, channel,
 				descriptor.call_function);
 	}
 
@@ -135,7 +148,7 @@ ProtocolError Protocol::handle_received_message(Message& message,
 			LOG(ERROR, "Missing request token");
 			return ProtocolError::MISSING_REQUEST_TOKEN;
 		}
-		return variables.handle_request(message, token, msg_id);
+		return variables.handle_request(d, message, token, msg_id);
 	}
 #if HAL_PLATFORM_OTA_PROTOCOL_V3
 	case CoAPMessageType::UPDATE_START_V3: {
@@ -159,22 +172,22 @@ ProtocolError Protocol::handle_received_message(Message& message,
 		return chunkedTransfer.handle_update_done(token, message, channel);
 #endif // !HAL_PLATFORM_OTA_PROTOCOL_V3
 	case CoAPMessageType::EVENT:
-		return subscriptions.handle_event(message, descriptor.call_event_handler, channel);
+		return subscriptions.handle_event(d, message, descriptor.call_event_handler, channel);
 
 	case CoAPMessageType::KEY_CHANGE:
-		return handle_key_change(message);
+		return handle_key_change(d, message);
 
 	case CoAPMessageType::SIGNAL_START:
 		message.set_length(
 				Messages::coded_ack(message.buf(), token,
-						ChunkReceivedCode::OK, queue[2], queue[3]));
+						ChunkReceivedCode::OK, msg_id >> 8, msg_id & 0xff));
 		callbacks.signal(true, 0, NULL);
 		return channel.send(message);
 
 	case CoAPMessageType::SIGNAL_STOP:
 		message.set_length(
 				Messages::coded_ack(message.buf(), token,
-						ChunkReceivedCode::OK, queue[2], queue[3]));
+						ChunkReceivedCode::OK, msg_id >> 8, msg_id & 0xff));
 		callbacks.signal(false, 0, NULL);
 		return channel.send(message);
 
@@ -185,13 +198,14 @@ ProtocolError Protocol::handle_received_message(Message& message,
 		break;
 
 	case CoAPMessageType::TIME:
-		handle_time_response(
-				queue[6] << 24 | queue[7] << 16 | queue[8] << 8 | queue[9]);
+		if (d.payloadSize() >= 4) {
+			handle_time_response(decode_uint32((uint8_t*)d.payload()));
+		}
 		break;
 
 	case CoAPMessageType::PING:
 		message.set_length(
-				Messages::empty_ack(message.buf(), queue[2], queue[3]));
+				Messages::empty_ack(message.buf(), msg_id >> 8, msg_id & 0xff));
 		error = channel.send(message);
 		break;
 
@@ -224,11 +238,10 @@ void Protocol::notify_message_complete(message_id_t msg_id, CoAPCode::Enum respo
 	}
 }
 
-ProtocolError Protocol::handle_key_change(Message& message)
+ProtocolError Protocol::handle_key_change(const CoapMessageDecoder& d, Message& message)
 {
-	uint8_t* buf = message.buf();
 	ProtocolError result = NO_ERROR;
-	if (CoAP::type(buf)==CoAPType::CON)
+	if (d.type() == CoapType::CON)
 	{
 		Message response;
 		channel.response(message, response, 5);
@@ -237,16 +250,9 @@ ProtocolError Protocol::handle_key_change(Message& message)
 		result = channel.send(response);
 	}
 
-	// 4 bytes coAP header, 2 bytes message type option
-	// token length, and skip 1 byte for the parameter option header.
-	if (message.length()>7)
+	if (Messages::requestParameter(d) == 1)
 	{
-		uint8_t* buf = message.buf();
-		uint8_t option_idx = 7 + (buf[0] & 0xF);
-		if (buf[option_idx]==1)
-		{
-			result = channel.command(MessageChannel::DISCARD_SESSION);
-		}
+		result = channel.command(MessageChannel::DISCARD_SESSION);
 	}
 	return result;
 }
@@ -431,6 +437,8 @@ void Protocol::reset() {
 	pinger.reset();
 	timesync_.reset();
 	ack_handlers.clear();
+	publisher.reset();
+	variables.reset();
 	channel.reset();
 	app_describe_msg_id = INVALID_MESSAGE_HANDLE;
 	system_describe_msg_id = INVALID_MESSAGE_HANDLE;
@@ -447,7 +455,7 @@ ProtocolError Protocol::hello(bool was_ota_upgrade_successful)
 	channel.create(message);
 
 	uint16_t flags = HELLO_FLAG_DIAGNOSTICS_SUPPORT | HELLO_FLAG_IMMEDIATE_UPDATES_SUPPORT |
-			HELLO_FLAG_GOODBYE_SUPPORT;
+			HELLO_FLAG_GOODBYE_SUPPORT | HELLO_FLAG_BLOCKWISE_TRANSFER;
 	if (was_ota_upgrade_successful) {
 		flags |= HELLO_FLAG_OTA_UPGRADE_SUCCESSFUL;
 	}
@@ -457,6 +465,9 @@ ProtocolError Protocol::hello(bool was_ota_upgrade_successful)
 	if (protocol_flags & ProtocolFlag::COMPRESSED_OTA) {
 		flags |= HELLO_FLAG_COMPRESSED_OTA;
 	}
+	if (protocol_flags & ProtocolFlag::DELTA_OTA) {
+		flags |= HELLO_FLAG_DELTA_OTA;
+	}
 #if HAL_PLATFORM_OTA_PROTOCOL_V3
 	flags |= HELLO_FLAG_OTA_PROTOCOL_V3;
 #endif
@@ -626,13 +637,68 @@ void Protocol::build_describe_message(Appender& appender, int desc_flags)
 	}
 }
 
+void Protocol::build_cached_describe_message(BufferAppender& appender, int desc_flags, uint32_t app_crc, uint32_t system_crc)
+{
+	// Metrics are generated on every request. Without the application state checksums there's
+	// no way to tell whether the cached payload is still valid
+	if (!descriptor.app_state_selector_info || desc_flags == DESCRIBE_METRICS ||
+			!(desc_flags & (DESCRIBE_APPLICATION | DESCRIBE_SYSTEM)))
+	{
+		build_describe_message(appender, desc_flags);
+		return;
+	}
+	if (describe_cache.data && describe_cache.flags == desc_flags && describe_cache.app_crc == app_crc &&
+			describe_cache.system_crc == system_crc)
+	{
+		LOG(TRACE, "Using cached describe message");
+		appender.append((const uint8_t*)describe_cache.data.get(), describe_cache.size);
+		return;
+	}
+	build_describe_message(appender, desc_flags);
+	describe_cache.data.reset();
+	if (appender.dataSize() > appender.bufferSize())
+	{
+		return;
+	}
+	// The cache is an optimization, so the allocation is allowed to fail
+	describe_cache.data.reset(new(std::nothrow) char[appender.dataSize()]);
+	if (describe_cache.data)
+	{
+		memcpy(describe_cache.data.get(), appender.buffer(), appender.dataSize());
+		describe_cache.size = appender.dataSize();
+		describe_cache.flags = desc_flags;
+		describe_cache.app_crc = app_crc;
+		describe_cache.system_crc = system_crc;
+	}
+}
+
+void Protocol::compute_describe_checksums(int desc_flags, uint32_t* app_crc, uint32_t* system_crc)
+{
+	*app_crc = 0;
+	*system_crc = 0;
+	if (!descriptor.app_state_selector_info)
+	{
+		return;
+	}
+	// Computing the system checksum requires enumerating the modules, so the checksums are computed
+	// once per describe message and shared by the change detection and the describe cache
+	if (desc_flags & DESCRIBE_APPLICATION)
+	{
+		*app_crc = descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_APP, SparkAppStateUpdate::COMPUTE, 0, nullptr);
+	}
+	if (desc_flags & DESCRIBE_SYSTEM)
+	{
+		*system_crc = descriptor.app_state_selector_info(SparkAppStateSelector::DESCRIBE_SYSTEM, SparkAppStateUpdate::COMPUTE, 0, nullptr);
+	}
+}
+
 ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, Message& message,
-                                                      size_t header_size, int desc_flags)
+                                                      size_t header_size, int desc_flags, uint32_t app_crc, uint32_t system_crc)
 {
     ProtocolError error;
 
     BufferAppender appender((message.buf() + header_size), (message.capacity() - header_size));
-    build_describe_message(appender, desc_flags);
+    build_cached_describe_message(appender, desc_flags, app_crc, system_crc);
 
     if (appender.dataSize() > appender.bufferSize())
     {
@@ -668,17 +734,20 @@ ProtocolError Protocol::generate_and_send_description(MessageChannel& channel, M
 
 ProtocolError Protocol::post_description(int desc_flags, bool force)
 {
+	uint32_t app_crc = 0;
+	uint32_t system_crc = 0;
+	compute_describe_checksums(desc_flags, &app_crc, &system_crc);
 	if (!force && descriptor.app_state_selector_info) {
 		const auto cachedState = channel.cached_app_state_descriptor();
 		if (desc_flags & DescriptionType::DESCRIBE_SYSTEM) {
-			const auto currentState = app_state_descriptor(AppStateDescriptor::SYSTEM_DESCRIBE_CRC);
+			const auto currentState = AppStateDescriptor().systemDescribeCrc(system_crc);
 			if (currentState.equalsTo(cachedState, AppStateDescriptor::SYSTEM_DESCRIBE_CRC)) {
 				LOG(INFO, "Checksum has not changed; not sending system DESCRIBE");
 				desc_flags &= ~DescriptionType::DESCRIBE_SYSTEM;
 			}
 		}
 		if (desc_flags & DescriptionType::DESCRIBE_APPLICATION) {
-			const auto currentState = app_state_descriptor(AppStateDescriptor::APP_DESCRIBE_CRC);
+			const auto currentState = AppStateDescriptor().appDescribeCrc(app_crc);
 			if (currentState.equalsTo(cachedState, AppStateDescriptor::APP_DESCRIBE_CRC)) {
 				LOG(INFO, "Checksum has not changed; not sending application DESCRIBE");
 				desc_flags &= ~DescriptionType::DESCRIBE_APPLICATION;
@@ -694,7 +763,7 @@ ProtocolError Protocol::post_description(int desc_flags, bool force)
 		return error;
 	}
 	const size_t header_size = Messages::describe_post_header(message.buf(), message.capacity(), 0 /* message_id */, desc_flags);
-	return generate_and_send_description(channel, message, header_size, desc_flags);
+	return generate_and_send_description(channel, message, header_size, desc_flags, app_crc, system_crc);
 }
 
 ProtocolError Protocol::send_description_response(token_t token, message_id_t msg_id, int desc_flags)
@@ -716,7 +785,10 @@ ProtocolError Protocol::send_description_response(token_t token, message_id_t ms
 	}
 	const auto buf = msg.buf();
 	const size_t size = Messages::description_response(buf, 0 /* message_id */, token);
-	return generate_and_send_description(channel, msg, size, desc_flags);
+	uint32_t app_crc = 0;
+	uint32_t system_crc = 0;
+	compute_describe_checksums(desc_flags, &app_crc, &system_crc);
+	return generate_and_send_description(channel, msg, size, desc_flags, app_crc, system_crc);
 }
 
 ProtocolError Protocol::send_subscription(const char *event_name, const char *device_id)
@@ -26,6 +26,8 @@ namespace protocol {
 static_assert(MAX_EVENT_MESSAGE_SIZE <= PROTOCOL_BUFFER_SIZE, "MAX_EVENT_MESSAGE_SIZE is too large");
 static_assert(MAX_FUNCTION_CALL_MESSAGE_SIZE <= PROTOCOL_BUFFER_SIZE, "MAX_FUNCTION_CALL_MESSAGE_SIZE is too large");
 static_assert(MAX_VARIABLE_VALUE_MESSAGE_SIZE <= PROTOCOL_BUFFER_SIZE, "MAX_VARIABLE_VALUE_MESSAGE_SIZE is too large");
+static_assert(MAX_EVENT_MESSAGE_SIZE + MAX_BLOCK_OPTIONS_SIZE <= PROTOCOL_BUFFER_SIZE, "Event blocks don't fit in PROTOCOL_BUFFER_SIZE");
+static_assert(MAX_VARIABLE_VALUE_MESSAGE_SIZE + MAX_BLOCK_OPTIONS_SIZE <= PROTOCOL_BUFFER_SIZE, "Variable blocks don't fit in PROTOCOL_BUFFER_SIZE");
 
 system_error_t toSystemError(ProtocolError error) {
     switch (error) {
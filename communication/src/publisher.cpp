@@ -19,6 +19,13 @@
 
 #include "protocol.h"
 
+#include "coap_message_encoder.h"
+#include "appender.h"
+
+#include <algorithm>
+#include <new>
+#include <cstdio>
+
 namespace particle {
 
 namespace protocol {
@@ -30,15 +37,6 @@ void Publisher::add_ack_handler(message_id_t msg_id, CompletionHandler handler)
 ProtocolError Publisher::send_event(MessageChannel& channel, const char* event_name,
             const char* data, int ttl, EventType::Enum event_type, int flags,
             system_tick_t time, CompletionHandler handler) {
-    bool is_system_event = is_system(event_name);
-    bool rate_limited = is_rate_limited(is_system_event, time);
-    if (rate_limited) {
-        g_rateLimitedEventsCounter++;
-        return BANDWIDTH_EXCEEDED;
-    }
-
-    Message message;
-    channel.create(message);
     bool confirmable = channel.is_unreliable();
     if (flags & EventType::NO_ACK) {
         confirmable = false;
@@ -47,14 +45,52 @@ ProtocolError Publisher::send_event(MessageChannel& channel, const char* event_n
     }
 
     size_t data_size = 0;
+    bool blockwise = false;
     if (data) {
         const auto max_data_size = protocol->get_max_event_data_size();
-        data_size = strnlen(data, max_data_size);
+        // Larger events can only be sent over a channel that acknowledges each block
+        if (channel.is_unreliable() && protocol->get_event_block_size()) {
+            data_size = strnlen(data, std::max(max_data_size, (size_t)MAX_BLOCKWISE_EVENT_DATA_LENGTH));
+            blockwise = data_size > max_data_size;
+        } else {
+            data_size = strnlen(data, max_data_size);
+        }
     }
-    size_t msglen = Messages::event(message.buf(), 0, event_name, data, data_size, ttl,
-            event_type, confirmable);
-    message.set_length(msglen);
-    const ProtocolError result = channel.send(message);
+
+    if ((flags & EventType::BATCH) && !(flags & EventType::WITH_ACK)) {
+        const size_t record_size = encode_batch_record(nullptr, 0, event_name, data, data_size, ttl);
+        // Events that wouldn't fit into an empty batch are sent on their own
+        if (record_size <= batch_capacity()) {
+            const ProtocolError result = add_to_batch(channel, event_name, data, data_size, ttl, event_type,
+                    confirmable, time, handler);
+            if (result != NO_ERROR) {
+                if (result == BANDWIDTH_EXCEEDED) {
+                    g_rateLimitedEventsCounter++;
+                }
+                handler.setError(toSystemError(result));
+            }
+            return result;
+        }
+    }
+
+    if (blockwise && blockwise_event) {
+        return BANDWIDTH_EXCEEDED; // Another event is being sent block-wise
+    }
+
+    bool is_system_event = is_system(event_name);
+    bool rate_limited = is_rate_limited(is_system_event, time);
+    if (rate_limited) {
+        g_rateLimitedEventsCounter++;
+        return BANDWIDTH_EXCEEDED;
+    }
+
+    if (blockwise) {
+        return send_blockwise_event(channel, event_name, data, data_size, ttl, event_type, std::move(handler));
+    }
+
+    Message message;
+    const ProtocolError result = send_message(channel, message, event_name, data, data_size, ttl, event_type,
+            confirmable);
     if (result == NO_ERROR) {
         // Register completion handler only if acknowledgement was requested explicitly
         if ((flags & EventType::WITH_ACK) && message.has_id()) {
@@ -66,6 +102,206 @@ ProtocolError Publisher::send_event(MessageChannel& channel, const char* event_n
     return result;
 }
 
+ProtocolError Publisher::process(MessageChannel& channel, system_tick_t time) {
+    if (!batch_size || (int32_t)(time - batch_deadline) < 0) {
+        return NO_ERROR;
+    }
+    const ProtocolError result = send_batch(channel, time);
+    if (result == BANDWIDTH_EXCEEDED) {
+        return NO_ERROR; // Try again later
+    }
+    return result;
+}
+
+ProtocolError Publisher::send_batch(MessageChannel& channel, system_tick_t time) {
+    if (!batch_size) {
+        return NO_ERROR;
+    }
+    const bool is_system_event = is_system(PUBLISH_BATCH_EVENT_NAME);
+    if (is_rate_limited(is_system_event, time)) {
+        // Postpone the next attempt until the rate limiter has a token for the batch
+        batch_deadline = time + next_event_delay(is_system_event, time);
+        return BANDWIDTH_EXCEEDED;
+    }
+    Message message;
+    const ProtocolError result = send_message(channel, message, PUBLISH_BATCH_EVENT_NAME, batch_buf.get(), batch_size,
+            batch_ttl, batch_type, batch_confirmable);
+    if (result == NO_ERROR) {
+        batch_size = 0;
+        batch_handlers.setResult();
+    }
+    return result;
+}
+
+void Publisher::reset() {
+    batch_size = 0;
+    batch_handlers.clear();
+}
+
+size_t Publisher::encode_batch_record(char* buf, size_t size, const char* event_name, const char* data,
+        size_t data_size, int ttl) {
+    BufferAppender appender(buf, size);
+    char num[16] = {};
+    const size_t name_len = strlen(event_name);
+    snprintf(num, sizeof(num), "%u:", (unsigned)name_len);
+    appender.appendString(num);
+    appender.appendString(event_name, name_len);
+    snprintf(num, sizeof(num), "%u:", (unsigned)data_size);
+    appender.appendString(num);
+    if (data_size) {
+        appender.appendString(data, data_size);
+    }
+    snprintf(num, sizeof(num), "%d\n", ttl);
+    appender.appendString(num);
+    return appender.dataSize();
+}
+
+ProtocolError Publisher::send_message(MessageChannel& channel, Message& message, const char* event_name,
+        const char* data, size_t data_size, int ttl, EventType::Enum event_type, bool confirmable) {
+    channel.create(message);
+    size_t msglen = Messages::event(message.buf(), 0, event_name, data, data_size, ttl,
+            event_type, confirmable);
+    message.set_length(msglen);
+    return channel.send(message);
+}
+
+ProtocolError Publisher::send_blockwise_event(MessageChannel& channel, const char* event_name, const char* data,
+        size_t data_size, int ttl, EventType::Enum event_type, CompletionHandler handler) {
+    std::unique_ptr<BlockwiseEvent> event(new(std::nothrow) BlockwiseEvent());
+    if (!event) {
+        return NO_MEMORY;
+    }
+    // The application's buffer may not outlive this call
+    event->data.reset(new(std::nothrow) char[data_size]);
+    if (!event->data) {
+        return NO_MEMORY;
+    }
+    memcpy(event->data.get(), data, data_size);
+    event->data_size = data_size;
+    event->block_size = protocol->get_event_block_size();
+    event->block_num = 0;
+    const size_t name_len = strnlen(event_name, MAX_EVENT_NAME_LENGTH);
+    memcpy(event->name, event_name, name_len);
+    event->name[name_len] = '\0';
+    event->ttl = ttl;
+    event->type = event_type;
+    event->handler = std::move(handler);
+    blockwise_event = std::move(event);
+    const ProtocolError result = send_event_block(channel);
+    if (result != NO_ERROR) {
+        blockwise_event->handler.setError(toSystemError(result));
+        blockwise_event.reset();
+    }
+    return result;
+}
+
+ProtocolError Publisher::send_event_block(MessageChannel& channel) {
+    const BlockwiseEvent& event = *blockwise_event;
+    const size_t offs = event.block_num * event.block_size;
+    const size_t size = std::min(event.data_size - offs, event.block_size);
+    const bool more = offs + size < event.data_size;
+    Message message;
+    ProtocolError result = channel.create(message);
+    if (result != NO_ERROR) {
+        return result;
+    }
+    CoapMessageEncoder e((char*)message.buf(), message.capacity());
+    e.type(CoapType::CON); // Each block needs to be acknowledged before the next one can be sent
+    e.code(CoapCode::POST);
+    e.id(0); // Will be assigned by the message channel
+    const char type = event.type;
+    e.option(CoapOption::URI_PATH, &type, 1);
+    e.option(CoapOption::URI_PATH, event.name);
+    if (event.ttl != 60) {
+        e.option(CoapOption::MAX_AGE, event.ttl);
+    }
+    e.block(CoapOption::BLOCK1, event.block_num, more, event.block_size);
+    if (event.block_num == 0) {
+        e.option(CoapOption::SIZE1, (unsigned)event.data_size);
+    }
+    e.payload(event.data.get() + offs, size);
+    const int r = e.encode();
+    if (r < 0 || (size_t)r > message.capacity()) {
+        return INSUFFICIENT_STORAGE;
+    }
+    message.set_length(r);
+    result = channel.send(message);
+    if (result != NO_ERROR) {
+        return result;
+    }
+    if (!message.has_id()) {
+        return MISSING_MESSAGE_ID;
+    }
+    // The server acknowledges the intermediate blocks with 2.31 (Continue)
+    add_ack_handler(message.get_id(), CompletionHandler(event_block_ack_callback, this));
+    return NO_ERROR;
+}
+
+void Publisher::handle_event_block_ack(int error) {
+    if (!blockwise_event) {
+        return;
+    }
+    BlockwiseEvent& event = *blockwise_event;
+    if (error == SYSTEM_ERROR_NONE && (event.block_num + 1) * event.block_size < event.data_size) {
+        ++event.block_num;
+        const ProtocolError result = send_event_block(protocol->getChannel());
+        if (result == NO_ERROR) {
+            return;
+        }
+        error = toSystemError(result);
+    }
+    if (error == SYSTEM_ERROR_NONE) {
+        event.handler.setResult();
+    } else {
+        event.handler.setError(error);
+    }
+    blockwise_event.reset();
+}
+
+void Publisher::event_block_ack_callback(int error, const void* data, void* callback_data, void* reserved) {
+    const auto self = static_cast<Publisher*>(callback_data);
+    self->handle_event_block_ack(error);
+}
+
+size_t Publisher::batch_capacity() const {
+    return std::min(protocol->get_max_event_data_size(), MAX_EVENT_DATA_LENGTH);
+}
+
+ProtocolError Publisher::add_to_batch(MessageChannel& channel, const char* event_name, const char* data,
+        size_t data_size, int ttl, EventType::Enum event_type, bool confirmable, system_tick_t time,
+        CompletionHandler& handler) {
+    if (!batch_buf) {
+        batch_buf.reset(new(std::nothrow) char[MAX_EVENT_DATA_LENGTH]);
+        if (!batch_buf) {
+            return INSUFFICIENT_STORAGE;
+        }
+    }
+    const size_t capacity = batch_capacity();
+    const size_t record_size = encode_batch_record(nullptr, 0, event_name, data, data_size, ttl);
+    if (batch_size && (batch_size + record_size > capacity || event_type != batch_type ||
+            confirmable != batch_confirmable)) {
+        const ProtocolError result = send_batch(channel, time);
+        if (result != NO_ERROR) {
+            return result;
+        }
+    }
+    // The handler is completed when the batch is sent
+    if (handler && !batch_handlers.addHandler(std::move(handler))) {
+        return NO_MEMORY;
+    }
+    if (!batch_size) {
+        batch_deadline = time + PUBLISH_BATCH_MAX_DELAY;
+        batch_ttl = ttl;
+        batch_type = event_type;
+        batch_confirmable = confirmable;
+    } else if (ttl > batch_ttl) {
+        batch_ttl = ttl;
+    }
+    batch_size += encode_batch_record(batch_buf.get() + batch_size, capacity - batch_size, event_name, data,
+            data_size, ttl);
+    return NO_ERROR;
+}
+
 } // protocol
 
 } // particle
@@ -23,10 +23,13 @@
 #include "events.h"
 #include "message_channel.h"
 #include "messages.h"
+#include "token_bucket.h"
 
 #include "completion_handler.h"
 #include "communication_diagnostic.h"
 
+#include <memory>
+
 namespace particle
 {
 namespace protocol
@@ -38,7 +41,9 @@ class Publisher
 {
 public:
 	explicit Publisher(Protocol* protocol) :
-			protocol(protocol)
+			protocol(protocol),
+			app_rate_limiter(PUBLISH_RATE_LIMIT_BURST, PUBLISH_RATE_LIMIT_PERIOD),
+			system_rate_limiter(PUBLISH_SYSTEM_RATE_LIMIT_BURST, PUBLISH_SYSTEM_RATE_LIMIT_PERIOD)
 	{
 	}
 
@@ -47,54 +52,143 @@ public:
 		return !strncmp(event_name, "spark", 5) || !strncmp(event_name, "particle", 8);
 	}
 
+	/**
+	 * Takes a token from the rate limiter of the given event class.
+	 *
+	 * @return `true` if the event should be rate limited.
+	 */
 	bool is_rate_limited(bool is_system_event, system_tick_t millis)
 	{
-		if (is_system_event)
-		{
-			static uint16_t lastMinute = 0;
-			static uint8_t eventsThisMinute = 0;
-
-			uint16_t currentMinute = uint16_t(millis >> 16);
-			if (currentMinute == lastMinute)
-			{      // == handles millis() overflow
-				if (eventsThisMinute == 255)
-					return true;
-			}
-			else
-			{
-				lastMinute = currentMinute;
-				eventsThisMinute = 0;
-			}
-			eventsThisMinute++;
-		}
-		else
-		{
-			static system_tick_t recent_event_ticks[5] =
-			{ (system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000, (system_tick_t) -1000,
-					(system_tick_t) -1000 };
-			static int evt_tick_idx = 0;
-
-			system_tick_t now = recent_event_ticks[evt_tick_idx] = millis;
-			evt_tick_idx++;
-			evt_tick_idx %= 5;
-			if (now - recent_event_ticks[evt_tick_idx] < 1000)
-			{
-				// exceeded allowable burst of 4 events per second
-				return true;
-			}
-		}
-		return false;
+		return !rate_limiter(is_system_event).take(millis);
+	}
+
+	/**
+	 * Returns the number of milliseconds until an event of the given class can be sent without
+	 * being rate limited, or 0 if it can be sent now.
+	 */
+	system_tick_t next_event_delay(bool is_system_event, system_tick_t millis)
+	{
+		return rate_limiter(is_system_event).next_token_delay(millis);
+	}
+
+	/**
+	 * Configures the rate limiter of the given event class.
+	 *
+	 * @param burst Maximum number of events that can be sent in a burst.
+	 * @param period Time in milliseconds it takes to regain the budget for one event. If 0, events
+	 *        of this class are not rate limited.
+	 */
+	void set_rate_limit(bool is_system_event, unsigned burst, system_tick_t period)
+	{
+		rate_limiter(is_system_event).configure(burst, period);
 	}
 
+	/**
+	 * Sends an event.
+	 *
+	 * Over an unreliable channel, event data that doesn't fit in a single message is sent in blocks
+	 * of `Protocol::get_event_block_size()` bytes using the Block1 option (RFC 7959), up to
+	 * `MAX_BLOCKWISE_EVENT_DATA_LENGTH` bytes. The blocks are sent as confirmable messages one at a
+	 * time and the whole event takes one token from the rate limiter. Only one event can be sent
+	 * block-wise at a time.
+	 *
+	 * Events sent with the `EventType::BATCH` flag are appended to a batch that is sent as a single
+	 * event named `PUBLISH_BATCH_EVENT_NAME`, either when the next event doesn't fit into it, or when
+	 * the oldest event in the batch has been waiting for `PUBLISH_BATCH_MAX_DELAY` milliseconds.
+	 * The flag is ignored for events sent with `EventType::WITH_ACK`. The completion handler of a
+	 * batched event is invoked when the batch is sent.
+	 */
 	ProtocolError send_event(MessageChannel& channel, const char* event_name,
 			const char* data, int ttl, EventType::Enum event_type, int flags,
 			system_tick_t time, CompletionHandler handler);
 
+	/**
+	 * Sends the pending batch of events if it has been waiting long enough.
+	 */
+	ProtocolError process(MessageChannel& channel, system_tick_t time);
+
+	/**
+	 * Sends the pending batch of events.
+	 */
+	ProtocolError send_batch(MessageChannel& channel, system_tick_t time);
+
+	/**
+	 * Discards the pending batch of events. The completion handlers of the batched events are
+	 * completed with `SYSTEM_ERROR_ABORTED`.
+	 */
+	void reset();
+
+	bool has_batch() const
+	{
+		return batch_size != 0;
+	}
+
+	/**
+	 * Encodes an event as a batch record of the following format:
+	 *
+	 * `<name length>:<name><data length>:<data><ttl>\n`
+	 *
+	 * where the lengths and the TTL are decimal numbers.
+	 *
+	 * @return Size of the record, which may exceed the buffer size.
+	 */
+	static size_t encode_batch_record(char* buf, size_t size, const char* event_name, const char* data,
+			size_t data_size, int ttl);
+
 private:
 	Protocol* protocol;
 
+	TokenBucket app_rate_limiter;
+	TokenBucket system_rate_limiter;
+
+	/**
+	 * Payload of the pending batch. The buffer is allocated when the first event is batched.
+	 */
+	std::unique_ptr<char[]> batch_buf;
+	size_t batch_size = 0;
+	system_tick_t batch_deadline = 0;
+	int batch_ttl = 0;
+	EventType::Enum batch_type = EventType::PRIVATE;
+	bool batch_confirmable = false;
+	CompletionHandlerList batch_handlers;
+
+	/**
+	 * State of the event being sent block-wise.
+	 */
+	struct BlockwiseEvent
+	{
+		std::unique_ptr<char[]> data;
+		size_t data_size;
+		size_t block_size;
+		unsigned block_num;
+		char name[MAX_EVENT_NAME_LENGTH + 1];
+		int ttl;
+		EventType::Enum type;
+		CompletionHandler handler;
+	};
+
+	std::unique_ptr<BlockwiseEvent> blockwise_event;
+
+	ProtocolError send_message(MessageChannel& channel, Message& message, const char* event_name,
+			const char* data, size_t data_size, int ttl, EventType::Enum event_type, bool confirmable);
+	size_t batch_capacity() const;
+	ProtocolError add_to_batch(MessageChannel& channel, const char* event_name, const char* data,
+			size_t data_size, int ttl, EventType::Enum event_type, bool confirmable, system_tick_t time,
+			CompletionHandler& handler);
+
+	ProtocolError send_blockwise_event(MessageChannel& channel, const char* event_name, const char* data,
+			size_t data_size, int ttl, EventType::Enum event_type, CompletionHandler handler);
+	ProtocolError send_event_block(MessageChannel& channel);
+	void handle_event_block_ack(int error);
+
+	static void event_block_ack_callback(int error, const void* data, void* callback_data, void* reserved);
+
 	void add_ack_handler(message_id_t msg_id, CompletionHandler handler);
+
+	TokenBucket& rate_limiter(bool is_system_event)
+	{
+		return is_system_event ? system_rate_limiter : app_rate_limiter;
+	}
 };
 
 }}
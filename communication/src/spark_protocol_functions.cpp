@@ -213,6 +213,10 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
         protocol->set_compressed_ota_enabled(value);
         return 0;
     }
+    case Connection::DELTA_OTA: {
+        protocol->set_delta_ota_enabled(value);
+        return 0;
+    }
     case Connection::SYSTEM_MODULE_VERSION: {
         protocol->set_system_version(value);
         return 0;
@@ -229,6 +233,13 @@ int spark_protocol_set_connection_property(ProtocolFacade* protocol, unsigned pr
         protocol->set_max_transmit_message_size(value);
         return 0;
     }
+    case Connection::OTA_RECEIVE_WINDOW_SIZE: {
+        protocol->set_ota_receive_window_size(value);
+        return 0;
+    }
+    case Connection::RECORD_PACKING: {
+        return protocol->set_record_packing(value);
+    }
     default:
         return ProtocolError::NOT_IMPLEMENTED;
     }
@@ -260,6 +271,15 @@ int spark_protocol_get_connection_property(ProtocolFacade* protocol, unsigned pr
         *size = sizeof(size_t);
         return 0;
     }
+    case Connection::PUBLISH_DELAY: {
+        if (*size < sizeof(system_tick_t)) {
+            *size = sizeof(system_tick_t);
+            return ProtocolError::INSUFFICIENT_STORAGE;
+        }
+        *(system_tick_t*)data = protocol->get_publish_delay();
+        *size = sizeof(system_tick_t);
+        return 0;
+    }
     default:
         return ProtocolError::NOT_IMPLEMENTED;
     }
@@ -22,9 +22,13 @@
 #include "protocol_defs.h"
 #include "events.h"
 #include "message_channel.h"
+#include "coap_message_decoder.h"
 
 #include "spark_wiring_vector.h"
 
+#include <memory>
+#include <new>
+#include <utility>
 #include <stdint.h>
 
 namespace particle
@@ -38,9 +42,108 @@ public:
 	typedef uint32_t (*calculate_crc_fn)(const unsigned char *buf, uint32_t buflen);
 
 private:
-	FilteringEventHandler event_handlers[MAX_SUBSCRIPTIONS];
+	/**
+	 * Node of the prefix trie over the subscription filters.
+	 */
+	struct TrieNode
+	{
+		uint16_t child; // First child node, or 0 if there are no child nodes
+		uint16_t sibling; // Next sibling node, or 0 if this is the last child node
+		int16_t handler; // First handler whose filter ends at this node, or -1
+		char c; // Filter character
+	};
+
+	/**
+	 * Registered handlers, in the order they were added. The handlers are allocated individually
+	 * and are never freed, so that the pointers passed to the event handler callback stay valid
+	 * while the registry changes. A removed handler is zeroed, moved to the end of the list when
+	 * the trie is rebuilt, and reused for the next handler that is added.
+	 */
+	Vector<FilteringEventHandler*> event_handlers;
+	/**
+	 * Next handler with the same filter, or -1.
+	 */
+	Vector<int16_t> next_handler;
+	/**
+	 * Prefix trie over the filters of the registered handlers. Node 0 is the root node.
+	 */
+	Vector<TrieNode> trie;
+	/**
+	 * Set when a handler is removed and the trie needs to be rebuilt.
+	 */
+	bool trie_dirty;
+	/**
+	 * Set while the handlers are being called. The trie can't be rebuilt at that time.
+	 */
+	bool dispatching;
 	Vector<message_handle_t> subscription_msg_ids;
 
+	ProtocolError link_handler(int16_t index)
+	{
+		if (trie.isEmpty() && !trie.append(TrieNode{ 0, 0, -1, 0 }))
+		{
+			return INSUFFICIENT_STORAGE;
+		}
+		const FilteringEventHandler& h = *event_handlers[index];
+		const size_t filter_length = strnlen(h.filter, sizeof(h.filter));
+		uint16_t node = 0;
+		for (size_t i = 0; i < filter_length; i++)
+		{
+			uint16_t child = find_child(node, h.filter[i]);
+			if (!child)
+			{
+				if (!trie.append(TrieNode{ 0, trie[node].child, -1, h.filter[i] }))
+				{
+					return INSUFFICIENT_STORAGE;
+				}
+				child = trie.size() - 1;
+				trie[node].child = child;
+			}
+			node = child;
+		}
+		// Keep the handlers with the same filter in the order they were added
+		next_handler[index] = -1;
+		int16_t* next = &trie[node].handler;
+		while (*next >= 0)
+		{
+			next = &next_handler[*next];
+		}
+		*next = index;
+		return NO_ERROR;
+	}
+
+	uint16_t find_child(uint16_t node, char c) const
+	{
+		uint16_t child = trie[node].child;
+		while (child && trie[child].c != c)
+		{
+			child = trie[child].sibling;
+		}
+		return child;
+	}
+
+	void rebuild_trie()
+	{
+		// Move the removed handlers to the end of the list, keeping the remaining ones in the
+		// order they were added
+		int count = 0;
+		for (int i = 0; i < event_handlers.size(); i++)
+		{
+			if (event_handlers[i]->handler)
+			{
+				std::swap(event_handlers[count++], event_handlers[i]);
+			}
+		}
+		// The trie for the remaining handlers needs at most as many nodes as the current one, so
+		// this doesn't allocate memory
+		trie.clear();
+		for (int i = 0; i < count; i++)
+		{
+			link_handler(i);
+		}
+		trie_dirty = false;
+	}
+
 protected:
 
 	ProtocolError send_subscription(MessageChannel& channel, const char* filter, const char* device_id, SubscriptionScope::Enum scope)
@@ -68,9 +171,18 @@ protected:
 
 public:
 
-	Subscriptions()
+	Subscriptions() :
+			trie_dirty(false),
+			dispatching(false)
+	{
+	}
+
+	~Subscriptions()
 	{
-		memset(&event_handlers, 0, sizeof(event_handlers));
+		for (FilteringEventHandler* handler: event_handlers)
+		{
+			delete handler;
+		}
 	}
 
 	uint32_t compute_subscriptions_checksum(calculate_crc_fn calculate_crc)
@@ -88,15 +200,13 @@ public:
 		return checksum;
 	}
 
-	ProtocolError handle_event(Message& message,
+	ProtocolError handle_event(const CoapMessageDecoder& d, Message& message,
 			void (*call_event_handler)(uint16_t size,
 					FilteringEventHandler* handler, const char* event,
 					const char* data, void* reserved),
 					MessageChannel& channel)
 	{
-		const unsigned len = message.length();
-		uint8_t* queue = message.buf();
-		if (CoAP::type(queue)==CoAPType::CON && channel.is_unreliable())
+		if (d.type()==CoapType::CON && channel.is_unreliable())
 		{
 			Message response;
 			if (channel.response(message, response, 5)==NO_ERROR)
@@ -110,117 +220,111 @@ public:
 			}
 		}
 
-		// end of CoAP message
-		unsigned char *end = queue + len;
-		// start of event name option (location path) - 6 bytes
-		// 4 bytes coap header, 2 bytes for the location path of the message
-		// plus the size of the token.
-		unsigned char *event_name = queue + 6 + (queue[0] & 0xF);
-		size_t event_name_length = CoAP::option_decode(&event_name);
-		if (0 == event_name_length)
+		// The first Uri-Path option contains the message type, the remaining ones contain the
+		// segments of the event name
+		auto it = d.findOption(CoapOption::URI_PATH);
+		if (!it.next() || it.option() != CoapOption::URI_PATH || 0 == it.size())
 		{
 			// error, malformed CoAP option
 			return MALFORMED_MESSAGE;
 		}
-
-		unsigned char *next_src = event_name + event_name_length;
-		unsigned char *next_dst = next_src;
-		while (next_src < end && 0x00 == (*next_src & 0xf0))
-		{
-			// there's another Uri-Path option, i.e., event name with slashes
-			size_t option_len = CoAP::option_decode(&next_src);
-			*next_dst++ = '/';
-			if (next_dst != next_src)
-			{
-				// at least one extra byte has been used to encode a CoAP Uri-Path option length
-				memmove(next_dst, next_src, option_len);
-			}
-			next_src += option_len;
-			next_dst += option_len;
-		}
-		event_name_length = next_dst - event_name;
-
-		if (next_src < end && 0x30 == (*next_src & 0xf0))
+		char *event_name = const_cast<char*>(it.data());
+		size_t event_name_length = it.size();
+		while (it.next() && it.option() == CoapOption::URI_PATH)
 		{
-			// Max-Age option is next, which we ignore
-			size_t next_len = CoAP::option_decode(&next_src);
-			next_src += next_len;
+			// there's another Uri-Path option, i.e., event name with slashes. The segments are
+			// joined in place: each option header is at least as long as the separator, so the
+			// options that haven't been read yet are never overwritten
+			event_name[event_name_length++] = '/';
+			memmove(event_name + event_name_length, it.data(), it.size());
+			event_name_length += it.size();
 		}
 
-		unsigned char *data = NULL;
-		if (next_src < end && 0xff == *next_src)
+		char *data = NULL;
+		if (d.hasPayload())
 		{
-			// payload is next
-			data = next_src + 1;
+			data = const_cast<char*>(d.payload());
 			// null terminate data string
-			*end = 0;
+			data[d.payloadSize()] = 0;
 		}
 		// null terminate event name string
 		event_name[event_name_length] = 0;
 
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		// Walk the trie along the event name; every node visited on the way holds the handlers
+		// whose filter is a prefix of the event name
+		if (trie_dirty)
+		{
+			rebuild_trie();
+		}
+		int16_t matched[MAX_SUBSCRIPTIONS];
+		int matched_count = 0;
+		uint16_t node = 0;
+		size_t i = 0;
+		while (!trie.isEmpty())
 		{
-			if (NULL == event_handlers[i].handler)
+			for (int16_t h = trie[node].handler; h >= 0 && matched_count < MAX_SUBSCRIPTIONS; h = next_handler[h])
+			{
+				// Keep the handlers sorted by their index, so that they're called in the order
+				// they were added
+				int j = matched_count++;
+				for (; j > 0 && matched[j - 1] > h; j--)
+				{
+					matched[j] = matched[j - 1];
+				}
+				matched[j] = h;
+			}
+			if (i == event_name_length)
 			{
 				break;
 			}
-			const size_t MAX_FILTER_LENGTH = sizeof(event_handlers[i].filter);
-			const size_t filter_length = strnlen(event_handlers[i].filter,
-					MAX_FILTER_LENGTH);
-
-			if (event_name_length < filter_length)
+			node = find_child(node, event_name[i++]);
+			if (!node)
 			{
-				// does not match this filter, try the next event handler
-				continue;
+				break;
 			}
-
-			const int cmp = memcmp(event_handlers[i].filter, event_name,
-					filter_length);
-			if (0 == cmp)
+		}
+		dispatching = true;
+		for (int j = 0; j < matched_count; j++)
+		{
+			FilteringEventHandler& handler = *event_handlers[matched[j]];
+			if (NULL == handler.handler)
+			{
+				continue; // removed by one of the previous handlers
+			}
+			// don't call the handler directly, use a callback for it.
+			if (!call_event_handler)
 			{
-				// don't call the handler directly, use a callback for it.
-				if (!call_event_handler)
+				if (handler.handler_data)
 				{
-					if (event_handlers[i].handler_data)
-					{
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-function-type"
-						EventHandlerWithData handler =
-								(EventHandlerWithData) event_handlers[i].handler;
+					EventHandlerWithData fn = (EventHandlerWithData) handler.handler;
 #pragma GCC diagnostic pop
-						handler(event_handlers[i].handler_data,
-								(char *) event_name, (char *) data);
-					}
-					else
-					{
-						event_handlers[i].handler((char *) event_name,
-								(char *) data);
-					}
+					fn(handler.handler_data, event_name, data);
 				}
 				else
 				{
-					call_event_handler(sizeof(FilteringEventHandler),
-							&event_handlers[i], (const char*) event_name,
-							(const char*) data, NULL);
+					handler.handler(event_name, data);
 				}
 			}
-			// else continue the for loop to try the next handler
+			else
+			{
+				call_event_handler(sizeof(FilteringEventHandler), &handler,
+						(const char*) event_name, (const char*) data, NULL);
+			}
 		}
+		dispatching = false;
 		return NO_ERROR;
 	}
 
 	template<typename F> ProtocolError for_each(F callback)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
 		ProtocolError error = NO_ERROR;
-		for (unsigned i = 0; i < NUM_HANDLERS; i++)
+		for (int i = 0; i < event_handlers.size(); i++)
 		{
-			if (nullptr != event_handlers[i].handler)
+			if (nullptr != event_handlers[i]->handler)
 			{
-				error = callback(event_handlers[i]);
+				error = callback(*event_handlers[i]);
 				if (error)
 					break;
 			}
@@ -230,32 +334,13 @@ public:
 
 	void remove_event_handlers(const char* event_name)
 	{
-		if (NULL == event_name)
-		{
-			memset(event_handlers, 0, sizeof(event_handlers));
-		}
-		else
+		for (int i = 0; i < event_handlers.size(); i++)
 		{
-			const int NUM_HANDLERS = sizeof(event_handlers)
-					/ sizeof(FilteringEventHandler);
-			int dest = 0;
-			for (int i = 0; i < NUM_HANDLERS; i++)
+			FilteringEventHandler& handler = *event_handlers[i];
+			if (handler.handler && (NULL == event_name || !strcmp(event_name, handler.filter)))
 			{
-				if (!strcmp(event_name, event_handlers[i].filter))
-				{
-					memset(&event_handlers[i], 0, sizeof(event_handlers[i]));
-				}
-				else
-				{
-					if (dest != i)
-					{
-						memcpy(event_handlers + dest, event_handlers + i,
-								sizeof(event_handlers[i]));
-						memset(event_handlers + i, 0,
-								sizeof(event_handlers[i]));
-					}
-					dest++;
-				}
+				memset(&handler, 0, sizeof(handler));
+				trie_dirty = true;
 			}
 		}
 	}
@@ -266,25 +351,24 @@ public:
 	bool event_handler_exists(const char *event_name, EventHandler handler,
 			void *handler_data, SubscriptionScope::Enum scope, const char* id)
 	{
-		const int NUM_HANDLERS = sizeof(event_handlers)
-				/ sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		for (int i = 0; i < event_handlers.size(); i++)
 		{
-			if (event_handlers[i].handler == handler
-					&& event_handlers[i].handler_data == handler_data
-					&& event_handlers[i].scope == scope)
+			const FilteringEventHandler& h = *event_handlers[i];
+			if (h.handler == handler
+					&& h.handler_data == handler_data
+					&& h.scope == scope)
 			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
+				const size_t MAX_FILTER_LEN = sizeof(h.filter);
 				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				if (!strncmp(event_handlers[i].filter, event_name, FILTER_LEN))
+				if (!strncmp(h.filter, event_name, FILTER_LEN))
 				{
 					const size_t MAX_ID_LEN =
-							sizeof(event_handlers[i].device_id) - 1;
+							sizeof(h.device_id) - 1;
 					const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
 					if (id_len)
-						return !strncmp(event_handlers[i].device_id, id, id_len);
+						return !strncmp(h.device_id, id, id_len);
 					else
-						return !event_handlers[i].device_id[0];
+						return !h.device_id[0];
 				}
 			}
 		}
@@ -300,27 +384,58 @@ public:
 		if (event_handler_exists(event_name, handler, handler_data, scope, id))
 			return NO_ERROR;
 
-		const int NUM_HANDLERS = sizeof(event_handlers) / sizeof(FilteringEventHandler);
-		for (int i = 0; i < NUM_HANDLERS; i++)
+		if (trie_dirty && !dispatching)
 		{
-			if (NULL == event_handlers[i].handler)
+			rebuild_trie();
+		}
+		// Removed handlers can only be reused once they have been unlinked from the trie
+		int index = -1;
+		int count = 0;
+		for (int i = 0; i < event_handlers.size(); i++)
+		{
+			if (event_handlers[i]->handler)
 			{
-				const size_t MAX_FILTER_LEN = sizeof(event_handlers[i].filter);
-				const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
-				memcpy(event_handlers[i].filter, event_name, FILTER_LEN);
-				memset(event_handlers[i].filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
-				event_handlers[i].handler = handler;
-				event_handlers[i].handler_data = handler_data;
-				event_handlers[i].device_id[0] = 0;
-				const size_t MAX_ID_LEN = sizeof(event_handlers[i].device_id) - 1;
-				const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
-				memcpy(event_handlers[i].device_id, id, id_len);
-				event_handlers[i].device_id[id_len] = 0;
-				event_handlers[i].scope = scope;
-				return NO_ERROR;
+				count++;
 			}
+			else if (index < 0 && !trie_dirty)
+			{
+				index = i;
+			}
+		}
+		if (count >= MAX_SUBSCRIPTIONS)
+		{
+			return INSUFFICIENT_STORAGE;
 		}
-		return INSUFFICIENT_STORAGE;
+		if (index < 0)
+		{
+			std::unique_ptr<FilteringEventHandler> h(new(std::nothrow) FilteringEventHandler());
+			if (!h || !event_handlers.reserve(event_handlers.size() + 1) || !next_handler.append(-1))
+			{
+				return INSUFFICIENT_STORAGE;
+			}
+			index = event_handlers.size();
+			event_handlers.append(h.release());
+		}
+		FilteringEventHandler& h = *event_handlers[index];
+		const size_t MAX_FILTER_LEN = sizeof(h.filter);
+		const size_t FILTER_LEN = strnlen(event_name, MAX_FILTER_LEN);
+		memcpy(h.filter, event_name, FILTER_LEN);
+		memset(h.filter + FILTER_LEN, 0, MAX_FILTER_LEN - FILTER_LEN);
+		h.handler_data = handler_data;
+		h.device_id[0] = 0;
+		const size_t MAX_ID_LEN = sizeof(h.device_id) - 1;
+		const size_t id_len = id ? strnlen(id, MAX_ID_LEN) : 0;
+		memcpy(h.device_id, id, id_len);
+		h.device_id[id_len] = 0;
+		h.scope = scope;
+		const ProtocolError error = link_handler(index);
+		if (error != NO_ERROR)
+		{
+			memset(&h, 0, sizeof(h));
+			return error;
+		}
+		h.handler = handler;
+		return NO_ERROR;
 	}
 
 	inline ProtocolError send_subscriptions(MessageChannel& channel)
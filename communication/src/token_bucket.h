@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "protocol_defs.h"
+
+namespace particle {
+
+namespace protocol {
+
+/**
+ * Token bucket rate limiter.
+ *
+ * The bucket holds up to `burst` tokens and gains one token every `period` milliseconds. Each
+ * rate-limited operation takes a token. A bucket with a zero period never limits anything.
+ *
+ * The bucket starts full. Time is passed in explicitly, and tick counter overflow is handled.
+ */
+class TokenBucket {
+public:
+    TokenBucket(unsigned burst, system_tick_t period) :
+            period_(period),
+            last_(0),
+            burst_(burst),
+            tokens_(burst),
+            started_(false) {
+    }
+
+    /**
+     * Changes the bucket parameters and refills the bucket.
+     */
+    void configure(unsigned burst, system_tick_t period) {
+        period_ = period;
+        burst_ = burst;
+        tokens_ = burst;
+        started_ = false;
+    }
+
+    /**
+     * Takes a token from the bucket.
+     *
+     * @return `true` if a token was available, or `false` if the operation should be rate limited.
+     */
+    bool take(system_tick_t now) {
+        if (!period_) {
+            return true;
+        }
+        refill(now);
+        if (!tokens_) {
+            return false;
+        }
+        --tokens_;
+        return true;
+    }
+
+    /**
+     * Returns the number of milliseconds until a token becomes available, or 0 if one is available
+     * now.
+     */
+    system_tick_t next_token_delay(system_tick_t now) {
+        if (!period_) {
+            return 0;
+        }
+        refill(now);
+        if (tokens_) {
+            return 0;
+        }
+        return period_ - (now - last_);
+    }
+
+    /**
+     * Returns the number of tokens currently available.
+     */
+    unsigned available(system_tick_t now) {
+        if (period_) {
+            refill(now);
+        }
+        return tokens_;
+    }
+
+    unsigned burst() const {
+        return burst_;
+    }
+
+    system_tick_t period() const {
+        return period_;
+    }
+
+private:
+    system_tick_t period_;
+    system_tick_t last_; // Time of the last refill, or `now` while the bucket is full
+    unsigned burst_;
+    unsigned tokens_;
+    bool started_;
+
+    void refill(system_tick_t now) {
+        if (!started_ || tokens_ >= burst_) {
+            started_ = true;
+            last_ = now;
+            return;
+        }
+        const system_tick_t n = (now - last_) / period_;
+        if (n >= burst_ - tokens_) {
+            tokens_ = burst_;
+            last_ = now;
+        } else if (n) {
+            tokens_ += n;
+            // Keep the fraction of the period that has already elapsed
+            last_ += n * period_;
+        }
+    }
+};
+
+} // namespace protocol
+
+} // namespace particle
@@ -19,9 +19,12 @@
 
 #include "protocol.h"
 #include "messages.h"
+#include "coap_message_encoder.h"
+#include "coap_message_decoder.h"
 
 #include "endian_util.h"
 
+#include <algorithm>
 #include <memory>
 #include <cstring>
 
@@ -30,33 +33,47 @@ namespace particle {
 namespace protocol {
 
 struct Variables::Context {
-    Context(Variables* self, token_t token) :
+    Context(Variables* self, token_t token, const char* key, const Block& block) :
             self(self),
-            token(token) {
+            token(token),
+            block(block) {
+        memcpy(this->key, key, sizeof(this->key));
     }
 
     Variables* self;
     token_t token;
+    char key[MAX_VARIABLE_KEY_LENGTH + 1];
+    Block block;
 };
 
-ProtocolError Variables::handle_request(Message& message, token_t token, message_id_t id) {
+ProtocolError Variables::handle_request(const CoapMessageDecoder& d, Message& message, token_t token, message_id_t id) {
     char key[MAX_VARIABLE_KEY_LENGTH + 1];
-    auto result = decode_request(message, key);
+    Block block = {};
+    auto result = decode_request(d, key, &block);
     if (result != ProtocolError::NO_ERROR) {
         return send_error_ack(message, token, id, CoAPCode::BAD_REQUEST);
     }
+    if (block.num > 0 && snapshot_.data && strcmp(snapshot_.key, key) == 0) {
+        // Serve the subsequent blocks of a transfer from the snapshot of the value
+        result = send_empty_ack(message, id);
+        if (result != ProtocolError::NO_ERROR) {
+            return result;
+        }
+        return send_snapshot_block(token, block);
+    }
     if (protocol_->getDescriptor().get_variable_async) {
-        result = handle_request(message, token, id, key);
+        result = handle_request(message, token, id, key, block);
     } else {
         // Use the compatibility callback
-        result = handle_request_compat(message, token, id, key);
+        result = handle_request_compat(message, token, id, key, block);
     }
     return result;
 }
 
-ProtocolError Variables::handle_request(Message& message, token_t token, message_id_t id, const char* key) {
+ProtocolError Variables::handle_request(Message& message, token_t token, message_id_t id, const char* key,
+        const Block& block) {
     // Allocate a context for the request
-    std::unique_ptr<Context> ctx(new(std::nothrow) Context(this, token));
+    std::unique_ptr<Context> ctx(new(std::nothrow) Context(this, token, key, block));
     if (!ctx) {
         return send_error_ack(message, token, id, CoAPCode::INTERNAL_SERVER_ERROR);
     }
@@ -71,7 +88,8 @@ ProtocolError Variables::handle_request(Message& message, token_t token, message
     return ProtocolError::NO_ERROR;
 }
 
-ProtocolError Variables::handle_request_compat(Message& message, token_t token, message_id_t id, const char* key) {
+ProtocolError Variables::handle_request_compat(Message& message, token_t token, message_id_t id, const char* key,
+        const Block& block) {
     const auto& descriptor = protocol_->getDescriptor();
     const auto value = descriptor.get_variable(key);
     if (!value) {
@@ -105,26 +123,37 @@ ProtocolError Variables::handle_request_compat(Message& message, token_t token,
     if (result != ProtocolError::NO_ERROR) {
         return result;
     }
+    if (is_multi_block(value_size, value_type, block)) {
+        // The value is owned by the application, so it may change between the blocks of the transfer
+        const auto copy = (char*)malloc(value_size);
+        if (copy) {
+            memcpy(copy, value, value_size);
+            set_snapshot(key, copy, value_size);
+            return send_snapshot_block(token, block);
+        }
+    }
     // Send a separate response
-    return send_response(token, value, value_size, value_type);
+    return send_response(token, value, value_size, value_type, block);
 }
 
-ProtocolError Variables::decode_request(Message& message, char* key) {
-    uint8_t* queue = message.buf();
-    uint8_t queue_offset = 8;
-    // copy the variable key
-    size_t key_length;
-    if (queue[7] == 0x0d) {
-        key_length = 0x0d + (queue[8] & 0xFF);
-        queue_offset++;
-    } else {
-        key_length = queue[7] & 0x0F;
+ProtocolError Variables::decode_request(const CoapMessageDecoder& d, char* key, Block* block) {
+    // The first Uri-Path option contains the message type, the second one contains the variable key
+    size_t key_length = 0;
+    auto it = d.findOption(CoapOption::URI_PATH);
+    if (it.next() && it.option() == CoapOption::URI_PATH) {
+        key_length = std::min(it.size(), MAX_VARIABLE_KEY_LENGTH);
+        memcpy(key, it.data(), key_length);
     }
-    if (key_length > MAX_VARIABLE_KEY_LENGTH) {
-        key_length = MAX_VARIABLE_KEY_LENGTH;
-    }
-    memcpy(key, queue + queue_offset, key_length);
     memset(key + key_length, 0, MAX_VARIABLE_KEY_LENGTH - key_length + 1);
+    // A server that supports block-wise transfers requests large values with the Block2 option
+    const int r = d.block(CoapOption::BLOCK2, &block->num, nullptr /* more */, &block->size);
+    if (r < 0) {
+        if (r != SYSTEM_ERROR_NOT_FOUND) {
+            return ProtocolError::MALFORMED_MESSAGE;
+        }
+        block->num = 0;
+        block->size = 0;
+    }
     return ProtocolError::NO_ERROR;
 }
 
@@ -176,14 +205,83 @@ size_t Variables::encode_response(uint8_t* buffer, token_t token, const void* va
             (const uint8_t*)value, value_size, channel.is_unreliable());
 }
 
-ProtocolError Variables::send_response(token_t token, const void* value, size_t value_size, SparkReturnType::Enum value_type) {
+ProtocolError Variables::encode_block_response(Message& message, token_t token, const void* value, size_t value_size,
+        uint32_t etag, const Block& block) {
+    // The server has to use the block size of the first response for the subsequent requests, but
+    // we may need to use smaller blocks than requested if the message size has been limited since
+    // then. The block number is adjusted so that the offset of the data doesn't change (RFC 7959, 2.4)
+    const size_t block_size = std::min(block.size, protocol_->get_variable_block_size());
+    if (!block_size) {
+        return ProtocolError::INSUFFICIENT_STORAGE;
+    }
+    const size_t offs = block.num * block.size;
+    if (offs > value_size || (offs == value_size && offs > 0)) {
+        return ProtocolError::NOT_FOUND;
+    }
+    const size_t n = std::min(value_size - offs, block_size);
+    const bool more = offs + n < value_size;
+    const unsigned num = offs / block_size;
+    auto& channel = protocol_->getChannel();
+    CoapMessageEncoder e((char*)message.buf(), message.capacity());
+    e.type(channel.is_unreliable() ? CoapType::CON : CoapType::NON);
+    e.code(CoapCode::CONTENT);
+    e.id(0); // Will be assigned by the message channel
+    e.token((const char*)&token, sizeof(token));
+    // The ETag allows the server to detect that the value has changed between the blocks (RFC 7959, 2.4)
+    etag = nativeToBigEndian(etag);
+    e.option(CoapOption::ETAG, (const char*)&etag, sizeof(etag));
+    e.block(CoapOption::BLOCK2, num, more, block_size);
+    if (num == 0) {
+        e.option(CoapOption::SIZE2, (unsigned)value_size);
+    }
+    e.payload((const char*)value + offs, n);
+    const int r = e.encode();
+    if (r < 0 || (size_t)r > message.capacity()) {
+        return ProtocolError::INSUFFICIENT_STORAGE;
+    }
+    message.set_length(r);
+    return ProtocolError::NO_ERROR;
+}
+
+ProtocolError Variables::send_response(token_t token, const void* value, size_t value_size, SparkReturnType::Enum value_type,
+        const Block& block) {
     Message msg;
     auto& channel = protocol_->getChannel();
     ProtocolError result = channel.create(msg);
     if (result != ProtocolError::NO_ERROR) {
         return result;
     }
-    result = encode_response(msg, token, value, value_size, value_type);
+    if (block.size && value_type == SparkReturnType::STRING) {
+        result = encode_block_response(msg, token, value, value_size, value_etag(value, value_size), block);
+        if (result == ProtocolError::NOT_FOUND) {
+            // The requested block is past the end of the value
+            return send_error_response(msg, token, CoAPCode::BAD_OPTION);
+        }
+    } else {
+        // Values of other types always fit in a single block
+        result = encode_response(msg, token, value, value_size, value_type);
+    }
+    if (result != ProtocolError::NO_ERROR) {
+        return send_error_response(msg, token, CoAPCode::INTERNAL_SERVER_ERROR);
+    }
+    return channel.send(msg);
+}
+
+ProtocolError Variables::send_snapshot_block(token_t token, const Block& block) {
+    Message msg;
+    auto& channel = protocol_->getChannel();
+    ProtocolError result = channel.create(msg);
+    if (result != ProtocolError::NO_ERROR) {
+        return result;
+    }
+    result = encode_block_response(msg, token, snapshot_.data, snapshot_.size, snapshot_.etag, block);
+    const size_t end = block.num * block.size + std::min(block.size, protocol_->get_variable_block_size());
+    if (result == ProtocolError::NOT_FOUND || end >= snapshot_.size) {
+        reset(); // This was the last block of the transfer
+    }
+    if (result == ProtocolError::NOT_FOUND) {
+        return send_error_response(msg, token, CoAPCode::BAD_OPTION);
+    }
     if (result != ProtocolError::NO_ERROR) {
         return send_error_response(msg, token, CoAPCode::INTERNAL_SERVER_ERROR);
     }
@@ -223,13 +321,45 @@ ProtocolError Variables::send_error_ack(Message& message, token_t token, message
     return protocol_->getChannel().send(message);
 }
 
+void Variables::reset() {
+    free(snapshot_.data);
+    snapshot_ = Snapshot();
+}
+
+bool Variables::is_multi_block(size_t value_size, SparkReturnType::Enum value_type, const Block& block) const {
+    return block.size && value_type == SparkReturnType::STRING &&
+            value_size > std::min(block.size, protocol_->get_variable_block_size());
+}
+
+void Variables::set_snapshot(const char* key, char* data, size_t size) {
+    reset();
+    memcpy(snapshot_.key, key, sizeof(snapshot_.key));
+    snapshot_.data = data;
+    snapshot_.size = size;
+    snapshot_.etag = value_etag(data, size);
+}
+
+uint32_t Variables::value_etag(const void* value, size_t value_size) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < value_size; ++i) {
+        h = (h ^ ((const uint8_t*)value)[i]) * 16777619u;
+    }
+    return h;
+}
+
 void Variables::get_variable_callback(int result, int type, void* data, size_t size, void* context) {
     const auto p = (Context*)context;
     if (result != ProtocolError::NO_ERROR) {
         const auto code = CoAP::codeForProtocolError((ProtocolError)result);
         p->self->send_error_response(p->token, code);
+    } else if (p->self->is_multi_block(size, (SparkReturnType::Enum)type, p->block)) {
+        // The snapshot takes the ownership over the value data
+        p->self->set_snapshot(p->key, (char*)data, size);
+        p->self->send_snapshot_block(p->token, p->block);
+        data = nullptr;
     } else {
-        p->self->send_response(p->token, data, size, (SparkReturnType::Enum)type);
+        p->self->send_response(p->token, data, size, (SparkReturnType::Enum)type, p->block);
     }
     free(data);
     delete p;
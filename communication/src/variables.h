@@ -31,38 +31,72 @@ namespace protocol {
 
 class Protocol;
 class Message;
+class CoapMessageDecoder;
 
 class Variables
 {
 public:
     explicit Variables(Protocol* protocol);
+    ~Variables();
 
-    ProtocolError handle_request(Message& message, token_t token, message_id_t id);
+    ProtocolError handle_request(const CoapMessageDecoder& d, Message& message, token_t token, message_id_t id);
+
+    void reset();
 
 private:
     struct Context;
 
+    // Block of the value requested via the Block2 option (RFC 7959)
+    struct Block {
+        unsigned num;
+        size_t size; // 0 if the value is not requested block-wise
+    };
+
+    // Copy of a value that doesn't fit in a single block. The blocks of a transfer are served from
+    // the same copy, which is released once the last block is sent or another transfer is started
+    struct Snapshot {
+        char key[MAX_VARIABLE_KEY_LENGTH + 1];
+        char* data;
+        size_t size;
+        uint32_t etag;
+    };
+
     Protocol* protocol_;
+    Snapshot snapshot_;
 
-    ProtocolError handle_request(Message& message, token_t token, message_id_t id, const char* key);
-    ProtocolError handle_request_compat(Message& message, token_t token, message_id_t id, const char* key);
+    ProtocolError handle_request(Message& message, token_t token, message_id_t id, const char* key, const Block& block);
+    ProtocolError handle_request_compat(Message& message, token_t token, message_id_t id, const char* key, const Block& block);
 
-    ProtocolError decode_request(Message& message, char* key);
+    ProtocolError decode_request(const CoapMessageDecoder& d, char* key, Block* block);
     ProtocolError encode_response(Message& message, token_t token, const void* value, size_t value_size, SparkReturnType::Enum value_type);
     size_t encode_response(uint8_t* buffer, token_t token, const void* value, size_t value_size);
+    ProtocolError encode_block_response(Message& message, token_t token, const void* value, size_t value_size,
+            uint32_t etag, const Block& block);
 
-    ProtocolError send_response(token_t token, const void* value, size_t value_size, SparkReturnType::Enum value_type);
+    ProtocolError send_response(token_t token, const void* value, size_t value_size, SparkReturnType::Enum value_type,
+            const Block& block);
+    ProtocolError send_snapshot_block(token_t token, const Block& block);
     ProtocolError send_error_response(token_t token, uint8_t code);
     ProtocolError send_error_response(Message& message, token_t token, uint8_t code);
 
     ProtocolError send_empty_ack(Message& message, message_id_t id);
     ProtocolError send_error_ack(Message& message, token_t token, message_id_t id, uint8_t code);
 
+    bool is_multi_block(size_t value_size, SparkReturnType::Enum value_type, const Block& block) const;
+    void set_snapshot(const char* key, char* data, size_t size);
+
+    static uint32_t value_etag(const void* value, size_t value_size);
+
     static void get_variable_callback(int result, int type, void* data, size_t size, void* context); // SparkDescriptor::GetVariableCallback
 };
 
 inline Variables::Variables(Protocol* protocol) :
-        protocol_(protocol) {
+        protocol_(protocol),
+        snapshot_() {
+}
+
+inline Variables::~Variables() {
+    reset();
 }
 
 } // namespace protocol
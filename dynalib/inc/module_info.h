@@ -44,7 +44,8 @@ typedef enum module_info_flags_t {
                                                 // and potentially module_info_suffix_t + CRC in the end of the binary (depending on platform/module)
                                                 // need to be skipped when copying/writing this module into its target location.
     MODULE_INFO_FLAG_COMPRESSED         = 0x02, // Indicates that the module data is compressed.
-    MODULE_INFO_FLAG_COMBINED           = 0x04  // Indicates that this module is combined with another module.
+    MODULE_INFO_FLAG_COMBINED           = 0x04, // Indicates that this module is combined with another module.
+    MODULE_INFO_FLAG_DELTA              = 0x08  // Indicates that the module data is a patch against the installed module.
 } module_info_flags_t;
 
 /**
@@ -203,6 +204,55 @@ typedef struct compressed_module_header {
     uint32_t original_size;
 } __attribute__((__packed__)) compressed_module_header;
 
+/**
+ * Delta module header.
+ *
+ * In a delta module, this header immediately follows the module info header (`module_info_t`) and
+ * precedes the patch data. The function, index, version and dependencies in the module info header
+ * are those of the module that is reconstructed by applying the patch to the currently installed
+ * module with the same function and index (the base module). The start and end addresses describe
+ * the delta module itself, so `module_length()` returns the size of the delta module without its
+ * CRC-32. The size of the reconstructed module is given by `original_size`.
+ *
+ * The patch data is compressed with raw Deflate. Once decompressed, it is a sequence of records, each
+ * starting with three little-endian 32-bit values: `diff_size`, `extra_size` and `seek`, followed by
+ * `diff_size` bytes that are added bytewise to the base module data at the current base offset, and
+ * `extra_size` bytes that are copied to the output as is. After a record is processed, the current
+ * base offset is advanced by `diff_size` and then by the signed value of `seek`.
+ */
+typedef struct delta_module_header {
+    /**
+     * Header size.
+     */
+    uint16_t size;
+    /**
+     * Patch method.
+     *
+     * As of now, the only supported method is the one described above (0).
+     */
+    uint8_t method;
+    /**
+     * Base two logarithm of the window size used when compressing the patch data.
+     */
+    uint8_t window_bits;
+    /**
+     * Size of the reconstructed module, including its CRC-32.
+     */
+    uint32_t original_size;
+    /**
+     * Size of the base module, including its CRC-32.
+     */
+    uint32_t base_size;
+    /**
+     * CRC-32 of the base module, in the byte order it is stored in the module.
+     */
+    uint32_t base_crc;
+    /**
+     * SHA-256 hash of the reconstructed module.
+     */
+    uint8_t sha[32];
+} __attribute__((__packed__)) delta_module_header;
+
 /*
  * The structure is a suffix to the module, placed before the end symbol
  */
@@ -275,6 +275,10 @@
 #define HAL_PLATFORM_COMPRESSED_OTA (0)
 #endif // HAL_PLATFORM_COMPRESSED_OTA
 
+#ifndef HAL_PLATFORM_DELTA_OTA
+#define HAL_PLATFORM_DELTA_OTA (0)
+#endif // HAL_PLATFORM_DELTA_OTA
+
 #ifndef HAL_PLATFORM_NETWORK_MULTICAST
 #define HAL_PLATFORM_NETWORK_MULTICAST (0)
 #endif // HAL_PLATFORM_NETWORK_MULTICAST
@@ -392,6 +396,10 @@
 #define HAL_PLATFORM_NEWLIB (0)
 #endif // HAL_PLATFORM_NEWLIB
 
+#ifndef HAL_PLATFORM_TLSF_HEAP
+#define HAL_PLATFORM_TLSF_HEAP (0)
+#endif // HAL_PLATFORM_TLSF_HEAP
+
 #ifndef HAL_PLATFORM_SPI_NUM
 #define HAL_PLATFORM_SPI_NUM (0)
 #endif // HAL_PLATFORM_SPI_NUM
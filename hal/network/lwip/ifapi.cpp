@@ -34,6 +34,7 @@ extern "C" {
 #include "resolvapi.h"
 #include "basenetif.h"
 #include "check.h"
+#include "alloc_trace.h"
 
 using namespace particle::net;
 
@@ -325,6 +326,10 @@ int if_init(void) {
     tcpip_init([](void* arg) {
         LOG(TRACE, "LwIP started");
         srand(HAL_RNG_GetRandomNumber());
+#if ALLOC_TRACE_ENABLED
+        // Account everything allocated by the TCP/IP thread to LwIP
+        alloc_trace_set_tag(ALLOC_TRACE_TAG_LWIP);
+#endif
     }, /* &sem */ nullptr);
 
     LwipTcpIpCoreLock lk;
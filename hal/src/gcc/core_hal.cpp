@@ -40,6 +40,7 @@
 #include <sstream>
 #include <iomanip>
 #include "system_error.h"
+#include "alloc_trace.h"
 
 #include "eeprom_file.h"
 #include "eeprom_hal.h"
@@ -136,6 +137,10 @@ const char* eeprom_bin = "eeprom.bin";
 extern "C" int main(int argc, char* argv[])
 {
     log_set_callbacks(log_message_callback, log_write_callback, log_enabled_callback, nullptr);
+#if ALLOC_TRACE_ENABLED
+    // System.reset() exits the process
+    atexit(alloc_trace_dump);
+#endif
     if (read_device_config(argc, argv)) {
     		// init the eeprom so that a file of size 0 can be used to trigger the save.
     		HAL_EEPROM_Init();
@@ -13,6 +13,10 @@ ifneq (,$(findstring hal,$(MAKE_DEPENDENCIES)))
 
 LDFLAGS += -lc
 
+# Replace the C allocation functions with the ones of the allocation tracer, see malloc_wrap.cpp
+ifeq ("$(USE_ALLOC_TRACE)","y")
+LDFLAGS += -Wl,--undefined=malloc
+endif
 
 # additional libraries required by gcc build
 ifdef SYSTEMROOT
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Allocation tracing on the virtual device. The C library's allocation functions are replaced
+ * (see include.mk) rather than wrapped, so that the blocks allocated by the C library itself,
+ * e.g. by strdup() or asprintf(), also carry the trace header. The replacements are implemented
+ * on top of the C library's allocator, and the global allocation operators of the C++ runtime use
+ * them as well.
+ */
+
+#include "alloc_trace.h"
+
+#if ALLOC_TRACE_ENABLED
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void __libc_free(void* ptr);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+
+void* memalign(size_t align, size_t size);
+void* valloc(size_t size);
+void* pvalloc(size_t size);
+size_t malloc_usable_size(void* ptr);
+
+} // extern "C"
+
+using namespace particle;
+using namespace particle::detail;
+
+namespace {
+
+// Blocks with a stricter alignment than that of a trace header are allocated with some padding
+// in front of the header. Its size is kept in the unused part of the header
+struct BlockHeader {
+    AllocTraceHeader trace;
+    uint32_t padding;
+};
+
+static_assert(sizeof(BlockHeader) <= ALLOC_TRACE_HEADER_SIZE, "Invalid size of the block header");
+
+void* blockMalloc(size_t size) {
+    const auto h = (BlockHeader*)__libc_malloc(size);
+    if (h) {
+        h->padding = 0;
+    }
+    return h;
+}
+
+void blockFree(void* ptr) {
+    const auto h = (BlockHeader*)ptr;
+    __libc_free((uint8_t*)h - h->padding);
+}
+
+void* blockRealloc(void* ptr, size_t size) {
+    const auto h = (BlockHeader*)ptr;
+    if (!h) {
+        return blockMalloc(size);
+    }
+    if (!h->padding) {
+        return __libc_realloc(h, size);
+    }
+    // Reallocated blocks don't need to keep their alignment
+    const auto newHeader = (BlockHeader*)blockMalloc(size);
+    if (newHeader) {
+        memcpy(newHeader, h, std::min<size_t>(size, h->trace.size + ALLOC_TRACE_HEADER_SIZE));
+        newHeader->padding = 0;
+        blockFree(h);
+    }
+    return newHeader;
+}
+
+size_t blockUsableSize(void* ptr) {
+    // The C library's malloc_usable_size() can't be called from the replacement function
+    return ((BlockHeader*)ptr)->trace.size + ALLOC_TRACE_HEADER_SIZE;
+}
+
+bool isValidAlignment(size_t align) {
+    return align && !(align & (align - 1));
+}
+
+void* alignedMalloc(size_t align, size_t size) {
+    if (align <= ALLOC_TRACE_HEADER_SIZE) {
+        return tracedMalloc(size, blockMalloc);
+    }
+    return tracedMalloc(size, [align](size_t size) -> void* {
+        if (size > SIZE_MAX - align) {
+            return nullptr;
+        }
+        const auto p = (uint8_t*)__libc_memalign(align, size + align);
+        if (!p) {
+            return nullptr;
+        }
+        const auto h = (BlockHeader*)(p + align - ALLOC_TRACE_HEADER_SIZE);
+        h->padding = align - ALLOC_TRACE_HEADER_SIZE;
+        return h;
+    });
+}
+
+} // namespace
+
+void* malloc(size_t size) {
+    return tracedMalloc(size, blockMalloc);
+}
+
+void free(void* ptr) {
+    tracedFree(ptr, blockFree);
+}
+
+void* realloc(void* ptr, size_t size) {
+    return tracedRealloc(ptr, size, blockRealloc, blockFree);
+}
+
+void* calloc(size_t n, size_t size) {
+    if (size && n > SIZE_MAX / size) {
+        alloc_trace_record_failure(alloc_trace_get_tag());
+        return nullptr;
+    }
+    const auto ptr = tracedMalloc(n * size, blockMalloc);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void* memalign(size_t align, size_t size) {
+    if (!isValidAlignment(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return alignedMalloc(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+int posix_memalign(void** ptr, size_t align, size_t size) {
+    if (!isValidAlignment(align) || align % sizeof(void*)) {
+        return EINVAL;
+    }
+    const auto p = alignedMalloc(align, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void* valloc(size_t size) {
+    return alignedMalloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) {
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    return alignedMalloc(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    return tracedUsableSize(ptr, blockUsableSize);
+}
+
+#endif // ALLOC_TRACE_ENABLED
@@ -42,6 +42,7 @@
 #include "logging.h"
 #include "static_recursive_mutex.h"
 #include "service_debug.h"
+#include "alloc_trace.h"
 
 #if PLATFORM_ID == 6 || PLATFORM_ID == 8
 # include "wwd_rtos_interface.h"
@@ -161,6 +162,10 @@ os_result_t os_thread_join(os_thread_t thread)
  */
 os_result_t os_thread_exit(os_thread_t thread)
 {
+#if ALLOC_TRACE_ENABLED
+    // The handle can be reused by a new thread
+    alloc_trace_release_thread(thread ? thread : os_thread_current(nullptr));
+#endif
     vTaskDelete(static_cast<TaskHandle_t>(thread));
     return 0;
 }
@@ -92,6 +92,8 @@
 
 #define HAL_PLATFORM_COMPRESSED_OTA (1)
 
+#define HAL_PLATFORM_DELTA_OTA (1)
+
 #define HAL_PLATFORM_FILE_MAXIMUM_FD (999)
 
 #define HAL_PLATFORM_SOCKET_IOCTL_NOTIFY (1)
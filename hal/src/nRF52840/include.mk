@@ -62,6 +62,11 @@ USE_PRINTF_FLOAT ?= n
 ifeq ("$(USE_PRINTF_FLOAT)","y")
 LDFLAGS += -u _printf_float
 endif
+# Use the TLSF heap instead of the FreeRTOS heap_4 allocator
+USE_TLSF_HEAP ?= n
+ifeq ("$(USE_TLSF_HEAP)","y")
+CFLAGS += -DHAL_PLATFORM_TLSF_HEAP=1
+endif
 LDFLAGS += -Wl,-Map,$(TARGET_BASE).map
 LDFLAGS += -u uxTopUsedPriority
 #
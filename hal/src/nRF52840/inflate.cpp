@@ -25,13 +25,22 @@
 
 int inflate_create(inflate_ctx** ctx, const inflate_opts* opts, inflate_output output, void* user_data) {
     CHECK_TRUE(output, SYSTEM_ERROR_INVALID_ARGUMENT);
-    size_t bufSize = (1 << INFLATE_MAX_WINDOW_BITS);
+    unsigned windowBits = INFLATE_MAX_WINDOW_BITS;
     if (opts && opts->window_bits) {
         if (opts->window_bits < INFLATE_MIN_WINDOW_BITS || opts->window_bits > INFLATE_MAX_WINDOW_BITS) {
             return SYSTEM_ERROR_INVALID_ARGUMENT;
         }
-        bufSize = (1 << opts->window_bits);
+        windowBits = opts->window_bits;
     }
+    unsigned bufBits = windowBits;
+    if (opts && opts->buffer_bits) {
+        // The decompressor uses the output buffer as its dictionary, so it can't be smaller than the window
+        if (opts->buffer_bits < windowBits || opts->buffer_bits > INFLATE_MAX_BUFFER_BITS) {
+            return SYSTEM_ERROR_INVALID_ARGUMENT;
+        }
+        bufBits = opts->buffer_bits;
+    }
+    const size_t bufSize = (1 << bufBits);
     char* buf = nullptr;
     CHECK(inflate_alloc_ctx(ctx, &buf, bufSize));
     (*ctx)->buf = buf;
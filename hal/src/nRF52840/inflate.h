@@ -22,6 +22,7 @@
 
 #define INFLATE_MIN_WINDOW_BITS 8
 #define INFLATE_MAX_WINDOW_BITS 15
+#define INFLATE_MAX_BUFFER_BITS 17
 
 typedef struct inflate_ctx inflate_ctx;
 
@@ -38,7 +39,20 @@ typedef enum inflate_flag {
 } inflate_flag;
 
 typedef struct inflate_opts {
+    /**
+     * Base two logarithm of the window size used when compressing the data.
+     *
+     * The valid range is [8, 15]. The value of 0 corresponds to the default window size of 15 bits.
+     */
     uint8_t window_bits;
+    /**
+     * Base two logarithm of the size of the output buffer.
+     *
+     * The buffer can be larger than the window in which case the decompressor produces more data per
+     * call and the output callback is invoked less often. The valid range is [`window_bits`, 17]. The
+     * value of 0 corresponds to a buffer of the window size.
+     */
+    uint8_t buffer_bits;
 } inflate_opts;
 
 #ifdef __cplusplus
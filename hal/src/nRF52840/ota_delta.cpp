@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+
+LOG_SOURCE_CATEGORY("hal.ota")
+
+#include "ota_delta.h"
+
+#if HAL_PLATFORM_DELTA_OTA
+
+#include "ota_module.h"
+#include "ota_flash_hal_impl.h"
+#include "flash_mal.h"
+#include "inflate.h"
+#include "sha256.h"
+#include "scope_guard.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace particle {
+
+namespace {
+
+const size_t BLOCK_SIZE = 256;
+
+flash_device_t flashDevice(const module_bounds_t& bounds) {
+    return (bounds.location == MODULE_BOUNDS_LOC_INTERNAL_FLASH) ? FLASH_INTERNAL : FLASH_SERIAL;
+}
+
+typedef DeltaPatcher<Sha256> Patcher;
+
+int inflateOutput(const char* data, size_t size, void* userData) {
+    const auto patcher = (Patcher*)userData;
+    return patcher->process(data, size);
+}
+
+int findBaseModule(const module_info_t& info, const delta_module_header& header, hal_module_t* base) {
+    for (unsigned i = 0; i < module_bounds_length; ++i) {
+        const auto bounds = module_bounds[i];
+        if (bounds->store != MODULE_STORE_MAIN || bounds->module_function != module_function(&info) ||
+                bounds->module_index != module_index(&info) || bounds->location != MODULE_BOUNDS_LOC_INTERNAL_FLASH) {
+            continue;
+        }
+        if (!fetch_module(base, bounds, true /* userDepsOptional */, MODULE_VALIDATION_INTEGRITY) ||
+                !(base->validity_result & MODULE_VALIDATION_INTEGRITY)) {
+            continue;
+        }
+        if (module_length(&base->info) + 4 /* CRC-32 */ == header.base_size && base->crc.crc32 == header.base_crc) {
+            return 0;
+        }
+    }
+    return SYSTEM_ERROR_OTA_MODULE_NOT_FOUND;
+}
+
+} // namespace
+
+} // namespace particle
+
+using namespace particle;
+
+int apply_delta_module(const hal_module_t* module, uintptr_t address, size_t maxSize, hal_module_t* patched) {
+    const auto& info = module->info;
+    const auto moduleSize = module_length(&info);
+    const auto srcDev = flashDevice(module->bounds);
+    // Parse the delta module header
+    delta_module_header header = {};
+    if (moduleSize < sizeof(module_info_t) + sizeof(header) + module->suffix.size) {
+        SYSTEM_ERROR_MESSAGE("Invalid module size");
+        return SYSTEM_ERROR_OTA_INVALID_SIZE;
+    }
+    CHECK(detail::readDeltaFlash(srcDev, module->bounds.start_address + sizeof(module_info_t), &header, sizeof(header)));
+    if (header.size < sizeof(header) || moduleSize < sizeof(module_info_t) + header.size + module->suffix.size ||
+            header.method != 0 /* Bsdiff-style patch compressed with raw Deflate */) {
+        SYSTEM_ERROR_MESSAGE("Invalid module format");
+        return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+    }
+    if (header.original_size > maxSize) {
+        SYSTEM_ERROR_MESSAGE("Reconstructed module is too large");
+        return SYSTEM_ERROR_OTA_INVALID_SIZE;
+    }
+    // Find the module the patch was created against
+    hal_module_t base = {};
+    if (findBaseModule(info, header, &base) < 0) {
+        SYSTEM_ERROR_MESSAGE("Base module not found");
+        return SYSTEM_ERROR_OTA_MODULE_NOT_FOUND;
+    }
+    LOG(INFO, "Applying patch; base version: %u; patch size: %u; module size: %u", (unsigned)module_version(&base.info),
+            (unsigned)moduleSize, (unsigned)header.original_size);
+    const auto destDev = flashDevice(module_ota);
+    if (!FLASH_EraseMemory(destDev, address, header.original_size)) {
+        return SYSTEM_ERROR_FLASH_IO;
+    }
+    Patcher patcher(header, FLASH_INTERNAL, base.bounds.start_address, destDev, address);
+    CHECK(patcher.init());
+    inflate_opts opts = {};
+    opts.window_bits = header.window_bits;
+    inflate_ctx* infl = nullptr;
+    CHECK(inflate_create(&infl, &opts, inflateOutput, &patcher));
+    SCOPE_GUARD({
+        inflate_destroy(infl);
+    });
+    // Decompress and apply the patch data
+    uintptr_t srcAddr = module->bounds.start_address + sizeof(module_info_t) + header.size;
+    const uintptr_t srcEndAddr = module->bounds.start_address + moduleSize - module->suffix.size;
+    int r = INFLATE_NEEDS_MORE_INPUT;
+    while (srcAddr < srcEndAddr && r != INFLATE_DONE) {
+        char buf[BLOCK_SIZE];
+        const size_t n = std::min<size_t>(srcEndAddr - srcAddr, sizeof(buf));
+        CHECK(detail::readDeltaFlash(srcDev, srcAddr, buf, n));
+        size_t offs = 0;
+        do {
+            size_t size = n - offs;
+            r = inflate_input(infl, buf + offs, &size, INFLATE_HAS_MORE_INPUT);
+            if (r < 0) {
+                SYSTEM_ERROR_MESSAGE("Unable to apply patch: %d", r);
+                return (r == SYSTEM_ERROR_BAD_DATA) ? SYSTEM_ERROR_OTA_INVALID_FORMAT : r;
+            }
+            offs += size;
+        } while (r != INFLATE_DONE && (offs < n || r == INFLATE_HAS_MORE_OUTPUT));
+        srcAddr += n;
+    }
+    if (r != INFLATE_DONE) {
+        SYSTEM_ERROR_MESSAGE("Incomplete patch data");
+        return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+    }
+    CHECK(patcher.finish());
+    // Validate the reconstructed module
+    module_bounds_t bounds = module_ota;
+    bounds.maximum_size -= address - bounds.start_address;
+    bounds.start_address = address;
+    if (!fetch_module(patched, &bounds, true /* userDepsOptional */, MODULE_VALIDATION_INTEGRITY |
+            MODULE_VALIDATION_DEPENDENCIES_FULL)) {
+        SYSTEM_ERROR_MESSAGE("Unable to fetch reconstructed module");
+        return SYSTEM_ERROR_OTA_MODULE_NOT_FOUND;
+    }
+    const auto& patchedInfo = patched->info;
+    if (module_function(&patchedInfo) != module_function(&info) || module_index(&patchedInfo) != module_index(&info) ||
+            module_version(&patchedInfo) != module_version(&info) || module_length(&patchedInfo) + 4 != header.original_size ||
+            (patchedInfo.flags & MODULE_INFO_FLAG_DELTA)) {
+        SYSTEM_ERROR_MESSAGE("Reconstructed module doesn't match delta module");
+        return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+    }
+    return 0;
+}
+
+#endif // HAL_PLATFORM_DELTA_OTA
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#if HAL_PLATFORM_DELTA_OTA
+
+#include "ota_flash_hal.h"
+#include "flash_hal.h"
+#include "exflash_hal.h"
+#include "endian_util.h"
+#include "system_error.h"
+#include "logging.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+
+/**
+ * Reconstructs a module from a delta module stored in the OTA region.
+ *
+ * The patch data is applied to the installed module with the same function and index as the delta
+ * module. The reconstructed module is validated in the same way as a module received in full.
+ *
+ * @param module Delta module.
+ * @param address Address in the OTA region where the reconstructed module should be written to. The
+ *        address needs to be aligned at the flash sector boundary.
+ * @param maxSize Maximum size of the reconstructed module.
+ * @param patched Receives the reconstructed module.
+ * @return 0 on success, otherwise an error code defined by `system_error_t`.
+ */
+int apply_delta_module(const hal_module_t* module, uintptr_t address, size_t maxSize, hal_module_t* patched);
+
+namespace particle {
+
+namespace detail {
+
+inline int readDeltaFlash(flash_device_t dev, uintptr_t addr, void* data, size_t size) {
+    const int r = (dev == FLASH_INTERNAL) ? hal_flash_read(addr, (uint8_t*)data, size) :
+            hal_exflash_read(addr, (uint8_t*)data, size);
+    if (r != 0) {
+        return SYSTEM_ERROR_FLASH_IO;
+    }
+    return 0;
+}
+
+inline int writeDeltaFlash(flash_device_t dev, uintptr_t addr, const void* data, size_t size) {
+    const int r = (dev == FLASH_INTERNAL) ? hal_flash_write(addr, (const uint8_t*)data, size) :
+            hal_exflash_write(addr, (const uint8_t*)data, size);
+    if (r != 0) {
+        return SYSTEM_ERROR_FLASH_IO;
+    }
+    return 0;
+}
+
+} // namespace detail
+
+/**
+ * Applies decompressed patch data to a base module stored in the flash.
+ *
+ * The patch data is passed to `process()` in pieces of arbitrary size. The reconstructed module is
+ * written to the destination address, which needs to be erased. `finish()` checks that the patch
+ * data is complete and that the hash of the reconstructed module matches the one in the delta
+ * module header.
+ *
+ * `HashT` is a SHA-256 implementation with the same interface as `Sha256`.
+ */
+template<typename HashT>
+class DeltaPatcher {
+public:
+    static const size_t BLOCK_SIZE = 256;
+
+    // Record header: <diff_size:4><extra_size:4><seek:4>
+    static const size_t RECORD_HEADER_SIZE = 12;
+
+    DeltaPatcher(const delta_module_header& header, flash_device_t baseDev, uintptr_t baseAddr, flash_device_t destDev,
+            uintptr_t destAddr) :
+            header_(header),
+            baseAddr_(baseAddr),
+            destAddr_(destAddr),
+            basePos_(0),
+            diffLeft_(0),
+            extraLeft_(0),
+            seek_(0),
+            recHeaderSize_(0),
+            bufSize_(0),
+            outSize_(0),
+            written_(0),
+            baseDev_(baseDev),
+            destDev_(destDev),
+            state_(State::RECORD_HEADER) {
+    }
+
+    int init() {
+        CHECK(sha_.init());
+        CHECK(sha_.start());
+        return 0;
+    }
+
+    /**
+     * Processes a piece of the patch data.
+     *
+     * @return Number of bytes processed, which is always equal to `size`, or an error code defined
+     *         by `system_error_t`.
+     */
+    int process(const char* data, size_t size) {
+        const auto end = data + size;
+        while (data < end) {
+            size_t n = end - data;
+            switch (state_) {
+            case State::RECORD_HEADER: {
+                n = std::min(n, RECORD_HEADER_SIZE - recHeaderSize_);
+                memcpy(recHeader_ + recHeaderSize_, data, n);
+                recHeaderSize_ += n;
+                if (recHeaderSize_ == RECORD_HEADER_SIZE) {
+                    CHECK(parseRecordHeader());
+                }
+                break;
+            }
+            case State::DIFF: {
+                n = std::min({ n, (size_t)diffLeft_, BLOCK_SIZE - bufSize_ });
+                uint8_t base[BLOCK_SIZE];
+                CHECK(detail::readDeltaFlash(baseDev_, baseAddr_ + basePos_, base, n));
+                for (size_t i = 0; i < n; ++i) {
+                    buf_[bufSize_ + i] = base[i] + (uint8_t)data[i];
+                }
+                basePos_ += n;
+                diffLeft_ -= n;
+                CHECK(appended(n));
+                break;
+            }
+            case State::EXTRA: {
+                n = std::min({ n, (size_t)extraLeft_, BLOCK_SIZE - bufSize_ });
+                memcpy(buf_ + bufSize_, data, n);
+                extraLeft_ -= n;
+                CHECK(appended(n));
+                break;
+            }
+            }
+            data += n;
+            if (state_ != State::RECORD_HEADER && !diffLeft_ && !extraLeft_) {
+                endRecord();
+            } else if (state_ == State::DIFF && !diffLeft_) {
+                state_ = State::EXTRA;
+            }
+        }
+        return size;
+    }
+
+    /**
+     * Completes the reconstruction of the module.
+     *
+     * @return 0 on success, otherwise an error code defined by `system_error_t`.
+     */
+    int finish() {
+        CHECK(flush());
+        if (state_ != State::RECORD_HEADER || recHeaderSize_ > 0 || written_ != header_.original_size) {
+            LOG(ERROR, "Incomplete patch data");
+            return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+        }
+        char hash[HashT::HASH_SIZE] = {};
+        CHECK(sha_.finish(hash));
+        if (memcmp(hash, header_.sha, sizeof(hash)) != 0) {
+            LOG(ERROR, "Hash of the reconstructed module doesn't match");
+            return SYSTEM_ERROR_OTA_INTEGRITY_CHECK_FAILED;
+        }
+        return 0;
+    }
+
+private:
+    enum class State {
+        RECORD_HEADER,
+        DIFF,
+        EXTRA
+    };
+
+    delta_module_header header_;
+    HashT sha_;
+    char recHeader_[RECORD_HEADER_SIZE];
+    uint8_t buf_[BLOCK_SIZE];
+    uintptr_t baseAddr_;
+    uintptr_t destAddr_;
+    int64_t basePos_;
+    uint32_t diffLeft_;
+    uint32_t extraLeft_;
+    int32_t seek_;
+    size_t recHeaderSize_;
+    size_t bufSize_;
+    size_t outSize_; // Total size of the produced data
+    size_t written_; // Size of the data written to flash
+    flash_device_t baseDev_;
+    flash_device_t destDev_;
+    State state_;
+
+    int parseRecordHeader() {
+        uint32_t v[3] = {};
+        memcpy(v, recHeader_, sizeof(v));
+        recHeaderSize_ = 0;
+        diffLeft_ = littleEndianToNative(v[0]);
+        extraLeft_ = littleEndianToNative(v[1]);
+        seek_ = (int32_t)littleEndianToNative(v[2]);
+        if ((uint64_t)outSize_ + diffLeft_ + extraLeft_ > header_.original_size) {
+            LOG(ERROR, "Reconstructed module is too large");
+            return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+        }
+        if (diffLeft_ > 0 && (basePos_ < 0 || basePos_ + diffLeft_ > header_.base_size)) {
+            LOG(ERROR, "Invalid base module offset");
+            return SYSTEM_ERROR_OTA_INVALID_FORMAT;
+        }
+        if (diffLeft_ > 0) {
+            state_ = State::DIFF;
+        } else if (extraLeft_ > 0) {
+            state_ = State::EXTRA;
+        } else {
+            endRecord();
+        }
+        return 0;
+    }
+
+    void endRecord() {
+        basePos_ += seek_;
+        state_ = State::RECORD_HEADER;
+    }
+
+    int appended(size_t size) {
+        bufSize_ += size;
+        outSize_ += size;
+        if (bufSize_ == BLOCK_SIZE) {
+            CHECK(flush());
+        }
+        return 0;
+    }
+
+    int flush() {
+        if (bufSize_ > 0) {
+            CHECK(sha_.update((const char*)buf_, bufSize_));
+            CHECK(detail::writeDeltaFlash(destDev_, destAddr_ + written_, buf_, bufSize_));
+            written_ += bufSize_;
+            bufSize_ = 0;
+        }
+        return 0;
+    }
+};
+
+template<typename HashT>
+const size_t DeltaPatcher<HashT>::BLOCK_SIZE;
+
+template<typename HashT>
+const size_t DeltaPatcher<HashT>::RECORD_HEADER_SIZE;
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_DELTA_OTA
@@ -48,6 +48,7 @@ LOG_SOURCE_CATEGORY("hal.ota")
 #include "deviceid_hal.h"
 #include <memory>
 #include "platform_radio_stack.h"
+#include "ota_delta.h"
 #include "check.h"
 
 #define OTA_CHUNK_SIZE                 (512)
@@ -499,8 +500,9 @@ int validateModules(const hal_module_t* modules, size_t moduleCount) {
         }
         const bool dropModuleInfo = (info->flags & MODULE_INFO_FLAG_DROP_MODULE_INFO);
         const bool compressed = (info->flags & MODULE_INFO_FLAG_COMPRESSED);
-        if (module->module_info_offset > 0 && (dropModuleInfo || compressed)) {
-            // Module with the DROP_MODULE_INFO or COMPRESSED flag set can't have a vector table
+        const bool delta = (info->flags & MODULE_INFO_FLAG_DELTA);
+        if (module->module_info_offset > 0 && (dropModuleInfo || compressed || delta)) {
+            // Module with the DROP_MODULE_INFO, COMPRESSED or DELTA flag set can't have a vector table
             SYSTEM_ERROR_MESSAGE("Invalid module format");
             return SYSTEM_ERROR_OTA_INVALID_FORMAT;
         }
@@ -509,6 +511,18 @@ int validateModules(const hal_module_t* modules, size_t moduleCount) {
             SYSTEM_ERROR_MESSAGE("Unsupported compressed module"); // TODO
             return SYSTEM_ERROR_OTA_UNSUPPORTED_MODULE;
         }
+        if (delta) {
+#if HAL_PLATFORM_DELTA_OTA
+            if ((moduleFunc != MODULE_FUNCTION_USER_PART && moduleFunc != MODULE_FUNCTION_SYSTEM_PART) ||
+                    (info->flags & (MODULE_INFO_FLAG_COMPRESSED | MODULE_INFO_FLAG_DROP_MODULE_INFO))) {
+                SYSTEM_ERROR_MESSAGE("Unsupported delta module");
+                return SYSTEM_ERROR_OTA_UNSUPPORTED_MODULE;
+            }
+#else
+            SYSTEM_ERROR_MESSAGE("Delta updates are not supported on this platform");
+            return SYSTEM_ERROR_OTA_UNSUPPORTED_MODULE;
+#endif // !HAL_PLATFORM_DELTA_OTA
+        }
         if (moduleFunc == MODULE_FUNCTION_NCP_FIRMWARE) {
 #if HAL_PLATFORM_NCP_UPDATABLE
             const auto moduleNcp = module_mcu_target(info);
@@ -546,6 +560,16 @@ int validateModules(const hal_module_t* modules, size_t moduleCount) {
 // TODO: Anything above 2 will almost certainly fail the dependency check
 const size_t MAX_COMBINED_MODULE_COUNT = 2;
 
+#if HAL_PLATFORM_DELTA_OTA
+
+const size_t OTA_FLASH_SECTOR_SIZE = 4096;
+
+inline uintptr_t alignToFlashSector(uintptr_t addr) {
+    return (addr + OTA_FLASH_SECTOR_SIZE - 1) / OTA_FLASH_SECTOR_SIZE * OTA_FLASH_SECTOR_SIZE;
+}
+
+#endif // HAL_PLATFORM_DELTA_OTA
+
 } // namespace
 
 int HAL_FLASH_OTA_Validate(bool userDepsOptional, module_validation_flags_t flags, void* reserved)
@@ -576,9 +600,30 @@ int HAL_FLASH_End(void* reserved)
         moduleCount = MAX_COMBINED_MODULE_COUNT;
     }
     CHECK(validateModules(modules, moduleCount));
+#if HAL_PLATFORM_DELTA_OTA
+    // Modules reconstructed from delta modules are stored in the OTA region after the received data
+    const auto& lastModule = modules[moduleCount - 1];
+    uintptr_t patchAddr = lastModule.bounds.start_address + module_length(&lastModule.info) + 4 /* CRC-32 */;
+    patchAddr = alignToFlashSector(patchAddr);
+#endif // HAL_PLATFORM_DELTA_OTA
     bool restartPending = false;
     for (size_t i = 0; i < moduleCount; ++i) {
-        const auto module = &modules[i];
+        auto module = &modules[i];
+#if HAL_PLATFORM_DELTA_OTA
+        hal_module_t patched = {};
+        if (module->info.flags & MODULE_INFO_FLAG_DELTA) {
+            const uintptr_t otaEndAddr = module_ota.start_address + module_ota.maximum_size;
+            if (patchAddr >= otaEndAddr) {
+                SYSTEM_ERROR_MESSAGE("No space for reconstructed module");
+                return SYSTEM_ERROR_OTA_INVALID_SIZE;
+            }
+            CHECK(apply_delta_module(module, patchAddr, otaEndAddr - patchAddr, &patched));
+            CHECK(validateModules(&patched, 1));
+            module = &patched;
+            patchAddr += module_length(&patched.info) + 4 /* CRC-32 */;
+            patchAddr = alignToFlashSector(patchAddr);
+        }
+#endif // HAL_PLATFORM_DELTA_OTA
         module_info_t& info = module->info;
         const auto moduleFunc = module_function(&info);
         const auto moduleSize = module_length(&info);
@@ -33,7 +33,11 @@ CPPSRC += $(call target_files,$(HAL_MODULE_PATH)/shared/,*.cpp)
 
 CPPSRC += $(call target_files,$(HAL_MODULE_PATH)/network/util/,*.cpp)
 
+ifeq ("$(USE_TLSF_HEAP)","y")
+CPPSRC += $(TARGET_HAL_PATH)/src/portable/FreeRTOS/heap_tlsf.cpp
+else
 CSRC += $(TARGET_HAL_PATH)/src/portable/FreeRTOS/heap_4_lock.c
+endif
 
 # ASM source files included in this build.
 ASRC +=
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Drop-in replacement for heap_4_lock.c based on the TLSF heap. Enabled with USE_TLSF_HEAP=y.
+ */
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "tlsf_heap.h"
+#include "service_debug.h"
+
+#undef configASSERT
+#define configASSERT(x) SPARK_ASSERT(x)
+
+// Heap options. Can be overridden to enable the guard words in a release build
+#ifndef TLSF_HEAP_FLAGS
+#ifdef DEBUG_BUILD
+#define TLSF_HEAP_FLAGS (particle::TlsfHeap::GUARD | particle::TlsfHeap::FILL_FREED)
+#else
+#define TLSF_HEAP_FLAGS (0)
+#endif
+#endif // !defined(TLSF_HEAP_FLAGS)
+
+extern "C" {
+
+extern char link_heap_location, link_heap_location_end;
+
+void __malloc_lock(struct _reent *ptr);
+void __malloc_unlock(struct _reent *ptr);
+
+void malloc_enable(uint8_t val);
+void malloc_set_heap_start(void* addr);
+void malloc_set_heap_end(void* addr);
+void* malloc_heap_start();
+void* malloc_heap_end();
+size_t pvPortLargestFreeBlock();
+void* pvPortMalloc(size_t xWantedSize);
+void* pvPortRealloc(void* pv, size_t xWantedSize);
+void vPortFree(void* pv);
+size_t xPortGetFreeHeapSize();
+size_t xPortGetMinimumEverFreeHeapSize();
+void vPortInitialiseBlocks();
+size_t xPortGetHeapSize();
+size_t xPortGetBlockSize(void* ptr);
+
+#if configUSE_MALLOC_FAILED_HOOK == 1
+void vApplicationMallocFailedHook(size_t xWantedSize);
+#endif
+
+} // extern "C"
+
+namespace {
+
+using particle::TlsfHeap;
+
+void* g_heapStart = &link_heap_location;
+void* g_heapEnd = &link_heap_location_end;
+
+#ifdef MODULAR_FIRMWARE
+uint8_t g_mallocEnabled = 0;
+#else
+uint8_t g_mallocEnabled = 1;
+#endif
+
+// Constant-initialized, so that it can be used before the global constructors are called
+TlsfHeap g_heap;
+
+class HeapLock {
+public:
+    HeapLock() {
+        __malloc_lock(nullptr);
+    }
+
+    ~HeapLock() {
+        __malloc_unlock(nullptr);
+    }
+};
+
+// Initializes the heap on first use. The heap boundaries can't change afterwards
+TlsfHeap* heap() {
+    if (!g_heap.isInitialized()) {
+        const int r = g_heap.init(g_heapStart, (uintptr_t)g_heapEnd - (uintptr_t)g_heapStart, TLSF_HEAP_FLAGS);
+        configASSERT(r == 0);
+        (void)r;
+    }
+    return &g_heap;
+}
+
+void checkBlock(void* ptr) {
+    configASSERT(ptr > g_heapStart && ptr < g_heapEnd);
+    if (!g_heap.check(ptr)) {
+        PANIC(HeapError, "Heap corruption detected");
+    }
+}
+
+void mallocFailed(size_t size) {
+#if configUSE_MALLOC_FAILED_HOOK == 1
+    vApplicationMallocFailedHook(size);
+#else
+    (void)size;
+#endif
+}
+
+} // namespace
+
+void malloc_enable(uint8_t val) {
+    g_mallocEnabled = val;
+}
+
+void malloc_set_heap_start(void* addr) {
+    g_heapStart = addr;
+}
+
+void malloc_set_heap_end(void* addr) {
+    g_heapEnd = addr;
+}
+
+void* malloc_heap_start() {
+    return g_heapStart;
+}
+
+void* malloc_heap_end() {
+    return g_heapEnd;
+}
+
+size_t pvPortLargestFreeBlock() {
+    if (!g_mallocEnabled) {
+        return 0;
+    }
+    HeapLock lock;
+    TlsfHeap::Stats stats = {};
+    heap()->stats(&stats);
+    return stats.largestFreeBlockSize;
+}
+
+void* pvPortMalloc(size_t xWantedSize) {
+    if (!g_mallocEnabled) {
+        return nullptr;
+    }
+    void* ptr = nullptr;
+    {
+        HeapLock lock;
+        ptr = heap()->alloc(xWantedSize);
+        traceMALLOC(ptr, xWantedSize);
+    }
+    if (!ptr && xWantedSize > 0) {
+        mallocFailed(xWantedSize);
+    }
+    return ptr;
+}
+
+void* pvPortRealloc(void* pv, size_t xWantedSize) {
+    if (!g_mallocEnabled) {
+        return nullptr;
+    }
+    void* ptr = nullptr;
+    {
+        HeapLock lock;
+        if (pv) {
+            checkBlock(pv);
+        }
+        ptr = heap()->realloc(pv, xWantedSize);
+    }
+    if (!ptr && xWantedSize > 0) {
+        mallocFailed(xWantedSize);
+    }
+    return ptr;
+}
+
+void vPortFree(void* pv) {
+    if (!pv) {
+        return;
+    }
+    HeapLock lock;
+    checkBlock(pv);
+    traceFREE(pv, g_heap.blockSize(pv));
+    g_heap.free(pv);
+}
+
+size_t xPortGetFreeHeapSize() {
+    HeapLock lock;
+    TlsfHeap::Stats stats = {};
+    heap()->stats(&stats);
+    return stats.freeSize;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize() {
+    HeapLock lock;
+    TlsfHeap::Stats stats = {};
+    heap()->stats(&stats);
+    return stats.totalSize - stats.peakUsedSize;
+}
+
+void vPortInitialiseBlocks() {
+    // This just exists to keep the linker quiet
+}
+
+size_t xPortGetHeapSize() {
+    configASSERT(g_heapEnd > g_heapStart);
+    return (uintptr_t)g_heapEnd - (uintptr_t)g_heapStart;
+}
+
+size_t xPortGetBlockSize(void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    configASSERT(ptr > g_heapStart && ptr < g_heapEnd);
+    return g_heap.blockSize(ptr);
+}
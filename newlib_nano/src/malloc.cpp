@@ -5,12 +5,15 @@
 #include <reent.h>
 #include <malloc.h>
 
+#include "hal_platform.h"
 #include "interrupts_hal.h"
 #include "service_debug.h"
+#include "alloc_trace.h"
 
 extern "C" {
 
 void *pvPortMalloc( size_t xWantedSize );
+void *pvPortRealloc( void *pv, size_t xWantedSize );
 void vPortFree( void *pv );
 size_t xPortGetFreeHeapSize( void );
 size_t xPortGetMinimumEverFreeHeapSize( void );
@@ -28,10 +31,35 @@ static void panic_if_in_isr() {
     }
 }
 
+static void* heap_realloc(void* ptr, size_t newsize) {
+#if HAL_PLATFORM_TLSF_HEAP
+    // The TLSF heap can resize the block in place
+    return pvPortRealloc(ptr, newsize);
+#else
+    if (newsize == 0) {
+        vPortFree(ptr);
+        return NULL;
+    }
+
+    void *p = pvPortMalloc(newsize);
+    if (p) {
+        if (ptr != NULL) {
+            memcpy(p, ptr, newsize);
+            vPortFree(ptr);
+        }
+    }
+    return p;
+#endif // !HAL_PLATFORM_TLSF_HEAP
+}
+
 void* _malloc_r(struct _reent *r, size_t s) {
     (void)r;
     panic_if_in_isr();
+#if ALLOC_TRACE_ENABLED
+    void* ptr = particle::tracedMalloc((size_t)s, pvPortMalloc);
+#else
     void* ptr = pvPortMalloc((size_t)s);
+#endif
     return ptr;
 }
 
@@ -44,7 +72,11 @@ void _free_r(struct _reent* r, void* ptr) {
         ptr = NULL;
     }
 #endif
+#if ALLOC_TRACE_ENABLED
+    particle::tracedFree(ptr, vPortFree);
+#else
     vPortFree(ptr);
+#endif
 }
 
 void _cfree_r(struct _reent* r, void* ptr) {
@@ -64,19 +96,11 @@ void* _realloc_r(struct _reent* r, void *ptr, size_t newsize) {
 
     panic_if_in_isr();
 
-    if (newsize == 0) {
-        vPortFree(ptr);
-        return NULL;
-    }
-
-    void *p = pvPortMalloc(newsize);
-    if (p) {
-        if (ptr != NULL) {
-            memcpy(p, ptr, newsize);
-            vPortFree(ptr);
-        }
-    }
-    return p;
+#if ALLOC_TRACE_ENABLED
+    return particle::tracedRealloc(ptr, newsize, heap_realloc, vPortFree);
+#else
+    return heap_realloc(ptr, newsize);
+#endif
 }
 
 static struct mallinfo current_mallinfo = {};
@@ -103,5 +127,9 @@ size_t _malloc_usable_size_r(struct _reent* r, void* ptr) {
 
     panic_if_in_isr();
 
+#if ALLOC_TRACE_ENABLED
+    return particle::tracedUsableSize(ptr, xPortGetBlockSize);
+#else
     return xPortGetBlockSize(ptr);
+#endif
 }
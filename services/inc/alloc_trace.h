@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Allocation tracing.
+ *
+ * When the firmware is built with `USE_ALLOC_TRACE=y`, the malloc wrappers prepend a small header
+ * to each heap block and account the block to the subsystem that allocated it. The subsystem is
+ * determined by the tag assigned to the current thread, see `alloc_trace_set_tag()`. Allocations
+ * made by threads without a tag are accounted to the system.
+ *
+ * The deallocation functions rely on the header being present, so all blocks on the heap need to
+ * be allocated through the tracer. On the virtual device, the C library's allocation functions are
+ * replaced rather than wrapped for this reason, as the functions that allocate memory internally,
+ * such as `strdup()`, don't call the wrapped functions.
+ */
+#ifndef ALLOC_TRACE_ENABLED
+#define ALLOC_TRACE_ENABLED (0)
+#endif
+
+/**
+ * Subsystem tags.
+ */
+typedef enum alloc_trace_tag {
+    ALLOC_TRACE_TAG_SYSTEM = 0, ///< System.
+    ALLOC_TRACE_TAG_COMMUNICATION = 1, ///< Cloud protocol.
+    ALLOC_TRACE_TAG_USER = 2, ///< Application and Wiring API.
+    ALLOC_TRACE_TAG_LWIP = 3, ///< LwIP.
+    ALLOC_TRACE_TAG_COUNT = 4 ///< Number of tags.
+} alloc_trace_tag;
+
+/**
+ * Per-tag allocation statistics.
+ */
+typedef struct alloc_trace_stats {
+    uint32_t live_size; ///< Size of the allocated blocks, not counting the trace headers.
+    uint32_t peak_size; ///< Maximum size of the allocated blocks since the statistics were reset.
+    uint32_t alloc_count; ///< Number of allocations, including reallocations.
+    uint32_t free_count; ///< Number of deallocations, including reallocations.
+    uint32_t failed_count; ///< Number of failed allocations.
+} alloc_trace_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Set the tag for the allocations made by the current thread.
+ *
+ * Setting `ALLOC_TRACE_TAG_SYSTEM` releases the resources allocated for the thread.
+ *
+ * @param tag Tag (a value defined by the `alloc_trace_tag` enum).
+ * @return Previous tag of the current thread, or a negative result code defined by `system_error_t`.
+ */
+int alloc_trace_set_tag(int tag);
+
+/**
+ * Get the tag of the current thread.
+ */
+int alloc_trace_get_tag(void);
+
+/**
+ * Release the tag of a thread that is being terminated.
+ *
+ * This function is called by the concurrent HAL, so that a new thread that gets the same handle
+ * doesn't inherit the tag.
+ *
+ * @param thread Thread handle.
+ */
+void alloc_trace_release_thread(void* thread);
+
+/**
+ * Account an allocation.
+ *
+ * This function is called by the malloc wrappers.
+ */
+void alloc_trace_record_alloc(int tag, size_t size);
+
+/**
+ * Account a deallocation.
+ *
+ * This function is called by the malloc wrappers.
+ */
+void alloc_trace_record_free(int tag, size_t size);
+
+/**
+ * Account a failed allocation.
+ *
+ * This function is called by the malloc wrappers.
+ */
+void alloc_trace_record_failure(int tag);
+
+/**
+ * Get the allocation statistics.
+ *
+ * @param tag Tag.
+ * @param stats Statistics.
+ * @param period Number of milliseconds since the statistics were reset (optional). Can be used to
+ *        calculate the allocation rate.
+ * @return 0 on success, otherwise a negative result code defined by `system_error_t`.
+ */
+int alloc_trace_get_stats(int tag, alloc_trace_stats* stats, uint32_t* period);
+
+/**
+ * Reset the peak sizes and counters of all tags.
+ */
+void alloc_trace_reset_stats(void);
+
+/**
+ * Get the name of a tag.
+ */
+const char* alloc_trace_tag_name(int tag);
+
+/**
+ * Log the allocation statistics.
+ */
+void alloc_trace_dump(void);
+
+#ifdef __cplusplus
+} // extern "C"
+
+#include <cstddef>
+
+namespace particle {
+
+/**
+ * Sets the allocation tag of the current thread for the lifetime of the object.
+ */
+class AllocTraceScope {
+public:
+#if ALLOC_TRACE_ENABLED
+    explicit AllocTraceScope(int tag) :
+            prevTag_(alloc_trace_set_tag(tag)) {
+    }
+
+    ~AllocTraceScope() {
+        if (prevTag_ >= 0) {
+            alloc_trace_set_tag(prevTag_);
+        }
+    }
+
+private:
+    int prevTag_;
+#else
+    explicit AllocTraceScope(int /* tag */) {
+    }
+#endif // !ALLOC_TRACE_ENABLED
+};
+
+namespace detail {
+
+struct AllocTraceHeader {
+    uint32_t size;
+    uint32_t tag;
+};
+
+// Keeps the blocks suitably aligned
+const size_t ALLOC_TRACE_HEADER_SIZE = alignof(std::max_align_t);
+
+static_assert(ALLOC_TRACE_HEADER_SIZE >= sizeof(AllocTraceHeader), "Invalid size of the trace header");
+
+inline AllocTraceHeader* allocTraceHeader(void* ptr) {
+    return (AllocTraceHeader*)((uint8_t*)ptr - ALLOC_TRACE_HEADER_SIZE);
+}
+
+} // namespace detail
+
+/**
+ * Allocates a block with a trace header.
+ *
+ * @param size Block size.
+ * @param mallocFn Underlying `malloc()` function.
+ */
+template<typename MallocFn>
+inline void* tracedMalloc(size_t size, MallocFn mallocFn) {
+    using namespace detail;
+    const int tag = alloc_trace_get_tag();
+    const auto h = (size <= UINT32_MAX - ALLOC_TRACE_HEADER_SIZE) ?
+            (AllocTraceHeader*)mallocFn(size + ALLOC_TRACE_HEADER_SIZE) : nullptr;
+    if (!h) {
+        alloc_trace_record_failure(tag);
+        return nullptr;
+    }
+    h->size = size;
+    h->tag = tag;
+    alloc_trace_record_alloc(tag, size);
+    return (uint8_t*)h + ALLOC_TRACE_HEADER_SIZE;
+}
+
+/**
+ * Frees a block allocated with `tracedMalloc()`.
+ *
+ * @param ptr Block.
+ * @param freeFn Underlying `free()` function.
+ */
+template<typename FreeFn>
+inline void tracedFree(void* ptr, FreeFn freeFn) {
+    using namespace detail;
+    if (!ptr) {
+        return;
+    }
+    const auto h = allocTraceHeader(ptr);
+    alloc_trace_record_free(h->tag, h->size);
+    freeFn(h);
+}
+
+/**
+ * Resizes a block allocated with `tracedMalloc()`.
+ *
+ * The block remains accounted to the subsystem that allocated it.
+ *
+ * @param ptr Block.
+ * @param size New block size.
+ * @param reallocFn Underlying `realloc()` function.
+ * @param freeFn Underlying `free()` function.
+ */
+template<typename ReallocFn, typename FreeFn>
+inline void* tracedRealloc(void* ptr, size_t size, ReallocFn reallocFn, FreeFn freeFn) {
+    using namespace detail;
+    if (!ptr) {
+        return tracedMalloc(size, [reallocFn](size_t size) {
+            return reallocFn(nullptr, size);
+        });
+    }
+    auto h = allocTraceHeader(ptr);
+    if (!size) {
+        tracedFree(ptr, freeFn);
+        return nullptr;
+    }
+    const int tag = h->tag;
+    const size_t oldSize = h->size;
+    h = (size <= UINT32_MAX - ALLOC_TRACE_HEADER_SIZE) ?
+            (AllocTraceHeader*)reallocFn(h, size + ALLOC_TRACE_HEADER_SIZE) : nullptr;
+    if (!h) {
+        alloc_trace_record_failure(tag);
+        return nullptr;
+    }
+    h->size = size;
+    alloc_trace_record_free(tag, oldSize);
+    alloc_trace_record_alloc(tag, size);
+    return (uint8_t*)h + ALLOC_TRACE_HEADER_SIZE;
+}
+
+/**
+ * Returns the usable size of a block allocated with `tracedMalloc()`.
+ *
+ * @param ptr Block.
+ * @param usableSizeFn Underlying `malloc_usable_size()` function.
+ */
+template<typename UsableSizeFn>
+inline size_t tracedUsableSize(void* ptr, UsableSizeFn usableSizeFn) {
+    using namespace detail;
+    if (!ptr) {
+        return 0;
+    }
+    return usableSizeFn(allocTraceHeader(ptr)) - ALLOC_TRACE_HEADER_SIZE;
+}
+
+} // namespace particle
+
+#endif // defined(__cplusplus)
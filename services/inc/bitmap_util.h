@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * Bitmap word type.
+ *
+ * Bit `n` of a bitmap is stored in bit `n % 32` of word `n / 32`.
+ */
+typedef uint32_t BitmapWord;
+
+const size_t BITMAP_WORD_BITS = sizeof(BitmapWord) * 8;
+
+/**
+ * Returns the number of words needed to store a bitmap of the specified size.
+ */
+inline size_t bitmapWordCount(size_t bits) {
+    return (bits + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+}
+
+inline void setBit(BitmapWord* bitmap, size_t pos) {
+    bitmap[pos / BITMAP_WORD_BITS] |= (BitmapWord)1 << (pos % BITMAP_WORD_BITS);
+}
+
+inline void clearBit(BitmapWord* bitmap, size_t pos) {
+    bitmap[pos / BITMAP_WORD_BITS] &= ~((BitmapWord)1 << (pos % BITMAP_WORD_BITS));
+}
+
+inline bool testBit(const BitmapWord* bitmap, size_t pos) {
+    return bitmap[pos / BITMAP_WORD_BITS] & ((BitmapWord)1 << (pos % BITMAP_WORD_BITS));
+}
+
+/**
+ * Finds the first bit with the specified value.
+ *
+ * The bitmap is scanned a word at a time, so the cost is proportional to the distance to the bit
+ * found rather than to the number of bits checked.
+ *
+ * @param bitmap Bitmap.
+ * @param bits Size of the bitmap in bits.
+ * @param pos Index of the bit to start from.
+ * @param value Bit value.
+ * @return Index of the bit found, or `bits` if there's no such bit.
+ */
+inline size_t findBit(const BitmapWord* bitmap, size_t bits, size_t pos, bool value) {
+    while (pos < bits) {
+        BitmapWord w = bitmap[pos / BITMAP_WORD_BITS];
+        if (!value) {
+            w = ~w;
+        }
+        w &= ~(BitmapWord)0 << (pos % BITMAP_WORD_BITS);
+        if (w) {
+            pos = pos / BITMAP_WORD_BITS * BITMAP_WORD_BITS + __builtin_ctz(w);
+            break;
+        }
+        pos = (pos / BITMAP_WORD_BITS + 1) * BITMAP_WORD_BITS;
+    }
+    return (pos < bits) ? pos : bits;
+}
+
+} // namespace particle
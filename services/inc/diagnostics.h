@@ -57,9 +57,14 @@
 #define DIAG_NAME_CLOUD_UNACKNOWLEDGED_MESSAGES "coap:unack"
 #define DIAG_NAME_CLOUD_TRANSMITTED_MESSAGES "coap:transmit"
 #define DIAG_NAME_CLOUD_COAP_ROUND_TRIP "coap:roundtrip"
+#define DIAG_NAME_CLOUD_COAP_POOL_HITS "coap:poolhit"
+#define DIAG_NAME_CLOUD_COAP_POOL_MISSES "coap:poolmiss"
 #define DIAG_NAME_CLOUD_RATE_LIMITED_EVENTS "pub:limit"
 #define DIAG_NAME_SYSTEM_TOTAL_RAM "sys:tram"
 #define DIAG_NAME_SYSTEM_USED_RAM "sys:uram"
+#define DIAG_NAME_SYSTEM_LARGEST_FREE_BLOCK "sys:lfree"
+#define DIAG_NAME_SYSTEM_HEAP_FRAGMENTATION "sys:hfrag"
+#define DIAG_NAME_SYSTEM_LOG_DROPPED_MESSAGES "log:drop"
 
 #ifdef __cplusplus
 extern "C" {
@@ -107,6 +112,11 @@ typedef enum diag_id {
     DIAG_ID_SYSTEM_TOTAL_RAM = 25, // sys:tram
     DIAG_ID_SYSTEM_USED_RAM = 26, // sys:uram
     DIAG_ID_CLOUD_COAP_ROUND_TRIP = 31, // coap:roundtrip
+    DIAG_ID_SYSTEM_LOG_DROPPED_MESSAGES = 44, // log:drop
+    DIAG_ID_CLOUD_COAP_POOL_HITS = 45, // coap:poolhit
+    DIAG_ID_CLOUD_COAP_POOL_MISSES = 46, // coap:poolmiss
+    DIAG_ID_SYSTEM_LARGEST_FREE_BLOCK = 47, // sys:lfree
+    DIAG_ID_SYSTEM_HEAP_FRAGMENTATION = 48, // sys:hfrag
     DIAG_ID_USER = 32768 // Base value for application-specific source IDs
 } diag_id;
 
@@ -116,6 +116,27 @@
     This parameter affects log_message() and some other functions along with their wrapper macros.
 
     LOG_DISABLE - disables logging entirely, turning all logging macros into no-op.
+
+    LOG_DEFERRED_MAX_RECORD_SIZE - specifies maximum size of a binary record generated in the
+    deferred logging mode (see log_set_deferred_buffer()).
+
+    Deferred logging mode allows to move the cost of formatting out of the code generating log
+    messages. In this mode, log_message() stores the format string, attributes and raw
+    arguments of a message in a ring buffer, and formatting is performed by log_process_deferred().
+    On platforms with threading support, log_set_deferred_buffer() starts a low priority thread
+    that calls log_process_deferred() periodically; on other platforms, the application needs to
+    call it. The format string and string arguments are copied to the buffer, so they don't need
+    to outlive the logging call. Category names are stored by pointer. Messages with a format
+    string that doesn't fit in a record are formatted immediately:
+
+        static char logBuf[2048];
+        log_set_deferred_buffer(logBuf, sizeof(logBuf), NULL);
+        ...
+        // Only needed on platforms without threading support
+        for (;;) {
+            log_process_deferred(0, NULL);
+            delay(10);
+        }
 */
 
 #include <string.h>
@@ -222,6 +243,15 @@ const char* log_level_name(int level, void *reserved);
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
         log_enabled_callback_type log_enabled, void *reserved);
 
+// Enables deferred logging mode using the provided buffer for pending messages and, on platforms
+// with threading support, starts the thread processing them. Passing a null buffer processes all
+// pending messages and disables the deferred mode
+int log_set_deferred_buffer(void *buffer, size_t size, void *reserved);
+
+// Formats and dispatches up to `max_count` pending deferred messages (0 - all pending messages).
+// Returns the number of processed messages
+int log_process_deferred(size_t max_count, void *reserved);
+
 extern void HAL_Delay_Microseconds(uint32_t delay);
 
 #ifdef __cplusplus
@@ -236,6 +266,10 @@ extern void HAL_Delay_Microseconds(uint32_t delay);
 #define LOG_MAX_STRING_LENGTH 160
 #endif
 
+#ifndef LOG_DEFERRED_MAX_RECORD_SIZE
+#define LOG_DEFERRED_MAX_RECORD_SIZE (LOG_MAX_STRING_LENGTH + 64)
+#endif
+
 #ifndef LOG_INCLUDE_SOURCE_INFO
 #define LOG_INCLUDE_SOURCE_INFO 0
 #endif
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "simple_file_storage.h"
+
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * A durable FIFO queue of variable-size records stored in the filesystem.
+ *
+ * Records are appended to a sequence of segment files named `<prefix>.<n>`. A segment is only
+ * appended to and is removed as a whole once all of its records have been consumed, so consuming
+ * records doesn't rewrite the remaining ones. The numbers of the first and last segments are kept
+ * in `<prefix>.idx`, which is only updated when a segment is started or removed.
+ *
+ * The last segment is kept open between calls to `push()`, and appended records are committed
+ * to the filesystem once `syncSize` bytes are pending, when the segment is full, before records
+ * are read from it, or when `sync()` is called. Records that haven't been committed yet are lost
+ * if the device resets. A commit copies the partially written last block of the segment and
+ * rewrites the directory's metadata, which erases up to two blocks. With segments of one
+ * filesystem block, filling a segment therefore erases at most `2 * (segmentSize / syncSize + 2)`
+ * blocks regardless of the size of the records, plus two blocks for every commit requested by
+ * a reader or a `sync()` call.
+ *
+ * Each record is prefixed with its size and a CRC-32 of its data. Torn or corrupted records at
+ * the end of the last segment are discarded when the queue is initialized.
+ *
+ * The read position in the first segment is not persisted, so records that were consumed from
+ * a partially consumed segment will be read again after a reset. The segment is discarded
+ * as soon as the queue becomes empty.
+ *
+ * This class is not thread-safe.
+ */
+class PersistentQueue {
+public:
+    static const size_t DEFAULT_SEGMENT_SIZE = FILESYSTEM_BLOCK_SIZE;
+    static const size_t DEFAULT_SYNC_SIZE = 512;
+    static const unsigned DEFAULT_MAX_SEGMENTS = 8;
+    static const size_t RECORD_HEADER_SIZE = 6;
+    static const size_t MAX_PREFIX_LENGTH = 32;
+
+    /**
+     * Constructor.
+     *
+     * @param prefix Path prefix of the queue files. The string is not copied and should not be
+     *        longer than `MAX_PREFIX_LENGTH` characters.
+     * @param segmentSize Maximum size of a segment file.
+     * @param maxSegments Maximum number of segment files.
+     * @param syncSize Number of appended bytes after which the records are committed to the
+     *        filesystem.
+     */
+    explicit PersistentQueue(const char* prefix, size_t segmentSize = DEFAULT_SEGMENT_SIZE,
+            unsigned maxSegments = DEFAULT_MAX_SEGMENTS, size_t syncSize = DEFAULT_SYNC_SIZE);
+
+    /**
+     * Destructor.
+     *
+     * Commits the pending records to the filesystem.
+     */
+    ~PersistentQueue();
+
+    /**
+     * Loads the state of the queue from the filesystem.
+     *
+     * This method is called implicitly by other methods if necessary.
+     *
+     * @return 0 on success, otherwise an error code defined by `system_error_t`.
+     */
+    int init();
+
+    /**
+     * Appends a record to the queue.
+     *
+     * @return 0 on success, `SYSTEM_ERROR_LIMIT_EXCEEDED` if the queue is full, or another error
+     *         code defined by `system_error_t`.
+     */
+    int push(const void* data, size_t size);
+
+    /**
+     * Commits the pending records to the filesystem.
+     *
+     * @return 0 on success, otherwise an error code defined by `system_error_t`.
+     */
+    int sync();
+
+    /**
+     * Reads the oldest record without removing it from the queue.
+     *
+     * @param data Destination buffer.
+     * @param size Buffer size. The buffer needs to be large enough to hold the entire record.
+     * @return Record size, `SYSTEM_ERROR_NOT_FOUND` if the queue is empty, or another error code
+     *         defined by `system_error_t`.
+     */
+    int peek(void* data, size_t size);
+
+    /**
+     * Removes the oldest record from the queue.
+     *
+     * @return 0 on success, `SYSTEM_ERROR_NOT_FOUND` if the queue is empty, or another error code
+     *         defined by `system_error_t`.
+     */
+    int pop();
+
+    /**
+     * Removes all records from the queue.
+     */
+    void clear();
+
+    /**
+     * Returns `true` if the queue is empty. The queue needs to be initialized.
+     */
+    bool empty() const;
+
+    size_t maxRecordSize() const;
+
+private:
+    struct Index {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    struct RecordHeader {
+        size_t size;
+        uint32_t crc;
+    };
+
+    class File;
+
+    char indexPath_[MAX_PREFIX_LENGTH + 5];
+    SimpleFileStorage indexFile_;
+    const char* prefix_;
+    size_t segSize_;
+    unsigned maxSegs_;
+    Index index_;
+    size_t readOffs_; // Offset of the oldest record in the first segment
+    size_t readEnd_; // Size of the first segment
+    size_t writeOffs_; // Size of the last segment
+    size_t syncOffs_; // Committed size of the last segment
+    size_t syncSize_;
+    lfs_file_t writeFile_;
+    bool writeOpen_;
+    bool inited_;
+
+    int openFront(File* file, RecordHeader* header);
+    int recover(lfs_t* lfs);
+    int openBack(lfs_t* lfs);
+    int syncBack(lfs_t* lfs);
+    int closeBack(lfs_t* lfs);
+    int startSegment();
+    void dropFirstSegment(lfs_t* lfs);
+    int saveIndex();
+    void segmentPath(char* buf, size_t size, uint32_t seg) const;
+
+    static int readHeader(lfs_t* lfs, lfs_file_t* file, RecordHeader* header);
+};
+
+inline bool PersistentQueue::empty() const {
+    return index_.first == index_.last && readOffs_ >= writeOffs_;
+}
+
+inline size_t PersistentQueue::maxRecordSize() const {
+    return segSize_ - RECORD_HEADER_SIZE;
+}
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -25,88 +25,82 @@
 #include "allocator.h"
 #include "system_error.h"
 
-#ifndef SIMPLE_POOL_PREFER_SMALLER_BLOCK
-#define SIMPLE_POOL_PREFER_SMALLER_BLOCK (1)
-#endif
-
+/**
+ * Pool allocator with segregated free lists.
+ *
+ * Memory is allocated from the free lists first and then from the unallocated space at the end of
+ * the pool. A freed block is merged with its free neighbours, and with the unallocated space if it's
+ * the last block in the pool. Free blocks are kept in lists by size class so that both allocation
+ * and deallocation take constant time.
+ */
 class SimpleBasePool: public particle::SimpleAllocator {
 public:
+    /**
+     * Pool statistics.
+     */
+    struct Stats {
+        size_t totalSize; ///< Pool size.
+        size_t usedSize; ///< Size of the allocated blocks, including the block headers.
+        size_t peakUsedSize; ///< Maximum size of the allocated blocks since the pool was created.
+        size_t freeSize; ///< Size of the free blocks and unallocated space.
+        size_t largestFreeBlockSize; ///< Size of the largest contiguous free area.
+        size_t freeBlockCount; ///< Number of free blocks, not counting the unallocated space.
+        size_t failedAllocCount; ///< Number of allocations that failed due to a lack of memory.
+    };
+
     virtual void* alloc(size_t size) override {
-        if (!begin_) {
+        if (!begin_ || size > size_) {
             return nullptr;
         }
-        void* p = nullptr;
-        const size_t alignedSize = aligned(sizeof(BlockHeader) + size);
-        if ((size_ - (ptr_ - begin_)) >= alignedSize) {
-            BlockHeader* b = reinterpret_cast<BlockHeader*>(ptr_);
-            b->size = alignedSize;
-            b->next = nullptr;
-            p = ptr_ + sizeof(BlockHeader);
-            ptr_ += alignedSize;
-        } else {
-            BlockHeader* candidate = nullptr;
-            BlockHeader* prev = nullptr;
-            for (BlockHeader* b = freeList_, *pr = nullptr; b != nullptr; pr = b, b = b->next) {
-                if (b->size >= alignedSize) {
-#if SIMPLE_POOL_PREFER_SMALLER_BLOCK == 1
-                    // Prefer smallest block
-                    if (candidate == nullptr || candidate->size > b->size) {
-#else
-                    // Prefer rightmost block
-                    if (true) {
-#endif // SIMPLE_POOL_PREFER_SMALLER_BLOCK
-                        candidate = b;
-                        prev = pr;
-                    }
-                }
-            }
-            if (candidate != nullptr) {
-                // Remove from free list
-                if (prev != nullptr) {
-                    prev->next = candidate->next;
-                } else {
-                    freeList_ = candidate->next;
-                    prev = freeList_;
-                }
-                if (candidate == freeListEnd_) {
-                    freeListEnd_ = prev;
+        const size_t blockSize = this->blockSize(size);
+        BlockHeader* b = takeFreeBlock(blockSize);
+        if (!b) {
+            b = takeUnallocated(blockSize);
+            if (!b) {
+                b = takeFreeBlockSlow(blockSize);
+                if (!b) {
+                    ++failedAllocCount_;
+                    return nullptr;
                 }
-                candidate->next = nullptr;
-                p = reinterpret_cast<void*>(candidate->data);
             }
         }
-        return p;
+        b->size |= BLOCK_USED;
+        usedSize_ += sizeOf(b);
+        if (usedSize_ > peakUsedSize_) {
+            peakUsedSize_ = usedSize_;
+        }
+        return reinterpret_cast<uint8_t*>(b) + HEADER_SIZE;
     }
 
     virtual void free(void* p) override {
         if (p == nullptr) {
             return;
         }
-        BlockHeader* block = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(p) - sizeof(BlockHeader));
-        if ((reinterpret_cast<uint8_t*>(block) + block->size) == ptr_) {
-            ptr_ -= block->size;
-        } else {
-            BlockHeader* ins = nullptr;
-            for(BlockHeader* b = freeList_; b != nullptr; b = b->next) {
-                if (block > b) {
-                    ins = b;
-                }
-            }
-            if (ins == nullptr) {
-                if (freeList_ == nullptr) {
-                    freeListEnd_ = block;
-                }
-                block->next = freeList_;
-                freeList_ = block;
-            } else {
-                block->next = ins->next;
-                ins->next = block;
-                if (ins == freeListEnd_) {
-                    freeListEnd_ = block;
-                }
-            }
+        BlockHeader* b = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(p) - HEADER_SIZE);
+        b->size &= ~BLOCK_USED;
+        usedSize_ -= b->size;
+        // Merge with the previous block
+        BlockHeader* prev = b->prevPhys;
+        if (prev && !isUsed(prev)) {
+            removeFree(prev);
+            prev->size += b->size;
+            b = prev;
+        }
+        BlockHeader* next = nextPhys(b);
+        if (reinterpret_cast<uint8_t*>(next) == ptr_) {
+            // Return the block to the unallocated space
+            ptr_ = reinterpret_cast<uint8_t*>(b);
+            last_ = b->prevPhys;
+            return;
         }
-        shrink();
+        // Merge with the next block
+        if (!isUsed(next)) {
+            removeFree(next);
+            b->size += next->size;
+            next = nextPhys(b);
+        }
+        next->prevPhys = b;
+        insertFree(b);
     }
 
     // FIXME: This API is here for compatibility with the existing system code and unit tests
@@ -118,6 +112,32 @@ public:
         this->free(p);
     }
 
+    /**
+     * Get pool statistics.
+     *
+     * The fragmentation of the free memory can be estimated as `1 - largestFreeBlockSize / freeSize`.
+     */
+    virtual void stats(Stats* stats) const {
+        const size_t unallocSize = (begin_ + size_) - ptr_;
+        stats->totalSize = size_;
+        stats->usedSize = usedSize_;
+        stats->peakUsedSize = peakUsedSize_;
+        stats->freeSize = freeSize_ + unallocSize;
+        stats->freeBlockCount = freeBlockCount_;
+        stats->failedAllocCount = failedAllocCount_;
+        size_t largest = unallocSize;
+        if (freeMask_) {
+            // The largest block is in the highest non-empty size class
+            const unsigned c = (sizeof(unsigned) * 8 - 1) - __builtin_clz(freeMask_);
+            for (BlockHeader* b = freeLists_[c]; b; b = b->nextFree) {
+                if (b->size > largest) {
+                    largest = b->size;
+                }
+            }
+        }
+        stats->largestFreeBlockSize = largest;
+    }
+
 protected:
     SimpleBasePool() {
         reset();
@@ -131,8 +151,16 @@ protected:
         begin_ = data;
         ptr_ = data;
         size_ = size;
-        freeList_ = nullptr;
-        freeListEnd_ = nullptr;
+        last_ = nullptr;
+        for (auto& list: freeLists_) {
+            list = nullptr;
+        }
+        freeMask_ = 0;
+        freeSize_ = 0;
+        freeBlockCount_ = 0;
+        usedSize_ = 0;
+        peakUsedSize_ = 0;
+        failedAllocCount_ = 0;
     }
 
     uint8_t* begin_;
@@ -142,42 +170,151 @@ protected:
 // private:
 
     struct BlockHeader {
-        BlockHeader* next;
-        uintptr_t size;
-        uint8_t data[0];
+        uintptr_t size; // Block size, including the header. The lowest bit is set if the block is allocated
+        BlockHeader* prevPhys; // Block preceding this block in memory
+        // These fields are only valid if the block is free
+        BlockHeader* nextFree;
+        BlockHeader* prevFree;
     };
 
     static_assert(sizeof(BlockHeader) % sizeof(uintptr_t) == 0, "SimpleBasePool: size of header should be a multiple of uintptr_t");
 
+    // Size of the header of an allocated block
+    static const size_t HEADER_SIZE = offsetof(BlockHeader, nextFree);
+    static const size_t MIN_BLOCK_SIZE = sizeof(BlockHeader);
+    static const uintptr_t BLOCK_USED = 0x01;
+
+    // Blocks of up to 8 words have a size class each, larger blocks are grouped by halves of the
+    // powers of two
+    static const unsigned SIZE_CLASS_COUNT = 16;
+
     static size_t aligned(size_t sz) {
-        return (sz + (sizeof(uintptr_t) - (sz % sizeof(uintptr_t))));
+        return (sz + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+    }
+
+    static size_t blockSize(size_t size) {
+        size_t sz = aligned(HEADER_SIZE + size);
+        if (sz < MIN_BLOCK_SIZE) {
+            sz = MIN_BLOCK_SIZE;
+        }
+        return sz;
     }
 
-    BlockHeader* getPrevFree(BlockHeader* block) const {
-        for (BlockHeader* b = freeList_; b != nullptr; b = b->next) {
-            if (b->next == block) {
-                return b;
+    static unsigned sizeClass(size_t size) {
+        const size_t words = size / sizeof(uintptr_t);
+        if (words < 8) {
+            return words - MIN_BLOCK_SIZE / sizeof(uintptr_t);
+        }
+        const unsigned log2 = (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(words);
+        const unsigned c = 4 + (log2 - 3) * 2 + ((words >> (log2 - 1)) & 1);
+        return (c < SIZE_CLASS_COUNT) ? c : SIZE_CLASS_COUNT - 1;
+    }
+
+    static size_t sizeOf(const BlockHeader* b) {
+        return b->size & ~BLOCK_USED;
+    }
+
+    static bool isUsed(const BlockHeader* b) {
+        return b->size & BLOCK_USED;
+    }
+
+    static BlockHeader* nextPhys(BlockHeader* b) {
+        return reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(b) + sizeOf(b));
+    }
+
+    void insertFree(BlockHeader* b) {
+        const unsigned c = sizeClass(b->size);
+        b->prevFree = nullptr;
+        b->nextFree = freeLists_[c];
+        if (b->nextFree) {
+            b->nextFree->prevFree = b;
+        }
+        freeLists_[c] = b;
+        freeMask_ |= (1u << c);
+        freeSize_ += b->size;
+        ++freeBlockCount_;
+    }
+
+    void removeFree(BlockHeader* b) {
+        if (b->prevFree) {
+            b->prevFree->nextFree = b->nextFree;
+        } else {
+            const unsigned c = sizeClass(b->size);
+            freeLists_[c] = b->nextFree;
+            if (!b->nextFree) {
+                freeMask_ &= ~(1u << c);
             }
         }
-        return nullptr;
+        if (b->nextFree) {
+            b->nextFree->prevFree = b->prevFree;
+        }
+        freeSize_ -= b->size;
+        --freeBlockCount_;
     }
 
-    void shrink() {
-        while (freeListEnd_ != nullptr && (reinterpret_cast<uint8_t*>(freeListEnd_) + freeListEnd_->size) == ptr_) {
-            ptr_ -= freeListEnd_->size;
-            freeListEnd_ = getPrevFree(freeListEnd_);
-            if (freeListEnd_ == nullptr) {
-                freeList_ = nullptr;
-            } else {
-                freeListEnd_->next = nullptr;
+    // Removes a free block from its list and returns its unused part back to the free lists
+    BlockHeader* takeFree(BlockHeader* b, size_t size) {
+        removeFree(b);
+        const size_t remain = b->size - size;
+        if (remain >= MIN_BLOCK_SIZE) {
+            BlockHeader* r = reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(b) + size);
+            r->size = remain;
+            r->prevPhys = b;
+            nextPhys(r)->prevPhys = r; // Free blocks are never followed by the unallocated space
+            b->size = size;
+            insertFree(r);
+        }
+        return b;
+    }
+
+    BlockHeader* takeFreeBlock(size_t size) {
+        const unsigned c = sizeClass(size);
+        // Blocks of the smaller size classes are all of the same size. For larger classes, only
+        // check the first block in the list
+        BlockHeader* b = freeLists_[c];
+        if (!b || b->size < size) {
+            // Any block of a larger size class is large enough
+            const unsigned mask = freeMask_ & ~((2u << c) - 1);
+            if (!mask) {
+                return nullptr;
             }
+            b = freeLists_[__builtin_ctz(mask)];
         }
+        return takeFree(b, size);
     }
 
-    uint8_t* ptr_;
+    BlockHeader* takeFreeBlockSlow(size_t size) {
+        // The remaining blocks of the requested size class may still be large enough
+        for (BlockHeader* b = freeLists_[sizeClass(size)]; b; b = b->nextFree) {
+            if (b->size >= size) {
+                return takeFree(b, size);
+            }
+        }
+        return nullptr;
+    }
 
-    BlockHeader* freeList_ = nullptr;
-    BlockHeader* freeListEnd_ = nullptr;
+    BlockHeader* takeUnallocated(size_t size) {
+        if (static_cast<size_t>((begin_ + size_) - ptr_) < size) {
+            return nullptr;
+        }
+        BlockHeader* b = reinterpret_cast<BlockHeader*>(ptr_);
+        b->size = size;
+        b->prevPhys = last_;
+        last_ = b;
+        ptr_ += size;
+        return b;
+    }
+
+    uint8_t* ptr_; // Start of the unallocated space
+    BlockHeader* last_; // Last block before the unallocated space
+
+    BlockHeader* freeLists_[SIZE_CLASS_COUNT];
+    unsigned freeMask_; // Bitmap of the non-empty free lists
+    size_t freeSize_;
+    size_t freeBlockCount_;
+    size_t usedSize_;
+    size_t peakUsedSize_;
+    size_t failedAllocCount_;
 };
 
 class SimpleAllocedPool : public SimpleBasePool {
@@ -230,4 +367,10 @@ public:
             SimpleBasePool::free(ptr);
         }
     }
+
+    virtual void stats(Stats* stats) const override {
+        ATOMIC_BLOCK() {
+            SimpleBasePool::stats(stats);
+        }
+    }
 };
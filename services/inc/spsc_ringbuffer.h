@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <sys/types.h>
+
+#include "system_error.h"
+
+/**
+ * Alignment of the producer and consumer indices of `SpscRingBuffer`.
+ *
+ * Cortex-M devices have no data cache, so by default the indices are only separated on the host.
+ */
+#ifndef SPSC_RING_BUFFER_INDEX_ALIGNMENT
+#if defined(__arm__)
+#define SPSC_RING_BUFFER_INDEX_ALIGNMENT (alignof(size_t))
+#else
+#define SPSC_RING_BUFFER_INDEX_ALIGNMENT (64)
+#endif
+#endif // SPSC_RING_BUFFER_INDEX_ALIGNMENT
+
+namespace particle {
+
+namespace services {
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer.
+ *
+ * Unlike `RingBuffer`, this class can be shared between exactly one producer (e.g. an ISR) and
+ * exactly one consumer (e.g. a thread) without disabling interrupts or taking a lock. Methods
+ * are split into producer-side (`put()`, `space()`, `acquire()`, `acquireCommit()`) and
+ * consumer-side (`get()`, `peek()`, `data()`, `consume()`, `consumeCommit()`) groups and each
+ * group may only be called from its own context.
+ *
+ * The producer can also assemble a variable-length record with `stage()` and publish it
+ * atomically with `acquireCommit()`, or discard it by not committing.
+ *
+ * The size of the buffer must be a power of two.
+ */
+template<typename T>
+class SpscRingBuffer {
+public:
+    SpscRingBuffer();
+    SpscRingBuffer(T* buffer, size_t size);
+
+    int init(T* buffer, size_t size);
+    // Not thread-safe: neither side may access the buffer while it is being reset
+    void reset();
+
+    size_t size() const;
+
+    bool full() const;
+    bool empty() const;
+
+    // Producer
+    size_t space() const;
+
+    ssize_t put(const T& v);
+    ssize_t put(const T* v, size_t size);
+    // Writes data at the given offset past the head without publishing it; see acquireCommit()
+    ssize_t stage(size_t offset, const T* v, size_t size);
+
+    size_t acquirable() const;
+    T* acquire(size_t size);
+    void acquireCommit(size_t size);
+
+    // Consumer
+    size_t data() const;
+
+    ssize_t get(T* v);
+    ssize_t get(T* v, size_t size);
+
+    ssize_t peek(T* v, size_t size) const;
+
+    size_t consumable() const;
+    T* consume(size_t size);
+    void consumeCommit(size_t size);
+
+private:
+    // Both indices grow monotonically and are only masked when accessing the buffer
+    alignas(SPSC_RING_BUFFER_INDEX_ALIGNMENT) std::atomic<size_t> head_; // Written by the producer
+    alignas(SPSC_RING_BUFFER_INDEX_ALIGNMENT) std::atomic<size_t> tail_; // Written by the consumer
+    alignas(SPSC_RING_BUFFER_INDEX_ALIGNMENT) T* buffer_;
+    size_t size_;
+    size_t mask_;
+
+    static void copy(T* dest, const T* src, size_t size);
+};
+
+template<typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer()
+        : head_(0),
+          tail_(0),
+          buffer_(nullptr),
+          size_(0),
+          mask_(0) {
+}
+
+template<typename T>
+inline SpscRingBuffer<T>::SpscRingBuffer(T* buffer, size_t size)
+        : SpscRingBuffer() {
+    init(buffer, size);
+}
+
+template<typename T>
+inline int SpscRingBuffer<T>::init(T* buffer, size_t size) {
+    if (!buffer || size == 0 || (size & (size - 1)) != 0) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    buffer_ = buffer;
+    size_ = size;
+    mask_ = size - 1;
+    reset();
+    return 0;
+}
+
+template<typename T>
+inline void SpscRingBuffer<T>::reset() {
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_release);
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::size() const {
+    return size_;
+}
+
+template<typename T>
+inline bool SpscRingBuffer<T>::full() const {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire) == size_;
+}
+
+template<typename T>
+inline bool SpscRingBuffer<T>::empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::space() const {
+    // Acquire pairs with the release in the consumer so that freed slots are not overwritten early
+    return size_ - (head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::put(const T& v) {
+    return put(&v, 1);
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::put(const T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (!v) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    if (size_ - (head - tail) < size) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const size_t offs = head & mask_;
+    const size_t n = std::min(size, size_ - offs);
+    copy(buffer_ + offs, v, n);
+    copy(buffer_, v + n, size - n);
+    head_.store(head + size, std::memory_order_release);
+    return size;
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::stage(size_t offset, const T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (!v) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    if (size_ - (head - tail) < offset + size) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const size_t offs = (head + offset) & mask_;
+    const size_t n = std::min(size, size_ - offs);
+    copy(buffer_ + offs, v, n);
+    copy(buffer_, v + n, size - n);
+    return size;
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::acquirable() const {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t free = size_ - (head - tail_.load(std::memory_order_acquire));
+    return std::min(free, size_ - (head & mask_));
+}
+
+template<typename T>
+inline T* SpscRingBuffer<T>::acquire(size_t size) {
+    if (size == 0 || acquirable() < size) {
+        return nullptr;
+    }
+    return buffer_ + (head_.load(std::memory_order_relaxed) & mask_);
+}
+
+template<typename T>
+inline void SpscRingBuffer<T>::acquireCommit(size_t size) {
+    head_.store(head_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::data() const {
+    // Acquire pairs with the release in the producer so that the data written is visible
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::get(T* v) {
+    return get(v, 1);
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::get(T* v, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    if (head - tail < size) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    if (v) {
+        const size_t offs = tail & mask_;
+        const size_t n = std::min(size, size_ - offs);
+        copy(v, buffer_ + offs, n);
+        copy(v + n, buffer_, size - n);
+    }
+    tail_.store(tail + size, std::memory_order_release);
+    return size;
+}
+
+template<typename T>
+inline ssize_t SpscRingBuffer<T>::peek(T* v, size_t size) const {
+    if (size == 0) {
+        return 0;
+    }
+    if (!v) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) - tail < size) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const size_t offs = tail & mask_;
+    const size_t n = std::min(size, size_ - offs);
+    copy(v, buffer_ + offs, n);
+    copy(v + n, buffer_, size - n);
+    return size;
+}
+
+template<typename T>
+inline size_t SpscRingBuffer<T>::consumable() const {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t avail = head_.load(std::memory_order_acquire) - tail;
+    return std::min(avail, size_ - (tail & mask_));
+}
+
+template<typename T>
+inline T* SpscRingBuffer<T>::consume(size_t size) {
+    if (size == 0 || consumable() < size) {
+        return nullptr;
+    }
+    return buffer_ + (tail_.load(std::memory_order_relaxed) & mask_);
+}
+
+template<typename T>
+inline void SpscRingBuffer<T>::consumeCommit(size_t size) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+template<typename T>
+inline void SpscRingBuffer<T>::copy(T* dest, const T* src, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        dest[i] = src[i];
+    }
+}
+
+} // namespace services
+
+} // namespace particle
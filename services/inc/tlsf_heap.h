@@ -0,0 +1,563 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "system_error.h"
+
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+namespace particle {
+
+/**
+ * Two-Level Segregated Fit heap.
+ *
+ * Free blocks are kept in lists indexed by two levels of size classes: a power of two, and one of
+ * `SL_COUNT` linear subdivisions of it. Bitmaps of the non-empty lists allow finding a suitable
+ * block with a couple of bit scans, so that allocation and deallocation take constant time
+ * regardless of the heap state. A freed block is merged with its free neighbours immediately.
+ *
+ * The heap is not thread-safe.
+ */
+class TlsfHeap {
+public:
+    /**
+     * Heap options.
+     */
+    enum Flag {
+        GUARD = 0x01, ///< Place a guard word at the end of each allocated block and check it when the block is freed.
+        FILL_FREED = 0x02 ///< Fill freed blocks with `FILL_PATTERN`. Takes time proportional to the block size.
+    };
+
+    /**
+     * Heap statistics.
+     */
+    struct Stats {
+        size_t totalSize; ///< Heap size, not counting the heap's own overhead.
+        size_t usedSize; ///< Size of the allocated blocks, including the block headers.
+        size_t peakUsedSize; ///< Maximum size of the allocated blocks since the heap was initialized.
+        size_t freeSize; ///< Size of the free blocks.
+        size_t largestFreeBlockSize; ///< Size of the largest free block, including the block header.
+        size_t freeBlockCount; ///< Number of free blocks.
+        size_t failedAllocCount; ///< Number of allocations that failed due to a lack of memory.
+        size_t guardErrorCount; ///< Number of freed blocks with a damaged guard word.
+    };
+
+    /**
+     * Maximum size of the heap.
+     */
+    static const size_t MAX_SIZE = (size_t)1 << 24;
+
+    /**
+     * Pattern used to fill the freed blocks.
+     */
+    static const uint8_t FILL_PATTERN = 0xdd;
+
+    constexpr TlsfHeap() :
+            begin_(nullptr),
+            end_(nullptr),
+            flags_(0),
+            totalSize_(0),
+            usedSize_(0),
+            peakUsedSize_(0),
+            freeSize_(0),
+            freeBlockCount_(0),
+            failedAllocCount_(0),
+            guardErrorCount_(0),
+            flBitmap_(0),
+            slBitmap_(),
+            heads_() {
+    }
+
+    /**
+     * Initialize the heap.
+     *
+     * Any previously allocated blocks are discarded. The heap doesn't use memory beyond the first
+     * `MAX_SIZE` bytes of the provided area.
+     *
+     * @param mem Memory area.
+     * @param size Size of the memory area.
+     * @param flags Heap options (a combination of the `Flag` values).
+     * @return 0 on success, otherwise a negative result code defined by `system_error_t`.
+     */
+    int init(void* mem, size_t size, unsigned flags = 0) {
+        begin_ = nullptr;
+        const uintptr_t addr = alignUp((uintptr_t)mem);
+        const size_t offs = addr - (uintptr_t)mem;
+        if (size > MAX_SIZE + offs) {
+            size = MAX_SIZE + offs;
+        }
+        if (size < offs + MIN_BLOCK_SIZE + HEADER_SIZE) {
+            return SYSTEM_ERROR_INVALID_ARGUMENT;
+        }
+        size = (size - offs) & ~(ALIGN - 1);
+        flags_ = flags;
+        flBitmap_ = 0;
+        memset(slBitmap_, 0, sizeof(slBitmap_));
+        memset(heads_, 0, sizeof(heads_));
+        usedSize_ = 0;
+        peakUsedSize_ = 0;
+        freeSize_ = 0;
+        freeBlockCount_ = 0;
+        failedAllocCount_ = 0;
+        guardErrorCount_ = 0;
+        // The heap is a single free block followed by an empty block marking the end of the heap
+        Block* const b = reinterpret_cast<Block*>(addr);
+        b->prevPhys = nullptr;
+        b->size = (size - HEADER_SIZE) | BLOCK_FREE;
+        Block* const end = nextPhys(b);
+        end->prevPhys = b;
+        end->size = 0;
+        begin_ = reinterpret_cast<uint8_t*>(addr);
+        end_ = reinterpret_cast<uint8_t*>(end);
+        totalSize_ = sizeOf(b);
+        insertFree(b);
+        return 0;
+    }
+
+    /**
+     * Allocate a block.
+     *
+     * @param size Block size.
+     * @return Pointer to the block, or `nullptr` if the size is 0 or there's not enough memory.
+     */
+    void* alloc(size_t size) {
+        if (!begin_ || !size) {
+            return nullptr;
+        }
+        Block* b = nullptr;
+        const size_t need = blockSize(size);
+        if (size <= MAX_SIZE) {
+            unsigned fl = 0, sl = 0;
+            mappingSearch(need, &fl, &sl);
+            b = findFree(fl, sl);
+        }
+        if (!b) {
+            ++failedAllocCount_;
+            return nullptr;
+        }
+        removeFree(b);
+        b->size &= ~BLOCK_FREE;
+        trim(b, need);
+        markUsed(b);
+        return payload(b);
+    }
+
+    /**
+     * Free a block.
+     *
+     * @param ptr Pointer to the block.
+     * @return 0 on success, `SYSTEM_ERROR_BAD_DATA` if the block was freed but its guard word was
+     *         damaged, or `SYSTEM_ERROR_INVALID_STATE` if the block is not allocated.
+     */
+    int free(void* ptr) {
+        if (!ptr) {
+            return 0;
+        }
+        Block* b = blockOf(ptr);
+        if (isFree(b)) {
+            return SYSTEM_ERROR_INVALID_STATE;
+        }
+        int result = 0;
+        if ((flags_ & GUARD) && !checkGuard(b)) {
+            ++guardErrorCount_;
+            result = SYSTEM_ERROR_BAD_DATA;
+        }
+        usedSize_ -= sizeOf(b);
+        if (flags_ & FILL_FREED) {
+            memset(ptr, FILL_PATTERN, sizeOf(b) - HEADER_SIZE);
+        }
+        b->size |= BLOCK_FREE;
+        b = mergePrev(b);
+        b = mergeNext(b);
+        insertFree(b);
+        return result;
+    }
+
+    /**
+     * Change the size of a block.
+     *
+     * The block is resized in place if it or its following free neighbour has enough space.
+     *
+     * @param ptr Pointer to the block, or `nullptr`.
+     * @param size New block size.
+     * @return Pointer to the resized block, or `nullptr` if the size is 0 or there's not enough
+     *         memory. In the latter case, the original block is left intact.
+     */
+    void* realloc(void* ptr, size_t size) {
+        if (!ptr) {
+            return alloc(size);
+        }
+        if (!size) {
+            free(ptr);
+            return nullptr;
+        }
+        if (size > MAX_SIZE) {
+            ++failedAllocCount_;
+            return nullptr;
+        }
+        Block* b = blockOf(ptr);
+        const size_t need = blockSize(size);
+        const size_t curSize = sizeOf(b);
+        if (need > curSize) {
+            Block* next = nextPhys(b);
+            if (!isFree(next) || curSize + sizeOf(next) < need) {
+                void* p = alloc(size);
+                if (!p) {
+                    return nullptr;
+                }
+                memcpy(p, ptr, usableSize(b));
+                free(ptr);
+                return p;
+            }
+            removeFree(next);
+            b->size += sizeOf(next);
+            nextPhys(b)->prevPhys = b;
+        }
+        usedSize_ -= curSize;
+        trim(b, need);
+        markUsed(b);
+        return ptr;
+    }
+
+    /**
+     * Get the usable size of an allocated block.
+     */
+    size_t blockSize(const void* ptr) const {
+        return ptr ? usableSize(blockOf(ptr)) : 0;
+    }
+
+    /**
+     * Check that a block is allocated and its guard word is intact.
+     */
+    bool check(const void* ptr) const {
+        const Block* b = blockOf(ptr);
+        return !isFree(b) && (!(flags_ & GUARD) || checkGuard(b));
+    }
+
+    /**
+     * Check the integrity of the heap.
+     *
+     * This method iterates over all blocks and is meant to be used for testing and debugging.
+     */
+    bool validate() const {
+        if (!begin_) {
+            return false;
+        }
+        size_t used = 0;
+        size_t freeSize = 0;
+        size_t freeCount = 0;
+        const Block* prev = nullptr;
+        const Block* b = reinterpret_cast<const Block*>(begin_);
+        while (b != reinterpret_cast<const Block*>(end_)) {
+            const size_t size = sizeOf(b);
+            if (b->prevPhys != prev || size < MIN_BLOCK_SIZE || (size & (ALIGN - 1)) ||
+                    reinterpret_cast<const uint8_t*>(b) + size > end_) {
+                return false;
+            }
+            if (isFree(b)) {
+                if (prev && isFree(prev)) {
+                    return false; // Adjacent free blocks should have been merged
+                }
+                unsigned fl = 0, sl = 0;
+                mapping(size, &fl, &sl);
+                if (!(flBitmap_ & (1u << fl)) || !(slBitmap_[fl] & (1u << sl)) || !inList(heads_[fl][sl], b)) {
+                    return false;
+                }
+                freeSize += size;
+                ++freeCount;
+            } else {
+                if ((flags_ & GUARD) && !checkGuard(b)) {
+                    return false;
+                }
+                used += size;
+            }
+            prev = b;
+            b = nextPhys(b);
+        }
+        return b->prevPhys == prev && used == usedSize_ && freeSize == freeSize_ && freeCount == freeBlockCount_ &&
+                used + freeSize == totalSize_;
+    }
+
+    /**
+     * Get heap statistics.
+     *
+     * The fragmentation of the free memory can be estimated as `1 - largestFreeBlockSize / freeSize`.
+     */
+    void stats(Stats* stats) const {
+        stats->totalSize = totalSize_;
+        stats->usedSize = usedSize_;
+        stats->peakUsedSize = peakUsedSize_;
+        stats->freeSize = freeSize_;
+        stats->freeBlockCount = freeBlockCount_;
+        stats->failedAllocCount = failedAllocCount_;
+        stats->guardErrorCount = guardErrorCount_;
+        size_t largest = 0;
+        if (flBitmap_) {
+            // The largest block is in the highest non-empty list
+            const unsigned fl = fls(flBitmap_);
+            const unsigned sl = fls(slBitmap_[fl]);
+            for (const Block* b = heads_[fl][sl]; b; b = b->nextFree) {
+                if (sizeOf(b) > largest) {
+                    largest = sizeOf(b);
+                }
+            }
+        }
+        stats->largestFreeBlockSize = largest;
+    }
+
+    bool isInitialized() const {
+        return begin_;
+    }
+
+private:
+    struct Block {
+        Block* prevPhys; // Previous block in memory
+        size_t size; // Block size including the header. The lowest bit is set if the block is free
+        // The fields below are only valid for free blocks
+        Block* nextFree;
+        Block* prevFree;
+    };
+
+    static const size_t ALIGN = 8;
+    static const size_t HEADER_SIZE = (offsetof(Block, nextFree) + ALIGN - 1) & ~(ALIGN - 1);
+    static const size_t MIN_BLOCK_SIZE = (sizeof(Block) + ALIGN - 1) & ~(ALIGN - 1);
+    static const size_t GUARD_SIZE = sizeof(uint32_t);
+    static const uint32_t GUARD_MAGIC = 0x5a17c0de;
+    static const size_t BLOCK_FREE = 0x01;
+
+    static const unsigned SL_LOG2 = 4; // Number of second-level lists per first-level list (log2)
+    static const unsigned SL_COUNT = 1 << SL_LOG2;
+    static const unsigned FL_SHIFT = SL_LOG2 + 3; // Blocks smaller than 2^FL_SHIFT share the first list
+    static const size_t SMALL_BLOCK_SIZE = (size_t)1 << FL_SHIFT;
+    static const unsigned FL_COUNT = 24 /* log2(MAX_SIZE) */ - FL_SHIFT + 1;
+
+    uint8_t* begin_;
+    uint8_t* end_; // End of heap marker
+    unsigned flags_;
+    size_t totalSize_;
+    size_t usedSize_;
+    size_t peakUsedSize_;
+    size_t freeSize_;
+    size_t freeBlockCount_;
+    size_t failedAllocCount_;
+    size_t guardErrorCount_;
+    uint32_t flBitmap_;
+    uint16_t slBitmap_[FL_COUNT];
+    Block* heads_[FL_COUNT][SL_COUNT];
+
+    static_assert(((size_t)1 << (FL_COUNT + FL_SHIFT - 1)) == MAX_SIZE, "Invalid number of first-level lists");
+    static_assert(SMALL_BLOCK_SIZE / SL_COUNT == ALIGN, "Invalid size of the small blocks");
+
+    size_t blockSize(size_t size) const {
+        size = alignUp(size + HEADER_SIZE + guardSize());
+        if (size < MIN_BLOCK_SIZE) {
+            size = MIN_BLOCK_SIZE;
+        }
+        return size;
+    }
+
+    size_t usableSize(const Block* b) const {
+        return sizeOf(b) - HEADER_SIZE - guardSize();
+    }
+
+    size_t guardSize() const {
+        if (flags_ & GUARD) {
+            return GUARD_SIZE;
+        }
+        return 0;
+    }
+
+    // Splits off the tail of an allocated block that exceeds the given size
+    void trim(Block* b, size_t size) {
+        const size_t rest = sizeOf(b) - size;
+        if (rest < MIN_BLOCK_SIZE) {
+            return;
+        }
+        b->size = size;
+        Block* r = nextPhys(b);
+        r->prevPhys = b;
+        r->size = rest | BLOCK_FREE;
+        nextPhys(r)->prevPhys = r;
+        r = mergeNext(r);
+        insertFree(r);
+    }
+
+    void markUsed(Block* b) {
+        usedSize_ += sizeOf(b);
+        if (usedSize_ > peakUsedSize_) {
+            peakUsedSize_ = usedSize_;
+        }
+        if (flags_ & GUARD) {
+            *guardOf(b) = guardValue(b);
+        }
+    }
+
+    Block* mergePrev(Block* b) {
+        Block* prev = b->prevPhys;
+        if (prev && isFree(prev)) {
+            removeFree(prev);
+            prev->size += sizeOf(b);
+            nextPhys(prev)->prevPhys = prev;
+            b = prev;
+        }
+        return b;
+    }
+
+    Block* mergeNext(Block* b) {
+        Block* next = nextPhys(b);
+        if (isFree(next)) {
+            removeFree(next);
+            b->size += sizeOf(next);
+            nextPhys(b)->prevPhys = b;
+        }
+        return b;
+    }
+
+    void insertFree(Block* b) {
+        unsigned fl = 0, sl = 0;
+        mapping(sizeOf(b), &fl, &sl);
+        Block* const head = heads_[fl][sl];
+        b->prevFree = nullptr;
+        b->nextFree = head;
+        if (head) {
+            head->prevFree = b;
+        }
+        heads_[fl][sl] = b;
+        slBitmap_[fl] |= 1u << sl;
+        flBitmap_ |= 1u << fl;
+        freeSize_ += sizeOf(b);
+        ++freeBlockCount_;
+    }
+
+    void removeFree(Block* b) {
+        unsigned fl = 0, sl = 0;
+        mapping(sizeOf(b), &fl, &sl);
+        if (b->prevFree) {
+            b->prevFree->nextFree = b->nextFree;
+        } else {
+            heads_[fl][sl] = b->nextFree;
+            if (!b->nextFree) {
+                slBitmap_[fl] &= ~(1u << sl);
+                if (!slBitmap_[fl]) {
+                    flBitmap_ &= ~(1u << fl);
+                }
+            }
+        }
+        if (b->nextFree) {
+            b->nextFree->prevFree = b->prevFree;
+        }
+        freeSize_ -= sizeOf(b);
+        --freeBlockCount_;
+    }
+
+    // Returns the first block in the first non-empty list at or above the given one
+    Block* findFree(unsigned fl, unsigned sl) const {
+        if (fl >= FL_COUNT) {
+            return nullptr;
+        }
+        uint32_t slMap = slBitmap_[fl] & (~0u << sl);
+        if (!slMap) {
+            const uint32_t flMap = flBitmap_ & (~0u << (fl + 1));
+            if (!flMap) {
+                return nullptr;
+            }
+            fl = ffs(flMap);
+            slMap = slBitmap_[fl];
+        }
+        return heads_[fl][ffs(slMap)];
+    }
+
+    // Returns the list containing blocks of the given size
+    static void mapping(size_t size, unsigned* fl, unsigned* sl) {
+        if (size < SMALL_BLOCK_SIZE) {
+            *fl = 0;
+            *sl = size / (SMALL_BLOCK_SIZE / SL_COUNT);
+        } else {
+            const unsigned f = fls(size);
+            *fl = f - FL_SHIFT + 1;
+            *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+        }
+    }
+
+    // Returns the first list whose blocks are all at least of the given size
+    static void mappingSearch(size_t size, unsigned* fl, unsigned* sl) {
+        if (size >= SMALL_BLOCK_SIZE) {
+            size += ((size_t)1 << (fls(size) - SL_LOG2)) - 1;
+        }
+        mapping(size, fl, sl);
+    }
+
+    bool checkGuard(const Block* b) const {
+        return *guardOf(b) == guardValue(b);
+    }
+
+    static uint32_t* guardOf(const Block* b) {
+        return (uint32_t*)((uintptr_t)b + sizeOf(b) - GUARD_SIZE);
+    }
+
+    static uint32_t guardValue(const Block* b) {
+        return GUARD_MAGIC ^ (uint32_t)(uintptr_t)b;
+    }
+
+    static bool inList(const Block* head, const Block* b) {
+        for (; head; head = head->nextFree) {
+            if (head == b) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static Block* nextPhys(const Block* b) {
+        return reinterpret_cast<Block*>((uintptr_t)b + sizeOf(b));
+    }
+
+    static Block* blockOf(const void* ptr) {
+        return reinterpret_cast<Block*>((uintptr_t)ptr - HEADER_SIZE);
+    }
+
+    static void* payload(Block* b) {
+        return reinterpret_cast<uint8_t*>(b) + HEADER_SIZE;
+    }
+
+    static size_t sizeOf(const Block* b) {
+        return b->size & ~BLOCK_FREE;
+    }
+
+    static bool isFree(const Block* b) {
+        return b->size & BLOCK_FREE;
+    }
+
+    static size_t alignUp(size_t size) {
+        return (size + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    // Index of the most significant bit set
+    static unsigned fls(size_t val) {
+        return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(val);
+    }
+
+    // Index of the least significant bit set
+    static unsigned ffs(uint32_t val) {
+        return __builtin_ctz(val);
+    }
+};
+
+} // namespace particle
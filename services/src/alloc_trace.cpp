@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+LOG_SOURCE_CATEGORY("alloc");
+
+#include "alloc_trace.h"
+
+#include "timer_hal.h"
+#include "system_error.h"
+
+#if PLATFORM_THREADING
+#include "concurrent_hal.h"
+#endif
+
+#include <atomic>
+
+namespace {
+
+// Maximum number of threads that can have a tag assigned
+const size_t MAX_TAGGED_THREADS = 8;
+
+const char* const TAG_NAMES[ALLOC_TRACE_TAG_COUNT] = {
+    "system", // ALLOC_TRACE_TAG_SYSTEM
+    "comm", // ALLOC_TRACE_TAG_COMMUNICATION
+    "user", // ALLOC_TRACE_TAG_USER
+    "lwip" // ALLOC_TRACE_TAG_LWIP
+};
+
+struct TagStats {
+    std::atomic<uint32_t> liveSize;
+    std::atomic<uint32_t> peakSize;
+    std::atomic<uint32_t> allocCount;
+    std::atomic<uint32_t> freeCount;
+    std::atomic<uint32_t> failedCount;
+};
+
+// The allocation functions can be called before the global constructors, so all the state below
+// needs to be constant-initialized
+TagStats g_stats[ALLOC_TRACE_TAG_COUNT] = {};
+std::atomic<uint32_t> g_resetTime(0);
+
+#if PLATFORM_THREADING
+
+struct ThreadTag {
+    std::atomic<os_thread_t> thread;
+    std::atomic<int> tag;
+};
+
+ThreadTag g_threadTags[MAX_TAGGED_THREADS] = {};
+
+ThreadTag* findThreadTag(os_thread_t thread) {
+    for (auto& t: g_threadTags) {
+        if (t.thread.load(std::memory_order_acquire) == thread) {
+            return &t;
+        }
+    }
+    return nullptr;
+}
+
+// Makes the entry available to other threads
+int releaseThreadTag(ThreadTag* t) {
+    const int tag = t->tag.exchange(ALLOC_TRACE_TAG_SYSTEM, std::memory_order_relaxed);
+    t->thread.store(nullptr, std::memory_order_release);
+    return tag;
+}
+
+#else
+
+std::atomic<int> g_tag(ALLOC_TRACE_TAG_SYSTEM);
+
+#endif // !PLATFORM_THREADING
+
+inline bool isValidTag(int tag) {
+    return tag >= 0 && tag < ALLOC_TRACE_TAG_COUNT;
+}
+
+void updatePeak(TagStats* s, uint32_t size) {
+    auto peak = s->peakSize.load(std::memory_order_relaxed);
+    while (size > peak && !s->peakSize.compare_exchange_weak(peak, size, std::memory_order_relaxed)) {
+    }
+}
+
+} // namespace
+
+int alloc_trace_set_tag(int tag) {
+    if (!isValidTag(tag)) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+#if PLATFORM_THREADING
+    const auto thread = os_thread_current(nullptr);
+    if (!thread) {
+        return SYSTEM_ERROR_INVALID_STATE;
+    }
+    auto t = findThreadTag(thread);
+    if (t) {
+        // The entry can only be modified by its owner thread
+        if (tag == ALLOC_TRACE_TAG_SYSTEM) {
+            return releaseThreadTag(t);
+        }
+        return t->tag.exchange(tag, std::memory_order_relaxed);
+    }
+    if (tag == ALLOC_TRACE_TAG_SYSTEM) {
+        return ALLOC_TRACE_TAG_SYSTEM; // Default tag
+    }
+    for (auto& t: g_threadTags) {
+        os_thread_t expected = nullptr;
+        if (t.thread.compare_exchange_strong(expected, thread, std::memory_order_acquire)) {
+            t.tag.store(tag, std::memory_order_relaxed);
+            return ALLOC_TRACE_TAG_SYSTEM;
+        }
+    }
+    return SYSTEM_ERROR_LIMIT_EXCEEDED;
+#else
+    return g_tag.exchange(tag, std::memory_order_relaxed);
+#endif
+}
+
+int alloc_trace_get_tag() {
+#if PLATFORM_THREADING
+    const auto thread = os_thread_current(nullptr);
+    if (thread) {
+        const auto t = findThreadTag(thread);
+        if (t) {
+            return t->tag.load(std::memory_order_relaxed);
+        }
+    }
+    return ALLOC_TRACE_TAG_SYSTEM;
+#else
+    return g_tag.load(std::memory_order_relaxed);
+#endif
+}
+
+void alloc_trace_release_thread(void* thread) {
+#if PLATFORM_THREADING
+    if (!thread) {
+        return;
+    }
+    const auto t = findThreadTag(thread);
+    if (t) {
+        releaseThreadTag(t);
+    }
+#endif
+}
+
+void alloc_trace_record_alloc(int tag, size_t size) {
+    if (!isValidTag(tag)) {
+        return;
+    }
+    auto s = &g_stats[tag];
+    const uint32_t live = s->liveSize.fetch_add(size, std::memory_order_relaxed) + size;
+    updatePeak(s, live);
+    s->allocCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void alloc_trace_record_free(int tag, size_t size) {
+    if (!isValidTag(tag)) {
+        return;
+    }
+    auto s = &g_stats[tag];
+    s->liveSize.fetch_sub(size, std::memory_order_relaxed);
+    s->freeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void alloc_trace_record_failure(int tag) {
+    if (!isValidTag(tag)) {
+        return;
+    }
+    g_stats[tag].failedCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+int alloc_trace_get_stats(int tag, alloc_trace_stats* stats, uint32_t* period) {
+    if (!isValidTag(tag) || !stats) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const auto s = &g_stats[tag];
+    stats->live_size = s->liveSize.load(std::memory_order_relaxed);
+    stats->peak_size = s->peakSize.load(std::memory_order_relaxed);
+    stats->alloc_count = s->allocCount.load(std::memory_order_relaxed);
+    stats->free_count = s->freeCount.load(std::memory_order_relaxed);
+    stats->failed_count = s->failedCount.load(std::memory_order_relaxed);
+    if (period) {
+        *period = HAL_Timer_Get_Milli_Seconds() - g_resetTime.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+void alloc_trace_reset_stats() {
+    for (auto& s: g_stats) {
+        // The live size is not reset, as the allocated blocks will be freed later
+        s.peakSize.store(s.liveSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        s.allocCount.store(0, std::memory_order_relaxed);
+        s.freeCount.store(0, std::memory_order_relaxed);
+        s.failedCount.store(0, std::memory_order_relaxed);
+    }
+    g_resetTime.store(HAL_Timer_Get_Milli_Seconds(), std::memory_order_relaxed);
+}
+
+const char* alloc_trace_tag_name(int tag) {
+    if (!isValidTag(tag)) {
+        return nullptr;
+    }
+    return TAG_NAMES[tag];
+}
+
+void alloc_trace_dump() {
+    uint32_t period = 0;
+    for (int tag = 0; tag < ALLOC_TRACE_TAG_COUNT; ++tag) {
+        alloc_trace_stats s = {};
+        alloc_trace_get_stats(tag, &s, &period);
+        const uint32_t rate = period ? (uint64_t)s.alloc_count * 1000 / period : 0;
+        LOG(INFO, "%s: live: %u, peak: %u, allocs: %u (%u/s), frees: %u, failed: %u", TAG_NAMES[tag],
+                (unsigned)s.live_size, (unsigned)s.peak_size, (unsigned)s.alloc_count, (unsigned)rate,
+                (unsigned)s.free_count, (unsigned)s.failed_count);
+    }
+    LOG(INFO, "Period: %u ms", (unsigned)period);
+}
@@ -19,9 +19,42 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include "timer_hal.h"
+#include "delay_hal.h"
+#include "concurrent_hal.h"
 #include "service_debug.h"
 #include "static_assert.h"
+#include "ringbuffer.h"
+
+// TODO: Move synchronization macros to some header file
+#if PLATFORM_ID != 3
+
+#define INTERRUPTS_HAL_EXCLUDE_PLATFORM_HEADERS
+#include "spark_wiring_interrupts.h"
+
+#define LOG_DEFERRED_DECLARE_LOCK(name)
+#define LOG_DEFERRED_WITH_LOCK(name) ATOMIC_BLOCK()
+
+#else // PLATFORM_ID == 3
+
+#if PLATFORM_THREADING
+
+#include "spark_wiring_thread.h"
+
+#define LOG_DEFERRED_DECLARE_LOCK(name) RecursiveMutex name
+#define LOG_DEFERRED_WITH_LOCK(name) WITH_LOCK(name)
+
+#else // PLATFORM_ID == 3 && !PLATFORM_THREADING
+
+#define LOG_DEFERRED_DECLARE_LOCK(name)
+#define LOG_DEFERRED_WITH_LOCK(name)
+
+#endif
+
+#endif
 
 #define STATIC_ASSERT_FIELD_SIZE(struct, field, size) \
         STATIC_ASSERT(field_size_changed_##struct##_##field, sizeof(struct::field) == size);
@@ -68,6 +101,532 @@ volatile log_message_callback_type log_msg_callback = 0;
 volatile log_write_callback_type log_write_callback = 0;
 volatile log_enabled_callback_type log_enabled_callback = 0;
 
+using particle::services::RingBuffer;
+
+// Deferred logging state
+RingBuffer<uint8_t> g_deferredBuf;
+size_t g_deferredDropped = 0;
+volatile bool g_deferredEnabled = false;
+LOG_DEFERRED_DECLARE_LOCK(g_deferredLock);
+
+#if PLATFORM_THREADING
+
+// Thread formatting the deferred messages. Messages can be logged from interrupt handlers, which
+// can't wake up the thread, so it polls the buffer instead
+const system_tick_t DEFERRED_THREAD_PERIOD = 10;
+const os_thread_prio_t DEFERRED_THREAD_PRIORITY = OS_THREAD_PRIORITY_DEFAULT - 1;
+
+os_thread_t g_deferredThread = OS_THREAD_INVALID_HANDLE;
+volatile bool g_deferredThreadStop = false;
+
+os_thread_return_t deferredThreadRun(void* param) {
+    while (!g_deferredThreadStop) {
+        log_process_deferred(0, nullptr);
+        HAL_Delay_Milliseconds(DEFERRED_THREAD_PERIOD);
+    }
+    os_thread_exit(nullptr);
+}
+
+int startDeferredThread() {
+    if (g_deferredThread != OS_THREAD_INVALID_HANDLE) {
+        return 0;
+    }
+    g_deferredThreadStop = false;
+    if (os_thread_create(&g_deferredThread, "log", DEFERRED_THREAD_PRIORITY, deferredThreadRun, nullptr,
+            OS_THREAD_STACK_SIZE_DEFAULT) != 0) {
+        g_deferredThread = OS_THREAD_INVALID_HANDLE;
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    return 0;
+}
+
+void stopDeferredThread() {
+    if (g_deferredThread == OS_THREAD_INVALID_HANDLE) {
+        return;
+    }
+    g_deferredThreadStop = true;
+    os_thread_join(g_deferredThread);
+    os_thread_cleanup(g_deferredThread);
+    g_deferredThread = OS_THREAD_INVALID_HANDLE;
+}
+
+#endif // PLATFORM_THREADING
+
+// Type of an argument consumed by a conversion specification
+enum class LogArgType: uint8_t {
+    NONE, // "%%"
+    INT,
+    LONG,
+    LLONG,
+    INTMAX,
+    SIZE,
+    PTRDIFF,
+    DOUBLE,
+    PTR,
+    STR,
+    UNSUPPORTED
+};
+
+struct LogFormatSpec {
+    const char* str; // Points to the '%' character
+    size_t len;
+    unsigned stars; // Number of int arguments consumed for the field width and precision
+    LogArgType type;
+};
+
+const size_t MAX_FORMAT_SPEC_LENGTH = 16;
+
+// Fixed part of a binary record. The record is followed by the format string, the `details`
+// attribute if it's set, and the raw arguments of the message. Strings are stored as a 16-bit
+// length followed by the string characters. The format string is copied, since it's not
+// guaranteed to outlive the log_message() call. The category name is a string literal (see
+// LOG_CATEGORY() and LOG_SOURCE_CATEGORY()) or the name of a logger, which must outlive the
+// logger, and the file and function names are only ever set to __FILE__ and __PRETTY_FUNCTION__
+// by the logging macros, so only their addresses are stored
+struct LogRecordHeader {
+    uint16_t size; // Record size
+    uint8_t level;
+    uint8_t truncated; // Set if some of the string arguments were truncated
+    uint32_t flags; // LogAttributes::flags
+    uint32_t time;
+    int line;
+    intptr_t code;
+    const char* category;
+    const char* file;
+    const char* function;
+};
+
+const uint16_t NULL_STRING_LENGTH = 0xffff;
+
+// Parses a printf-style conversion specification
+const char* parseFormatSpec(const char* fmt, LogFormatSpec* spec) {
+    const char* p = fmt + 1;
+    spec->str = fmt;
+    spec->stars = 0;
+    // Flags
+    while (*p && strchr("-+ #0'", *p)) {
+        ++p;
+    }
+    // Field width
+    if (*p == '*') {
+        ++spec->stars;
+        ++p;
+    } else {
+        while (isdigit((unsigned char)*p)) {
+            ++p;
+        }
+    }
+    // Precision
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            ++spec->stars;
+            ++p;
+        } else {
+            while (isdigit((unsigned char)*p)) {
+                ++p;
+            }
+        }
+    }
+    // Length modifier
+    LogArgType intType = LogArgType::INT;
+    bool longDouble = false;
+    bool wide = false;
+    switch (*p) {
+    case 'h':
+        p += (p[1] == 'h') ? 2 : 1; // Promoted to int
+        break;
+    case 'l':
+        if (p[1] == 'l') {
+            intType = LogArgType::LLONG;
+            p += 2;
+        } else {
+            intType = LogArgType::LONG;
+            wide = true;
+            ++p;
+        }
+        break;
+    case 'j':
+        intType = LogArgType::INTMAX;
+        ++p;
+        break;
+    case 'z':
+        intType = LogArgType::SIZE;
+        ++p;
+        break;
+    case 't':
+        intType = LogArgType::PTRDIFF;
+        ++p;
+        break;
+    case 'L':
+        longDouble = true;
+        ++p;
+        break;
+    default:
+        break;
+    }
+    // Conversion specifier
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        spec->type = intType;
+        break;
+    case 'c':
+        spec->type = wide ? LogArgType::UNSUPPORTED : LogArgType::INT;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->type = longDouble ? LogArgType::UNSUPPORTED : LogArgType::DOUBLE;
+        break;
+    case 'p':
+        spec->type = LogArgType::PTR;
+        break;
+    case 's':
+        spec->type = wide ? LogArgType::UNSUPPORTED : LogArgType::STR;
+        break;
+    case '%':
+        spec->type = (p == fmt + 1) ? LogArgType::NONE : LogArgType::UNSUPPORTED;
+        break;
+    default:
+        spec->type = LogArgType::UNSUPPORTED; // %n, etc.
+        break;
+    }
+    if (*p) {
+        ++p;
+    }
+    spec->len = p - fmt;
+    if (spec->len > MAX_FORMAT_SPEC_LENGTH) {
+        spec->type = LogArgType::UNSUPPORTED;
+    }
+    return p;
+}
+
+class LogRecordWriter {
+public:
+    LogRecordWriter(uint8_t* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            offs_(0),
+            ok_(true),
+            truncated_(false) {
+    }
+
+    template<typename T>
+    void write(const T& val) {
+        if (offs_ + sizeof(T) > size_) {
+            ok_ = false;
+            return;
+        }
+        memcpy(buf_ + offs_, &val, sizeof(T));
+        offs_ += sizeof(T);
+    }
+
+    void writeString(const char* str) {
+        if (!str) {
+            write(NULL_STRING_LENGTH);
+            return;
+        }
+        // Long strings are truncated to the space available in the record
+        const size_t avail = (offs_ + sizeof(uint16_t) < size_) ? size_ - offs_ - sizeof(uint16_t) : 0;
+        uint16_t len = strnlen(str, avail + 1);
+        if (len > avail) {
+            truncated_ = true;
+            len = avail;
+        }
+        write(len);
+        if (ok_) {
+            memcpy(buf_ + offs_, str, len);
+            offs_ += len;
+        }
+    }
+
+    // Stores a string that can't be truncated. The string is stored with a terminating null
+    // character, so that it can be used directly from the record
+    void writeCString(const char* str) {
+        if (!str) {
+            write(NULL_STRING_LENGTH);
+            return;
+        }
+        const size_t len = strlen(str);
+        if (len >= NULL_STRING_LENGTH || offs_ + sizeof(uint16_t) + len + 1 > size_) {
+            ok_ = false;
+            return;
+        }
+        write((uint16_t)len);
+        memcpy(buf_ + offs_, str, len + 1);
+        offs_ += len + 1;
+    }
+
+    size_t size() const {
+        return offs_;
+    }
+
+    bool ok() const {
+        return ok_;
+    }
+
+    bool truncated() const {
+        return truncated_;
+    }
+
+private:
+    uint8_t* buf_;
+    size_t size_;
+    size_t offs_;
+    bool ok_;
+    bool truncated_;
+};
+
+class LogRecordReader {
+public:
+    LogRecordReader(const uint8_t* buf, size_t size) :
+            buf_(buf),
+            size_(size),
+            offs_(0) {
+    }
+
+    template<typename T>
+    T read() {
+        T val = T();
+        if (offs_ + sizeof(T) <= size_) {
+            memcpy(&val, buf_ + offs_, sizeof(T));
+            offs_ += sizeof(T);
+        }
+        return val;
+    }
+
+    // Returns a string stored in the record. The string is copied to the provided buffer
+    const char* readString(char* str, size_t size) {
+        const uint16_t len = read<uint16_t>();
+        if (len == NULL_STRING_LENGTH) {
+            return nullptr;
+        }
+        const size_t n = std::min<size_t>(std::min<size_t>(len, size_ - offs_), size - 1);
+        memcpy(str, buf_ + offs_, n);
+        str[n] = '\0';
+        offs_ += len;
+        return str;
+    }
+
+    // Returns a string stored with writeCString(). The returned pointer refers to the record data
+    const char* readCString() {
+        const uint16_t len = read<uint16_t>();
+        if (len == NULL_STRING_LENGTH || offs_ + len + 1 > size_ || buf_[offs_ + len] != '\0') {
+            return nullptr;
+        }
+        const auto str = (const char*)buf_ + offs_;
+        offs_ += len + 1;
+        return str;
+    }
+
+private:
+    const uint8_t* buf_;
+    size_t size_;
+    size_t offs_;
+};
+
+// Encodes a log message into a binary record. Returns the record size or 0 if the message cannot
+// be represented in binary form
+size_t encodeLogRecord(uint8_t* buf, size_t size, int level, const char* category, const LogAttributes* attr,
+        const char* fmt, va_list args) {
+    LogRecordHeader h = {};
+    h.level = level;
+    h.flags = attr->flags;
+    h.time = attr->time;
+    h.line = attr->has_line ? attr->line : 0;
+    h.code = attr->has_code ? attr->code : 0;
+    h.category = category;
+    h.file = attr->has_file ? attr->file : nullptr;
+    h.function = attr->has_function ? attr->function : nullptr;
+    LogRecordWriter w(buf, size);
+    w.write(h);
+    // Messages with a format string that doesn't fit in the record are formatted immediately
+    w.writeCString(fmt);
+    if (!w.ok()) {
+        return 0;
+    }
+    if (attr->has_details) {
+        w.writeString(attr->details);
+    }
+    const char* p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            ++p;
+            continue;
+        }
+        LogFormatSpec spec = {};
+        p = parseFormatSpec(p, &spec);
+        for (unsigned i = 0; i < spec.stars; ++i) {
+            w.write(va_arg(args, int));
+        }
+        switch (spec.type) {
+        case LogArgType::NONE:
+            break;
+        case LogArgType::INT:
+            w.write(va_arg(args, int));
+            break;
+        case LogArgType::LONG:
+            w.write(va_arg(args, long));
+            break;
+        case LogArgType::LLONG:
+            w.write(va_arg(args, long long));
+            break;
+        case LogArgType::INTMAX:
+            w.write(va_arg(args, intmax_t));
+            break;
+        case LogArgType::SIZE:
+            w.write(va_arg(args, size_t));
+            break;
+        case LogArgType::PTRDIFF:
+            w.write(va_arg(args, ptrdiff_t));
+            break;
+        case LogArgType::DOUBLE:
+            w.write(va_arg(args, double));
+            break;
+        case LogArgType::PTR:
+            w.write(va_arg(args, void*));
+            break;
+        case LogArgType::STR:
+            w.writeString(va_arg(args, const char*));
+            break;
+        default:
+            return 0;
+        }
+        if (!w.ok()) {
+            return 0;
+        }
+    }
+    if (!w.ok()) {
+        return 0;
+    }
+    const auto hdr = (LogRecordHeader*)buf;
+    hdr->size = w.size();
+    hdr->truncated = w.truncated();
+    return w.size();
+}
+
+template<typename T>
+int formatArg(char* buf, size_t size, const char* spec, const int* stars, unsigned starCount, T val) {
+    switch (starCount) {
+    case 0:
+        return snprintf(buf, size, spec, val);
+    case 1:
+        return snprintf(buf, size, spec, stars[0], val);
+    default:
+        return snprintf(buf, size, spec, stars[0], stars[1], val);
+    }
+}
+
+// Formats a message stored in a binary record
+void formatLogRecord(char* buf, size_t size, const LogRecordHeader& h, const char* fmt, LogRecordReader& r) {
+    char spec[MAX_FORMAT_SPEC_LENGTH + 1];
+    char str[LOG_MAX_STRING_LENGTH];
+    size_t offs = 0; // Total length of the formatted message
+    const char* p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            if (offs < size - 1) {
+                buf[offs] = *p;
+            }
+            ++offs;
+            ++p;
+            continue;
+        }
+        LogFormatSpec s = {};
+        p = parseFormatSpec(p, &s);
+        if (s.type == LogArgType::NONE) {
+            if (offs < size - 1) {
+                buf[offs] = '%';
+            }
+            ++offs;
+            continue;
+        }
+        memcpy(spec, s.str, s.len);
+        spec[s.len] = '\0';
+        int stars[2] = {};
+        for (unsigned i = 0; i < s.stars; ++i) {
+            stars[i] = r.read<int>();
+        }
+        char* const dest = buf + std::min(offs, size - 1);
+        const size_t avail = size - std::min(offs, size - 1);
+        int n = 0;
+        switch (s.type) {
+        case LogArgType::INT:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<int>());
+            break;
+        case LogArgType::LONG:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<long>());
+            break;
+        case LogArgType::LLONG:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<long long>());
+            break;
+        case LogArgType::INTMAX:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<intmax_t>());
+            break;
+        case LogArgType::SIZE:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<size_t>());
+            break;
+        case LogArgType::PTRDIFF:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<ptrdiff_t>());
+            break;
+        case LogArgType::DOUBLE:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<double>());
+            break;
+        case LogArgType::PTR:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.read<void*>());
+            break;
+        case LogArgType::STR:
+            n = formatArg(dest, avail, spec, stars, s.stars, r.readString(str, sizeof(str)));
+            break;
+        default:
+            break;
+        }
+        if (n > 0) {
+            offs += n;
+        }
+    }
+    if (offs > size - 1 || (h.truncated && offs > 0)) {
+        offs = std::min(offs, size - 1);
+        buf[offs - 1] = '~';
+    }
+    buf[offs] = '\0';
+}
+
+// Stores a message in the deferred logging buffer. Returns false if the message needs to be
+// formatted immediately
+bool logMessageDeferred(int level, const char *category, LogAttributes *attr, const char *fmt, va_list args) {
+    const log_enabled_callback_type enabled_callback = log_enabled_callback;
+    if (enabled_callback && !enabled_callback(level, category, 0)) {
+        return true; // Filter the message before paying for its encoding
+    }
+    uint8_t buf[LOG_DEFERRED_MAX_RECORD_SIZE];
+    const size_t size = encodeLogRecord(buf, sizeof(buf), level, category, attr, fmt, args);
+    if (!size) {
+        return false;
+    }
+    LOG_DEFERRED_WITH_LOCK(g_deferredLock) {
+        if (!g_deferredEnabled) {
+            return false;
+        }
+        if (g_deferredBuf.space() < (ssize_t)size) {
+            ++g_deferredDropped;
+        } else {
+            g_deferredBuf.put(buf, size);
+        }
+    }
+    return true;
+}
+
 } // namespace
 
 void log_set_callbacks(log_message_callback_type log_msg, log_write_callback_type log_write,
@@ -86,6 +645,15 @@ void log_message_v(int level, const char *category, LogAttributes *attr, void *r
     if (!attr->has_time) {
         LOG_ATTR_SET(*attr, time, HAL_Timer_Get_Milli_Seconds());
     }
+    if (msg_callback && g_deferredEnabled) {
+        va_list argsCopy;
+        va_copy(argsCopy, args);
+        const bool ok = logMessageDeferred(level, category, attr, fmt, argsCopy);
+        va_end(argsCopy);
+        if (ok) {
+            return;
+        }
+    }
     char buf[LOG_MAX_STRING_LENGTH];
     if (msg_callback) {
         const int n = vsnprintf(buf, sizeof(buf), fmt, args);
@@ -210,6 +778,97 @@ void log_dump(int level, const char *category, const void *data, size_t size, in
     }
 }
 
+int log_set_deferred_buffer(void *buffer, size_t size, void *reserved) {
+    if (buffer && size < LOG_DEFERRED_MAX_RECORD_SIZE) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+#if PLATFORM_THREADING
+    if (buffer) {
+        const int ret = startDeferredThread();
+        if (ret < 0) {
+            return ret;
+        }
+    } else {
+        stopDeferredThread();
+    }
+#endif
+    if (!buffer) {
+        log_process_deferred(0, nullptr);
+    }
+    LOG_DEFERRED_WITH_LOCK(g_deferredLock) {
+        if (buffer) {
+            g_deferredBuf.init((uint8_t*)buffer, size);
+        } else {
+            g_deferredBuf.init(nullptr, 0);
+        }
+        g_deferredDropped = 0;
+        g_deferredEnabled = buffer;
+    }
+    return 0;
+}
+
+int log_process_deferred(size_t max_count, void *reserved) {
+    int count = 0;
+    for (;;) {
+        if (max_count && (size_t)count >= max_count) {
+            break;
+        }
+        uint8_t rec[LOG_DEFERRED_MAX_RECORD_SIZE];
+        size_t recSize = 0;
+        size_t dropped = 0;
+        LOG_DEFERRED_WITH_LOCK(g_deferredLock) {
+            uint16_t n = 0;
+            if (g_deferredEnabled && g_deferredBuf.data() >= (ssize_t)sizeof(LogRecordHeader) &&
+                    g_deferredBuf.peek((uint8_t*)&n, sizeof(n)) == sizeof(n)) {
+                g_deferredBuf.get(rec, n);
+                recSize = n;
+            }
+            if (!recSize) {
+                dropped = g_deferredDropped;
+                g_deferredDropped = 0;
+            }
+        }
+        const log_message_callback_type msg_callback = log_msg_callback;
+        if (!recSize) {
+            if (dropped && msg_callback) {
+                LogAttributes attr = {};
+                attr.size = sizeof(LogAttributes);
+                LOG_ATTR_SET(attr, time, HAL_Timer_Get_Milli_Seconds());
+                char buf[64];
+                snprintf(buf, sizeof(buf), "%u deferred message(s) dropped", (unsigned)dropped);
+                msg_callback(buf, LOG_LEVEL_WARN, nullptr, &attr, 0);
+            }
+            break;
+        }
+        ++count;
+        if (!msg_callback) {
+            continue;
+        }
+        LogRecordReader r(rec, recSize);
+        const auto h = r.read<LogRecordHeader>();
+        LogAttributes attr = {};
+        attr.size = sizeof(LogAttributes);
+        attr.flags = h.flags;
+        attr.time = h.time;
+        attr.line = h.line;
+        attr.code = h.code;
+        attr.file = h.file;
+        attr.function = h.function;
+        const char* const fmt = r.readCString();
+        if (!fmt) {
+            continue; // Malformed record
+        }
+        char details[LOG_MAX_STRING_LENGTH];
+        if (attr.has_details) {
+            attr.details = r.readString(details, sizeof(details));
+        }
+        char buf[LOG_MAX_STRING_LENGTH];
+        formatLogRecord(buf, sizeof(buf), h, fmt, r);
+        msg_callback(buf, h.level, h.category, &attr, 0);
+    }
+    return count;
+}
+
 int log_enabled(int level, const char *category, void *reserved) {
     const log_enabled_callback_type enabled_callback = log_enabled_callback;
     if (enabled_callback) {
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "persistent_queue.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "endian_util.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace particle {
+
+namespace {
+
+const size_t MAX_PATH_LENGTH = PersistentQueue::MAX_PREFIX_LENGTH + 12;
+
+// CRC-32 (IEEE 802.3) computed a nibble at a time to keep the table small
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    auto p = (const uint8_t*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ p[i]) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (p[i] >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+} // namespace
+
+class PersistentQueue::File {
+public:
+    explicit File(lfs_t* lfs) :
+            lfs_(lfs),
+            file_(),
+            open_(false) {
+    }
+
+    ~File() {
+        close();
+    }
+
+    int open(const char* path, int flags) {
+        const int r = lfs_file_open(lfs_, &file_, path, flags);
+        if (r < 0) {
+            return r;
+        }
+        open_ = true;
+        return 0;
+    }
+
+    int close() {
+        if (!open_) {
+            return 0;
+        }
+        open_ = false;
+        return lfs_file_close(lfs_, &file_);
+    }
+
+    lfs_t* lfs() const {
+        return lfs_;
+    }
+
+    lfs_file_t* file() {
+        return &file_;
+    }
+
+private:
+    lfs_t* lfs_;
+    lfs_file_t file_;
+    bool open_;
+};
+
+PersistentQueue::PersistentQueue(const char* prefix, size_t segmentSize, unsigned maxSegments, size_t syncSize) :
+        indexPath_(),
+        indexFile_(indexPath_),
+        prefix_(prefix),
+        segSize_(std::min<size_t>(segmentSize, 0xffff + RECORD_HEADER_SIZE)),
+        maxSegs_(std::max(maxSegments, 1u)),
+        index_(),
+        readOffs_(0),
+        readEnd_(0),
+        writeOffs_(0),
+        syncOffs_(0),
+        syncSize_(std::max<size_t>(syncSize, 1)),
+        writeFile_(),
+        writeOpen_(false),
+        inited_(false) {
+    snprintf(indexPath_, sizeof(indexPath_), "%s.idx", prefix);
+}
+
+PersistentQueue::~PersistentQueue() {
+    if (!writeOpen_) {
+        return;
+    }
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return;
+    }
+    const fs::FsLock lock(fs);
+    closeBack(&fs->instance);
+}
+
+int PersistentQueue::init() {
+    if (inited_) {
+        return 0;
+    }
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return SYSTEM_ERROR_FILE;
+    }
+    const fs::FsLock lock(fs);
+    Index index = {};
+    const int r = indexFile_.load(&index, sizeof(index));
+    indexFile_.close();
+    if (r == sizeof(index) && index.last - index.first < maxSegs_) {
+        index_ = index;
+    } else {
+        if (r != SYSTEM_ERROR_NOT_FOUND) {
+            LOG(WARN, "%s: Invalid index", indexPath_);
+        }
+        index_ = Index();
+        CHECK(saveIndex());
+    }
+    readOffs_ = 0;
+    readEnd_ = 0;
+    CHECK(recover(&fs->instance));
+    inited_ = true;
+    return 0;
+}
+
+int PersistentQueue::push(const void* data, size_t size) {
+    CHECK(init());
+    if (size > maxRecordSize()) {
+        return SYSTEM_ERROR_TOO_LARGE;
+    }
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return SYSTEM_ERROR_FILE;
+    }
+    const fs::FsLock lock(fs);
+    const auto lfs = &fs->instance;
+    if (writeOffs_ + RECORD_HEADER_SIZE + size > segSize_) {
+        CHECK(closeBack(lfs));
+        CHECK(startSegment());
+    }
+    CHECK(openBack(lfs));
+    uint8_t h[RECORD_HEADER_SIZE] = {};
+    const auto n = nativeToLittleEndian<uint16_t>(size);
+    const auto crc = nativeToLittleEndian<uint32_t>(crc32(data, size));
+    memcpy(h, &n, sizeof(n));
+    memcpy(h + sizeof(n), &crc, sizeof(crc));
+    int r = lfs_file_write(lfs, &writeFile_, h, sizeof(h));
+    if (r == (int)sizeof(h) && size > 0) {
+        r = lfs_file_write(lfs, &writeFile_, data, size) + sizeof(h);
+    }
+    if (r != (int)(sizeof(h) + size)) {
+        LOG(ERROR, "%s: lfs_file_write() failed: %d", prefix_, r);
+        // Discard the partially written record
+        lfs_file_truncate(lfs, &writeFile_, writeOffs_);
+        return SYSTEM_ERROR_FILE;
+    }
+    writeOffs_ += sizeof(h) + size;
+    if (writeOffs_ - syncOffs_ >= syncSize_) {
+        CHECK(syncBack(lfs));
+    }
+    return 0;
+}
+
+int PersistentQueue::sync() {
+    if (!writeOpen_) {
+        return 0;
+    }
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return SYSTEM_ERROR_FILE;
+    }
+    const fs::FsLock lock(fs);
+    return syncBack(&fs->instance);
+}
+
+int PersistentQueue::peek(void* data, size_t size) {
+    CHECK(init());
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return SYSTEM_ERROR_FILE;
+    }
+    const fs::FsLock lock(fs);
+    for (;;) {
+        File f(&fs->instance);
+        RecordHeader h = {};
+        CHECK(openFront(&f, &h));
+        if (size < h.size) {
+            return SYSTEM_ERROR_TOO_LARGE;
+        }
+        const int r = lfs_file_read(f.lfs(), f.file(), data, h.size);
+        if (r < 0) {
+            LOG(ERROR, "lfs_file_read() failed: %d", r);
+            return SYSTEM_ERROR_FILE;
+        }
+        if (r == (int)h.size && crc32(data, h.size) == h.crc) {
+            return h.size;
+        }
+        // The size of the record can't be trusted either, so the rest of the segment is skipped
+        LOG(WARN, "%s: Discarding corrupted segment %u", prefix_, (unsigned)index_.first);
+        f.close();
+        dropFirstSegment(&fs->instance);
+    }
+}
+
+int PersistentQueue::pop() {
+    CHECK(init());
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return SYSTEM_ERROR_FILE;
+    }
+    const fs::FsLock lock(fs);
+    File f(&fs->instance);
+    RecordHeader h = {};
+    CHECK(openFront(&f, &h));
+    f.close();
+    readOffs_ += RECORD_HEADER_SIZE + h.size;
+    // Remove the segment right away so that its records are not read again after a reset
+    if (empty() || (index_.first != index_.last && readOffs_ >= readEnd_)) {
+        dropFirstSegment(&fs->instance);
+    }
+    return 0;
+}
+
+void PersistentQueue::clear() {
+    const auto fs = filesystem_get_instance(nullptr);
+    if (!fs) {
+        return;
+    }
+    const fs::FsLock lock(fs);
+    if (init() < 0) {
+        return;
+    }
+    while (index_.first != index_.last) {
+        dropFirstSegment(&fs->instance);
+    }
+    dropFirstSegment(&fs->instance);
+}
+
+int PersistentQueue::openFront(File* file, RecordHeader* header) {
+    for (;;) {
+        if (empty()) {
+            return SYSTEM_ERROR_NOT_FOUND;
+        }
+        const bool last = (index_.first == index_.last);
+        if (last) {
+            // The records need to be committed before they can be read via another file handle
+            CHECK(syncBack(file->lfs()));
+        }
+        char path[MAX_PATH_LENGTH] = {};
+        segmentPath(path, sizeof(path), index_.first);
+        int r = file->open(path, LFS_O_RDONLY);
+        if (r == 0) {
+            const auto size = lfs_file_size(file->lfs(), file->file());
+            if (size < 0) {
+                LOG(ERROR, "%s: lfs_file_size() failed: %d", path, size);
+                return SYSTEM_ERROR_FILE;
+            }
+            readEnd_ = last ? writeOffs_ : size;
+            if (readOffs_ < readEnd_) {
+                r = lfs_file_seek(file->lfs(), file->file(), readOffs_, LFS_SEEK_SET);
+                if (r < 0) {
+                    LOG(ERROR, "%s: lfs_file_seek() failed: %d", path, r);
+                    return SYSTEM_ERROR_FILE;
+                }
+                r = readHeader(file->lfs(), file->file(), header);
+                if (r == 0 && readOffs_ + RECORD_HEADER_SIZE + header->size <= readEnd_) {
+                    return 0;
+                }
+                if (r == SYSTEM_ERROR_FILE) {
+                    return r;
+                }
+                LOG(WARN, "%s: Discarding invalid data", path);
+            }
+            file->close();
+        } else if (r != LFS_ERR_NOENT) {
+            LOG(ERROR, "%s: lfs_file_open() failed: %d", path, r);
+            return SYSTEM_ERROR_FILE;
+        }
+        dropFirstSegment(file->lfs());
+    }
+}
+
+int PersistentQueue::recover(lfs_t* lfs) {
+    char path[MAX_PATH_LENGTH] = {};
+    segmentPath(path, sizeof(path), index_.last);
+    File f(lfs);
+    int r = f.open(path, LFS_O_RDWR);
+    if (r == LFS_ERR_NOENT) {
+        writeOffs_ = 0;
+        return 0;
+    }
+    if (r < 0) {
+        LOG(ERROR, "%s: lfs_file_open() failed: %d", path, r);
+        return SYSTEM_ERROR_FILE;
+    }
+    const auto size = lfs_file_size(lfs, f.file());
+    if (size < 0) {
+        LOG(ERROR, "%s: lfs_file_size() failed: %d", path, size);
+        return SYSTEM_ERROR_FILE;
+    }
+    // Find the end of the last record that was written completely
+    size_t offs = 0;
+    for (;;) {
+        RecordHeader h = {};
+        r = readHeader(lfs, f.file(), &h);
+        if (r < 0) {
+            if (r == SYSTEM_ERROR_FILE) {
+                return r;
+            }
+            break;
+        }
+        if (offs + RECORD_HEADER_SIZE + h.size > (size_t)size) {
+            break;
+        }
+        uint8_t buf[64];
+        uint32_t crc = 0;
+        size_t n = h.size;
+        while (n > 0) {
+            const size_t k = std::min(n, sizeof(buf));
+            r = lfs_file_read(lfs, f.file(), buf, k);
+            if (r != (int)k) {
+                break;
+            }
+            crc = crc32(buf, k, crc);
+            n -= k;
+        }
+        if (n > 0 || crc != h.crc) {
+            break;
+        }
+        offs += RECORD_HEADER_SIZE + h.size;
+    }
+    if (offs < (size_t)size) {
+        LOG(WARN, "%s: Discarding %u bytes of invalid data", path, (unsigned)(size - offs));
+        r = lfs_file_truncate(lfs, f.file(), offs);
+        if (r < 0) {
+            LOG(ERROR, "%s: lfs_file_truncate() failed: %d", path, r);
+            return SYSTEM_ERROR_FILE;
+        }
+    }
+    r = f.close();
+    if (r < 0) {
+        LOG(ERROR, "%s: lfs_file_close() failed: %d", path, r);
+        return SYSTEM_ERROR_FILE;
+    }
+    writeOffs_ = offs;
+    return 0;
+}
+
+int PersistentQueue::openBack(lfs_t* lfs) {
+    if (writeOpen_) {
+        return 0;
+    }
+    char path[MAX_PATH_LENGTH] = {};
+    segmentPath(path, sizeof(path), index_.last);
+    const int r = lfs_file_open(lfs, &writeFile_, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+    if (r < 0) {
+        LOG(ERROR, "%s: lfs_file_open() failed: %d", path, r);
+        return SYSTEM_ERROR_FILE;
+    }
+    writeOpen_ = true;
+    syncOffs_ = writeOffs_;
+    return 0;
+}
+
+int PersistentQueue::syncBack(lfs_t* lfs) {
+    if (!writeOpen_ || syncOffs_ == writeOffs_) {
+        return 0;
+    }
+    const int r = lfs_file_sync(lfs, &writeFile_);
+    if (r < 0) {
+        LOG(ERROR, "%s: lfs_file_sync() failed: %d", prefix_, r);
+        return SYSTEM_ERROR_FILE;
+    }
+    syncOffs_ = writeOffs_;
+    return 0;
+}
+
+int PersistentQueue::closeBack(lfs_t* lfs) {
+    if (!writeOpen_) {
+        return 0;
+    }
+    writeOpen_ = false;
+    syncOffs_ = writeOffs_;
+    const int r = lfs_file_close(lfs, &writeFile_);
+    if (r < 0) {
+        LOG(ERROR, "%s: lfs_file_close() failed: %d", prefix_, r);
+        return SYSTEM_ERROR_FILE;
+    }
+    return 0;
+}
+
+int PersistentQueue::startSegment() {
+    if (index_.last - index_.first + 1 >= maxSegs_) {
+        return SYSTEM_ERROR_LIMIT_EXCEEDED;
+    }
+    ++index_.last;
+    const int r = saveIndex();
+    if (r < 0) {
+        --index_.last;
+        return r;
+    }
+    writeOffs_ = 0;
+    return 0;
+}
+
+void PersistentQueue::dropFirstSegment(lfs_t* lfs) {
+    if (index_.first == index_.last) {
+        closeBack(lfs);
+    }
+    char path[MAX_PATH_LENGTH] = {};
+    segmentPath(path, sizeof(path), index_.first);
+    const int r = lfs_remove(lfs, path);
+    if (r < 0 && r != LFS_ERR_NOENT) {
+        LOG(ERROR, "%s: lfs_remove() failed: %d", path, r);
+    }
+    readOffs_ = 0;
+    readEnd_ = 0;
+    if (index_.first == index_.last) {
+        // The segment is reused, which doesn't require updating the index
+        writeOffs_ = 0;
+        return;
+    }
+    ++index_.first;
+    saveIndex();
+}
+
+int PersistentQueue::saveIndex() {
+    const int r = indexFile_.save(&index_, sizeof(index_));
+    indexFile_.close();
+    if (r < 0) {
+        return r;
+    }
+    return 0;
+}
+
+void PersistentQueue::segmentPath(char* buf, size_t size, uint32_t seg) const {
+    snprintf(buf, size, "%s.%lu", prefix_, (unsigned long)seg);
+}
+
+int PersistentQueue::readHeader(lfs_t* lfs, lfs_file_t* file, RecordHeader* header) {
+    uint8_t h[RECORD_HEADER_SIZE] = {};
+    const int r = lfs_file_read(lfs, file, h, sizeof(h));
+    if (r < 0) {
+        LOG(ERROR, "lfs_file_read() failed: %d", r);
+        return SYSTEM_ERROR_FILE;
+    }
+    if (r == 0) {
+        return SYSTEM_ERROR_END_OF_STREAM;
+    }
+    if (r != (int)sizeof(h)) {
+        return SYSTEM_ERROR_BAD_DATA;
+    }
+    uint16_t n = 0;
+    uint32_t crc = 0;
+    memcpy(&n, h, sizeof(n));
+    memcpy(&crc, h + sizeof(n), sizeof(crc));
+    header->size = littleEndianToNative(n);
+    header->crc = littleEndianToNative(crc);
+    return 0;
+}
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+namespace particle {
+
+/**
+ * Open-addressing hash index over the string keys of an array-like container.
+ *
+ * The index doesn't store the keys: the elements are referenced by their position in the container,
+ * and the keys are obtained via a callback when a hash match needs to be confirmed. Removing an
+ * element from the container requires rebuilding the index.
+ */
+class KeyIndex {
+public:
+    typedef uint32_t Hash;
+
+    /**
+     * Maximum number of elements that can be indexed. The element indices are stored as 16-bit
+     * values, one of which denotes an empty slot.
+     */
+    static const size_t MAX_SIZE = UINT16_MAX - 1;
+
+    KeyIndex() :
+            slots_(nullptr),
+            capacity_(0),
+            size_(0) {
+    }
+
+    ~KeyIndex() {
+        free(slots_);
+    }
+
+    /**
+     * Computes the hash of a key (FNV-1a).
+     *
+     * @param key Key.
+     * @param maxLen Maximum length of the key.
+     */
+    static Hash hash(const char* key, size_t maxLen) {
+        Hash h = 2166136261u;
+        for (size_t i = 0; i < maxLen && key[i]; ++i) {
+            h = (h ^ (uint8_t)key[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    /**
+     * Finds an element.
+     *
+     * @param key Key.
+     * @param h Hash of the key.
+     * @param maxLen Maximum length of the key.
+     * @param keyAt Callback returning the key of the element with a given index.
+     * @return Index of the element, or -1 if the element is not found.
+     */
+    template<typename KeyAtFn>
+    int find(const char* key, Hash h, size_t maxLen, KeyAtFn keyAt) const {
+        if (!capacity_) {
+            return -1;
+        }
+        const size_t mask = capacity_ - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& s = slots_[i];
+            if (!s.index) {
+                return -1;
+            }
+            if (s.hash == h && strncmp(keyAt(s.index - 1), key, maxLen) == 0) {
+                return s.index - 1;
+            }
+        }
+    }
+
+    /**
+     * Adds an element to the index.
+     *
+     * @param index Index of the element in the container.
+     * @param h Hash of the element's key.
+     * @return `true` on success, or `false` if the index couldn't be grown or `index` is not less
+     *         than `MAX_SIZE`.
+     */
+    bool insert(unsigned index, Hash h) {
+        if (index >= MAX_SIZE || ((size_ + 1) * 2 > capacity_ && !grow())) {
+            return false;
+        }
+        insertSlot(index + 1, h);
+        ++size_;
+        return true;
+    }
+
+    /**
+     * Removes all elements from the index.
+     */
+    void clear() {
+        if (slots_) {
+            memset(slots_, 0, capacity_ * sizeof(Slot));
+        }
+        size_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    struct Slot {
+        Hash hash; // Key hash. Kept in full, since the slot position depends on more than 16 bits
+                   // of the hash once the capacity exceeds 65536
+        uint16_t index; // Element index + 1, or 0 if the slot is empty
+    };
+
+    static const size_t MIN_CAPACITY = 8;
+
+    Slot* slots_;
+    size_t capacity_;
+    size_t size_;
+
+    void insertSlot(uint16_t index, Hash h) {
+        const size_t mask = capacity_ - 1;
+        size_t i = h & mask;
+        while (slots_[i].index) {
+            i = (i + 1) & mask;
+        }
+        slots_[i].hash = h;
+        slots_[i].index = index;
+    }
+
+    bool grow() {
+        // Keep the load factor at or below 1/2
+        const size_t capacity = capacity_ ? capacity_ * 2 : MIN_CAPACITY;
+        const auto slots = (Slot*)calloc(capacity, sizeof(Slot));
+        if (!slots) {
+            return false;
+        }
+        const auto oldSlots = slots_;
+        const size_t oldCapacity = capacity_;
+        slots_ = slots;
+        capacity_ = capacity;
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldSlots[i].index) {
+                insertSlot(oldSlots[i].index, oldSlots[i].hash);
+            }
+        }
+        free(oldSlots);
+        return true;
+    }
+};
+
+} // namespace particle
@@ -179,6 +179,17 @@ const uint32_t PUBLISH_EVENT_FLAG_WITH_ACK = 0x8;
  * This is a stop-gap solution until all synchronous APIs return futures, allowing asynchronous operation.
  */
 const uint32_t PUBLISH_EVENT_FLAG_ASYNC = EventType::ASYNC;
+/**
+ * The event can be sent together with other batched events in a single message.
+ */
+const uint32_t PUBLISH_EVENT_FLAG_BATCH = EventType::BATCH;
+/**
+ * The event is stored in the filesystem if it cannot be sent right away, and is sent once the
+ * device is connected to the Cloud. Events published with this flag are sent in order.
+ *
+ * This flag is handled by the system layer and is ignored on platforms without a filesystem.
+ */
+const uint32_t PUBLISH_EVENT_FLAG_PERSISTENT = 0x20;
 
 
 PARTICLE_STATIC_ASSERT(publish_no_ack_flag_matches, PUBLISH_EVENT_FLAG_NO_ACK==EventType::NO_ACK);
@@ -347,7 +358,10 @@ typedef enum spark_connection_property {
     SPARK_CLOUD_DISCONNECT_OPTIONS = 2, ///< Default disconnection options (set).
     SPARK_CLOUD_MAX_EVENT_DATA_SIZE = 3, ///< Maximum size of event data (get).
     SPARK_CLOUD_MAX_VARIABLE_VALUE_SIZE = 4, ///< Maximum size of a variable value (get).
-    SPARK_CLOUD_MAX_FUNCTION_ARGUMENT_SIZE = 5 ///< Maximum size of a function call argument (get).
+    SPARK_CLOUD_MAX_FUNCTION_ARGUMENT_SIZE = 5, ///< Maximum size of a function call argument (get).
+    SPARK_CLOUD_PUBLISH_DELAY = 6, ///< Time in milliseconds until an event can be published without being rate limited (get).
+    SPARK_CLOUD_OTA_RECEIVE_WINDOW_SIZE = 7, ///< Size of the receiver window for OTA updates in bytes (set).
+    SPARK_CLOUD_RECORD_PACKING = 8 ///< Maximum size of a datagram into which the outgoing DTLS records are packed, or 0 to disable packing (set).
 } spark_connection_property;
 
 int spark_set_connection_property(unsigned property, unsigned value, const void* data, void* reserved);
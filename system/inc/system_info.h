@@ -133,6 +133,17 @@ int system_format_diag_data(const uint16_t* id, size_t count, unsigned flags, ap
 
 bool system_metrics(appender_fn appender, void* append_data, uint32_t flags, uint32_t page, void* reserved=NULL);
 
+/**
+ * Formats the per-subsystem heap statistics collected by the allocation tracer in JSON.
+ *
+ * @param append Appender function.
+ * @param append_data Opaque data passed to the appender function.
+ * @param reserved Reserved argument (should be set to NULL).
+ * @return 0 on success, or `SYSTEM_ERROR_NOT_SUPPORTED` if the firmware is built without
+ *         allocation tracing (see `USE_ALLOC_TRACE`).
+ */
+int system_format_alloc_trace(appender_fn append, void* append_data, void* reserved);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
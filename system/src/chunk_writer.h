@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "concurrent_hal.h"
+#include "system_error.h"
+
+#include <memory>
+#include <new>
+#include <cstring>
+#include <cstdint>
+
+namespace particle {
+
+namespace system {
+
+namespace detail {
+
+/**
+ * Writes chunks of the update binary to the flash in a background thread.
+ *
+ * Chunks are copied to one of the staging buffers and written in the order they were received.
+ * The first error returned by the target is latched: the remaining staged chunks are discarded
+ * and the error is reported by all subsequent calls to `write()` and `flush()`.
+ *
+ * The target class needs to provide the following methods, which are called by the writer
+ * thread:
+ *
+ * `int writeChunk(const char* data, size_t size, size_t offset)`
+ * `void chunkWritten(const char* data, size_t size, size_t offset, size_t partialSize)`
+ */
+template<typename TargetT>
+class ChunkWriter {
+public:
+    static const unsigned BUFFER_COUNT = 2;
+
+    explicit ChunkWriter(TargetT* target) :
+            target_(target),
+            freeBufs_(nullptr),
+            pendingBufs_(nullptr),
+            thread_(OS_THREAD_INVALID_HANDLE),
+            error_(0) {
+    }
+
+    ~ChunkWriter() {
+        destroy();
+    }
+
+    int init(size_t stackSize) {
+        if (os_queue_create(&freeBufs_, sizeof(uint8_t), BUFFER_COUNT, nullptr) != 0 ||
+                os_queue_create(&pendingBufs_, sizeof(uint8_t), BUFFER_COUNT + 1, nullptr) != 0) {
+            destroy();
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+        for (uint8_t i = 0; i < BUFFER_COUNT; ++i) {
+            os_queue_put(freeBufs_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        if (os_thread_create(&thread_, "ota", OS_THREAD_PRIORITY_DEFAULT, run, this, stackSize) != 0) {
+            thread_ = OS_THREAD_INVALID_HANDLE;
+            destroy();
+            return SYSTEM_ERROR_NO_MEMORY;
+        }
+        return 0;
+    }
+
+    void destroy() {
+        if (thread_ != OS_THREAD_INVALID_HANDLE) {
+            flush();
+            os_queue_put(pendingBufs_, &STOP, CONCURRENT_WAIT_FOREVER, nullptr);
+            os_thread_join(thread_);
+            os_thread_cleanup(thread_);
+            thread_ = OS_THREAD_INVALID_HANDLE;
+        }
+        if (pendingBufs_) {
+            os_queue_destroy(pendingBufs_, nullptr);
+            pendingBufs_ = nullptr;
+        }
+        if (freeBufs_) {
+            os_queue_destroy(freeBufs_, nullptr);
+            freeBufs_ = nullptr;
+        }
+    }
+
+    // Blocks until a staging buffer is available. Returns the error of a previously staged write
+    // if it failed
+    int write(const char* data, size_t size, size_t offset, size_t partialSize) {
+        if (error_ < 0) {
+            return error_;
+        }
+        uint8_t index = 0;
+        os_queue_take(freeBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+        if (error_ < 0) {
+            os_queue_put(freeBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+            return error_;
+        }
+        auto buf = &bufs_[index];
+        if (buf->capacity < size) {
+            buf->data.reset(new(std::nothrow) char[size]);
+            if (!buf->data) {
+                buf->capacity = 0;
+                os_queue_put(freeBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+                return SYSTEM_ERROR_NO_MEMORY;
+            }
+            buf->capacity = size;
+        }
+        memcpy(buf->data.get(), data, size);
+        buf->size = size;
+        buf->offset = offset;
+        buf->partialSize = partialSize;
+        os_queue_put(pendingBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+        return 0;
+    }
+
+    // Blocks until all staged chunks are written
+    int flush() {
+        uint8_t indices[BUFFER_COUNT] = {};
+        for (auto& i: indices) {
+            os_queue_take(freeBufs_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        for (const auto& i: indices) {
+            os_queue_put(freeBufs_, &i, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        return (error_ < 0) ? error_ : 0;
+    }
+
+private:
+    struct Buffer {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t size;
+        size_t offset;
+        size_t partialSize;
+
+        Buffer() :
+                capacity(0),
+                size(0),
+                offset(0),
+                partialSize(0) {
+        }
+    };
+
+    // Buffer index used to stop the writer thread
+    static const uint8_t STOP = 0xff;
+
+    Buffer bufs_[BUFFER_COUNT];
+    TargetT* target_;
+    os_queue_t freeBufs_;
+    os_queue_t pendingBufs_;
+    os_thread_t thread_;
+    volatile int error_;
+
+    static void run(void* arg) {
+        const auto self = static_cast<ChunkWriter*>(arg);
+        for (;;) {
+            uint8_t index = 0;
+            os_queue_take(self->pendingBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+            if (index == STOP) {
+                break;
+            }
+            const auto buf = &self->bufs_[index];
+            if (self->error_ >= 0) {
+                const int r = self->target_->writeChunk(buf->data.get(), buf->size, buf->offset);
+                if (r < 0) {
+                    self->error_ = r;
+                } else {
+                    self->target_->chunkWritten(buf->data.get(), buf->size, buf->offset, buf->partialSize);
+                }
+            }
+            os_queue_put(self->freeBufs_, &index, CONCURRENT_WAIT_FOREVER, nullptr);
+        }
+        os_thread_exit(nullptr);
+    }
+};
+
+template<typename TargetT>
+const uint8_t ChunkWriter<TargetT>::STOP;
+
+} // namespace detail
+
+} // namespace system
+
+} // namespace particle
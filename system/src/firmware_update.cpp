@@ -40,6 +40,11 @@ LOG_SOURCE_CATEGORY("system.ota");
 #include "spark_wiring_system.h"
 #include "spark_wiring_rgb.h"
 
+#if PLATFORM_THREADING
+#include "spark_wiring_thread.h"
+#include "chunk_writer.h"
+#endif
+
 #include <cstdio>
 #include <cstdarg>
 
@@ -76,6 +81,14 @@ struct PersistentTransferState {
 
 #endif // HAL_PLATFORM_RESUMABLE_OTA
 
+#if PLATFORM_THREADING
+
+// Stack size of the background flash writer thread. Updating the transfer state involves
+// filesystem operations
+const size_t CHUNK_WRITER_STACK_SIZE = 4 * 1024;
+
+#endif // PLATFORM_THREADING
+
 } // namespace
 
 namespace detail {
@@ -170,6 +183,14 @@ int FirmwareUpdate::startUpdate(size_t fileSize, const char* fileHash, size_t* p
         }
         SPARK_FLASH_UPDATE = 1; // TODO: Get rid of legacy state variables
         updating_ = true;
+#if PLATFORM_THREADING
+        writer_.reset(new(std::nothrow) detail::ChunkWriter<FirmwareUpdate>(this));
+        if (!writer_ || writer_->init(CHUNK_WRITER_STACK_SIZE) < 0) {
+            // Not a critical error
+            LOG(WARN, "Unable to start background flash writer, writing data synchronously");
+            writer_.reset();
+        }
+#endif
         // Generate a system event
         fileDesc_ = FileTransfer::Descriptor();
         fileDesc_.file_length = fileSize;
@@ -195,8 +216,12 @@ int FirmwareUpdate::finishUpdate(FirmwareUpdateFlags flags) {
         if (!updating_) {
             return SYSTEM_ERROR_INVALID_STATE;
         }
+        int r = flushChunks();
+        if (r < 0) {
+            endUpdate(false /* ok */);
+            return r;
+        }
         if (!validateOnly) {
-            int r = 0;
 #if HAL_PLATFORM_RESUMABLE_OTA
             if (transferState_) {
                 r = finalizeTransferState();
@@ -222,6 +247,7 @@ int FirmwareUpdate::finishUpdate(FirmwareUpdateFlags flags) {
     } else if (updating_ && !validateOnly) {
 #if HAL_PLATFORM_RESUMABLE_OTA
         if (discardData) {
+            flushChunks(); // Make sure the transfer state is not being updated
             clearTransferState();
         }
 #endif
@@ -235,23 +261,23 @@ int FirmwareUpdate::saveChunk(const char* chunkData, size_t chunkSize, size_t ch
         return SYSTEM_ERROR_INVALID_STATE;
     }
     TimingFlashUpdateTimeout = 0; // TODO: Get rid of legacy state variables
-    const uintptr_t addr = HAL_OTA_FlashAddress() + chunkOffset;
-    int r = HAL_FLASH_Update((const uint8_t*)chunkData, addr, chunkSize, nullptr);
-    if (r != 0) {
+    int r = 0;
+#if PLATFORM_THREADING
+    if (writer_) {
+        r = writer_->write(chunkData, chunkSize, chunkOffset, partialSize);
+    } else
+#endif
+    {
+        r = writeChunk(chunkData, chunkSize, chunkOffset);
+        if (r >= 0) {
+            chunkWritten(chunkData, chunkSize, chunkOffset, partialSize);
+        }
+    }
+    if (r < 0) {
         SYSTEM_ERROR_MESSAGE("Failed to save firmware data: %d", r);
         endUpdate(false /* ok */);
-        return SYSTEM_ERROR_FLASH_IO;
-    }
-#if HAL_PLATFORM_RESUMABLE_OTA
-    if (transferState_) {
-        r = updateTransferState(chunkData, chunkSize, chunkOffset, partialSize);
-        if (r != 0) {
-            // Not a critical error
-            LOG(ERROR, "Failed to update transfer state: %d", r);
-            clearTransferState();
-        }
+        return r;
     }
-#endif
     if (!ledOverridden_) {
         LED_Toggle(PARTICLE_LED_RGB);
     }
@@ -267,6 +293,14 @@ void FirmwareUpdate::process() {
         return;
     }
 #if HAL_PLATFORM_RESUMABLE_OTA
+#if PLATFORM_THREADING
+    // The transfer state is updated by the background flash writer. Don't wait for it to finish
+    // writing a chunk
+    std::unique_lock<Mutex> lock(stateMutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+#endif
     if (transferState_) {
         const auto state = transferState_.get();
         if (state->bytesToSync > 0 && HAL_Timer_Get_Milli_Seconds() - state->lastSyncTime >= TRANSFER_STATE_SYNC_INTERVAL) {
@@ -284,6 +318,41 @@ void FirmwareUpdate::process() {
 #endif
 }
 
+int FirmwareUpdate::writeChunk(const char* chunkData, size_t chunkSize, size_t chunkOffset) {
+    const uintptr_t addr = HAL_OTA_FlashAddress() + chunkOffset;
+    const int r = HAL_FLASH_Update((const uint8_t*)chunkData, addr, chunkSize, nullptr);
+    if (r != 0) {
+        LOG(ERROR, "HAL_FLASH_Update() failed: %d", r);
+        return SYSTEM_ERROR_FLASH_IO;
+    }
+    return 0;
+}
+
+void FirmwareUpdate::chunkWritten(const char* chunkData, size_t chunkSize, size_t chunkOffset, size_t partialSize) {
+#if HAL_PLATFORM_RESUMABLE_OTA
+#if PLATFORM_THREADING
+    const std::lock_guard<Mutex> lock(stateMutex_);
+#endif
+    if (transferState_) {
+        const int r = updateTransferState(chunkData, chunkSize, chunkOffset, partialSize);
+        if (r != 0) {
+            // Not a critical error
+            LOG(ERROR, "Failed to update transfer state: %d", r);
+            clearTransferState();
+        }
+    }
+#endif
+}
+
+int FirmwareUpdate::flushChunks() {
+#if PLATFORM_THREADING
+    if (writer_) {
+        return writer_->flush();
+    }
+#endif
+    return 0;
+}
+
 FirmwareUpdate* FirmwareUpdate::instance() {
     static FirmwareUpdate instance;
     return &instance;
@@ -421,6 +490,9 @@ void FirmwareUpdate::endUpdate(bool ok) {
     if (!updating_) {
         return;
     }
+#if PLATFORM_THREADING
+    writer_.reset(); // Waits for the staged chunks to be written
+#endif
 #if HAL_PLATFORM_RESUMABLE_OTA
     transferState_.reset();
 #endif
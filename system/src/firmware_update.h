@@ -22,6 +22,10 @@
 #include "file_transfer.h"
 #include "system_defs.h"
 
+#if PLATFORM_THREADING
+#include "spark_wiring_thread.h"
+#endif
+
 #include <memory>
 
 namespace particle {
@@ -34,6 +38,11 @@ namespace detail {
 struct TransferState;
 #endif
 
+#if PLATFORM_THREADING
+template<typename TargetT>
+class ChunkWriter;
+#endif
+
 } // namespace detail
 
 /**
@@ -63,6 +72,11 @@ public:
     /**
      * Save a chunk of the update binary.
      *
+     * On platforms with threading support, the chunk data is copied to a staging buffer and
+     * written to the flash in a background thread. This method only blocks if all staging buffers
+     * are in use. An error that occurs while writing the data is reported by a subsequent call to
+     * this method or `finishUpdate()`.
+     *
      * @param chunkData Chunk data.
      * @param chunkSize Chunk size.
      * @param chunkOffset Offset of the chunk in the file.
@@ -92,6 +106,13 @@ private:
     bool updating_; // Whether an update is in progress
     bool ledOverridden_; // FIXME
 
+#if PLATFORM_THREADING
+    std::unique_ptr<detail::ChunkWriter<FirmwareUpdate>> writer_; // Background flash writer
+    Mutex stateMutex_; // Locked while the transfer state is being updated
+
+    friend class detail::ChunkWriter<FirmwareUpdate>;
+#endif
+
 #if HAL_PLATFORM_RESUMABLE_OTA
     std::unique_ptr<detail::TransferState> transferState_; // Transfer state
 
@@ -103,6 +124,10 @@ private:
 
     FirmwareUpdate();
 
+    int writeChunk(const char* chunkData, size_t chunkSize, size_t chunkOffset);
+    void chunkWritten(const char* chunkData, size_t chunkSize, size_t chunkOffset, size_t partialSize);
+    int flushChunks();
+
     void endUpdate(bool ok);
 };
 
@@ -53,6 +53,7 @@
 #include "led_service.h"
 #include "diagnostics.h"
 #include "check.h"
+#include "alloc_trace.h"
 #include "spark_wiring_interrupts.h"
 #include "spark_wiring_cellular.h"
 #include "spark_wiring_cellular_printable.h"
@@ -490,6 +491,7 @@ void app_loop(bool threaded)
                 //Execute user application setup only once
                 DECLARE_SYS_HEALTH(ENTERED_Setup);
                 if (system_mode() != SAFE_MODE) {
+                    AllocTraceScope traceScope(ALLOC_TRACE_TAG_USER);
                     setup();
                 }
                 SPARK_WIRING_APPLICATION = 1;
@@ -507,7 +509,10 @@ void app_loop(bool threaded)
             //Execute user application loop
             DECLARE_SYS_HEALTH(ENTERED_Loop);
             if (system_mode()!=SAFE_MODE) {
-                loop();
+                {
+                    AllocTraceScope traceScope(ALLOC_TRACE_TAG_USER);
+                    loop();
+                }
                 DECLARE_SYS_HEALTH(RAN_Loop);
 #if !(defined(MODULAR_FIRMWARE) && MODULAR_FIRMWARE)
                 _post_loop();
@@ -707,6 +712,22 @@ RunTimeInfoDiagnosticData g_usedRamDiagData(DIAG_ID_SYSTEM_USED_RAM, DIAG_NAME_S
     }
 );
 
+RunTimeInfoDiagnosticData g_largestFreeBlockDiagData(DIAG_ID_SYSTEM_LARGEST_FREE_BLOCK, DIAG_NAME_SYSTEM_LARGEST_FREE_BLOCK,
+    [](const runtime_info_t& info) -> RunTimeInfoDiagnosticData::IntType {
+        return info.largest_free_block_heap;
+    }
+);
+
+// Percentage of the free heap that is not part of the largest free block
+RunTimeInfoDiagnosticData g_heapFragmentationDiagData(DIAG_ID_SYSTEM_HEAP_FRAGMENTATION, DIAG_NAME_SYSTEM_HEAP_FRAGMENTATION,
+    [](const runtime_info_t& info) -> RunTimeInfoDiagnosticData::IntType {
+        if (!info.freeheap || info.largest_free_block_heap >= info.freeheap) {
+            return 0;
+        }
+        return 100 - (uint64_t)info.largest_free_block_heap * 100 / info.freeheap;
+    }
+);
+
 } // namespace
 
 /*******************************************************************************
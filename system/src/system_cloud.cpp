@@ -34,6 +34,7 @@
 #include "spark_wiring_cloud.h"
 #include "system_cloud.h"
 #include "system_cloud_internal.h"
+#include "system_publish_queue.h"
 #include "system_publish_vitals.h"
 #include "system_task.h"
 #include "system_threading.h"
@@ -41,6 +42,7 @@
 #include "system_cloud_internal.h"
 #include "string_convert.h"
 #include "spark_protocol_functions.h"
+#include "completion_handler.h"
 #include "events.h"
 #include "deviceid_hal.h"
 #include "system_mode.h"
@@ -183,6 +185,31 @@ bool spark_send_event(const char* name, const char* data, int ttl, uint32_t flag
     SYSTEM_THREAD_CONTEXT_SYNC(spark_send_event(name, data, ttl, flags, reserved));
     }
 
+#if HAL_PLATFORM_FILESYSTEM
+    if (flags & PUBLISH_EVENT_FLAG_PERSISTENT) {
+        const auto queue = PublishQueue::instance();
+        // The event is only sent right away if there are no older events to be sent before it
+        system_tick_t delay = 0;
+        size_t size = sizeof(delay);
+        if (!spark_cloud_flag_connected() || !queue->empty() ||
+                getConnectionProperty(protocol::Connection::PUBLISH_DELAY, &delay, &size) != 0 || delay > 0) {
+            const int r = queue->push(name, data, ttl,
+                    convert(flags & ~(PUBLISH_EVENT_FLAG_PERSISTENT | PUBLISH_EVENT_FLAG_ASYNC)));
+            if (reserved) {
+                auto d = static_cast<const spark_send_event_data*>(reserved);
+                CompletionHandler handler(d->handler_callback, d->handler_data);
+                if (r < 0) {
+                    handler.setError(r);
+                } else {
+                    handler.setResult();
+                }
+            }
+            return r == 0;
+        }
+    }
+#endif // HAL_PLATFORM_FILESYSTEM
+    flags &= ~PUBLISH_EVENT_FLAG_PERSISTENT;
+
     spark_protocol_send_event_data d = {};
     d.size = sizeof(d);
     if (reserved) {
@@ -299,6 +326,16 @@ int spark_set_connection_property(unsigned property, unsigned value, const void*
         const auto r = spark_protocol_set_connection_property(sp, property, value, d, reserved);
         return spark_protocol_to_system_error(r);
     }
+    case SPARK_CLOUD_OTA_RECEIVE_WINDOW_SIZE: {
+        const auto r = spark_protocol_set_connection_property(sp, protocol::Connection::OTA_RECEIVE_WINDOW_SIZE, value,
+                nullptr /* data */, reserved);
+        return spark_protocol_to_system_error(r);
+    }
+    case SPARK_CLOUD_RECORD_PACKING: {
+        const auto r = spark_protocol_set_connection_property(sp, protocol::Connection::RECORD_PACKING, value,
+                nullptr /* data */, reserved);
+        return spark_protocol_to_system_error(r);
+    }
     default:
         return SYSTEM_ERROR_INVALID_ARGUMENT;
     }
@@ -323,6 +360,11 @@ int spark_get_connection_property(unsigned property, void* data, size_t* size, v
             return SYSTEM_ERROR_INVALID_STATE;
         }
         return getConnectionProperty(protocol::Connection::MAX_FUNCTION_ARGUMENT_SIZE, data, size);
+    case SPARK_CLOUD_PUBLISH_DELAY:
+        if (!SPARK_CLOUD_CONNECTED) {
+            return SYSTEM_ERROR_INVALID_STATE;
+        }
+        return getConnectionProperty(protocol::Connection::PUBLISH_DELAY, data, size);
     default:
         return SYSTEM_ERROR_INVALID_ARGUMENT;
     }
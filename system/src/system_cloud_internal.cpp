@@ -31,6 +31,7 @@
 #include "spark_wiring_string.h"
 #include "spark_protocol_functions.h"
 #include "append_list.h"
+#include "key_index.h"
 #include "core_hal.h"
 #include "deviceid_hal.h"
 #include "ota_flash_hal.h"
@@ -53,6 +54,7 @@
 #include "system_network_internal.h"
 #include "str_util.h"
 #include "scope_guard.h"
+#include "alloc_trace.h"
 #if HAL_PLATFORM_MUXER_MAY_NEED_DELAY_IN_TX
 #include "network/ncp/cellular/ncp.h"
 #include "network/ncp/cellular/cellular_ncp_client.h"
@@ -239,20 +241,25 @@ ProtocolFacade* system_cloud_protocol_instance(void)
 
 static append_list<User_Var_Lookup_Table_t> vars(5);
 static append_list<User_Func_Lookup_Table_t> funcs(5);
+// Hash indices over the keys of the registered variables and functions
+static KeyIndex varIndex;
+static KeyIndex funcIndex;
+
+static User_Var_Lookup_Table_t* find_var_by_key(const char* varKey, KeyIndex::Hash keyHash)
+{
+    const int i = varIndex.find(varKey, keyHash, USER_VAR_KEY_LENGTH, [](unsigned i) {
+        return vars[i].userVarKey;
+    });
+    return (i >= 0) ? &vars[i] : NULL;
+}
 
 User_Var_Lookup_Table_t* find_var_by_key(const char* varKey)
 {
-    for (int i = vars.size(); i-->0; )
-    {
-        if (0 == strncmp(vars[i].userVarKey, varKey, USER_VAR_KEY_LENGTH))
-        {
-            return &vars[i];
-        }
-    }
-    return NULL;
+    return find_var_by_key(varKey, KeyIndex::hash(varKey, USER_VAR_KEY_LENGTH));
 }
 
-template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const char* name, const char* itemType, const T& value) {
+template<typename T> T* add_if_sufficient_describe(append_list<T>& list, KeyIndex& index, KeyIndex::Hash keyHash,
+		const char* name, const char* itemType, const T& value) {
 	T* result = list.add(value);
 	if (result) {
 		spark_protocol_describe_data data;
@@ -268,8 +275,17 @@ template<typename T> T* add_if_sufficient_describe(append_list<T>& list, const c
 			INFO("get describe data unsupported");
 		}
 	}
+	if (result && (size_t)list.size() > KeyIndex::MAX_SIZE) {
+		list.removeAt(list.size()-1);
+		ERROR("Cannot add %s named %s: at most %u can be registered", itemType, name, (unsigned)KeyIndex::MAX_SIZE);
+		return nullptr;
+	}
+	if (result && !index.insert(list.size()-1, keyHash)) {
+		list.removeAt(list.size()-1);
+		result = nullptr;
+	}
 	if (!result) {
-		ERROR("Cannot add %s named %d: insufficient storage", itemType, name);
+		ERROR("Cannot add %s named %s: insufficient storage", itemType, name);
 	}
 	return result;
 }
@@ -287,10 +303,11 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
 	}
 	memcpy(item.userVarKey, varKey, USER_VAR_KEY_LENGTH);
 
-    User_Var_Lookup_Table_t* result = find_var_by_key(varKey);
+    const auto keyHash = KeyIndex::hash(varKey, USER_VAR_KEY_LENGTH);
+    User_Var_Lookup_Table_t* result = find_var_by_key(varKey, keyHash);
 
     if (!result) {
-    	result = add_if_sufficient_describe(vars, varKey, "variable", item);
+    	result = add_if_sufficient_describe(vars, varIndex, keyHash, varKey, "variable", item);
     }
     else {
     	*result = item;
@@ -298,16 +315,17 @@ User_Var_Lookup_Table_t* find_var_by_key_or_add(const char* varKey, const void*
     return result;
 }
 
+static User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey, KeyIndex::Hash keyHash)
+{
+    const int i = funcIndex.find(funcKey, keyHash, USER_FUNC_KEY_LENGTH, [](unsigned i) {
+        return funcs[i].userFuncKey;
+    });
+    return (i >= 0) ? &funcs[i] : NULL;
+}
+
 User_Func_Lookup_Table_t* find_func_by_key(const char* funcKey)
 {
-    for (int i = funcs.size(); i-->0; )
-    {
-        if (0 == strncmp(funcs[i].userFuncKey, funcKey, USER_FUNC_KEY_LENGTH))
-        {
-            return &funcs[i];
-        }
-    }
-    return NULL;
+    return find_func_by_key(funcKey, KeyIndex::hash(funcKey, USER_FUNC_KEY_LENGTH));
 }
 
 User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const cloud_function_descriptor* desc)
@@ -317,12 +335,13 @@ User_Func_Lookup_Table_t* find_func_by_key_or_add(const char* funcKey, const clo
 	item.pUserFuncData = desc->data;
     memcpy(item.userFuncKey, desc->funcKey, USER_FUNC_KEY_LENGTH);
 
-    User_Func_Lookup_Table_t* result = find_func_by_key(funcKey);
+    const auto keyHash = KeyIndex::hash(funcKey, USER_FUNC_KEY_LENGTH);
+    User_Func_Lookup_Table_t* result = find_func_by_key(funcKey, keyHash);
     if (result) {
     	*result = item;
     }
     else {
-    	result = add_if_sufficient_describe(funcs, funcKey, "function", item);
+    	result = add_if_sufficient_describe(funcs, funcIndex, keyHash, funcKey, "function", item);
     }
     return result;
 }
@@ -390,16 +409,30 @@ uint32_t compute_describe_app_checksum()
 	return crc(chk, sizeof(chk));
 }
 
+/**
+ * Computes the checksum of the system info reported in the system describe message. The checksum
+ * covers all the fields that end up in the message, since it's also used as the key of the
+ * cached describe message.
+ */
 uint32_t compute_describe_system_checksum()
 {
     hal_system_info_t info;
     memset(&info, 0, sizeof(info));
     info.size = sizeof(info);
+    info.flags = HAL_SYSTEM_INFO_FLAGS_CLOUD;
     HAL_System_Info(&info, true, NULL);
 	uint32_t checksum = info.platform_id;
+	for (int i=0; i<info.key_value_count; i++)
+	{
+		checksum += string_crc(info.key_values[i].key);
+		checksum += crc(info.key_values[i].value, strnlen(info.key_values[i].value, sizeof(info.key_values[i].value)));
+	}
 	for (int i=0; i<info.module_count; i++)
 	{
-		checksum += crc(info.modules[i].suffix.sha);
+		const hal_module_t& module = info.modules[i];
+		const uint32_t chk[] = { crc(module.suffix.sha), crc(module.info), module.bounds.maximum_size,
+				(uint32_t)module.bounds.store, module.validity_checked, module.validity_result };
+		checksum += crc(chk, sizeof(chk));
 	}
 	HAL_System_Info(&info, false, NULL);
     return checksum;
@@ -1091,6 +1124,11 @@ void Spark_Protocol_Init(void)
         }
 #endif // HAL_PLATFORM_COMPRESSED_OTA
 
+#if HAL_PLATFORM_DELTA_OTA
+        // Enable delta OTA updates
+        spark_protocol_set_connection_property(sp, protocol::Connection::DELTA_OTA, 1, nullptr, nullptr);
+#endif // HAL_PLATFORM_DELTA_OTA
+
         spark_protocol_set_connection_property(sp, protocol::Connection::SYSTEM_MODULE_VERSION, MODULE_VERSION,
                 nullptr, nullptr);
         spark_protocol_set_connection_property(sp, protocol::Connection::MAX_BINARY_SIZE, HAL_OTA_FlashLength(),
@@ -1140,7 +1178,11 @@ int Spark_Handshake(bool presence_announce)
     cloud_socket_aborted = false; // Clear cancellation flag for socket operations
     LOG(INFO,"Starting handshake: presense_announce=%d", presence_announce);
     bool session_resumed = false;
-    int err = spark_protocol_handshake(sp);
+    int err = 0;
+    {
+        AllocTraceScope traceScope(ALLOC_TRACE_TAG_COMMUNICATION);
+        err = spark_protocol_handshake(sp);
+    }
 
 #if HAL_PLATFORM_MUXER_MAY_NEED_DELAY_IN_TX
     // XXX: Adding a delay only for platforms Boron and BSoM, because older cell versions of
@@ -1245,6 +1287,7 @@ int Spark_Handshake(bool presence_announce)
 
 bool Spark_Communication_Loop(void)
 {
+    AllocTraceScope traceScope(ALLOC_TRACE_TAG_COMMUNICATION);
     return spark_protocol_event_loop(sp);
 }
 
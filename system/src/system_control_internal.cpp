@@ -28,6 +28,7 @@
 #include "debug.h"
 #include "delay_hal.h"
 #include "hal_platform.h"
+#include "alloc_trace.h"
 
 #include "control/network.h"
 #include "control/wifi_new.h"
@@ -211,6 +212,25 @@ void SystemControl::processRequest(ctrl_request* req, ControlRequestChannel* /*
         }
         break;
     }
+    case CTRL_REQUEST_ALLOC_TRACE_INFO: {
+        // An optional request byte with bit 0 set resets the statistics once they have been read
+        const bool reset = req->request_size > 0 && (req->request_data[0] & 0x01);
+        struct Formatter {
+            static int callback(Appender* appender, void* data) {
+                return system_format_alloc_trace(Appender::callback, appender, nullptr);
+            }
+        };
+        const int ret = formatReplyData(req, Formatter::callback);
+#if ALLOC_TRACE_ENABLED
+        if (ret == 0 && reset) {
+            alloc_trace_reset_stats();
+        }
+#else
+        (void)reset;
+#endif
+        setResult(req, ret);
+        break;
+    }
     /* config requests */
     case CTRL_REQUEST_SET_CLAIM_CODE: {
         setResult(req, control::config::handleSetClaimCodeRequest(req));
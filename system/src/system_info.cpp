@@ -21,6 +21,7 @@
 #include "spark_wiring_json.h"
 #include "spark_wiring_diagnostics.h"
 #include "spark_macros.h"
+#include "alloc_trace.h"
 #include <cstdio>
 
 namespace {
@@ -402,3 +403,32 @@ bool system_metrics(appender_fn appender, void* append_data, uint32_t flags, uin
     const int ret = system_format_diag_data(nullptr, 0, flags, appender, append_data, nullptr);
     return ret == 0;
 }
+
+int system_format_alloc_trace(appender_fn append, void* append_data, void* reserved) {
+#if ALLOC_TRACE_ENABLED
+    AppendJson json(append, append_data);
+    uint32_t period = 0;
+    json.beginObject();
+    json.name("tags").beginArray();
+    for (int tag = 0; tag < ALLOC_TRACE_TAG_COUNT; ++tag) {
+        alloc_trace_stats stats = {};
+        CHECK(alloc_trace_get_stats(tag, &stats, &period));
+        json.beginObject();
+        json.name("name").value(alloc_trace_tag_name(tag));
+        json.name("live").value((unsigned)stats.live_size);
+        json.name("peak").value((unsigned)stats.peak_size);
+        json.name("allocs").value((unsigned)stats.alloc_count);
+        json.name("frees").value((unsigned)stats.free_count);
+        json.name("failed").value((unsigned)stats.failed_count);
+        // Allocations per second
+        json.name("rate").value(period ? (unsigned)((uint64_t)stats.alloc_count * 1000 / period) : 0u);
+        json.endObject();
+    }
+    json.endArray();
+    json.name("period").value((unsigned)period);
+    json.endObject();
+    return json.isOk() ? 0 : SYSTEM_ERROR_UNKNOWN;
+#else
+    return SYSTEM_ERROR_NOT_SUPPORTED;
+#endif // !ALLOC_TRACE_ENABLED
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_publish_queue.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "system_cloud.h"
+#include "system_cloud_internal.h"
+#include "spark_protocol_functions.h"
+#include "protocol_defs.h"
+#include "timer_hal.h"
+#include "endian_util.h"
+#include "logging.h"
+#include "check.h"
+
+#include <memory>
+#include <new>
+#include <cstring>
+
+namespace particle {
+
+namespace system {
+
+namespace {
+
+// Record format: <flags:1><ttl:4><name>\0<data>
+const size_t RECORD_HEADER_SIZE = 5;
+const size_t MAX_RECORD_SIZE = RECORD_HEADER_SIZE + protocol::MAX_EVENT_NAME_LENGTH + 1 + protocol::MAX_EVENT_DATA_LENGTH;
+
+// Maximum number of events sent in one iteration of the system loop
+const unsigned MAX_EVENTS_PER_ITERATION = 4;
+
+bool isRateLimited() {
+    system_tick_t delay = 0;
+    size_t size = sizeof(delay);
+    const int r = spark_protocol_get_connection_property(sp, protocol::Connection::PUBLISH_DELAY, &delay, &size,
+            nullptr /* reserved */);
+    return r != 0 || delay > 0;
+}
+
+} // namespace
+
+PublishQueue::PublishQueue() :
+        queue_(PUBLISH_QUEUE_FILE_PREFIX, PersistentQueue::DEFAULT_SEGMENT_SIZE, PUBLISH_QUEUE_MAX_SEGMENTS),
+        pushTime_(0),
+        syncPending_(false) {
+}
+
+int PublishQueue::push(const char* name, const char* data, int ttl, uint32_t flags) {
+    const size_t nameLen = strnlen(name, protocol::MAX_EVENT_NAME_LENGTH + 1);
+    if (nameLen == 0 || nameLen > protocol::MAX_EVENT_NAME_LENGTH) {
+        return SYSTEM_ERROR_INVALID_ARGUMENT;
+    }
+    const size_t dataLen = data ? strnlen(data, protocol::MAX_EVENT_DATA_LENGTH) : 0;
+    const size_t size = RECORD_HEADER_SIZE + nameLen + 1 + dataLen;
+    std::unique_ptr<char[]> buf(new(std::nothrow) char[size]);
+    if (!buf) {
+        return SYSTEM_ERROR_NO_MEMORY;
+    }
+    buf[0] = (uint8_t)flags;
+    const auto t = nativeToLittleEndian<uint32_t>(ttl);
+    memcpy(buf.get() + 1, &t, sizeof(t));
+    memcpy(buf.get() + RECORD_HEADER_SIZE, name, nameLen + 1);
+    memcpy(buf.get() + RECORD_HEADER_SIZE + nameLen + 1, data, dataLen);
+    CHECK(queue_.push(buf.get(), size));
+    if (!syncPending_) {
+        pushTime_ = HAL_Timer_Get_Milli_Seconds();
+        syncPending_ = true;
+    }
+    return 0;
+}
+
+void PublishQueue::process() {
+    if (syncPending_ && HAL_Timer_Get_Milli_Seconds() - pushTime_ >= PUBLISH_QUEUE_SYNC_INTERVAL) {
+        const int r = queue_.sync();
+        if (r < 0) {
+            LOG(ERROR, "Unable to store queued events: %d", r);
+        }
+        syncPending_ = false;
+    }
+    if (!spark_cloud_flag_connected() || empty()) {
+        return;
+    }
+    std::unique_ptr<char[]> buf;
+    for (unsigned i = 0; i < MAX_EVENTS_PER_ITERATION && !queue_.empty(); ++i) {
+        // Leave the events in the queue rather than have them rejected by the rate limiter
+        if (isRateLimited()) {
+            break;
+        }
+        if (!buf) {
+            // Reserve one more byte for the terminating null character of the event data
+            buf.reset(new(std::nothrow) char[MAX_RECORD_SIZE + 1]);
+            if (!buf) {
+                break;
+            }
+        }
+        const int size = queue_.peek(buf.get(), MAX_RECORD_SIZE);
+        if (size < 0) {
+            if (size != SYSTEM_ERROR_NOT_FOUND) {
+                LOG(ERROR, "Unable to read queued event: %d", size);
+            }
+            break;
+        }
+        buf[size] = '\0';
+        const char* name = buf.get() + RECORD_HEADER_SIZE;
+        const size_t nameLen = ((size_t)size > RECORD_HEADER_SIZE) ? strlen(name) : 0;
+        if (nameLen == 0 || RECORD_HEADER_SIZE + nameLen >= (size_t)size) {
+            LOG(WARN, "Discarding invalid queued event");
+            queue_.pop();
+            continue;
+        }
+        uint32_t ttl = 0;
+        memcpy(&ttl, buf.get() + 1, sizeof(ttl));
+        ttl = littleEndianToNative(ttl);
+        const char* data = name + nameLen + 1;
+        const uint32_t flags = (uint8_t)buf[0];
+        if (!spark_protocol_send_event(sp, name, data, ttl, flags, nullptr /* reserved */)) {
+            break;
+        }
+        queue_.pop();
+    }
+}
+
+bool PublishQueue::empty() {
+    return queue_.init() < 0 || queue_.empty();
+}
+
+PublishQueue* PublishQueue::instance() {
+    static PublishQueue queue;
+    return &queue;
+}
+
+} // namespace system
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hal_platform.h"
+
+#if HAL_PLATFORM_FILESYSTEM
+
+#include "persistent_queue.h"
+#include "system_tick_hal.h"
+
+#include <cstdint>
+
+/**
+ * Path prefix of the files of the persistent event queue.
+ */
+#ifndef PUBLISH_QUEUE_FILE_PREFIX
+#define PUBLISH_QUEUE_FILE_PREFIX "/sys/pubq"
+#endif
+
+/**
+ * Maximum number of segment files of the persistent event queue, each taking one filesystem block.
+ */
+#ifndef PUBLISH_QUEUE_MAX_SEGMENTS
+#define PUBLISH_QUEUE_MAX_SEGMENTS 8
+#endif
+
+/**
+ * Maximum time in milliseconds for which queued events are kept in the filesystem's caches
+ * before they are committed to the flash.
+ */
+#ifndef PUBLISH_QUEUE_SYNC_INTERVAL
+#define PUBLISH_QUEUE_SYNC_INTERVAL 5000
+#endif
+
+namespace particle {
+
+namespace system {
+
+/**
+ * Queue of events published with the `PUBLISH_EVENT_FLAG_PERSISTENT` flag.
+ *
+ * The events are stored in the filesystem while they cannot be sent to the Cloud, and are sent
+ * in the order they were published once the device is connected. Draining the queue is paced
+ * by the protocol's rate limiter. Queued events are committed to the flash in batches, so the
+ * events queued within the last `PUBLISH_QUEUE_SYNC_INTERVAL` milliseconds can be lost if the
+ * device resets unexpectedly.
+ *
+ * This class is meant to be used on the system thread.
+ */
+class PublishQueue {
+public:
+    /**
+     * Stores an event in the queue.
+     *
+     * @param flags Event type and flags as passed to `spark_protocol_send_event()`.
+     * @return 0 on success, otherwise an error code defined by `system_error_t`.
+     */
+    int push(const char* name, const char* data, int ttl, uint32_t flags);
+
+    /**
+     * Commits the queued events to the flash if necessary, and sends queued events while the
+     * device is connected to the Cloud and the events are not rate limited.
+     */
+    void process();
+
+    bool empty();
+
+    static PublishQueue* instance();
+
+private:
+    PersistentQueue queue_;
+    system_tick_t pushTime_;
+    bool syncPending_;
+
+    PublishQueue();
+};
+
+} // namespace system
+
+} // namespace particle
+
+#endif // HAL_PLATFORM_FILESYSTEM
@@ -33,6 +33,7 @@
 #include "system_network_internal.h"
 #include "system_update.h"
 #include "firmware_update.h"
+#include "system_publish_queue.h"
 #include "spark_macros.h"
 #include "string.h"
 #include "core_hal.h"
@@ -488,6 +489,10 @@ void Spark_Idle_Events(bool force_events/*=false*/)
 
         manage_cloud_connection(force_events);
 
+#if HAL_PLATFORM_FILESYSTEM
+        system::PublishQueue::instance()->process();
+#endif // HAL_PLATFORM_FILESYSTEM
+
         system::FirmwareUpdate::instance()->process();
     }
     else
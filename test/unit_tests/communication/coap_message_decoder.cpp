@@ -503,3 +503,76 @@ TEST_CASE("CoapMessageDecoder") {
         }
     }
 }
+
+TEST_CASE("CoapMessageDecoder::findOption()") {
+    auto d = makeDecoder();
+    SECTION("finds options by their numbers") {
+        // Uri-Path: "a", Uri-Path: "bc", Uri-Query: "d", Block2: 0x12
+        auto buf = std::string("\x40\x01\x04\xd2\xb1\x61\x02\x62\x63\x41\x64\x81\x12\xff\x78", 15);
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        auto it = d.findOption(CoapOption::URI_PATH);
+        REQUIRE(it);
+        CHECK(std::string(it.data(), it.size()) == "a");
+        // Repeated options can be iterated over starting from the first one found
+        REQUIRE(it.next());
+        CHECK(it.option() == (unsigned)CoapOption::URI_PATH);
+        CHECK(std::string(it.data(), it.size()) == "bc");
+        REQUIRE(it.next());
+        CHECK(it.option() == (unsigned)CoapOption::URI_QUERY);
+        it = d.findOption(CoapOption::BLOCK2);
+        REQUIRE(it);
+        CHECK(it.toUInt() == 0x12);
+        CHECK(!it.next());
+        CHECK(!d.findOption(CoapOption::URI_HOST));
+        CHECK(!d.findOption(CoapOption::SIZE2));
+        CHECK(std::string(d.payload(), d.payloadSize()) == "x");
+    }
+    SECTION("finds options in a message with more options than can be indexed") {
+        std::string buf("\x40\x01\x04\xd2", 4);
+        for (size_t i = 0; i < MAX_INDEXED_COAP_OPTIONS + 4; ++i) {
+            buf += (char)0x11; // Delta: 1, length: 1
+            buf += (char)i;
+        }
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        for (size_t i = 0; i < MAX_INDEXED_COAP_OPTIONS + 4; ++i) {
+            auto it = d.findOption(i + 1);
+            REQUIRE(it);
+            CHECK(it.toUInt() == i);
+        }
+        CHECK(!d.findOption(MAX_INDEXED_COAP_OPTIONS + 5));
+    }
+}
+
+TEST_CASE("CoapMessageDecoder::block()") {
+    auto d = makeDecoder();
+    unsigned num = 0;
+    bool more = false;
+    size_t size = 0;
+    SECTION("decodes a block option") {
+        auto buf = std::string("\x40\x02\x04\xd2\xd2\x0e\x12\xce", 8); // Block1: NUM=300, M=1, SZX=6
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        CHECK(d.block(CoapOption::BLOCK1, &num, &more, &size) == 0);
+        CHECK(num == 300);
+        CHECK(more);
+        CHECK(size == 1024);
+        CHECK(d.block(CoapOption::BLOCK2, &num, &more, &size) == SYSTEM_ERROR_NOT_FOUND);
+    }
+    SECTION("decodes a zero-length block option") {
+        auto buf = std::string("\x40\x01\x04\xd2\xd0\x0a", 6); // Block2: NUM=0, M=0, SZX=0
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        CHECK(d.block(CoapOption::BLOCK2, &num, &more, &size) == 0);
+        CHECK(num == 0);
+        CHECK(!more);
+        CHECK(size == 16);
+    }
+    SECTION("fails if the block size exponent is reserved") {
+        auto buf = std::string("\x40\x01\x04\xd2\xd1\x0a\x07", 7); // SZX=7
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        CHECK(d.block(CoapOption::BLOCK2, &num, &more, &size) == SYSTEM_ERROR_BAD_DATA);
+    }
+    SECTION("fails if the option value is too long") {
+        auto buf = std::string("\x40\x01\x04\xd2\xd4\x0a\x00\x00\x00\x10", 10);
+        REQUIRE(d.decode(buf.data(), buf.size()) == (int)buf.size());
+        CHECK(d.block(CoapOption::BLOCK2, &num, &more, &size) == SYSTEM_ERROR_BAD_DATA);
+    }
+}
@@ -519,4 +519,38 @@ TEST_CASE("CoapMessageEncoder") {
             CHECK(std::string(buf, 16) == std::string("\x42\x45\x04\xd2\xaa\xbb\x14\x61\x62\x63\x64\xff\x78\x78\x78\x78", 16));
         }
     }
+
+    SECTION("encodes block options correctly") {
+        char buf[16] = {};
+        SECTION("first block") {
+            auto e = makeEncoder(buf, sizeof(buf));
+            e.type(CoapType::CON);
+            e.code(CoapCode::CONTENT);
+            e.id(1234);
+            e.block(CoapOption::BLOCK2, 0 /* num */, false /* more */, 16 /* size */);
+            CHECK(e.encode() == 6); // Zero-length option value
+            CHECK(std::string(buf, 6) == std::string("\x40\x45\x04\xd2\xd0\x0a", 6));
+        }
+        SECTION("block number, M flag and block size") {
+            auto e = makeEncoder(buf, sizeof(buf));
+            e.type(CoapType::CON);
+            e.code(CoapCode::POST);
+            e.id(1234);
+            e.block(CoapOption::BLOCK1, 300 /* num */, true /* more */, 1024 /* size */);
+            CHECK(e.encode() == 8);
+            CHECK(std::string(buf, 8) == std::string("\x40\x02\x04\xd2\xd2\x0e\x12\xce", 8));
+        }
+        SECTION("fails if block size is invalid") {
+            auto e = makeEncoder(buf, sizeof(buf));
+            e.type(CoapType::CON);
+            e.block(CoapOption::BLOCK1, 0, false, 100);
+            CHECK(e.encode() == SYSTEM_ERROR_INVALID_ARGUMENT);
+        }
+        SECTION("fails if block number is too large") {
+            auto e = makeEncoder(buf, sizeof(buf));
+            e.type(CoapType::CON);
+            e.block(CoapOption::BLOCK1, 0x100000, false, 16);
+            CHECK(e.encode() == SYSTEM_ERROR_INVALID_ARGUMENT);
+        }
+    }
 }
@@ -18,8 +18,11 @@
  */
 
 #include <climits>
+#include <vector>
 
 #include "coap_channel.h"
+#include "coap_message_pool.h"
+#include "communication_diagnostic.h"
 #include "forward_message_channel.h"
 #include "messages.h"
 
@@ -393,6 +396,147 @@ SCENARIO("an unacknowledged message is resent up to MAX_TRANSMIT times, with exp
 
 }
 
+SCENARIO("many confirmable messages are tracked and timed out independently", "[reliability]")
+{
+	REQUIRE(CoAPMessage::messages()==0);
+	GIVEN("a message store with many pending confirmable messages")
+	{
+		Mock<MessageChannel> mock;
+		MessageChannel& channel = mock.get();
+		build_message_channel_mock(mock);
+		When(Method(mock,send)).AlwaysReturn(NO_ERROR);
+
+		CoAPMessageStore store;
+		const int count = 100;
+		for (int i=0; i<count; i++)
+		{
+			const message_id_t id = 1000 + i*7;
+			uint8_t data[] = { 0x40, 0, uint8_t(id >> 8), uint8_t(id & 0xFF) };
+			Message m(data, sizeof(data), sizeof(data));
+			m.decode_id();
+			// stagger the sending times across several revolutions of the timer wheel
+			REQUIRE(store.send(m, i*1000)==NO_ERROR);
+		}
+		REQUIRE(store.has_unacknowledged_requests());
+
+		WHEN("every other message is acknowledged")
+		{
+			for (int i=0; i<count; i+=2)
+				REQUIRE(store.clear_message(1000 + i*7));
+
+			THEN("only the remaining messages can be retrieved")
+			{
+				for (int i=0; i<count; i++)
+					REQUIRE((store.from_id(1000 + i*7)!=nullptr)==(i%2==1));
+			}
+
+			AND_WHEN("time passes until all messages time out")
+			{
+				for (system_tick_t t=0; t<count*1000+300*1000; t+=333)
+					store.process(t, channel);
+
+				THEN("each remaining message was retransmitted MAX_RETRANSMIT times and removed")
+				{
+					Verify(Method(mock,send)).Exactly(count/2*CoAPMessage::MAX_RETRANSMIT);
+					REQUIRE(!store.has_messages());
+					REQUIRE(!store.has_unacknowledged_requests());
+				}
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("a message timeout handler can remove other messages from the store", "[reliability]")
+{
+	REQUIRE(CoAPMessage::messages()==0);
+	GIVEN("a message store with several confirmable messages sent at the same time")
+	{
+		Mock<MessageChannel> mock;
+		MessageChannel& channel = mock.get();
+		build_message_channel_mock(mock);
+		When(Method(mock,send)).AlwaysReturn(NO_ERROR);
+
+		CoAPMessageStore store;
+		const int count = 10;
+		int timeouts = 0;
+		CoAPMessage::delivery_fn handler = [&store, &timeouts](CoAPMessage::Delivery delivered) {
+			if (delivered==CoAPMessage::NOT_DELIVERED)
+			{
+				++timeouts;
+				// remove the other messages, some of which are likely to be in the same slot of the timer wheel
+				for (int i=0; i<count; i++)
+					store.clear_message(1000 + i);
+			}
+		};
+		for (int i=0; i<count; i++)
+		{
+			const message_id_t id = 1000 + i;
+			uint8_t data[] = { 0x40, 0, uint8_t(id >> 8), uint8_t(id & 0xFF) };
+			Message m(data, sizeof(data), sizeof(data));
+			m.decode_id();
+			REQUIRE(store.send(m, 0)==NO_ERROR);
+			store.from_id(id)->set_delivered_handler(&handler);
+		}
+
+		WHEN("time passes until the first message times out")
+		{
+			for (system_tick_t t=0; t<300*1000 && store.has_messages(); t+=333)
+				store.process(t, channel);
+
+			THEN("the handler is invoked once and all messages are removed")
+			{
+				REQUIRE(timeouts==1);
+				REQUIRE(!store.has_messages());
+			}
+		}
+	}
+	REQUIRE(CoAPMessage::messages()==0);
+}
+
+SCENARIO("CoAPMessage instances are allocated from a pool until it is exhausted")
+{
+	REQUIRE(CoAPMessage::messages()==0);
+	uint8_t buf[4] = { 0x60, 0, 0x12, 0x34 }; // ACK
+	Message msg(buf, sizeof(buf), sizeof(buf));
+	msg.decode_id();
+
+	const unsigned hits = g_coapPoolHitCounter;
+	const unsigned misses = g_coapPoolMissCounter;
+	std::vector<CoAPMessage*> msgs;
+	for (int i=0; i<COAP_MESSAGE_POOL_SMALL_COUNT; i++)
+	{
+		CoAPMessage* m = CoAPMessage::create(msg);
+		REQUIRE(m!=nullptr);
+		CHECK(CoAPMessagePool::contains(m));
+		msgs.push_back(m);
+	}
+	CHECK(g_coapPoolHitCounter==hits+COAP_MESSAGE_POOL_SMALL_COUNT);
+	CHECK(g_coapPoolMissCounter==misses);
+
+	// Once the small bucket is exhausted, the next bigger one is used
+	CoAPMessage* m = CoAPMessage::create(msg);
+	REQUIRE(m!=nullptr);
+	CHECK(CoAPMessagePool::contains(m));
+	msgs.push_back(m);
+
+	// Messages allocated via new are pooled too and fall back to the heap
+	for (int i=0; i<COAP_MESSAGE_POOL_MEDIUM_COUNT+COAP_MESSAGE_POOL_LARGE_COUNT; i++)
+		msgs.push_back(new CoAPMessage(i));
+	CHECK(g_coapPoolMissCounter==misses+1);
+	CoAPMessage* heap = msgs.back();
+	CHECK(!CoAPMessagePool::contains(heap));
+
+	for (CoAPMessage* m: msgs)
+		delete m;
+	REQUIRE(CoAPMessage::messages()==0);
+
+	// Freed blocks are reused
+	m = CoAPMessage::create(msg);
+	CHECK(CoAPMessagePool::contains(m));
+	delete m;
+}
+
 SCENARIO("a CoAPMessage can be created with the message buffer part of the allocation")
 {
 	// todo - factor out the message tests to their own test suite
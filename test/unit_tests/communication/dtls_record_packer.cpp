@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dtls_record_packer.h"
+
+#include <catch2/catch.hpp>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace particle::protocol;
+
+class Socket {
+public:
+    Socket() :
+            result_(0),
+            useResult_(false) {
+    }
+
+    int send(const uint8_t* data, size_t size) {
+        if (useResult_) {
+            return result_;
+        }
+        datagrams_.push_back(std::string((const char*)data, size));
+        return size;
+    }
+
+    // Makes the subsequent calls to send() return the given result
+    void result(int result) {
+        result_ = result;
+        useResult_ = true;
+    }
+
+    void ok() {
+        useResult_ = false;
+    }
+
+    const std::vector<std::string>& datagrams() const {
+        return datagrams_;
+    }
+
+private:
+    std::vector<std::string> datagrams_;
+    int result_;
+    bool useResult_;
+};
+
+int sendRecord(DtlsRecordPacker& packer, Socket& sock, const std::string& rec) {
+    return packer.send((const uint8_t*)rec.data(), rec.size(), [&sock](const uint8_t* data, size_t size) {
+        return sock.send(data, size);
+    });
+}
+
+int flush(DtlsRecordPacker& packer, Socket& sock) {
+    return packer.flush([&sock](const uint8_t* data, size_t size) {
+        return sock.send(data, size);
+    });
+}
+
+int close(DtlsRecordPacker& packer, Socket& sock) {
+    return packer.close([&sock](const uint8_t* data, size_t size) {
+        return sock.send(data, size);
+    });
+}
+
+} // namespace
+
+TEST_CASE("DtlsRecordPacker") {
+    DtlsRecordPacker packer;
+    Socket sock;
+
+    SECTION("sends each record in a separate datagram if packing is disabled") {
+        CHECK(!packer.isEnabled());
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        CHECK(sendRecord(packer, sock, "de") == 2);
+        CHECK(flush(packer, sock) == 0);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abc", "de" }));
+    }
+
+    SECTION("packs records until the next one doesn't fit in the datagram") {
+        REQUIRE(packer.init(8) == 0);
+        CHECK(packer.isEnabled());
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        CHECK(sendRecord(packer, sock, "defg") == 4);
+        CHECK(sock.datagrams().empty());
+        CHECK(packer.bufferedSize() == 7);
+        CHECK(sendRecord(packer, sock, "hi") == 2);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abcdefg" }));
+        CHECK(flush(packer, sock) == 2);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abcdefg", "hi" }));
+        CHECK(packer.bufferedSize() == 0);
+        CHECK(flush(packer, sock) == 0);
+        CHECK(sock.datagrams().size() == 2);
+    }
+
+    SECTION("fills the datagram completely") {
+        REQUIRE(packer.init(8) == 0);
+        CHECK(sendRecord(packer, sock, "abcd") == 4);
+        CHECK(sendRecord(packer, sock, "efgh") == 4);
+        CHECK(sock.datagrams().empty());
+        CHECK(flush(packer, sock) == 8);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abcdefgh" }));
+    }
+
+    SECTION("sends a record larger than the datagram as is after the buffered records") {
+        REQUIRE(packer.init(4) == 0);
+        CHECK(sendRecord(packer, sock, "ab") == 2);
+        CHECK(sendRecord(packer, sock, "cdefgh") == 6);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "ab", "cdefgh" }));
+        CHECK(packer.bufferedSize() == 0);
+    }
+
+    SECTION("keeps the buffered records if sending would block") {
+        REQUIRE(packer.init(4) == 0);
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        sock.result(0);
+        CHECK(sendRecord(packer, sock, "de") == 0);
+        CHECK(flush(packer, sock) == 0);
+        CHECK(packer.bufferedSize() == 3);
+        sock.ok();
+        CHECK(sendRecord(packer, sock, "de") == 2);
+        CHECK(flush(packer, sock) == 2);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abc", "de" }));
+    }
+
+    SECTION("discards the buffered records on an error") {
+        REQUIRE(packer.init(4) == 0);
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        sock.result(-1);
+        CHECK(sendRecord(packer, sock, "de") == -1);
+        CHECK(packer.bufferedSize() == 0);
+        sock.ok();
+        CHECK(sendRecord(packer, sock, "fg") == 2);
+        CHECK(flush(packer, sock) == 2);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "fg" }));
+    }
+
+    SECTION("discards the buffered records when reset or reinitialized") {
+        REQUIRE(packer.init(8) == 0);
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        packer.reset();
+        CHECK(flush(packer, sock) == 0);
+        CHECK(sendRecord(packer, sock, "de") == 2);
+        REQUIRE(packer.init(0) == 0);
+        CHECK(!packer.isEnabled());
+        CHECK(packer.bufferedSize() == 0);
+        CHECK(sock.datagrams().empty());
+    }
+
+    SECTION("sends the buffered records when the session is closed") {
+        REQUIRE(packer.init(8) == 0);
+        CHECK(sendRecord(packer, sock, "abc") == 3);
+        CHECK(sendRecord(packer, sock, "de") == 2);
+        CHECK(close(packer, sock) == 5);
+        CHECK(packer.bufferedSize() == 0);
+        CHECK(sock.datagrams() == std::vector<std::string>({ "abcde" }));
+        // The records are discarded if they can't be sent
+        CHECK(sendRecord(packer, sock, "fg") == 2);
+        sock.result(0);
+        CHECK(close(packer, sock) == 0);
+        CHECK(packer.bufferedSize() == 0);
+    }
+}
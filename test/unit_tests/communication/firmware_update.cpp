@@ -44,7 +44,8 @@ enum OtaCoapOption {
     FILE_SHA256 = 2061,
     CHUNK_SIZE = 2065,
     DISCARD_DATA = 2069,
-    CANCEL_UPDATE = 2073
+    CANCEL_UPDATE = 2073,
+    ACK_RANGES = 2077
 };
 
 class FirmwareUpdateWrapper: public FirmwareUpdate {
@@ -60,7 +61,8 @@ public:
     }
 
     // Sends an UpdateStart message to the device
-    int sendStart(size_t fileSize, const std::string& fileHash, size_t chunkSize, bool discardData) {
+    int sendStart(size_t fileSize, const std::string& fileHash, size_t chunkSize, bool discardData,
+            bool ackRanges = false) {
         CoapMessage m;
         m.type(CoapType::CON);
         m.code(CoapCode::POST);
@@ -73,6 +75,9 @@ public:
         if (discardData) {
             m.emptyOption(OtaCoapOption::DISCARD_DATA);
         }
+        if (ackRanges) {
+            m.emptyOption(OtaCoapOption::ACK_RANGES);
+        }
         return sendMessage(std::move(m));
     }
 
@@ -229,6 +234,22 @@ std::vector<unsigned> parseChunkAckPayload(const CoapMessage& msg) {
     return sackIndices;
 }
 
+// Returns a list of pairs of the first chunk index and the number of chunks in the range
+std::vector<std::pair<unsigned, unsigned>> parseChunkAckRanges(const CoapMessage& msg) {
+    const unsigned ackIndex = msg.option(OtaCoapOption::CHUNK_INDEX).toUInt();
+    std::vector<std::pair<unsigned, unsigned>> ranges;
+    const auto& payload = msg.payload();
+    if (payload.size() % 4 != 0) {
+        throw std::runtime_error("Unexpected size of the payload data");
+    }
+    for (size_t offs = 0; offs < payload.size(); offs += 4) {
+        uint16_t v[2] = {};
+        memcpy(v, payload.data() + offs, 4);
+        ranges.push_back(std::make_pair(ackIndex + v[0], v[1]));
+    }
+    return ranges;
+}
+
 bool hasDiagnosticPayload(const CoapMessage& msg) {
     static const std::regex rx("^\\{\"code\":-\\d+,\"message\":\".+\"\\}$");
     return msg.hasPayload() && std::regex_match(msg.payload(), rx);
@@ -236,7 +257,7 @@ bool hasDiagnosticPayload(const CoapMessage& msg) {
 
 bool hasStatsPayload(const CoapMessage& msg) {
     static const std::regex rx("^\\{\"recv_chunks\":\\d+,\"dup_chunks\":\\d+,\"ooo_chunks\":\\d+,\"sent_acks\":\\d+,"
-            "\"proc_time\":\\d+}$");
+            "\"proc_time\":\\d+,\"stall_time\":\\d+,\"rtt\":\\d+}$");
     return msg.hasPayload() && std::regex_match(msg.payload(), rx);
 }
 
@@ -597,6 +618,89 @@ TEST_CASE("FirmwareUpdate") {
         w.sendChunk(4 /* index */, genString(512) /* data */);
         CHECK(!w.hasMessages()); // ACK delayed
     }
+    SECTION("acknowledges chunks using ranges if requested by the server") {
+        w.sendStart(4096 /* fileSize */, std::string() /* fileHash */, 512 /* chunkSize */, false /* discardData */,
+                true /* ackRanges */);
+        w.skipMessages(1); // Skip the ACK
+        auto m = w.receiveMessage();
+        CHECK(m.hasOption(OtaCoapOption::ACK_RANGES));
+        // Chunk 2
+        w.sendChunk(2 /* index */, genString(512) /* data */);
+        m = w.receiveMessage();
+        CHECK(m.option(OtaCoapOption::CHUNK_INDEX).toUInt() == 0);
+        CHECK(parseChunkAckRanges(m) == std::vector<std::pair<unsigned, unsigned>>{ { 2, 1 } });
+        // Chunk 3
+        w.sendChunk(3 /* index */, genString(512) /* data */);
+        m = w.receiveMessage();
+        CHECK(parseChunkAckRanges(m) == std::vector<std::pair<unsigned, unsigned>>{ { 2, 2 } });
+        // Chunk 5
+        w.sendChunk(5 /* index */, genString(512) /* data */);
+        m = w.receiveMessage();
+        CHECK(parseChunkAckRanges(m) == std::vector<std::pair<unsigned, unsigned>>{ { 2, 2 }, { 5, 1 } });
+        // Chunk 1
+        w.sendChunk(1 /* index */, genString(512) /* data */);
+        m = w.receiveMessage();
+        CHECK(m.option(OtaCoapOption::CHUNK_INDEX).toUInt() == 3);
+        CHECK(parseChunkAckRanges(m) == std::vector<std::pair<unsigned, unsigned>>{ { 5, 1 } });
+        // Chunk 4
+        w.sendChunk(4 /* index */, genString(512) /* data */);
+        m = w.receiveMessage();
+        CHECK(m.option(OtaCoapOption::CHUNK_INDEX).toUInt() == 5);
+        CHECK(!m.hasPayload()); // No gaps
+    }
+    SECTION("uses the receiver window size configured at runtime") {
+        w.receiveWindowSize(4096);
+        CHECK(w.receiveWindowSize() == 4096);
+        w.sendStart(1000 /* fileSize */, std::string() /* fileHash */, 512 /* chunkSize */, false /* discardData */);
+        w.skipMessages(1); // Skip the ACK
+        auto m = w.receiveMessage();
+        CHECK(m.option(OtaCoapOption::WINDOW_SIZE).toUInt() == 8);
+        w.receiveWindowSize(OTA_MAX_RECEIVE_WINDOW_SIZE + 1);
+        CHECK(w.receiveWindowSize() == OTA_MAX_RECEIVE_WINDOW_SIZE);
+    }
+    SECTION("adjusts the acknowledgement delay to the measured round-trip time") {
+        w.sendStart(2048 /* fileSize */, std::string() /* fileHash */, 512 /* chunkSize */, false /* discardData */);
+        w.skipMessages(1); // Skip the ACK
+        auto m = w.receiveMessage();
+        w.addMillis(400);
+        w.sendMessage(CoapMessage().type(CoapType::ACK).code(CoapCode::EMPTY).id(m.id()));
+        CHECK(w.stats().rtt == 400);
+        // Chunk 1
+        w.sendChunk(1 /* index */, genString(512) /* data */);
+        w.skipMessages(1); // Skip the UpdateAck
+        // Chunk 2
+        w.addMillis(10);
+        w.sendChunk(2 /* index */, genString(512) /* data */);
+        w.addMillis(99);
+        w.processTimeouts();
+        CHECK(!w.hasMessages()); // ACK delayed by a quarter of the RTT
+        w.addMillis(1);
+        w.processTimeouts();
+        m = w.receiveMessage();
+        CHECK(m.option(OtaCoapOption::CHUNK_INDEX).toUInt() == 2);
+    }
+    SECTION("measures the receiver window stall time and per-window throughput") {
+        w.receiveWindowSize(1024);
+        w.sendStart(3072 /* fileSize */, std::string() /* fileHash */, 512 /* chunkSize */, false /* discardData */);
+        w.skipMessages(2); // Skip the ACK and response
+        w.sendChunk(1 /* index */, genString(512) /* data */);
+        w.addMillis(100);
+        // The server runs out of the receiver window
+        w.sendChunk(2 /* index */, genString(512) /* data */);
+        w.skipMessages(1); // Skip the UpdateAck
+        CHECK(w.stats().windowStalls == 1);
+        CHECK(w.stats().windowThroughput == 10240);
+        w.addMillis(400);
+        w.sendChunk(3 /* index */, genString(512) /* data */);
+        CHECK(w.stats().windowStallTime == 400);
+        CHECK(w.stats().rtt == 400);
+        w.addMillis(100);
+        w.sendChunk(4 /* index */, genString(512) /* data */);
+        CHECK(w.stats().windowStalls == 1);
+        CHECK(w.stats().windowThroughput == 2048);
+        CHECK(w.stats().minWindowThroughput == 2048);
+        CHECK(w.stats().maxWindowThroughput == 10240);
+    }
     SECTION("always acknowledges a duplicate chunk") {
         w.sendStart(4096 /* fileSize */, std::string() /* fileHash */, 512 /* chunkSize */, false /* discardData */);
         w.skipMessages(2); // Skip the ACK and response
@@ -21,6 +21,8 @@
 
 #include <catch2/catch.hpp>
 #include "fakeit.hpp"
+
+#include "util/coap_message_channel.h"
 using namespace fakeit;
 
 using namespace particle;
@@ -71,15 +73,16 @@ void event_handler(const char* event, const char* data)
 {
 }
 
-SCENARIO("6 subscribe messages are registered")
+SCENARIO("MAX_SUBSCRIPTIONS subscribe messages are registered")
 {
 	MessageChannel* channel = nullptr;
 	AbstractProtocol p(*channel);	// channel is not used
-	for (int i=0; i<6; i++) {
+	for (int i=0; i<MAX_SUBSCRIPTIONS; i++) {
 		INFO("adding event " << i);
-		char buf[2];
-		buf[1] = 0;
-		buf[0] = 'A'+i;
+		char buf[3];
+		buf[2] = 0;
+		buf[1] = 'A'+i%26;
+		buf[0] = 'A'+i/26;
 		bool added = p.add_event_handler(buf, event_handler);
 		REQUIRE(added);
 	}
@@ -239,3 +242,403 @@ SCENARIO("Events are non-confirmable over an unreliable channel with the NO_ACK
 {
 	verify_event_type_with_flags(EventType::NO_ACK, CoAPType::NON);
 }
+
+void store_completion_result(int error, const void* data, void* callback_data, void* reserved)
+{
+	*static_cast<int*>(callback_data) = error;
+}
+
+std::string make_test_data(size_t size)
+{
+	std::string data;
+	for (size_t i = 0; i < size; ++i) {
+		data += (char)('a' + i % 26);
+	}
+	return data;
+}
+
+SCENARIO("Events that don't fit in a single message are sent block-wise")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	test::CoapMessageChannel channel;
+	AbstractProtocol p(channel);
+	builder.build(p);
+
+	const size_t block_size = p.get_event_block_size();
+	REQUIRE(block_size > 0);
+	const std::string data = make_test_data(p.get_max_event_data_size() + block_size + 100);
+	int result = SYSTEM_ERROR_UNKNOWN;
+	REQUIRE(p.send_event("abc", data.c_str(), 60, EventType::PRIVATE, 0,
+			CompletionHandler(store_completion_result, &result)));
+
+	std::string received;
+	unsigned num = 0;
+	bool more = true;
+	while (more) {
+		REQUIRE(channel.hasMessages());
+		const auto msg = channel.receiveMessage();
+		REQUIRE(msg.type() == CoapType::CON);
+		REQUIRE(msg.code() == (unsigned)CoapCode::POST);
+		const auto path = msg.options(CoapOption::URI_PATH);
+		REQUIRE(path.size() == 2);
+		CHECK(path[1].toString() == "abc");
+		REQUIRE(msg.hasOption(CoapOption::BLOCK1));
+		unsigned block_num = 0;
+		size_t size = 0;
+		REQUIRE(decodeCoapBlockOption(msg.option(CoapOption::BLOCK1).toUInt(), &block_num, &more, &size) == 0);
+		CHECK(block_num == num);
+		CHECK(size == block_size);
+		CHECK(msg.hasOption(CoapOption::SIZE1) == (num == 0));
+		received += msg.payload();
+		// Block acknowledgements
+		CHECK(result == SYSTEM_ERROR_UNKNOWN);
+		channel.sendMessage(test::CoapMessage().type(CoapType::ACK).code(more ? CoapCode::CONTINUE : CoapCode::CHANGED)
+				.id(msg.id()));
+		REQUIRE(p.event_loop());
+		++num;
+	}
+	CHECK(received == data);
+	CHECK(result == SYSTEM_ERROR_NONE);
+	CHECK(!channel.hasMessages());
+
+	WHEN("the server rejects a block")
+	{
+		result = SYSTEM_ERROR_UNKNOWN;
+		REQUIRE(p.send_event("abc", data.c_str(), 60, EventType::PRIVATE, 0,
+				CompletionHandler(store_completion_result, &result)));
+		const auto msg = channel.receiveMessage();
+		channel.sendMessage(test::CoapMessage().type(CoapType::ACK).code(CoapCode::REQUEST_ENTITY_TOO_LARGE)
+				.id(msg.id()));
+		REQUIRE(p.event_loop());
+
+		THEN("the transfer is aborted")
+		{
+			CHECK(result == SYSTEM_ERROR_COAP_4XX);
+			CHECK(!channel.hasMessages());
+		}
+	}
+}
+
+const size_t VARIABLE_VALUE_SIZE = 3000;
+
+std::string large_variable_value;
+int large_variable_reads = 0;
+
+void get_large_variable(const char* key, SparkDescriptor::GetVariableCallback callback, void* context)
+{
+	const auto data = malloc(large_variable_value.size());
+	memcpy(data, large_variable_value.data(), large_variable_value.size());
+	++large_variable_reads;
+	callback(SYSTEM_ERROR_NONE, SparkReturnType::STRING, data, large_variable_value.size(), context);
+}
+
+// Requests the value of a variable block by block and returns the ETag of the blocks
+std::string read_large_variable(AbstractProtocol& p, test::CoapMessageChannel& channel, std::string* received,
+		unsigned* count)
+{
+	std::string etag;
+	unsigned num = 0;
+	bool more = true;
+	while (more) {
+		channel.sendMessage(test::CoapMessage().type(CoapType::CON).code(CoapCode::GET).id(100 + num).token("t")
+				.option(CoapOption::URI_PATH, "v").option(CoapOption::URI_PATH, "var")
+				.option(CoapOption::BLOCK2, encodeCoapBlockOption(num, false /* more */, 512)));
+		REQUIRE(p.event_loop());
+		const auto ack = channel.receiveMessage();
+		CHECK(ack.type() == CoapType::ACK);
+		CHECK(ack.id() == 100 + num);
+		const auto msg = channel.receiveMessage();
+		REQUIRE(msg.code() == (unsigned)CoapCode::CONTENT);
+		CHECK(msg.token() == "t");
+		unsigned block_num = 0;
+		size_t size = 0;
+		REQUIRE(decodeCoapBlockOption(msg.option(CoapOption::BLOCK2).toUInt(), &block_num, &more, &size) == 0);
+		CHECK(block_num == num);
+		CHECK(size == 512);
+		if (num == 0) {
+			CHECK(msg.option(CoapOption::SIZE2).toUInt() == VARIABLE_VALUE_SIZE);
+			etag = msg.option(CoapOption::ETAG).toString();
+			CHECK(etag.size() == 4);
+		} else {
+			CHECK(msg.option(CoapOption::ETAG).toString() == etag);
+		}
+		*received += msg.payload();
+		++num;
+	}
+	*count = num;
+	return etag;
+}
+
+SCENARIO("Variable values are sent block-wise when the server requests the Block2 option")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	builder.descriptor.size = sizeof(builder.descriptor);
+	builder.descriptor.get_variable_async = get_large_variable;
+	test::CoapMessageChannel channel;
+	AbstractProtocol p(channel);
+	builder.build(p);
+
+	large_variable_value = make_test_data(VARIABLE_VALUE_SIZE);
+	large_variable_reads = 0;
+	std::string received;
+	unsigned num = 0;
+	const auto etag = read_large_variable(p, channel, &received, &num);
+	CHECK(received == large_variable_value);
+	CHECK(num == (VARIABLE_VALUE_SIZE + 511) / 512);
+
+	THEN("the value is read once per transfer")
+	{
+		CHECK(large_variable_reads == 1);
+	}
+
+	WHEN("the value changes between the transfers")
+	{
+		large_variable_value[0] = '-';
+		received.clear();
+		const auto etag2 = read_large_variable(p, channel, &received, &num);
+
+		THEN("the new value is sent with a different ETag")
+		{
+			CHECK(received == large_variable_value);
+			CHECK(etag2 != etag);
+			CHECK(large_variable_reads == 2);
+		}
+	}
+
+	WHEN("the value changes during a transfer")
+	{
+		received.clear();
+		large_variable_value[0] = '-';
+		channel.sendMessage(test::CoapMessage().type(CoapType::CON).code(CoapCode::GET).id(1).token("t")
+				.option(CoapOption::URI_PATH, "v").option(CoapOption::URI_PATH, "var")
+				.option(CoapOption::BLOCK2, encodeCoapBlockOption(0, false /* more */, 512)));
+		REQUIRE(p.event_loop());
+		channel.receiveMessage(); // ACK
+		received += channel.receiveMessage().payload();
+		large_variable_value[600] = '-';
+		channel.sendMessage(test::CoapMessage().type(CoapType::CON).code(CoapCode::GET).id(2).token("t")
+				.option(CoapOption::URI_PATH, "v").option(CoapOption::URI_PATH, "var")
+				.option(CoapOption::BLOCK2, encodeCoapBlockOption(1, false /* more */, 512)));
+		REQUIRE(p.event_loop());
+		channel.receiveMessage(); // ACK
+		received += channel.receiveMessage().payload();
+
+		THEN("the subsequent blocks are served from the snapshot taken at the start of the transfer")
+		{
+			CHECK(received[0] == '-');
+			CHECK(received[600] != '-');
+			CHECK(large_variable_reads == 2);
+		}
+	}
+}
+
+
+std::string received_event_name;
+std::string received_event_data;
+
+void store_event(const char* event, const char* data)
+{
+	received_event_name = event;
+	received_event_data = data ? data : "";
+}
+
+std::string called_function_key;
+std::string called_function_arg;
+
+int store_function_call(const char* key, const char* arg, SparkDescriptor::FunctionResultCallback callback, void* reserved)
+{
+	called_function_key = key;
+	called_function_arg = arg;
+	return 0;
+}
+
+SCENARIO("Requests are parsed from the decoded CoAP options")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	builder.descriptor.size = sizeof(builder.descriptor);
+	builder.descriptor.call_function = store_function_call;
+	test::CoapMessageChannel channel;
+	AbstractProtocol p(channel);
+	builder.build(p);
+
+	WHEN("an event with a multi-segment name is received")
+	{
+		REQUIRE(p.add_event_handler("my/event", store_event));
+		// The 14-character segment is encoded with an extended option length
+		channel.sendMessage(test::CoapMessage().type(CoapType::NON).code(CoapCode::POST).id(1)
+				.option(CoapOption::URI_PATH, "e").option(CoapOption::URI_PATH, "my")
+				.option(CoapOption::URI_PATH, "event").option(CoapOption::URI_PATH, "with-long-name")
+				.option(CoapOption::MAX_AGE, 60).payload("data"));
+		REQUIRE(p.event_loop());
+
+		THEN("the segments are joined into the event name")
+		{
+			CHECK(received_event_name == "my/event/with-long-name");
+			CHECK(received_event_data == "data");
+		}
+	}
+
+	WHEN("a function call is received")
+	{
+		channel.sendMessage(test::CoapMessage().type(CoapType::CON).code(CoapCode::POST).id(2).token("t")
+				.option(CoapOption::URI_PATH, "f").option(CoapOption::URI_PATH, "fn")
+				.option(CoapOption::URI_QUERY, "argument"));
+		REQUIRE(p.event_loop());
+
+		THEN("the function is called with the key and argument from the request")
+		{
+			const auto ack = channel.receiveMessage();
+			CHECK(ack.type() == CoapType::ACK);
+			CHECK(ack.code() == (unsigned)CoapCode::EMPTY);
+			CHECK(ack.id() == 2);
+			CHECK(called_function_key == "fn");
+			CHECK(called_function_arg == "argument");
+		}
+	}
+}
+
+const char* const describe_function_keys[] = { "fn1", "fn2" };
+int describe_function_count = 1;
+int describe_build_count = 0;
+int describe_checksum_count = 0;
+
+int describe_num_functions()
+{
+	++describe_build_count;
+	return describe_function_count;
+}
+
+const char* describe_function_key(int index)
+{
+	return describe_function_keys[index];
+}
+
+int describe_num_variables()
+{
+	return 0;
+}
+
+uint32_t describe_app_state(SparkAppStateSelector::Enum selector, SparkAppStateUpdate::Enum operation, uint32_t data, void* reserved)
+{
+	if (selector == SparkAppStateSelector::DESCRIBE_APP && operation == SparkAppStateUpdate::COMPUTE) {
+		++describe_checksum_count;
+		return describe_function_count;
+	}
+	return 0;
+}
+
+SCENARIO("The describe payload is cached until the application state changes")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	builder.descriptor.size = sizeof(builder.descriptor);
+	builder.descriptor.num_functions = describe_num_functions;
+	builder.descriptor.get_function_key = describe_function_key;
+	builder.descriptor.num_variables = describe_num_variables;
+	builder.descriptor.app_state_selector_info = describe_app_state;
+	test::CoapMessageChannel channel;
+	AbstractProtocol p(channel);
+	builder.build(p);
+
+	describe_function_count = 1;
+	describe_build_count = 0;
+	describe_checksum_count = 0;
+	auto request_description = [&channel, &p](unsigned id) {
+		channel.sendMessage(test::CoapMessage().type(CoapType::CON).code(CoapCode::GET).id(id).token("t")
+				.option(CoapOption::URI_PATH, "d").option(CoapOption::URI_QUERY, std::string(1, (char)DESCRIBE_APPLICATION)));
+		REQUIRE(p.event_loop());
+		const auto ack = channel.receiveMessage();
+		CHECK(ack.id() == id);
+		return channel.receiveMessage().payload();
+	};
+
+	CHECK(request_description(1) == "{\"f\":[\"fn1\"],\"v\":{}}");
+	CHECK(describe_build_count == 1);
+	CHECK(request_description(2) == "{\"f\":[\"fn1\"],\"v\":{}}");
+	CHECK(describe_build_count == 1);
+
+	WHEN("a function is registered")
+	{
+		describe_function_count = 2;
+
+		THEN("the payload is rebuilt")
+		{
+			CHECK(request_description(3) == "{\"f\":[\"fn1\",\"fn2\"],\"v\":{}}");
+			CHECK(describe_build_count == 2);
+		}
+	}
+
+	WHEN("the description is posted")
+	{
+		describe_checksum_count = 0;
+		REQUIRE(p.post_description(DESCRIBE_APPLICATION, false /* force */) == ProtocolError::NO_ERROR);
+
+		THEN("the checksum is computed once and the cached payload is sent")
+		{
+			CHECK(channel.receiveMessage().payload() == "{\"f\":[\"fn1\"],\"v\":{}}");
+			CHECK(describe_checksum_count == 1);
+			CHECK(describe_build_count == 1);
+		}
+	}
+}
+
+std::vector<std::string> dispatched_events;
+
+void store_dispatched_event(void* handler_data, const char* event, const char* data)
+{
+	dispatched_events.push_back(std::string((const char*)handler_data) + ":" + event);
+}
+
+SCENARIO("Events are dispatched to all handlers whose filter is a prefix of the event name, in the order the handlers were added")
+{
+	ProtocolBuilder builder;
+	builder.callbacks.millis = &fake_millis;
+	builder.descriptor.size = sizeof(builder.descriptor);
+	test::CoapMessageChannel channel;
+	AbstractProtocol p(channel);
+	builder.build(p);
+
+	const char* const filters[] = { "ab", "", "abc", "a", "abd", "b", "abc" };
+	for (unsigned i = 0; i < sizeof(filters) / sizeof(filters[0]); ++i) {
+		REQUIRE(p.add_event_handler(filters[i], (EventHandler)store_dispatched_event, (void*)filters[i],
+				SubscriptionScope::MY_DEVICES, nullptr));
+	}
+	dispatched_events.clear();
+	auto send_event = [&channel, &p](const char* name) {
+		channel.sendMessage(test::CoapMessage().type(CoapType::NON).code(CoapCode::POST).id(1)
+				.option(CoapOption::URI_PATH, "e").option(CoapOption::URI_PATH, name));
+		REQUIRE(p.event_loop());
+	};
+
+	send_event("abcd");
+	CHECK(dispatched_events == std::vector<std::string>({ "ab:abcd", ":abcd", "abc:abcd", "a:abcd" }));
+
+	WHEN("handlers are removed")
+	{
+		p.remove_event_handlers("ab");
+		p.remove_event_handlers("");
+		dispatched_events.clear();
+		send_event("abd");
+
+		THEN("the remaining handlers are still called")
+		{
+			CHECK(dispatched_events == std::vector<std::string>({ "a:abd", "abd:abd" }));
+		}
+
+		AND_WHEN("a handler is added again")
+		{
+			REQUIRE(p.add_event_handler("ab", (EventHandler)store_dispatched_event, (void*)"ab",
+					SubscriptionScope::MY_DEVICES, nullptr));
+			dispatched_events.clear();
+			send_event("abc");
+
+			THEN("it is called after the existing handlers")
+			{
+				CHECK(dispatched_events == std::vector<std::string>({ "abc:abc", "a:abc", "ab:abc" }));
+			}
+		}
+	}
+}
@@ -18,11 +18,61 @@
  */
 
 #include "publisher.h"
+#include "protocol.h"
+
+#include "util/coap_message_channel.h"
 
 #include <catch2/catch.hpp>
 
+#include <string>
+#include <cstring>
+
+using namespace particle;
 using namespace particle::protocol;
 
+namespace {
+
+class TestProtocol : public Protocol
+{
+public:
+	TestProtocol(MessageChannel& channel) : Protocol(channel) {}
+
+	size_t build_hello(Message& message, uint16_t flags) override
+	{
+		return 0;
+	}
+
+	int command(ProtocolCommands::Enum command, uint32_t value, const void* data) override
+	{
+		return 0;
+	}
+
+	void init(const char *id, const SparkKeys &keys, const SparkCallbacks &callbacks,
+			const SparkDescriptor &descriptor) override
+	{
+	}
+
+	int get_status(protocol_status* status) const override
+	{
+		return 0;
+	}
+};
+
+struct HandlerResult
+{
+	bool done = false;
+	int error = 0;
+};
+
+void handler_callback(int error, const void* data, void* callback_data, void* reserved)
+{
+	const auto r = static_cast<HandlerResult*>(callback_data);
+	r->done = true;
+	r->error = error;
+}
+
+} // namespace
+
 SCENARIO("publisher")
 {
 	GIVEN("a publisher")
@@ -30,56 +80,71 @@ SCENARIO("publisher")
 		Protocol* protocol = nullptr;
 		Publisher publisher(protocol);
 
-		WHEN("4 application events are sent within 1 second")
+		WHEN("4 application events are sent at once")
 		{
-			REQUIRE(publisher.is_rate_limited(false, 1000)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1200)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1400)==false);
-			REQUIRE(publisher.is_rate_limited(false, 1600)==false);
+			for (int i=0; i<4; i++) {
+				REQUIRE(publisher.is_rate_limited(false, 1000)==false);
+			}
 
-			const system_tick_t next_app_event = 5000;  // 1000ms + 4s
-			THEN("application events until 4 seconds have elapsed are rate limited")
+			THEN("application events are rate limited until the budget for one event is regained")
 			{
-				for (system_tick_t i=1600; i<next_app_event; i+=100) {
+				for (system_tick_t i=1000; i<1250; i+=10) {
 					REQUIRE(publisher.is_rate_limited(false, i)==true);
 				}
+				REQUIRE(publisher.next_event_delay(false, 1000)==250);
+				REQUIRE(publisher.is_rate_limited(false, 1250)==false);
 			}
 
-			THEN("an application event after 4 seconds have elapsed is not rate limited")
+			THEN("4 application events are allowed per second")
 			{
-				REQUIRE(publisher.is_rate_limited(false, next_app_event)==false);
+				for (system_tick_t i=1250; i<=2000; i+=250) {
+					REQUIRE(publisher.next_event_delay(false, i)==0);
+					REQUIRE(publisher.is_rate_limited(false, i)==false);
+					REQUIRE(publisher.is_rate_limited(false, i)==true);
+				}
+			}
+
+			THEN("rejected events do not delay the next token")
+			{
+				for (system_tick_t i=1000; i<1250; i+=10) {
+					publisher.is_rate_limited(false, i);
+				}
+				REQUIRE(publisher.is_rate_limited(false, 1250)==false);
+			}
+
+			THEN("the full burst is available again after a second")
+			{
+				for (int i=0; i<4; i++) {
+					REQUIRE(publisher.is_rate_limited(false, 2000)==false);
+				}
+				REQUIRE(publisher.is_rate_limited(false, 2000)==true);
 			}
 		}
 
-		WHEN("255 system events are sent in less than a minute")
+		WHEN("255 system events are sent in less than a second")
 		{
 			for (int i=0; i<255; i++) {
 				INFO("The counter is " << i);
 				REQUIRE(publisher.is_rate_limited(true, i)==false);
 			}
 
-			THEN("all system events until the next minute begins are rate limited")
+			THEN("further system events are rate limited until the budget is regained")
 			{
-				for (int i=1000; i<60*1000; i+=1000) {
-					INFO("The counter is " << i);
-					REQUIRE(publisher.is_rate_limited(true, i)==true);
-				}
-
-				// it's only approximately 1 minute, the cutoff is 64k milliseconds
-				for (int i=60000; i<65536; i+=8) {
-					INFO("The counter is " << i);
-					REQUIRE(publisher.is_rate_limited(true, i)==true);
-				}
+				REQUIRE(publisher.is_rate_limited(true, 254)==true);
+				// The budget is regained relative to the first event
+				REQUIRE(publisher.next_event_delay(true, 254)==PUBLISH_SYSTEM_RATE_LIMIT_PERIOD - 254);
+				REQUIRE(publisher.is_rate_limited(true, PUBLISH_SYSTEM_RATE_LIMIT_PERIOD)==false);
+				REQUIRE(publisher.is_rate_limited(true, PUBLISH_SYSTEM_RATE_LIMIT_PERIOD)==true);
 
-				AND_THEN("system events in the next minute are not rate limited")
+				AND_THEN("the full burst is available again after about a minute")
 				{
-					for (int i=65536; i<65536+255; i++) {
+					const system_tick_t t = 256 * PUBLISH_SYSTEM_RATE_LIMIT_PERIOD;
+					for (int i=0; i<255; i++) {
 						INFO("The counter is " << i);
-						REQUIRE(publisher.is_rate_limited(true, i)==false);
+						REQUIRE(publisher.is_rate_limited(true, t)==false);
 					}
 				}
 			}
-
 			THEN("application events are still rate limited after a burst of 4")
 			{
 				REQUIRE(publisher.is_rate_limited(false, 1000)==false);
@@ -89,5 +154,152 @@ SCENARIO("publisher")
 				REQUIRE(publisher.is_rate_limited(false, 1000)==true);
 			}
 		}
+
+		WHEN("the rate limit is reconfigured")
+		{
+			publisher.set_rate_limit(false, 2, 100);
+
+			THEN("the new burst and rate apply")
+			{
+				REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				REQUIRE(publisher.is_rate_limited(false, 0)==true);
+				REQUIRE(publisher.next_event_delay(false, 50)==50);
+				REQUIRE(publisher.is_rate_limited(false, 100)==false);
+			}
+
+			THEN("a zero period disables rate limiting")
+			{
+				publisher.set_rate_limit(false, 0, 0);
+				for (int i=0; i<100; i++) {
+					REQUIRE(publisher.is_rate_limited(false, 0)==false);
+				}
+			}
+		}
+
+		WHEN("the tick counter overflows")
+		{
+			const system_tick_t t = (system_tick_t)-100;
+			for (int i=0; i<4; i++) {
+				REQUIRE(publisher.is_rate_limited(false, t)==false);
+			}
+
+			THEN("tokens are regained across the overflow")
+			{
+				REQUIRE(publisher.is_rate_limited(false, 0)==true);
+				REQUIRE(publisher.next_event_delay(false, 0)==150);
+				REQUIRE(publisher.is_rate_limited(false, 150)==false);
+			}
+		}
+	}
+}
+
+SCENARIO("batched events are encoded as length-prefixed records")
+{
+	GIVEN("a buffer")
+	{
+		char buf[64] = {};
+
+		WHEN("an event is encoded")
+		{
+			const size_t n = Publisher::encode_batch_record(buf, sizeof(buf), "temp", "21.5", 4, 60);
+
+			THEN("the record contains the name, data and TTL")
+			{
+				REQUIRE(n == strlen("4:temp4:21.560\n"));
+				REQUIRE(std::string(buf, n) == "4:temp4:21.560\n");
+			}
+		}
+
+		WHEN("an event without data is encoded")
+		{
+			const size_t n = Publisher::encode_batch_record(buf, sizeof(buf), "boot", nullptr, 0, 3600);
+
+			THEN("the data length is zero")
+			{
+				REQUIRE(std::string(buf, n) == "4:boot0:3600\n");
+			}
+		}
+
+		WHEN("the buffer is too small")
+		{
+			const size_t n = Publisher::encode_batch_record(buf, 8, "temperature", "21.5", 4, 60);
+
+			THEN("the full size of the record is returned and the buffer is not overrun")
+			{
+				REQUIRE(n == strlen("11:temperature4:21.560\n"));
+				REQUIRE(buf[8] == '\0');
+			}
+		}
+	}
+}
+
+SCENARIO("completion handlers of batched events are invoked when the batch is sent")
+{
+	GIVEN("a publisher with a pending batch")
+	{
+		test::CoapMessageChannel channel;
+		TestProtocol protocol(channel);
+		Publisher publisher(&protocol);
+		HandlerResult r1, r2;
+		REQUIRE(publisher.send_event(channel, "a", "1", 60, EventType::PRIVATE, EventType::BATCH, 0,
+				CompletionHandler(handler_callback, &r1))==NO_ERROR);
+		REQUIRE(publisher.send_event(channel, "b", "2", 60, EventType::PRIVATE, EventType::BATCH, 0,
+				CompletionHandler(handler_callback, &r2))==NO_ERROR);
+
+		THEN("the handlers are not invoked while the events are queued")
+		{
+			REQUIRE(publisher.has_batch());
+			REQUIRE_FALSE(channel.hasMessages());
+			REQUIRE_FALSE(r1.done);
+			REQUIRE_FALSE(r2.done);
+		}
+
+		WHEN("the batch is sent")
+		{
+			REQUIRE(publisher.process(channel, PUBLISH_BATCH_MAX_DELAY)==NO_ERROR);
+
+			THEN("all handlers of the batch are completed")
+			{
+				REQUIRE_FALSE(publisher.has_batch());
+				REQUIRE(channel.hasMessages());
+				REQUIRE(r1.done);
+				REQUIRE(r1.error==0);
+				REQUIRE(r2.done);
+				REQUIRE(r2.error==0);
+			}
+		}
+
+		WHEN("the publisher is reset")
+		{
+			publisher.reset();
+
+			THEN("the batch is discarded and its handlers are aborted")
+			{
+				REQUIRE_FALSE(publisher.has_batch());
+				REQUIRE_FALSE(channel.hasMessages());
+				REQUIRE(r1.done);
+				REQUIRE(r1.error==SYSTEM_ERROR_ABORTED);
+				REQUIRE(r2.done);
+				REQUIRE(r2.error==SYSTEM_ERROR_ABORTED);
+				REQUIRE(publisher.process(channel, PUBLISH_BATCH_MAX_DELAY)==NO_ERROR);
+				REQUIRE_FALSE(channel.hasMessages());
+			}
+		}
+
+		WHEN("an event of another type flushes the batch")
+		{
+			HandlerResult r3;
+			REQUIRE(publisher.send_event(channel, "c", "3", 60, EventType::PUBLIC, EventType::BATCH, 0,
+					CompletionHandler(handler_callback, &r3))==NO_ERROR);
+
+			THEN("only the handlers of the sent batch are completed")
+			{
+				REQUIRE(r1.done);
+				REQUIRE(r2.done);
+				REQUIRE_FALSE(r3.done);
+				REQUIRE(publisher.has_batch());
+			}
+		}
 	}
 }
@@ -1,4 +1,5 @@
 #include "inflate.h"
+#include "inflate_impl.h"
 #include "system_error.h"
 
 #include <boost/iostreams/filter/zlib.hpp>
@@ -6,6 +7,9 @@
 #include <boost/iostreams/copy.hpp>
 
 #include <functional>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
 #include <random>
 #include <string>
 #include <vector>
@@ -22,6 +26,7 @@ class Options {
 public:
     Options() :
             windowBits_(DEFAULT_WINDOW_BITS),
+            bufferBits_(0),
             hasMoreInput_(false) {
     }
 
@@ -43,8 +48,18 @@ public:
         return windowBits_;
     }
 
+    Options& bufferBits(unsigned count) {
+        bufferBits_ = count;
+        return *this;
+    }
+
+    unsigned bufferBits() const {
+        return bufferBits_;
+    }
+
 private:
     unsigned windowBits_;
+    unsigned bufferBits_;
     bool hasMoreInput_;
 };
 
@@ -80,6 +95,7 @@ public:
         destroy();
         inflate_opts inflOpts = {};
         inflOpts.window_bits = opts.windowBits();
+        inflOpts.buffer_bits = opts.bufferBits();
         const int r = inflate_create(&ctx_, &inflOpts, outputCallback, this);
         REQUIRE(r == 0);
     }
@@ -250,6 +266,31 @@ TEST_CASE("inflate_create()") {
         CHECK(ctx == nullptr);
     }
 
+    SECTION("can be configured with an output buffer larger than the window") {
+        inflate_ctx* ctx = nullptr;
+        inflate_opts opts = {};
+        opts.window_bits = 10;
+        opts.buffer_bits = INFLATE_MAX_BUFFER_BITS;
+        int r = inflate_create(&ctx, &opts, dummyOutputCallback, nullptr);
+        CHECK(r == 0);
+        CHECK(ctx != nullptr);
+        inflate_destroy(ctx);
+    }
+
+    SECTION("fails if the number of buffer bits is out of range") {
+        inflate_ctx* ctx = nullptr;
+        inflate_opts opts = {};
+        opts.window_bits = 12;
+        opts.buffer_bits = 11;
+        int r = inflate_create(&ctx, &opts, dummyOutputCallback, nullptr);
+        CHECK(r == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(ctx == nullptr);
+        opts.buffer_bits = INFLATE_MAX_BUFFER_BITS + 1;
+        r = inflate_create(&ctx, &opts, dummyOutputCallback, nullptr);
+        CHECK(r == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(ctx == nullptr);
+    }
+
     SECTION("fails if the output callback is NULL") {
         inflate_ctx* ctx = nullptr;
         int r = inflate_create(&ctx, nullptr, nullptr, nullptr);
@@ -417,6 +458,26 @@ TEST_CASE("inflate_input()") {
         CHECK(infl.output() == decomp);
     }
 
+    SECTION("works as expected with an output buffer larger than the window") {
+        auto decomp = genCompressibleData(200000);
+        auto comp = deflate(decomp);
+        infl.init(Options().bufferBits(INFLATE_MAX_BUFFER_BITS));
+        infl.outputFn([](const char* data, size_t size, Output* out) {
+            return out->append(data, std::min(randomSize(1000, 50000), size));
+        });
+        int r = 0;
+        size_t offs = 0;
+        do {
+            auto data = comp.data() + offs;
+            size_t size = std::min<size_t>(256, comp.size() - offs);
+            bool hasMore = (offs + size < comp.size());
+            r = infl.input(data, &size, Options().hasMoreInput(hasMore));
+            offs += size;
+        } while (r == INFLATE_NEEDS_MORE_INPUT || r == INFLATE_HAS_MORE_OUTPUT);
+        CHECK(r == INFLATE_DONE);
+        CHECK(infl.output() == decomp);
+    }
+
     SECTION("stress test") {
         for (unsigned i = 0; i < 500; ++i) {
             auto decomp = genCompressibleData(10000, 100000);
@@ -437,3 +498,54 @@ TEST_CASE("inflate_input()") {
         }
     }
 }
+
+// Run explicitly with: hal "[benchmark]"
+//
+// A firmware image can be used as the test data by setting the INFLATE_BENCHMARK_FILE environment
+// variable to the path of the binary
+TEST_CASE("inflate_input() throughput", "[.][benchmark]") {
+    std::string decomp;
+    const auto file = std::getenv("INFLATE_BENCHMARK_FILE");
+    if (file) {
+        std::ifstream in(file, std::ios::binary);
+        REQUIRE(in);
+        decomp.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else {
+        decomp = genCompressibleData(512 * 1024);
+    }
+    const auto comp = deflate(decomp);
+    WARN("Uncompressed size: " << decomp.size() << "; compressed size: " << comp.size());
+    const unsigned iterations = 20;
+    // Input chunk sizes: the bootloader reads the compressed data from flash in 256-byte blocks
+    for (size_t chunkSize: { 256, 4096 }) {
+        for (unsigned bufBits = DEFAULT_WINDOW_BITS; bufBits <= INFLATE_MAX_BUFFER_BITS; ++bufBits) {
+            Inflate infl;
+            infl.init(Options().bufferBits(bufBits));
+            size_t outSize = 0;
+            infl.outputFn([&outSize](const char* data, size_t size, Output* out) {
+                outSize += size;
+                return size;
+            });
+            const auto t1 = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < iterations; ++i) {
+                int r = 0;
+                size_t offs = 0;
+                do {
+                    auto data = comp.data() + offs;
+                    size_t size = std::min(chunkSize, comp.size() - offs);
+                    bool hasMore = (offs + size < comp.size());
+                    r = infl.input(data, &size, Options().hasMoreInput(hasMore));
+                    offs += size;
+                } while (r == INFLATE_NEEDS_MORE_INPUT || r == INFLATE_HAS_MORE_OUTPUT);
+                REQUIRE(r == INFLATE_DONE);
+                infl.reset();
+            }
+            const auto t2 = std::chrono::steady_clock::now();
+            REQUIRE(outSize == decomp.size() * iterations);
+            const double sec = std::chrono::duration<double>(t2 - t1).count();
+            const size_t ramSize = sizeof(inflate_ctx) + (1 << bufBits);
+            WARN("Input chunk: " << chunkSize << " bytes; buffer: " << (1 << bufBits) << " bytes; RAM: " <<
+                    ramSize << " bytes; " << outSize / sec / 1e6 << " MB/s");
+        }
+    }
+}
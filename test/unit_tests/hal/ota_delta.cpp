@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_delta.h"
+
+#include <catch2/catch.hpp>
+
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace {
+
+using namespace particle;
+
+const uintptr_t BASE_ADDRESS = 0x1000;
+const uintptr_t DEST_ADDRESS = 0x2000;
+
+std::string g_intFlash;
+std::string g_extFlash;
+
+int readFlash(const std::string& flash, uintptr_t addr, uint8_t* data, size_t size) {
+    if (addr + size > flash.size()) {
+        return -1;
+    }
+    memcpy(data, flash.data() + addr, size);
+    return 0;
+}
+
+int writeFlash(std::string* flash, uintptr_t addr, const uint8_t* data, size_t size) {
+    if (addr + size > flash->size()) {
+        return -1;
+    }
+    memcpy(&flash->at(addr), data, size);
+    return 0;
+}
+
+// Stand-in for SHA-256: a CRC-32 of the data padded with zeros
+class TestHash {
+public:
+    static const size_t HASH_SIZE = 32;
+
+    int init() {
+        return 0;
+    }
+
+    int start() {
+        crc_ = crc32(0, nullptr, 0);
+        return 0;
+    }
+
+    int update(const char* data, size_t size) {
+        crc_ = crc32(crc_, (const Bytef*)data, size);
+        return 0;
+    }
+
+    int finish(char* buf) {
+        memset(buf, 0, HASH_SIZE);
+        memcpy(buf, &crc_, sizeof(crc_));
+        return 0;
+    }
+
+    static void hash(const std::string& data, uint8_t* buf) {
+        TestHash h;
+        h.start();
+        h.update(data.data(), data.size());
+        h.finish((char*)buf);
+    }
+
+private:
+    uLong crc_;
+};
+
+class Patch {
+public:
+    Patch& record(uint32_t diffSize, uint32_t extraSize, int32_t seek) {
+        const uint32_t v[3] = { nativeToLittleEndian(diffSize), nativeToLittleEndian(extraSize),
+                nativeToLittleEndian((uint32_t)seek) };
+        data_.append((const char*)v, sizeof(v));
+        return *this;
+    }
+
+    // Appends diff bytes that turn `base` into `target`
+    Patch& diff(const std::string& base, const std::string& target) {
+        for (size_t i = 0; i < target.size(); ++i) {
+            data_ += (char)((uint8_t)target[i] - (uint8_t)base[i]);
+        }
+        return *this;
+    }
+
+    Patch& extra(const std::string& data) {
+        data_ += data;
+        return *this;
+    }
+
+    const std::string& data() const {
+        return data_;
+    }
+
+private:
+    std::string data_;
+};
+
+// Applies a patch to the base module, feeding the patch data in pieces of the given size
+int applyPatch(const std::string& base, const std::string& target, const std::string& patch, size_t pieceSize = 7,
+        std::string* result = nullptr) {
+    g_intFlash = std::string(BASE_ADDRESS, '\xff') + base;
+    g_extFlash = std::string(DEST_ADDRESS + target.size() + 1024, '\xff');
+    delta_module_header header = {};
+    header.size = sizeof(header);
+    header.original_size = target.size();
+    header.base_size = base.size();
+    TestHash::hash(target, header.sha);
+    DeltaPatcher<TestHash> patcher(header, FLASH_INTERNAL, BASE_ADDRESS, FLASH_SERIAL, DEST_ADDRESS);
+    REQUIRE(patcher.init() == 0);
+    for (size_t offs = 0; offs < patch.size(); offs += pieceSize) {
+        const size_t n = std::min(pieceSize, patch.size() - offs);
+        const int r = patcher.process(patch.data() + offs, n);
+        if (r < 0) {
+            return r;
+        }
+        REQUIRE(r == (int)n);
+    }
+    const int r = patcher.finish();
+    if (result) {
+        *result = g_extFlash.substr(DEST_ADDRESS, target.size());
+    }
+    return r;
+}
+
+std::string makeData(size_t size, unsigned seed) {
+    std::string s;
+    for (size_t i = 0; i < size; ++i) {
+        s += (char)((i * 31 + seed * 17) ^ (i >> 3));
+    }
+    return s;
+}
+
+} // namespace
+
+extern "C" {
+
+int hal_flash_read(uintptr_t addr, uint8_t* data, size_t size) {
+    return readFlash(g_intFlash, addr, data, size);
+}
+
+int hal_flash_write(uintptr_t addr, const uint8_t* data, size_t size) {
+    return writeFlash(&g_intFlash, addr, data, size);
+}
+
+int hal_exflash_read(uintptr_t addr, uint8_t* data, size_t size) {
+    return readFlash(g_extFlash, addr, data, size);
+}
+
+int hal_exflash_write(uintptr_t addr, const uint8_t* data, size_t size) {
+    return writeFlash(&g_extFlash, addr, data, size);
+}
+
+} // extern "C"
+
+TEST_CASE("DeltaPatcher") {
+    // Target: the first 1000 bytes of the base with a few changes, 300 new bytes, and the rest of
+    // the base with the next 200 bytes skipped
+    const auto base = makeData(3000, 1);
+    auto target = base.substr(0, 1000);
+    target[10] ^= 0x55;
+    target[999] ^= 0xaa;
+    const auto inserted = makeData(300, 2);
+    target += inserted;
+    target += base.substr(1200);
+    Patch patch;
+    patch.record(1000, 300, 200).diff(base.substr(0, 1000), target.substr(0, 1000)).extra(inserted);
+    patch.record(1800, 0, 0).diff(base.substr(1200), target.substr(1300));
+
+    SECTION("reconstructs a module from a valid patch") {
+        for (size_t pieceSize: { (size_t)1, (size_t)7, (size_t)256, patch.data().size() }) {
+            std::string result;
+            CHECK(applyPatch(base, target, patch.data(), pieceSize, &result) == 0);
+            CHECK(result == target);
+        }
+    }
+
+    SECTION("applies a patch with a negative seek") {
+        // Output the second half of the base followed by the first half
+        const auto target2 = base.substr(1500) + base.substr(0, 1500);
+        Patch p;
+        p.record(0, 0, 1500).record(1500, 0, -3000).diff(base.substr(1500), target2.substr(0, 1500));
+        p.record(1500, 0, 0).diff(base.substr(0, 1500), target2.substr(1500));
+        std::string result;
+        CHECK(applyPatch(base, target2, p.data(), 64, &result) == 0);
+        CHECK(result == target2);
+    }
+
+    SECTION("rejects a truncated patch") {
+        // Truncated in the middle of the diff data
+        auto data = patch.data();
+        data.resize(data.size() - 10);
+        CHECK(applyPatch(base, target, data) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+        // Truncated in the middle of a record header
+        data = patch.data().substr(0, 12 + 1300 + 5);
+        CHECK(applyPatch(base, target, data) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+    }
+
+    SECTION("rejects a patch with trailing data") {
+        auto data = patch.data();
+        data += Patch().record(0, 1, 0).extra("x").data();
+        CHECK(applyPatch(base, target, data) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+    }
+
+    SECTION("rejects a patch that reads outside of the base module") {
+        // Seek past the end of the base module
+        Patch p1;
+        p1.record(1000, 300, 2000).diff(base.substr(0, 1000), target.substr(0, 1000)).extra(inserted);
+        p1.record(1800, 0, 0).diff(base.substr(1200), target.substr(1300));
+        CHECK(applyPatch(base, target, p1.data()) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+        // Seek before the start of the base module
+        Patch p2;
+        p2.record(0, 0, -1).record(10, 0, 0).diff(base, target.substr(0, 10));
+        CHECK(applyPatch(base, target, p2.data()) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+        // Diff larger than the base module
+        Patch p3;
+        p3.record(base.size() + 1, 0, 0);
+        CHECK(applyPatch(base, base + "x", p3.data()) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+    }
+
+    SECTION("rejects a patch that produces too much data") {
+        Patch p;
+        p.record(0, target.size() + 1, 0);
+        CHECK(applyPatch(base, target, p.data()) == SYSTEM_ERROR_OTA_INVALID_FORMAT);
+    }
+
+    SECTION("rejects a patch if the hash of the reconstructed module doesn't match") {
+        auto data = patch.data();
+        data[12 + 500] ^= 0x01; // Corrupt a diff byte
+        CHECK(applyPatch(base, target, data) == SYSTEM_ERROR_OTA_INTEGRITY_CHECK_FAILED);
+    }
+}
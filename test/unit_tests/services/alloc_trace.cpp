@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define ALLOC_TRACE_ENABLED 1
+
+#include "alloc_trace.h"
+#include "system_error.h"
+#include "logging.h"
+
+#include "catch2/catch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+extern "C" uint32_t HAL_Timer_Get_Milli_Seconds() {
+    static uint32_t millis = 0;
+    return millis += 10;
+}
+
+extern "C" void log_message(int level, const char* category, LogAttributes* attr, void* reserved, const char* fmt, ...) {
+}
+
+namespace {
+
+using namespace particle;
+
+alloc_trace_stats getStats(int tag) {
+    alloc_trace_stats s = {};
+    REQUIRE(alloc_trace_get_stats(tag, &s, nullptr) == 0);
+    return s;
+}
+
+void resetStats() {
+    alloc_trace_reset_stats();
+    alloc_trace_set_tag(ALLOC_TRACE_TAG_SYSTEM);
+}
+
+void* testMalloc(size_t size) {
+    return tracedMalloc(size, ::malloc);
+}
+
+void testFree(void* ptr) {
+    tracedFree(ptr, ::free);
+}
+
+void* testRealloc(void* ptr, size_t size) {
+    return tracedRealloc(ptr, size, ::realloc, ::free);
+}
+
+} // namespace
+
+TEST_CASE("alloc_trace") {
+    resetStats();
+
+    SECTION("accounts allocations to the current tag") {
+        const auto userLive = getStats(ALLOC_TRACE_TAG_USER).live_size;
+        void* p1 = nullptr;
+        {
+            AllocTraceScope scope(ALLOC_TRACE_TAG_USER);
+            CHECK(alloc_trace_get_tag() == ALLOC_TRACE_TAG_USER);
+            p1 = testMalloc(100);
+            REQUIRE(p1);
+        }
+        CHECK(alloc_trace_get_tag() == ALLOC_TRACE_TAG_SYSTEM);
+        auto s = getStats(ALLOC_TRACE_TAG_USER);
+        CHECK(s.live_size == userLive + 100);
+        CHECK(s.alloc_count == 1);
+        CHECK(s.free_count == 0);
+        // The block is accounted to the tag it was allocated with
+        testFree(p1);
+        s = getStats(ALLOC_TRACE_TAG_USER);
+        CHECK(s.live_size == userLive);
+        CHECK(s.peak_size == userLive + 100);
+        CHECK(s.free_count == 1);
+    }
+
+    SECTION("keeps the tag of a reallocated block") {
+        void* p = nullptr;
+        {
+            AllocTraceScope scope(ALLOC_TRACE_TAG_LWIP);
+            p = testMalloc(10);
+            REQUIRE(p);
+            memset(p, 0xab, 10);
+        }
+        {
+            AllocTraceScope scope(ALLOC_TRACE_TAG_COMMUNICATION);
+            p = testRealloc(p, 1000);
+            REQUIRE(p);
+        }
+        CHECK(((uint8_t*)p)[9] == 0xab);
+        auto s = getStats(ALLOC_TRACE_TAG_LWIP);
+        CHECK(s.live_size == 1000);
+        CHECK(s.peak_size == 1000);
+        CHECK(s.alloc_count == 2);
+        CHECK(s.free_count == 1);
+        CHECK(getStats(ALLOC_TRACE_TAG_COMMUNICATION).alloc_count == 0);
+        CHECK(testRealloc(p, 0) == nullptr);
+        s = getStats(ALLOC_TRACE_TAG_LWIP);
+        CHECK(s.live_size == 0);
+        CHECK(s.free_count == 2);
+    }
+
+    SECTION("reports the usable size without the trace header") {
+        AllocTraceScope scope(ALLOC_TRACE_TAG_USER);
+        void* p = testMalloc(40);
+        REQUIRE(p);
+        const auto size = tracedUsableSize(p, [](void* ptr) {
+            return (size_t)1000;
+        });
+        CHECK(size == 1000 - detail::ALLOC_TRACE_HEADER_SIZE);
+        testFree(p);
+    }
+
+    SECTION("frees the block together with its trace header") {
+        static uint8_t buf[64] = {};
+        static void* freed = nullptr;
+        void* p = nullptr;
+        {
+            AllocTraceScope scope(ALLOC_TRACE_TAG_USER);
+            p = tracedMalloc(10, [](size_t size) -> void* {
+                return buf;
+            });
+        }
+        CHECK(p == buf + detail::ALLOC_TRACE_HEADER_SIZE);
+        const auto freeCount = getStats(ALLOC_TRACE_TAG_USER).free_count;
+        tracedFree(p, [](void* ptr) {
+            freed = ptr;
+        });
+        CHECK(freed == buf);
+        CHECK(getStats(ALLOC_TRACE_TAG_USER).free_count == freeCount + 1);
+    }
+
+    SECTION("counts failed allocations") {
+        AllocTraceScope scope(ALLOC_TRACE_TAG_COMMUNICATION);
+        const auto p = tracedMalloc(100, [](size_t) -> void* {
+            return nullptr;
+        });
+        CHECK(p == nullptr);
+        const auto s = getStats(ALLOC_TRACE_TAG_COMMUNICATION);
+        CHECK(s.failed_count == 1);
+        CHECK(s.alloc_count == 0);
+    }
+
+    SECTION("validates the arguments") {
+        alloc_trace_stats s = {};
+        CHECK(alloc_trace_get_stats(ALLOC_TRACE_TAG_COUNT, &s, nullptr) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(alloc_trace_set_tag(-1) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(alloc_trace_tag_name(ALLOC_TRACE_TAG_LWIP) == std::string("lwip"));
+        CHECK(alloc_trace_tag_name(ALLOC_TRACE_TAG_COUNT) == nullptr);
+    }
+
+    SECTION("reports the period since the statistics were reset") {
+        alloc_trace_stats s = {};
+        uint32_t period = 0;
+        REQUIRE(alloc_trace_get_stats(ALLOC_TRACE_TAG_SYSTEM, &s, &period) == 0);
+        CHECK(period > 0);
+    }
+}
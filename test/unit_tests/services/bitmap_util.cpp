@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitmap_util.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+// Chunk count of the largest module that can be transferred with 512-byte chunks
+const size_t BENCH_BITMAP_BITS = 65535;
+const size_t BENCH_ITERATIONS = 1000;
+
+size_t findBitSlow(const std::vector<BitmapWord>& bitmap, size_t bits, size_t pos, bool value) {
+    for (; pos < bits; ++pos) {
+        if (testBit(bitmap.data(), pos) == value) {
+            break;
+        }
+    }
+    return std::min(pos, bits);
+}
+
+template<typename F>
+double runBenchmark(F fn) {
+    const auto t1 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < BENCH_ITERATIONS; ++i) {
+        fn();
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(t2 - t1).count() / BENCH_ITERATIONS;
+}
+
+} // namespace
+
+TEST_CASE("setBit(), clearBit(), testBit()") {
+    BitmapWord bitmap[3] = {};
+    setBit(bitmap, 0);
+    setBit(bitmap, 31);
+    setBit(bitmap, 32);
+    setBit(bitmap, 95);
+    CHECK(bitmap[0] == 0x80000001);
+    CHECK(bitmap[1] == 0x00000001);
+    CHECK(bitmap[2] == 0x80000000);
+    CHECK(testBit(bitmap, 31));
+    CHECK(!testBit(bitmap, 30));
+    clearBit(bitmap, 31);
+    CHECK(!testBit(bitmap, 31));
+    CHECK(bitmap[0] == 0x00000001);
+    CHECK(bitmapWordCount(0) == 0);
+    CHECK(bitmapWordCount(1) == 1);
+    CHECK(bitmapWordCount(32) == 1);
+    CHECK(bitmapWordCount(33) == 2);
+}
+
+TEST_CASE("findBit()") {
+    SECTION("finds set and cleared bits across word boundaries") {
+        BitmapWord bitmap[3] = { 0xffffffff, 0x00000000, 0x00010000 };
+        CHECK(findBit(bitmap, 96, 0, true) == 0);
+        CHECK(findBit(bitmap, 96, 0, false) == 32);
+        CHECK(findBit(bitmap, 96, 31, true) == 31);
+        CHECK(findBit(bitmap, 96, 32, true) == 80);
+        CHECK(findBit(bitmap, 96, 80, false) == 81);
+    }
+
+    SECTION("ignores the bits beyond the bitmap size") {
+        BitmapWord bitmap[2] = { 0xffffffff, 0x0000ffff };
+        CHECK(findBit(bitmap, 48, 0, false) == 48);
+        CHECK(findBit(bitmap, 40, 0, false) == 40);
+        CHECK(findBit(bitmap, 40, 40, true) == 40);
+        CHECK(findBit(bitmap, 40, 100, true) == 40);
+    }
+
+    SECTION("returns the same results as a bit-by-bit scan") {
+        std::default_random_engine gen;
+        for (size_t bits: { 1, 31, 32, 33, 100, 1000 }) {
+            std::vector<BitmapWord> bitmap(bitmapWordCount(bits));
+            for (size_t i = 0; i < bits; ++i) {
+                if (gen() % 4 != 0) {
+                    setBit(bitmap.data(), i);
+                }
+            }
+            for (size_t pos = 0; pos <= bits; ++pos) {
+                REQUIRE(findBit(bitmap.data(), bits, pos, true) == findBitSlow(bitmap, bits, pos, true));
+                REQUIRE(findBit(bitmap.data(), bits, pos, false) == findBitSlow(bitmap, bits, pos, false));
+            }
+        }
+    }
+}
+
+// Run explicitly with: services "[benchmark]"
+TEST_CASE("findBit() vs bit-by-bit scan", "[.][benchmark]") {
+    // A transfer at the end of a flight: all chunks received except for a few gaps
+    std::vector<BitmapWord> bitmap(bitmapWordCount(BENCH_BITMAP_BITS), ~(BitmapWord)0);
+    for (size_t i: { 1000, 1001, 30000, 65000 }) {
+        clearBit(bitmap.data(), i);
+    }
+    size_t found = 0;
+    const double slowTime = runBenchmark([&]() {
+        for (size_t pos = 0; (pos = findBitSlow(bitmap, BENCH_BITMAP_BITS, pos, false)) < BENCH_BITMAP_BITS; ++pos) {
+            ++found;
+        }
+    });
+    const double fastTime = runBenchmark([&]() {
+        for (size_t pos = 0; (pos = findBit(bitmap.data(), BENCH_BITMAP_BITS, pos, false)) < BENCH_BITMAP_BITS; ++pos) {
+            ++found;
+        }
+    });
+    CHECK(found == BENCH_ITERATIONS * 8);
+    WARN("Bit-by-bit scan: " << slowTime << " us");
+    WARN("Word-at-a-time scan: " << fastTime << " us");
+}
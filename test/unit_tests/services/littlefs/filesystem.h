@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Filesystem HAL for the tests that run against a real littlefs instance
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <lfs_util.h>
+#include <lfs.h>
+
+#define FILESYSTEM_PROG_SIZE    (256)
+#define FILESYSTEM_READ_SIZE    (256)
+#define FILESYSTEM_BLOCK_SIZE   (4096)
+#define FILESYSTEM_BLOCK_COUNT  (64)
+#define FILESYSTEM_LOOKAHEAD    (64)
+
+typedef struct {
+    struct lfs_config config;
+    lfs_t instance;
+} filesystem_t;
+
+filesystem_t* filesystem_get_instance(void* reserved);
+int filesystem_lock(filesystem_t* fs);
+int filesystem_unlock(filesystem_t* fs);
+
+#ifdef __cplusplus
+} // extern "C"
+
+namespace particle {
+
+namespace fs {
+
+class FsLock {
+public:
+    FsLock(filesystem_t* fs)
+            : fs_(fs) {
+        lock();
+    }
+
+    ~FsLock() {
+        unlock();
+    }
+
+    void lock() {
+        filesystem_lock(fs_);
+    }
+
+    void unlock() {
+        filesystem_unlock(fs_);
+    }
+
+private:
+    filesystem_t* fs_;
+};
+
+} // namespace fs
+
+} // namespace particle
+
+#endif // defined(__cplusplus)
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "persistent_queue.h"
+#include "system_error.h"
+
+#include "mock/filesystem.h"
+
+#include <catch2/catch.hpp>
+#include <hippomocks.h>
+
+#include <string>
+
+using namespace particle;
+
+namespace {
+
+std::string peekString(PersistentQueue& q) {
+    char buf[256] = {};
+    const int r = q.peek(buf, sizeof(buf));
+    if (r < 0) {
+        return std::string();
+    }
+    return std::string(buf, r);
+}
+
+std::string popString(PersistentQueue& q) {
+    const auto s = peekString(q);
+    q.pop();
+    return s;
+}
+
+} // namespace
+
+TEST_CASE("PersistentQueue") {
+    MockRepository mocks;
+    test::Filesystem fs(&mocks);
+
+    SECTION("returns records in the order they were added") {
+        PersistentQueue q("q");
+        REQUIRE(q.init() == 0);
+        CHECK(q.empty());
+        CHECK(q.peek(nullptr, 0) == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(q.pop() == SYSTEM_ERROR_NOT_FOUND);
+        CHECK(q.push("abc", 3) == 0);
+        CHECK(q.push("", 0) == 0);
+        CHECK(q.push("defgh", 5) == 0);
+        CHECK(!q.empty());
+        CHECK(peekString(q) == "abc");
+        CHECK(peekString(q) == "abc");
+        CHECK(popString(q) == "abc");
+        CHECK(popString(q) == "");
+        CHECK(popString(q) == "defgh");
+        CHECK(q.empty());
+    }
+
+    SECTION("requires the buffer to be large enough for the record") {
+        PersistentQueue q("q");
+        CHECK(q.push("abcdef", 6) == 0);
+        char buf[4] = {};
+        CHECK(q.peek(buf, sizeof(buf)) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(q.push(buf, q.maxRecordSize() + 1) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("keeps the records across resets") {
+        {
+            PersistentQueue q("q");
+            CHECK(q.push("abc", 3) == 0);
+            CHECK(q.push("def", 3) == 0);
+        }
+        PersistentQueue q("q");
+        REQUIRE(q.init() == 0);
+        CHECK(popString(q) == "abc");
+        CHECK(popString(q) == "def");
+        CHECK(q.empty());
+    }
+
+    SECTION("doesn't return the records of a drained queue after a reset") {
+        {
+            PersistentQueue q("q");
+            CHECK(q.push("abc", 3) == 0);
+            CHECK(popString(q) == "abc");
+            CHECK(!fs.hasFile("q.0"));
+        }
+        PersistentQueue q("q");
+        REQUIRE(q.init() == 0);
+        CHECK(q.empty());
+    }
+
+    SECTION("spreads the records across segments and removes consumed segments") {
+        PersistentQueue q("q", 32 /* segmentSize */, 3 /* maxSegments */);
+        const std::string rec(10, 'a'); // 16 bytes with the header
+        for (int i = 0; i < 6; ++i) {
+            CHECK(q.push(rec.data(), rec.size()) == 0);
+        }
+        CHECK(fs.readFile("q.0").size() == 32);
+        CHECK(fs.readFile("q.1").size() == 32);
+        CHECK(fs.readFile("q.2").size() == 32);
+        CHECK(q.push(rec.data(), rec.size()) == SYSTEM_ERROR_LIMIT_EXCEEDED);
+        CHECK(popString(q) == rec);
+        CHECK(fs.hasFile("q.0"));
+        CHECK(popString(q) == rec);
+        CHECK(!fs.hasFile("q.0"));
+        CHECK(q.push(rec.data(), rec.size()) == 0);
+        CHECK(fs.hasFile("q.3"));
+        for (int i = 0; i < 5; ++i) {
+            CHECK(popString(q) == rec);
+        }
+        CHECK(q.empty());
+        CHECK(!fs.hasFile("q.1"));
+        CHECK(!fs.hasFile("q.2"));
+        CHECK(!fs.hasFile("q.3"));
+    }
+
+    SECTION("discards a partially written record at the end of the last segment") {
+        {
+            PersistentQueue q("q");
+            CHECK(q.push("abc", 3) == 0);
+            CHECK(q.push("def", 3) == 0);
+        }
+        auto data = fs.readFile("q.0");
+        fs.writeFile("q.0", data.substr(0, data.size() - 1));
+        PersistentQueue q("q");
+        REQUIRE(q.init() == 0);
+        CHECK(fs.readFile("q.0").size() == PersistentQueue::RECORD_HEADER_SIZE + 3);
+        CHECK(q.push("ghi", 3) == 0);
+        CHECK(popString(q) == "abc");
+        CHECK(popString(q) == "ghi");
+        CHECK(q.empty());
+    }
+
+    SECTION("skips a corrupted segment") {
+        PersistentQueue q("q", 32 /* segmentSize */);
+        const std::string rec(10, 'a');
+        for (int i = 0; i < 3; ++i) {
+            CHECK(q.push(rec.data(), rec.size()) == 0);
+        }
+        auto data = fs.readFile("q.0");
+        data[PersistentQueue::RECORD_HEADER_SIZE] = 'b';
+        fs.writeFile("q.0", data);
+        CHECK(popString(q) == rec);
+        CHECK(!fs.hasFile("q.0"));
+        CHECK(q.empty());
+    }
+
+    SECTION("keeps the last segment open between pushes") {
+        {
+            PersistentQueue q("q");
+            CHECK(q.push("abc", 3) == 0);
+            CHECK(q.push("def", 3) == 0);
+            CHECK(fs.hasOpenFiles());
+            CHECK(q.sync() == 0);
+            CHECK(fs.hasOpenFiles());
+            CHECK(popString(q) == "abc");
+            CHECK(popString(q) == "def");
+            // The drained segment is closed before it's removed
+            CHECK(!fs.hasOpenFiles());
+            CHECK(q.push("ghi", 3) == 0);
+        }
+        CHECK(!fs.hasOpenFiles());
+        PersistentQueue q("q");
+        CHECK(popString(q) == "ghi");
+    }
+
+    SECTION("can be cleared") {
+        PersistentQueue q("q", 32 /* segmentSize */);
+        const std::string rec(10, 'a');
+        for (int i = 0; i < 5; ++i) {
+            CHECK(q.push(rec.data(), rec.size()) == 0);
+        }
+        q.clear();
+        CHECK(q.empty());
+        CHECK(!fs.hasFile("q.0"));
+        CHECK(!fs.hasFile("q.2"));
+        CHECK(q.push("abc", 3) == 0);
+        CHECK(popString(q) == "abc");
+    }
+}
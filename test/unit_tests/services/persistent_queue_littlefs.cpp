@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "persistent_queue.h"
+#include "system_error.h"
+
+#include <catch2/catch.hpp>
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace particle;
+
+namespace {
+
+// littlefs instance backed by an image file
+class FileDevice {
+public:
+    FileDevice() :
+            fs_(),
+            file_(std::tmpfile()),
+            erases_(0) {
+        if (!file_) {
+            throw std::runtime_error("Unable to create image file");
+        }
+        restore(std::string(FILESYSTEM_BLOCK_SIZE * FILESYSTEM_BLOCK_COUNT, '\xff'));
+        instance_ = this;
+        initConfig();
+        if (lfs_format(&fs_.instance, &fs_.config) != 0) {
+            throw std::runtime_error("lfs_format() failed");
+        }
+        mount();
+    }
+
+    ~FileDevice() {
+        lfs_unmount(&fs_.instance);
+        std::fclose(file_);
+        instance_ = nullptr;
+    }
+
+    // Simulates a reset of the device by remounting the filesystem from the given image
+    void reset(const std::string& image) {
+        lfs_unmount(&fs_.instance);
+        restore(image);
+        mount();
+    }
+
+    std::string image() const {
+        std::string data(FILESYSTEM_BLOCK_SIZE * FILESYSTEM_BLOCK_COUNT, '\0');
+        std::fseek(file_, 0, SEEK_SET);
+        if (std::fread(&data[0], 1, data.size(), file_) != data.size()) {
+            throw std::runtime_error("Unable to read image file");
+        }
+        return data;
+    }
+
+    unsigned erases() const {
+        return erases_;
+    }
+
+    filesystem_t* fs() {
+        return &fs_;
+    }
+
+    static FileDevice* instance() {
+        return instance_;
+    }
+
+private:
+    filesystem_t fs_;
+    std::FILE* file_;
+    unsigned erases_;
+
+    static FileDevice* instance_;
+
+    void initConfig() {
+        fs_.config.context = this;
+        fs_.config.read = read;
+        fs_.config.prog = prog;
+        fs_.config.erase = erase;
+        fs_.config.sync = sync;
+        fs_.config.read_size = FILESYSTEM_READ_SIZE;
+        fs_.config.prog_size = FILESYSTEM_PROG_SIZE;
+        fs_.config.block_size = FILESYSTEM_BLOCK_SIZE;
+        fs_.config.block_count = FILESYSTEM_BLOCK_COUNT;
+        fs_.config.lookahead = FILESYSTEM_LOOKAHEAD;
+    }
+
+    void mount() {
+        fs_.instance = lfs_t();
+        if (lfs_mount(&fs_.instance, &fs_.config) != 0) {
+            throw std::runtime_error("lfs_mount() failed");
+        }
+    }
+
+    void restore(const std::string& image) {
+        std::fseek(file_, 0, SEEK_SET);
+        if (std::fwrite(image.data(), 1, image.size(), file_) != image.size()) {
+            throw std::runtime_error("Unable to write image file");
+        }
+    }
+
+    static int read(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, void* buf, lfs_size_t size) {
+        const auto d = static_cast<FileDevice*>(c->context);
+        std::fseek(d->file_, block * c->block_size + off, SEEK_SET);
+        return (std::fread(buf, 1, size, d->file_) == size) ? 0 : LFS_ERR_IO;
+    }
+
+    static int prog(const struct lfs_config* c, lfs_block_t block, lfs_off_t off, const void* buf, lfs_size_t size) {
+        const auto d = static_cast<FileDevice*>(c->context);
+        std::fseek(d->file_, block * c->block_size + off, SEEK_SET);
+        return (std::fwrite(buf, 1, size, d->file_) == size) ? 0 : LFS_ERR_IO;
+    }
+
+    static int erase(const struct lfs_config* c, lfs_block_t block) {
+        const auto d = static_cast<FileDevice*>(c->context);
+        const std::string data(c->block_size, '\xff');
+        std::fseek(d->file_, block * c->block_size, SEEK_SET);
+        ++d->erases_;
+        return (std::fwrite(data.data(), 1, data.size(), d->file_) == data.size()) ? 0 : LFS_ERR_IO;
+    }
+
+    static int sync(const struct lfs_config* c) {
+        const auto d = static_cast<FileDevice*>(c->context);
+        return (std::fflush(d->file_) == 0) ? 0 : LFS_ERR_IO;
+    }
+};
+
+FileDevice* FileDevice::instance_ = nullptr;
+
+std::string popString(PersistentQueue& q) {
+    char buf[256] = {};
+    const int r = q.peek(buf, sizeof(buf));
+    if (r < 0) {
+        return std::string();
+    }
+    q.pop();
+    return std::string(buf, r);
+}
+
+// Fills the first segment of a queue with records of the given size and returns the number of erased blocks
+unsigned fillSegment(FileDevice& dev, size_t syncSize, size_t recordSize) {
+    PersistentQueue q("q", FILESYSTEM_BLOCK_SIZE, 2 /* maxSegments */, syncSize);
+    REQUIRE(q.init() == 0);
+    const unsigned erases = dev.erases();
+    const std::string rec(recordSize - PersistentQueue::RECORD_HEADER_SIZE, 'a');
+    for (size_t i = 0; i < FILESYSTEM_BLOCK_SIZE / recordSize; ++i) {
+        REQUIRE(q.push(rec.data(), rec.size()) == 0);
+    }
+    REQUIRE(q.sync() == 0);
+    const unsigned n = dev.erases() - erases;
+    q.clear();
+    return n;
+}
+
+} // namespace
+
+filesystem_t* filesystem_get_instance(void* reserved) {
+    return FileDevice::instance()->fs();
+}
+
+int filesystem_lock(filesystem_t* fs) {
+    return 0;
+}
+
+int filesystem_unlock(filesystem_t* fs) {
+    return 0;
+}
+
+TEST_CASE("PersistentQueue on littlefs") {
+    FileDevice dev;
+
+    SECTION("keeps the records across remounts") {
+        {
+            PersistentQueue q("q", 64 /* segmentSize */);
+            for (int i = 0; i < 10; ++i) {
+                CHECK(q.push(std::to_string(i).data(), 1) == 0);
+            }
+            CHECK(popString(q) == "0");
+        }
+        dev.reset(dev.image());
+        PersistentQueue q("q", 64 /* segmentSize */);
+        REQUIRE(q.init() == 0);
+        // The read position in a partially consumed segment is not persisted
+        for (int i = 0; i < 10; ++i) {
+            CHECK(popString(q) == std::to_string(i));
+        }
+        CHECK(q.empty());
+    }
+
+    SECTION("loses only the records that were not committed when the device resets") {
+        std::string image;
+        {
+            PersistentQueue q("q", FILESYSTEM_BLOCK_SIZE, 2 /* maxSegments */, 64 /* syncSize */);
+            CHECK(q.push("abc", 3) == 0);
+            CHECK(q.push("def", 3) == 0);
+            CHECK(q.sync() == 0);
+            CHECK(q.push("ghi", 3) == 0);
+            image = dev.image();
+        }
+        dev.reset(image);
+        PersistentQueue q("q");
+        REQUIRE(q.init() == 0);
+        CHECK(popString(q) == "abc");
+        CHECK(popString(q) == "def");
+        CHECK(q.empty());
+    }
+
+    SECTION("commits pending records before reading them") {
+        PersistentQueue q("q", FILESYSTEM_BLOCK_SIZE, 2 /* maxSegments */, 1024 /* syncSize */);
+        CHECK(q.push("abc", 3) == 0);
+        CHECK(popString(q) == "abc");
+        CHECK(q.push("def", 3) == 0);
+        CHECK(q.push("ghi", 3) == 0);
+        CHECK(popString(q) == "def");
+        CHECK(popString(q) == "ghi");
+        CHECK(q.empty());
+    }
+
+    SECTION("bounds the number of erased blocks by the sync size") {
+        const size_t syncSize = 512;
+        const unsigned batched = fillSegment(dev, syncSize, 32 /* recordSize */);
+        CHECK(batched <= 2 * (FILESYSTEM_BLOCK_SIZE / syncSize + 2));
+        // Committing every record erases blocks for each of them
+        const unsigned eager = fillSegment(dev, 1 /* syncSize */, 32 /* recordSize */);
+        CHECK(eager > 2 * batched);
+    }
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spsc_ringbuffer.h"
+#include "ringbuffer.h"
+
+#include <catch2/catch.hpp>
+
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstring>
+
+using namespace particle::services;
+
+namespace {
+
+const size_t BENCH_BUFFER_SIZE = 1024;
+const size_t BENCH_CHUNK_SIZE = 64;
+const size_t BENCH_TOTAL_SIZE = 64 * 1024 * 1024;
+
+// Runs a producer and a consumer thread and returns the throughput in bytes per second
+template<typename PutF, typename GetF>
+double runBenchmark(PutF put, GetF get) {
+    const auto t1 = std::chrono::steady_clock::now();
+    std::thread producer([&put]() {
+        uint8_t chunk[BENCH_CHUNK_SIZE] = {};
+        size_t sent = 0;
+        uint8_t val = 0;
+        while (sent < BENCH_TOTAL_SIZE) {
+            for (size_t i = 0; i < sizeof(chunk); ++i) {
+                chunk[i] = val++;
+            }
+            while (put(chunk, sizeof(chunk)) < 0) {
+                std::this_thread::yield();
+            }
+            sent += sizeof(chunk);
+        }
+    });
+    bool ok = true;
+    uint8_t chunk[BENCH_CHUNK_SIZE] = {};
+    size_t recv = 0;
+    uint8_t val = 0;
+    while (recv < BENCH_TOTAL_SIZE) {
+        while (get(chunk, sizeof(chunk)) < 0) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < sizeof(chunk); ++i) {
+            ok = ok && (chunk[i] == val++);
+        }
+        recv += sizeof(chunk);
+    }
+    producer.join();
+    const auto t2 = std::chrono::steady_clock::now();
+    CHECK(ok);
+    return BENCH_TOTAL_SIZE / std::chrono::duration<double>(t2 - t1).count();
+}
+
+} // namespace
+
+TEST_CASE("SpscRingBuffer") {
+    uint8_t buf[8] = {};
+    SpscRingBuffer<uint8_t> rb;
+
+    SECTION("requires the buffer size to be a power of two") {
+        CHECK(rb.init(buf, 6) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(rb.init(nullptr, 8) == SYSTEM_ERROR_INVALID_ARGUMENT);
+        CHECK(rb.init(buf, 8) == 0);
+        CHECK(rb.size() == 8);
+        CHECK(rb.empty());
+        CHECK(rb.space() == 8);
+        CHECK(rb.data() == 0);
+    }
+
+    SECTION("can be filled and drained") {
+        REQUIRE(rb.init(buf, sizeof(buf)) == 0);
+        CHECK(rb.put((const uint8_t*)"abcdefgh", 8) == 8);
+        CHECK(rb.full());
+        CHECK(rb.space() == 0);
+        CHECK(rb.put('x') == SYSTEM_ERROR_TOO_LARGE);
+        char out[9] = {};
+        CHECK(rb.peek((uint8_t*)out, 3) == 3);
+        CHECK(strcmp(out, "abc") == 0);
+        CHECK(rb.get((uint8_t*)out, 8) == 8);
+        CHECK(strcmp(out, "abcdefgh") == 0);
+        CHECK(rb.empty());
+        CHECK(rb.get((uint8_t*)out, 1) == SYSTEM_ERROR_TOO_LARGE);
+    }
+
+    SECTION("wraps around the end of the buffer") {
+        REQUIRE(rb.init(buf, sizeof(buf)) == 0);
+        char out[9] = {};
+        for (int i = 0; i < 10; ++i) {
+            CHECK(rb.put((const uint8_t*)"abcde", 5) == 5);
+            CHECK(rb.data() == 5);
+            memset(out, 0, sizeof(out));
+            CHECK(rb.get((uint8_t*)out, 5) == 5);
+            CHECK(strcmp(out, "abcde") == 0);
+        }
+    }
+
+    SECTION("supports zero-copy access to contiguous regions") {
+        REQUIRE(rb.init(buf, sizeof(buf)) == 0);
+        CHECK(rb.put((const uint8_t*)"abcdef", 6) == 6);
+        CHECK(rb.get(nullptr, 6) == 6);
+        // Head is at offset 6: only 2 bytes can be acquired until the end of the buffer
+        CHECK(rb.acquirable() == 2);
+        CHECK(rb.acquire(3) == nullptr);
+        auto p = rb.acquire(2);
+        REQUIRE(p == buf + 6);
+        memcpy(p, "gh", 2);
+        rb.acquireCommit(2);
+        CHECK(rb.acquirable() == 6);
+        CHECK(rb.consumable() == 2);
+        auto c = rb.consume(2);
+        REQUIRE(c == buf + 6);
+        CHECK(memcmp(c, "gh", 2) == 0);
+        rb.consumeCommit(2);
+        CHECK(rb.empty());
+    }
+
+    SECTION("publishes staged data only when committed") {
+        REQUIRE(rb.init(buf, sizeof(buf)) == 0);
+        CHECK(rb.put((const uint8_t*)"abcdef", 6) == 6);
+        CHECK(rb.get(nullptr, 4) == 4);
+        CHECK(rb.stage(0, (const uint8_t*)"gh", 2) == 2);
+        CHECK(rb.stage(2, (const uint8_t*)"ijkl", 4) == 4);
+        CHECK(rb.stage(6, (const uint8_t*)"m", 1) == SYSTEM_ERROR_TOO_LARGE);
+        CHECK(rb.data() == 2);
+        rb.acquireCommit(6);
+        char out[9] = {};
+        CHECK(rb.get((uint8_t*)out, 8) == 8);
+        CHECK(strcmp(out, "efghijkl") == 0);
+        // Data staged but not committed is discarded by the next staging
+        CHECK(rb.stage(0, (const uint8_t*)"xyz", 3) == 3);
+        CHECK(rb.stage(0, (const uint8_t*)"uv", 2) == 2);
+        rb.acquireCommit(2);
+        memset(out, 0, sizeof(out));
+        CHECK(rb.get((uint8_t*)out, 2) == 2);
+        CHECK(strcmp(out, "uv") == 0);
+        CHECK(rb.empty());
+    }
+
+    SECTION("transfers data between two threads") {
+        std::vector<uint8_t> large(64);
+        SpscRingBuffer<uint8_t> rb2(large.data(), large.size());
+        const size_t total = 64 * 1024;
+        std::thread producer([&rb2, total]() {
+            for (size_t i = 0; i < total;) {
+                if (rb2.put((uint8_t)i) == 1) {
+                    ++i;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        bool ok = true;
+        for (size_t i = 0; i < total;) {
+            uint8_t v = 0;
+            if (rb2.get(&v) == 1) {
+                ok = ok && (v == (uint8_t)i);
+                ++i;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        CHECK(ok);
+        CHECK(rb2.empty());
+    }
+}
+
+// Run explicitly with: services "[benchmark]"
+TEST_CASE("SpscRingBuffer vs RingBuffer throughput", "[.][benchmark]") {
+    std::vector<uint8_t> buf(BENCH_BUFFER_SIZE);
+
+    // The existing buffer has to be guarded by a lock when shared between two contexts
+    RingBuffer<uint8_t> locked(buf.data(), buf.size());
+    std::mutex mutex;
+    const double lockedRate = runBenchmark([&](const uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return locked.put(data, size);
+    }, [&](uint8_t* data, size_t size) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return locked.get(data, size);
+    });
+
+    SpscRingBuffer<uint8_t> spsc(buf.data(), buf.size());
+    const double spscRate = runBenchmark([&](const uint8_t* data, size_t size) {
+        return spsc.put(data, size);
+    }, [&](uint8_t* data, size_t size) {
+        return spsc.get(data, size);
+    });
+
+    WARN("RingBuffer + mutex: " << lockedRate / 1e6 << " MB/s");
+    WARN("SpscRingBuffer: " << spscRate / 1e6 << " MB/s");
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tlsf_heap.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+using namespace particle;
+
+const size_t HEAP_SIZE = 64 * 1024;
+
+// Size of the heap used by the soak test. Roughly matches the amount of free heap on Gen 3 devices
+const size_t SOAK_HEAP_SIZE = 96 * 1024;
+
+class Heap {
+public:
+    explicit Heap(size_t size = HEAP_SIZE, unsigned flags = 0) :
+            mem_(new uint64_t[size / sizeof(uint64_t)]()) {
+        REQUIRE(heap_.init(mem_.get(), size, flags) == 0);
+    }
+
+    TlsfHeap* operator->() {
+        return &heap_;
+    }
+
+    TlsfHeap::Stats stats() const {
+        TlsfHeap::Stats s = {};
+        heap_.stats(&s);
+        return s;
+    }
+
+private:
+    std::unique_ptr<uint64_t[]> mem_;
+    TlsfHeap heap_;
+};
+
+// Allocation trace entry
+struct TraceOp {
+    char op; // 'a' - allocate, 'f' - free, 'r' - reallocate
+    unsigned id; // Block ID
+    size_t size; // Block size
+};
+
+typedef std::vector<TraceOp> Trace;
+
+/*
+ * Loads an allocation trace. The trace is a text file with one operation per line:
+ *
+ * a <id> <size>  Allocate a block
+ * r <id> <size>  Reallocate a block
+ * f <id>         Free a block
+ *
+ * Empty lines and lines starting with '#' are ignored.
+ */
+Trace loadTrace(const std::string& file) {
+    std::ifstream in(file);
+    REQUIRE(in.good());
+    Trace trace;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream s(line);
+        TraceOp op = {};
+        s >> op.op >> op.id;
+        if (op.op != 'f') {
+            s >> op.size;
+        }
+        REQUIRE(!s.fail());
+        trace.push_back(op);
+    }
+    return trace;
+}
+
+// Generates a trace resembling the allocation pattern of a running device: mostly short-lived
+// small blocks (messages, strings, containers), occasional large buffers, and a slowly growing
+// set of long-lived blocks that pin the free memory in place
+Trace generateTrace(size_t count) {
+    std::mt19937 gen(12345);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<size_t> smallSize(1, 128);
+    std::uniform_int_distribution<size_t> mediumSize(129, 1024);
+    std::uniform_int_distribution<size_t> largeSize(1025, 4096);
+    Trace trace;
+    std::vector<unsigned> live;
+    std::vector<unsigned> longLived;
+    unsigned nextId = 0;
+    while (trace.size() < count) {
+        const int p = percent(gen);
+        if ((p < 45 && live.size() < 150) || live.empty()) {
+            const int k = percent(gen);
+            const size_t size = (k < 80) ? smallSize(gen) : (k < 97) ? mediumSize(gen) : largeSize(gen);
+            const unsigned id = nextId++;
+            trace.push_back({ 'a', id, size });
+            if (percent(gen) < 2) {
+                longLived.push_back(id);
+            } else {
+                live.push_back(id);
+            }
+        } else if (p < 55) {
+            const size_t i = gen() % live.size();
+            trace.push_back({ 'r', live[i], smallSize(gen) + mediumSize(gen) / 2 });
+        } else {
+            // Free a recently allocated block more often than an older one
+            const size_t n = std::min<size_t>(live.size(), 16);
+            const size_t i = (percent(gen) < 80) ? live.size() - 1 - gen() % n : gen() % live.size();
+            trace.push_back({ 'f', live[i], 0 });
+            live.erase(live.begin() + i);
+        }
+        if (longLived.size() > 64) {
+            // Replace one of the long-lived blocks
+            const size_t i = gen() % longLived.size();
+            trace.push_back({ 'f', longLived[i], 0 });
+            longLived.erase(longLived.begin() + i);
+        }
+    }
+    return trace;
+}
+
+struct ReplayResult {
+    double meanTime; // Nanoseconds per operation
+    double maxTime; // Nanoseconds
+    double p9999Time; // 99.99th percentile, nanoseconds
+    size_t failedOps;
+};
+
+template<typename AllocFn, typename ReallocFn, typename FreeFn, typename SampleFn>
+ReplayResult replayTrace(const Trace& trace, AllocFn alloc, ReallocFn realloc, FreeFn free, SampleFn sample) {
+    std::map<unsigned, void*> blocks;
+    ReplayResult r = {};
+    std::vector<double> times;
+    times.reserve(trace.size());
+    double total = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        const TraceOp& op = trace[i];
+        auto it = blocks.find(op.id);
+        void* ptr = (it != blocks.end()) ? it->second : nullptr;
+        if (op.op != 'a' && !ptr) {
+            continue; // The block couldn't be allocated
+        }
+        const auto t1 = std::chrono::steady_clock::now();
+        if (op.op == 'a') {
+            ptr = alloc(op.size);
+        } else if (op.op == 'r') {
+            void* p = realloc(ptr, op.size);
+            if (p) {
+                ptr = p;
+            } else {
+                ++r.failedOps;
+            }
+        } else {
+            free(ptr);
+            ptr = nullptr;
+        }
+        const auto t2 = std::chrono::steady_clock::now();
+        const double t = std::chrono::duration<double, std::nano>(t2 - t1).count();
+        total += t;
+        times.push_back(t);
+        if (op.op == 'a' && !ptr) {
+            ++r.failedOps;
+        }
+        if (ptr) {
+            blocks[op.id] = ptr;
+        } else if (it != blocks.end()) {
+            blocks.erase(it);
+        }
+        if (i % 256 == 0) {
+            sample();
+        }
+    }
+    for (const auto& b: blocks) {
+        free(b.second);
+    }
+    if (!times.empty()) {
+        std::sort(times.begin(), times.end());
+        r.meanTime = total / times.size();
+        r.maxTime = times.back();
+        r.p9999Time = times[times.size() * 9999 / 10000];
+    }
+    return r;
+}
+
+} // namespace
+
+TEST_CASE("TlsfHeap") {
+    SECTION("allocates aligned blocks of the requested size") {
+        Heap h;
+        std::vector<uint8_t*> blocks;
+        for (size_t size = 1; size < 300; size += 7) {
+            auto p = (uint8_t*)h->alloc(size);
+            REQUIRE(p);
+            CHECK(((uintptr_t)p % 8) == 0);
+            CHECK(h->blockSize(p) >= size);
+            memset(p, (int)size, size);
+            blocks.push_back(p);
+        }
+        CHECK(h->validate());
+        size_t size = 1;
+        for (auto p: blocks) {
+            CHECK((std::count(p, p + size, (uint8_t)size) == (ptrdiff_t)size));
+            CHECK(h->free(p) == 0);
+            size += 7;
+        }
+        CHECK(h->validate());
+        const auto s = h.stats();
+        CHECK(s.usedSize == 0);
+        CHECK(s.freeBlockCount == 1);
+        CHECK(s.freeSize == s.totalSize);
+    }
+
+    SECTION("fails to allocate a block of zero size or larger than the heap") {
+        Heap h;
+        CHECK(h->alloc(0) == nullptr);
+        CHECK(h->alloc(HEAP_SIZE) == nullptr);
+        CHECK(h.stats().failedAllocCount == 1);
+        CHECK(h->alloc(HEAP_SIZE / 2) != nullptr);
+    }
+
+    SECTION("merges a freed block with its free neighbours") {
+        Heap h;
+        const auto total = h.stats().totalSize;
+        auto p1 = h->alloc(100);
+        auto p2 = h->alloc(100);
+        auto p3 = h->alloc(100);
+        auto p4 = h->alloc(100);
+        REQUIRE((p1 && p2 && p3 && p4));
+        h->free(p1);
+        h->free(p3);
+        CHECK(h.stats().freeBlockCount == 3);
+        h->free(p2);
+        CHECK(h.stats().freeBlockCount == 2);
+        h->free(p4);
+        const auto s = h.stats();
+        CHECK(s.freeBlockCount == 1);
+        CHECK(s.largestFreeBlockSize == total);
+        CHECK(h->validate());
+    }
+
+    SECTION("reuses a freed block of the same size") {
+        Heap h;
+        auto p1 = h->alloc(200);
+        auto p2 = h->alloc(200);
+        REQUIRE((p1 && p2));
+        h->free(p1);
+        CHECK(h->alloc(200) == p1);
+        CHECK(h->validate());
+    }
+
+    SECTION("resizes a block in place if possible") {
+        Heap h;
+        auto p1 = (uint8_t*)h->alloc(100);
+        REQUIRE(p1);
+        memset(p1, 0xab, 100);
+        // Grow into the following free space
+        auto p = (uint8_t*)h->realloc(p1, 1000);
+        CHECK(p == p1);
+        CHECK(h->blockSize(p) >= 1000);
+        // Shrink
+        p = (uint8_t*)h->realloc(p1, 50);
+        CHECK(p == p1);
+        CHECK(h->blockSize(p) < 100);
+        CHECK((std::count(p, p + 50, 0xab) == 50));
+        CHECK(h->validate());
+        // Move the block if the following block is in use
+        auto p2 = h->alloc(100);
+        REQUIRE(p2);
+        p = (uint8_t*)h->realloc(p1, 1000);
+        REQUIRE(p);
+        CHECK(p != p1);
+        CHECK((std::count(p, p + 50, 0xab) == 50));
+        CHECK(h->validate());
+        // The original block is left intact if there's not enough memory
+        CHECK(h->realloc(p, HEAP_SIZE) == nullptr);
+        CHECK((std::count(p, p + 50, 0xab) == 50));
+        CHECK(h->realloc(p, 0) == nullptr);
+        CHECK(h->realloc(nullptr, 10) != nullptr);
+        CHECK(h->validate());
+    }
+
+    SECTION("detects a double free") {
+        Heap h;
+        auto p1 = h->alloc(10);
+        auto p2 = h->alloc(10);
+        REQUIRE((p1 && p2));
+        CHECK(h->free(p1) == 0);
+        CHECK(h->free(p1) == SYSTEM_ERROR_INVALID_STATE);
+        CHECK(h->validate());
+    }
+
+    SECTION("detects a damaged guard word") {
+        Heap h(HEAP_SIZE, TlsfHeap::GUARD);
+        auto p = (uint8_t*)h->alloc(10);
+        REQUIRE(p);
+        CHECK(h->check(p));
+        memset(p, 0, h->blockSize(p));
+        CHECK(h->check(p));
+        p[h->blockSize(p)] ^= 0x01;
+        CHECK(!h->check(p));
+        CHECK(!h->validate());
+        CHECK(h->free(p) == SYSTEM_ERROR_BAD_DATA);
+        CHECK(h.stats().guardErrorCount == 1);
+        CHECK(h->validate());
+    }
+
+    SECTION("fills freed blocks with a pattern") {
+        Heap h(HEAP_SIZE, TlsfHeap::FILL_FREED);
+        auto p1 = (uint8_t*)h->alloc(100);
+        auto p2 = h->alloc(100);
+        REQUIRE((p1 && p2));
+        memset(p1, 0, 100);
+        h->free(p1);
+        // The beginning of the block is used for the free list pointers
+        CHECK((std::count(p1 + 16, p1 + 100, 0xdd) == 84));
+    }
+
+    SECTION("reports the heap statistics") {
+        Heap h;
+        auto s = h.stats();
+        CHECK(s.totalSize > HEAP_SIZE - 64);
+        CHECK(s.totalSize <= HEAP_SIZE);
+        CHECK(s.freeSize == s.totalSize);
+        CHECK(s.largestFreeBlockSize == s.totalSize);
+        CHECK(s.usedSize == 0);
+        std::vector<void*> blocks;
+        for (int i = 0; i < 10; ++i) {
+            blocks.push_back(h->alloc(1000));
+        }
+        for (int i = 0; i < 10; i += 2) {
+            h->free(blocks[i]);
+        }
+        s = h.stats();
+        CHECK(s.usedSize + s.freeSize == s.totalSize);
+        CHECK(s.freeBlockCount == 6);
+        CHECK(s.largestFreeBlockSize == s.totalSize - s.peakUsedSize);
+        CHECK(s.peakUsedSize > s.usedSize);
+    }
+
+    SECTION("keeps the heap consistent under random operations") {
+        Heap h(HEAP_SIZE, TlsfHeap::GUARD);
+        const auto trace = generateTrace(20000);
+        size_t n = 0;
+        bool valid = true;
+        replayTrace(trace, [&h](size_t size) {
+            return h->alloc(size);
+        }, [&h](void* ptr, size_t size) {
+            return h->realloc(ptr, size);
+        }, [&h](void* ptr) {
+            h->free(ptr);
+        }, [&]() {
+            ++n;
+            valid = valid && h->validate();
+        });
+        CHECK(n > 0);
+        CHECK(valid);
+        const auto s = h.stats();
+        CHECK(s.usedSize == 0);
+        CHECK(s.freeBlockCount == 1);
+        CHECK(s.guardErrorCount == 0);
+    }
+}
+
+// Run explicitly with: services "[benchmark]"
+//
+// Replays the allocation trace from the file specified via the TLSF_HEAP_TRACE environment variable,
+// or a synthetic trace if the variable is not set
+TEST_CASE("TlsfHeap soak test", "[.][benchmark]") {
+    const char* file = getenv("TLSF_HEAP_TRACE");
+    const Trace trace = file ? loadTrace(file) : generateTrace(1000000);
+    Heap h(SOAK_HEAP_SIZE);
+    size_t maxFrag = 0;
+    size_t maxFreeBlocks = 0;
+    const auto tlsf = replayTrace(trace, [&h](size_t size) {
+        return h->alloc(size);
+    }, [&h](void* ptr, size_t size) {
+        return h->realloc(ptr, size);
+    }, [&h](void* ptr) {
+        h->free(ptr);
+    }, [&]() {
+        const auto s = h.stats();
+        if (s.freeSize > 0) {
+            const size_t frag = 100 - s.largestFreeBlockSize * 100 / s.freeSize;
+            maxFrag = std::max(maxFrag, frag);
+        }
+        maxFreeBlocks = std::max(maxFreeBlocks, s.freeBlockCount);
+    });
+    const auto sys = replayTrace(trace, ::malloc, ::realloc, ::free, []() {});
+    const auto s = h.stats();
+    CHECK(h->validate());
+    CHECK(s.usedSize == 0);
+    WARN("Trace: " << trace.size() << " operations");
+    WARN("TLSF heap: " << tlsf.meanTime << " ns per operation (99.99%: " << tlsf.p9999Time << " ns, max: " <<
+            tlsf.maxTime << " ns), " << tlsf.failedOps << " failed operations");
+    WARN("TLSF heap: peak usage: " << s.peakUsedSize << " of " << s.totalSize << " bytes, max. fragmentation: " <<
+            maxFrag << "%, max. free blocks: " << maxFreeBlocks);
+    WARN("System heap: " << sys.meanTime << " ns per operation (99.99%: " << sys.p9999Time << " ns, max: " <<
+            sys.maxTime << " ns), " << sys.failedOps << " failed operations");
+}
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2020 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "chunk_writer.h"
+
+#include <catch2/catch.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <string>
+
+// Minimal implementation of the queue and thread functions of the concurrent HAL
+namespace {
+
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<std::string> items;
+    size_t itemSize;
+    size_t maxCount;
+};
+
+} // namespace
+
+int os_queue_create(os_queue_t* queue, size_t item_size, size_t item_count, void* reserved) {
+    const auto q = new Queue();
+    q->itemSize = item_size;
+    q->maxCount = item_count;
+    *queue = q;
+    return 0;
+}
+
+int os_queue_put(os_queue_t queue, const void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    q->cond.wait(lock, [q]() {
+        return q->items.size() < q->maxCount;
+    });
+    q->items.push_back(std::string((const char*)item, q->itemSize));
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_queue_take(os_queue_t queue, void* item, system_tick_t delay, void* reserved) {
+    const auto q = static_cast<Queue*>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    q->cond.wait(lock, [q]() {
+        return !q->items.empty();
+    });
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    q->cond.notify_all();
+    return 0;
+}
+
+int os_queue_destroy(os_queue_t queue, void* reserved) {
+    delete static_cast<Queue*>(queue);
+    return 0;
+}
+
+os_result_t os_thread_create(os_thread_t* thread, const char* name, os_thread_prio_t priority, os_thread_fn_t fun,
+        void* thread_param, size_t stack_size) {
+    *thread = new std::thread(fun, thread_param);
+    return 0;
+}
+
+os_result_t os_thread_join(os_thread_t thread) {
+    static_cast<std::thread*>(thread)->join();
+    return 0;
+}
+
+os_result_t os_thread_exit(os_thread_t thread) {
+    return 0;
+}
+
+os_result_t os_thread_cleanup(os_thread_t thread) {
+    delete static_cast<std::thread*>(thread);
+    return 0;
+}
+
+namespace {
+
+using namespace particle;
+using namespace particle::system::detail;
+
+struct Chunk {
+    std::string data;
+    size_t offset;
+    size_t partialSize;
+};
+
+// Records the chunks written by the writer thread
+class Target {
+public:
+    Target() :
+            failAt_(-1),
+            writeCount_(0),
+            mismatch_(false) {
+    }
+
+    int writeChunk(const char* data, size_t size, size_t offset) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (writeCount_++ == failAt_) {
+            return SYSTEM_ERROR_FLASH_IO;
+        }
+        written_.push_back({ std::string(data, size), offset, 0 });
+        return 0;
+    }
+
+    void chunkWritten(const char* data, size_t size, size_t offset, size_t partialSize) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (written_.empty() || written_.back().data != std::string(data, size) || written_.back().offset != offset) {
+            mismatch_ = true;
+            return;
+        }
+        written_.back().partialSize = partialSize;
+    }
+
+    // Makes the write of the chunk with the given index fail
+    void failAt(int index) {
+        failAt_ = index;
+    }
+
+    std::vector<Chunk> written() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        REQUIRE_FALSE(mismatch_);
+        return written_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<Chunk> written_;
+    int failAt_;
+    int writeCount_;
+    bool mismatch_; // Set if chunkWritten() wasn't called for the chunk that was just written
+};
+
+} // namespace
+
+TEST_CASE("ChunkWriter") {
+    Target target;
+    ChunkWriter<Target> writer(&target);
+    REQUIRE(writer.init(0 /* stackSize */) == 0);
+
+    SECTION("writes chunks in the order they were received") {
+        // Out-of-order and duplicate chunks are passed through as is
+        const std::string chunks[] = { "bbbb", "aaaa", "dd", "bbbb", "cccc" };
+        const size_t offsets[] = { 4, 0, 12, 4, 8 };
+        for (size_t i = 0; i < 5; ++i) {
+            std::string buf = chunks[i];
+            REQUIRE(writer.write(buf.data(), buf.size(), offsets[i], i * 10) == 0);
+            // The data is copied to a staging buffer
+            buf.assign(buf.size(), 'x');
+        }
+        REQUIRE(writer.flush() == 0);
+        const auto written = target.written();
+        REQUIRE(written.size() == 5);
+        for (size_t i = 0; i < 5; ++i) {
+            CHECK(written[i].data == chunks[i]);
+            CHECK(written[i].offset == offsets[i]);
+            CHECK(written[i].partialSize == i * 10);
+        }
+    }
+
+    SECTION("flushes a single staged chunk") {
+        REQUIRE(writer.write("abc", 3, 0, 3) == 0);
+        REQUIRE(writer.flush() == 0);
+        const auto written = target.written();
+        REQUIRE(written.size() == 1);
+        CHECK(written[0].data == "abc");
+        // Flushing an idle writer doesn't block
+        REQUIRE(writer.flush() == 0);
+    }
+
+    SECTION("grows a staging buffer for a larger chunk") {
+        REQUIRE(writer.write("ab", 2, 0, 0) == 0);
+        REQUIRE(writer.write("cd", 2, 2, 0) == 0);
+        const std::string big(1000, 'e');
+        REQUIRE(writer.write(big.data(), big.size(), 4, 0) == 0);
+        REQUIRE(writer.flush() == 0);
+        const auto written = target.written();
+        REQUIRE(written.size() == 3);
+        CHECK(written[2].data == big);
+    }
+
+    SECTION("latches a write error") {
+        target.failAt(1);
+        REQUIRE(writer.write("aaaa", 4, 0, 0) == 0);
+        REQUIRE(writer.write("bbbb", 4, 4, 0) == 0);
+        // Chunks staged before the error was detected are discarded
+        const int r = writer.write("cccc", 4, 8, 0);
+        CHECK((r == 0 || r == SYSTEM_ERROR_FLASH_IO));
+        // The error is reported when the staged chunks are flushed
+        REQUIRE(writer.flush() == SYSTEM_ERROR_FLASH_IO);
+        REQUIRE(writer.write("dddd", 4, 12, 0) == SYSTEM_ERROR_FLASH_IO);
+        REQUIRE(writer.flush() == SYSTEM_ERROR_FLASH_IO);
+        const auto written = target.written();
+        REQUIRE(written.size() == 1);
+        CHECK(written[0].data == "aaaa");
+    }
+
+    SECTION("writes the staged chunks when destroyed") {
+        REQUIRE(writer.write("abc", 3, 0, 0) == 0);
+        writer.destroy();
+        const auto written = target.written();
+        REQUIRE(written.size() == 1);
+        CHECK(written[0].data == "abc");
+    }
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "key_index.h"
+
+#include "catch2/catch.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace particle;
+
+namespace {
+
+const size_t MAX_KEY_LENGTH = 12;
+
+class Keys {
+public:
+    bool add(const std::string& key) {
+        if (!index_.insert(keys_.size(), KeyIndex::hash(key.c_str(), MAX_KEY_LENGTH))) {
+            return false;
+        }
+        keys_.push_back(key);
+        return true;
+    }
+
+    int find(const std::string& key) const {
+        return index_.find(key.c_str(), KeyIndex::hash(key.c_str(), MAX_KEY_LENGTH), MAX_KEY_LENGTH, [this](unsigned i) {
+            return keys_.at(i).c_str();
+        });
+    }
+
+private:
+    std::vector<std::string> keys_;
+    KeyIndex index_;
+};
+
+} // namespace
+
+TEST_CASE("KeyIndex") {
+    Keys keys;
+
+    SECTION("an empty index has no elements") {
+        CHECK(keys.find("") == -1);
+        CHECK(keys.find("abc") == -1);
+    }
+
+    SECTION("finds the elements by key") {
+        for (unsigned i = 0; i < 1000; ++i) {
+            REQUIRE(keys.add("key" + std::to_string(i)));
+        }
+        for (unsigned i = 0; i < 1000; ++i) {
+            REQUIRE(keys.find("key" + std::to_string(i)) == (int)i);
+        }
+        CHECK(keys.find("key") == -1);
+        CHECK(keys.find("key1000") == -1);
+    }
+
+    SECTION("compares at most the maximum key length") {
+        REQUIRE(keys.add("123456789012"));
+        CHECK(keys.find("123456789012") == 0);
+        CHECK(keys.find("1234567890123") == 0);
+        CHECK(keys.find("12345678901") == -1);
+    }
+
+    SECTION("fails to index more than the maximum number of elements") {
+        for (unsigned i = 0; i < KeyIndex::MAX_SIZE; ++i) {
+            REQUIRE(keys.add(std::to_string(i)));
+        }
+        CHECK(!keys.add("abc"));
+        // The elements are still found after the index has grown past 65536 slots
+        for (unsigned i = 0; i < KeyIndex::MAX_SIZE; ++i) {
+            REQUIRE(keys.find(std::to_string(i)) == (int)i);
+        }
+        CHECK(keys.find("abc") == -1);
+    }
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spark_wiring_logging.h"
+
+#include <catch2/catch.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string>
+
+// Minimal implementation of the concurrent HAL and other system functions used by the logging code
+namespace {
+
+struct Semaphore {
+    std::mutex mutex;
+    std::condition_variable cond;
+    unsigned count;
+    unsigned maxCount;
+};
+
+} // namespace
+
+os_result_t os_thread_create(os_thread_t* thread, const char* name, os_thread_prio_t priority, os_thread_fn_t fun,
+        void* thread_param, size_t stack_size) {
+    *thread = new std::thread(fun, thread_param);
+    return 0;
+}
+
+bool os_thread_is_current(os_thread_t thread) {
+    return static_cast<std::thread*>(thread)->get_id() == std::this_thread::get_id();
+}
+
+os_result_t os_thread_join(os_thread_t thread) {
+    static_cast<std::thread*>(thread)->join();
+    return 0;
+}
+
+os_result_t os_thread_exit(os_thread_t thread) {
+    return 0;
+}
+
+os_result_t os_thread_cleanup(os_thread_t thread) {
+    const auto t = static_cast<std::thread*>(thread);
+    if (t->joinable()) {
+        t->join();
+    }
+    delete t;
+    return 0;
+}
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max_count, unsigned initial_count) {
+    const auto s = new Semaphore();
+    s->count = initial_count;
+    s->maxCount = max_count;
+    *semaphore = s;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete static_cast<Semaphore*>(semaphore);
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    std::unique_lock<std::mutex> lock(s->mutex);
+    s->cond.wait(lock, [s]() {
+        return s->count > 0;
+    });
+    --s->count;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    const auto s = static_cast<Semaphore*>(semaphore);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->count < s->maxCount) {
+        ++s->count;
+    }
+    s->cond.notify_all();
+    return 0;
+}
+
+int os_mutex_recursive_create(os_mutex_recursive_t* mutex) {
+    *mutex = new std::recursive_mutex();
+    return 0;
+}
+
+int os_mutex_recursive_destroy(os_mutex_recursive_t mutex) {
+    delete static_cast<std::recursive_mutex*>(mutex);
+    return 0;
+}
+
+int os_mutex_recursive_lock(os_mutex_recursive_t mutex) {
+    static_cast<std::recursive_mutex*>(mutex)->lock();
+    return 0;
+}
+
+int os_mutex_recursive_trylock(os_mutex_recursive_t mutex) {
+    return static_cast<std::recursive_mutex*>(mutex)->try_lock() ? 0 : 1;
+}
+
+int os_mutex_recursive_unlock(os_mutex_recursive_t mutex) {
+    static_cast<std::recursive_mutex*>(mutex)->unlock();
+    return 0;
+}
+
+void HAL_Delay_Milliseconds(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int system_ctrl_alloc_reply_data(ctrl_request* req, size_t size, void* reserved) {
+    return SYSTEM_ERROR_NOT_SUPPORTED;
+}
+
+void system_ctrl_set_result(ctrl_request* req, int result, ctrl_completion_handler_fn handler, void* data,
+        void* reserved) {
+}
+
+namespace {
+
+using namespace spark;
+
+// Output stream that can be blocked to keep the drain thread from consuming the buffered messages
+class Output: public Print {
+public:
+    Output() :
+            blocked_(false) {
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* data, size_t size) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() {
+            return !blocked_;
+        });
+        data_.append((const char*)data, size);
+        return size;
+    }
+
+    void block() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = true;
+    }
+
+    void unblock() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        blocked_ = false;
+        cond_.notify_all();
+    }
+
+    std::string data() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return data_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::string data_;
+    bool blocked_;
+};
+
+void logMessage(LogHandler& handler, const std::string& msg) {
+    LogAttributes attr = {};
+    attr.size = sizeof(attr);
+    handler.message(msg.c_str(), LOG_LEVEL_INFO, "app", attr);
+}
+
+void logWrite(LogHandler& handler, const std::string& data) {
+    handler.write(data.c_str(), data.size(), LOG_LEVEL_INFO, "app");
+}
+
+} // namespace
+
+TEST_CASE("AsyncLogHandler") {
+    Output out;
+
+    SECTION("writes the messages to the stream in the order they were logged") {
+        {
+            AsyncLogHandler<StreamLogHandler> handler(out, LOG_LEVEL_ALL);
+            logMessage(handler, "msg1");
+            logMessage(handler, "msg2");
+            logWrite(handler, "raw");
+            logMessage(handler, "msg3");
+            // The destructor waits until the buffered messages are written
+        }
+        CHECK(out.data() == "[app] INFO: msg1\r\n[app] INFO: msg2\r\nraw[app] INFO: msg3\r\n");
+    }
+
+    SECTION("drops the messages that don't fit into the buffer") {
+        const unsigned dropped = AsyncLogHandler<>::droppedCount();
+        std::string expected;
+        {
+            AsyncLogHandler<StreamLogHandler> handler(out, LOG_LEVEL_ALL, {}, 64 /* bufferSize */);
+            // Keep the drain thread blocked in the first write
+            out.block();
+            logMessage(handler, "first");
+            expected = "[app] INFO: first\r\n";
+            // 18 bytes each. The first message stays in the buffer until the drain thread is
+            // unblocked, so only two more messages fit into it
+            for (int i = 0; i < 10; ++i) {
+                logMessage(handler, "msg" + std::to_string(i));
+            }
+            const unsigned n = AsyncLogHandler<>::droppedCount() - dropped;
+            CHECK(n == 8);
+            for (unsigned i = 0; i < 10 - n; ++i) {
+                expected += "[app] INFO: msg" + std::to_string(i) + "\r\n";
+            }
+            // A message longer than the buffer is dropped as a whole
+            logMessage(handler, std::string(100, 'x'));
+            CHECK(AsyncLogHandler<>::droppedCount() - dropped == n + 1);
+            out.unblock();
+        }
+        CHECK(out.data() == expected);
+    }
+
+    SECTION("drains the buffer while the messages are logged") {
+        std::string expected;
+        const unsigned dropped = AsyncLogHandler<>::droppedCount();
+        {
+            AsyncLogHandler<StreamLogHandler> handler(out, LOG_LEVEL_ALL, {}, 64 /* bufferSize */);
+            for (int i = 0; i < 1000; ++i) {
+                const auto msg = "msg" + std::to_string(i);
+                logMessage(handler, msg);
+                expected += "[app] INFO: " + msg + "\r\n";
+                // Give the drain thread a chance to catch up
+                if (i % 2) {
+                    while (out.data().size() < expected.size() &&
+                            AsyncLogHandler<>::droppedCount() == dropped) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+        CHECK(AsyncLogHandler<>::droppedCount() == dropped);
+        CHECK(out.data() == expected);
+    }
+
+    SECTION("can be used with JSONStreamLogHandler") {
+        {
+            AsyncLogHandler<JSONStreamLogHandler> handler(out, LOG_LEVEL_ALL);
+            logMessage(handler, "msg1");
+            logMessage(handler, "msg2");
+        }
+        CHECK(out.data() == "{\"l\":\"INFO\",\"m\":\"msg1\",\"c\":\"app\"}\r\n{\"l\":\"INFO\",\"m\":\"msg2\",\"c\":\"app\"}\r\n");
+    }
+}
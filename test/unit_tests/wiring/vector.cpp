@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2021 Particle Industries, Inc.  All rights reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spark_wiring_vector.h"
+
+#include "catch2/catch.hpp"
+
+#include <chrono>
+#include <string>
+
+namespace {
+
+const int BENCH_ITERATIONS = 1000;
+
+// Allocator counting the number of allocations
+struct CountingAllocator {
+    static size_t count;
+
+    static void* malloc(size_t size) {
+        ++count;
+        return ::malloc(size);
+    }
+
+    static void* realloc(void* ptr, size_t size) {
+        ++count;
+        return ::realloc(ptr, size);
+    }
+
+    static void free(void* ptr) {
+        ::free(ptr);
+    }
+};
+
+size_t CountingAllocator::count = 0;
+
+struct BenchResult {
+    double time; // Microseconds per iteration
+    double allocs; // Allocations per iteration
+};
+
+template<typename F>
+BenchResult runBenchmark(F fn) {
+    CountingAllocator::count = 0;
+    const auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; ++i) {
+        fn();
+    }
+    const auto t2 = std::chrono::steady_clock::now();
+    BenchResult r;
+    r.time = std::chrono::duration<double, std::micro>(t2 - t1).count() / BENCH_ITERATIONS;
+    r.allocs = (double)CountingAllocator::count / BENCH_ITERATIONS;
+    return r;
+}
+
+// Appends elements one by one, reallocating the vector on every insertion as the previous growth
+// policy did
+template<typename VectorT, typename T>
+void appendExact(VectorT& v, const T& value) {
+    v.reserve(v.size() + 1);
+    v.append(value);
+}
+
+} // namespace
+
+// Run explicitly with: wiring "[benchmark]"
+TEST_CASE("Vector growth policy", "[.][benchmark]") {
+    typedef spark::Vector<int, CountingAllocator> IntVector;
+    typedef spark::Vector<std::string, CountingAllocator> StringVector;
+
+    SECTION("appending 1000 integers") {
+        int sum = 0;
+        const auto exact = runBenchmark([&]() {
+            IntVector v;
+            for (int i = 0; i < 1000; ++i) {
+                appendExact(v, i);
+            }
+            sum += v.last();
+        });
+        const auto geometric = runBenchmark([&]() {
+            IntVector v;
+            for (int i = 0; i < 1000; ++i) {
+                v.append(i);
+            }
+            sum += v.last();
+        });
+        CHECK(sum == 999 * BENCH_ITERATIONS * 2);
+        WARN("Exact growth: " << exact.time << " us, " << exact.allocs << " allocations");
+        WARN("Geometric growth: " << geometric.time << " us, " << geometric.allocs << " allocations");
+    }
+
+    SECTION("appending 200 strings") {
+        const std::string s("a string that doesn't fit in the small string buffer");
+        int size = 0;
+        const auto exact = runBenchmark([&]() {
+            StringVector v;
+            for (int i = 0; i < 200; ++i) {
+                appendExact(v, s);
+            }
+            size += v.size();
+        });
+        const auto geometric = runBenchmark([&]() {
+            StringVector v;
+            for (int i = 0; i < 200; ++i) {
+                v.append(s);
+            }
+            size += v.size();
+        });
+        CHECK(size == 200 * BENCH_ITERATIONS * 2);
+        WARN("Exact growth: " << exact.time << " us, " << exact.allocs << " allocations");
+        WARN("Geometric growth: " << geometric.time << " us, " << geometric.allocs << " allocations");
+    }
+}
+
+// Run explicitly with: wiring "[benchmark]"
+TEST_CASE("SmallVector vs Vector", "[.][benchmark]") {
+    // A typical short-lived container holding a few elements, e.g. the handlers matching a URC
+    int sum = 0;
+    const auto vec = runBenchmark([&]() {
+        for (int i = 0; i < 100; ++i) {
+            spark::Vector<int, CountingAllocator> v;
+            for (int j = 0; j < 4; ++j) {
+                v.append(j);
+            }
+            sum += v.size();
+        }
+    });
+    const auto small = runBenchmark([&]() {
+        for (int i = 0; i < 100; ++i) {
+            spark::SmallVector<int, 4, CountingAllocator> v;
+            for (int j = 0; j < 4; ++j) {
+                v.append(j);
+            }
+            sum += v.size();
+        }
+    });
+    CHECK(sum == 4 * 100 * BENCH_ITERATIONS * 2);
+    CHECK(small.allocs == 0);
+    WARN("Vector: " << vec.time << " us, " << vec.allocs << " allocations");
+    WARN("SmallVector: " << small.time << " us, " << small.allocs << " allocations");
+}
@@ -867,6 +867,28 @@ TEST_CASE("Miscellaneous") {
         CHECK(LOG_ENABLED_C(TRACE, "aaa"));
         CHECK(LOG_ENABLED_C(ERROR, "x"));
     }
+    SECTION("cached levels are invalidated when handlers are added or removed") {
+        DefaultLogHandler log1(LOG_LEVEL_WARN, {
+            { "a.b", LOG_LEVEL_ERROR }
+        });
+        CHECK(!LOG_ENABLED_C(INFO, "a"));
+        CHECK(!LOG_ENABLED_C(INFO, "a")); // Cached
+        CHECK(!LOG_ENABLED_C(WARN, "a.b"));
+        CHECK(!LOG_ENABLED_C(INFO, nullptr));
+        {
+            DefaultLogHandler log2(LOG_LEVEL_INFO);
+            CHECK(LOG_ENABLED_C(INFO, "a"));
+            CHECK(LOG_ENABLED_C(WARN, "a.b"));
+            CHECK(LOG_ENABLED_C(INFO, nullptr));
+        }
+        CHECK(!LOG_ENABLED_C(INFO, "a"));
+        CHECK(!LOG_ENABLED_C(WARN, "a.b"));
+        CHECK(!LOG_ENABLED_C(INFO, nullptr));
+        LOG_C(WARN, "a.b", "warn");
+        LOG_C(ERROR, "a.b", "error");
+        log1.checkNext().messageEquals("error");
+        log1.checkAtEnd();
+    }
     SECTION("attribute flag values") {
         CHECK_LOG_ATTR_FLAG(has_file, 0x01);
         CHECK_LOG_ATTR_FLAG(has_line, 0x02);
@@ -878,6 +900,75 @@ TEST_CASE("Miscellaneous") {
     }
 }
 
+TEST_CASE("Deferred logging") {
+    DefaultLogHandler log(LOG_LEVEL_INFO);
+    static char buf[1024];
+    REQUIRE(log_set_deferred_buffer(buf, sizeof(buf), nullptr) == 0);
+    SECTION("messages are formatted when processed") {
+        LOG(INFO, "%d %u %ld %lld %zu %x %c %s %.2f %% %5s|%-*d|%.*s", -1, 2u, 3L, 4LL, (size_t)5, 0xab, 'c', "str", 1.5,
+                "ab", 3, 6, 2, "abc");
+        LOG_ATTR(WARN, (code = -1, details = "details"), "%s", "attr");
+        CHECK(!log.hasNext());
+        CHECK(log_process_deferred(0, nullptr) == 2);
+        log.checkNext().messageEquals("-1 2 3 4 5 ab c str 1.50 %    ab|6  |ab").levelEquals(LOG_LEVEL_INFO)
+                .categoryEquals(LOG_THIS_CATEGORY()).fileEquals(SOURCE_FILE);
+        log.checkNext().messageEquals("attr").levelEquals(LOG_LEVEL_WARN).codeEquals(-1).detailsEquals("details");
+        log.checkAtEnd();
+        CHECK(log_process_deferred(0, nullptr) == 0);
+    }
+    SECTION("string arguments are copied") {
+        std::string s = "abc";
+        LOG(INFO, "%s", s.c_str());
+        s = "xyz";
+        log_process_deferred(0, nullptr);
+        log.checkNext().messageEquals("abc");
+    }
+    SECTION("format strings are copied") {
+        std::string fmt = "%d";
+        LOG_C(INFO, "a", fmt.c_str(), 1);
+        fmt = "xx";
+        LOG_C(INFO, "b", "%d", 2);
+        log_process_deferred(0, nullptr);
+        log.checkNext().messageEquals("1").categoryEquals("a");
+        log.checkNext().messageEquals("2").categoryEquals("b");
+        log.checkAtEnd();
+    }
+    SECTION("disabled messages are not stored") {
+        LOG(TRACE, "trace");
+        CHECK(log_process_deferred(0, nullptr) == 0);
+        log.checkAtEnd();
+    }
+    SECTION("long messages are truncated") {
+        const std::string s = test::randomString(LOG_MAX_STRING_LENGTH * 3 / 2);
+        LOG(INFO, "%s", s.c_str());
+        log_process_deferred(0, nullptr);
+        log.checkNext().messageEquals(s.substr(0, LOG_MAX_STRING_LENGTH - 2) + '~');
+    }
+    SECTION("unsupported conversions are formatted immediately") {
+        LOG(INFO, "%Lf", (long double)1.5);
+        log.checkNext().messageEquals("1.500000");
+        CHECK(log_process_deferred(0, nullptr) == 0);
+    }
+    SECTION("dropped messages are reported") {
+        int count = 0;
+        for (int i = 0; i < 100; ++i) {
+            LOG(INFO, "%d", i);
+        }
+        CHECK(log_process_deferred(1, nullptr) == 1);
+        log.checkNext().messageEquals("0");
+        while (log_process_deferred(1, nullptr) == 1) {
+            ++count;
+        }
+        CHECK(count > 0);
+        for (int i = 0; i < count; ++i) {
+            log.checkNext().levelEquals(LOG_LEVEL_INFO);
+        }
+        log.checkNext().messageEquals(std::to_string(100 - count - 1) + " deferred message(s) dropped").levelEquals(LOG_LEVEL_WARN);
+        log.checkAtEnd();
+    }
+    log_set_deferred_buffer(nullptr, 0, nullptr);
+}
+
 TEST_CASE("Logger API") {
     SECTION("message logging") {
         DefaultLogHandler log(LOG_LEVEL_ALL);
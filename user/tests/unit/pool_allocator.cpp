@@ -26,31 +26,17 @@ public:
     }
 
     size_t available() const {
-        size_t sz = (begin_ + size_) - ptr_;
-        for (BlockHeader* b = freeList_; b != nullptr; b = b->next) {
-            sz += b->size;
-        }
-
-        return sz;
-    }
-
-    uint8_t* ptr() {
-        return ptr_;
+        Stats s;
+        stats(&s);
+        return s.freeSize;
     }
 
-    uint8_t* begin() {
-        return ptr_;
-    }
-
-    using BlockHeaderT = SimpleBasePool::BlockHeader;
-
-    BlockHeaderT* freeList() {
-        return freeList_;
-    }
-
-    BlockHeaderT* freeListEnd() {
-        return freeListEnd_;
+    size_t freeBlockCount() const {
+        Stats s;
+        stats(&s);
+        return s.freeBlockCount;
     }
+    using SimpleBasePool::HEADER_SIZE;
 };
 
 class TestSimpleStaticPool : public SimpleStaticPool {
@@ -60,23 +46,17 @@ public:
     }
 
     size_t available() const {
-        size_t sz = (begin_ + size_) - ptr_;
-        for (BlockHeader* b = freeList_; b != nullptr; b = b->next) {
-            sz += b->size;
-        }
-
-        return sz;
-    }
-
-    using BlockHeaderT = SimpleBasePool::BlockHeader;
-
-    BlockHeaderT* freeList() {
-        return freeList_;
+        Stats s;
+        stats(&s);
+        return s.freeSize;
     }
 
-    BlockHeaderT* freeListEnd() {
-        return freeListEnd_;
+    size_t freeBlockCount() const {
+        Stats s;
+        stats(&s);
+        return s.freeBlockCount;
     }
+    using SimpleBasePool::HEADER_SIZE;
 };
 
 } // anonymous
@@ -160,8 +140,7 @@ void testPool(void* ptr, size_t size) {
             }
 
             CHECK(pool.available() == size);
-            CHECK(pool.freeList() == nullptr);
-            CHECK(pool.freeListEnd() == nullptr);
+            CHECK(pool.freeBlockCount() == 0); // All blocks are merged back to the unallocated space
         }
 
         SECTION("Random order deallocations") {
@@ -193,8 +172,7 @@ void testPool(void* ptr, size_t size) {
             }
 
             CHECK(pool.available() == size);
-            CHECK(pool.freeList() == nullptr);
-            CHECK(pool.freeListEnd() == nullptr);
+            CHECK(pool.freeBlockCount() == 0); // All blocks are merged back to the unallocated space
         }
 
         SECTION("Allocations from free list") {
@@ -239,8 +217,75 @@ void testPool(void* ptr, size_t size) {
             }
 
             CHECK(pool.available() == size);
-            CHECK(pool.freeList() == nullptr);
-            CHECK(pool.freeListEnd() == nullptr);
+            CHECK(pool.freeBlockCount() == 0); // All blocks are merged back to the unallocated space
+        }
+
+        SECTION("Neighbouring free blocks are merged") {
+            const size_t w = sizeof(uintptr_t);
+            void* a = pool.allocate(4 * w);
+            void* b = pool.allocate(4 * w);
+            void* c = pool.allocate(4 * w);
+            void* d = pool.allocate(4 * w);
+            REQUIRE((a && b && c && d));
+            pool.deallocate(b);
+            pool.deallocate(c);
+            CHECK(pool.freeBlockCount() == 1);
+            pool.deallocate(a);
+            CHECK(pool.freeBlockCount() == 1);
+            // The merged block fits 3 blocks of 4 words with their headers minus one header
+            void* p = pool.allocate(12 * w + 2 * Pool::HEADER_SIZE);
+            CHECK(p == a);
+            CHECK(pool.freeBlockCount() == 0);
+            pool.deallocate(d);
+            pool.deallocate(p);
+            CHECK(pool.available() == size);
+            CHECK(pool.freeBlockCount() == 0);
+        }
+
+        SECTION("Free blocks are split") {
+            const size_t w = sizeof(uintptr_t);
+            void* a = pool.allocate(16 * w);
+            void* b = pool.allocate(1);
+            REQUIRE((a && b));
+            pool.deallocate(a);
+            void* c = pool.allocate(1);
+            void* d = pool.allocate(1);
+            CHECK(c == a);
+            CHECK(d != nullptr);
+            CHECK(d < b);
+            CHECK(pool.freeBlockCount() == 1);
+        }
+
+        SECTION("Statistics") {
+            SimpleBasePool::Stats s = {};
+            pool.stats(&s);
+            CHECK(s.totalSize == size);
+            CHECK(s.freeSize == size);
+            CHECK(s.largestFreeBlockSize == size);
+            CHECK(s.usedSize == 0);
+            void* a = pool.allocate(size / 4);
+            void* b = pool.allocate(size / 4);
+            void* c = pool.allocate(size / 4);
+            REQUIRE((a && b && c));
+            pool.stats(&s);
+            const size_t peak = s.usedSize;
+            CHECK(s.peakUsedSize == peak);
+            CHECK((s.usedSize + s.freeSize) == size);
+            pool.deallocate(b);
+            CHECK(pool.allocate(size / 2) == nullptr);
+            pool.stats(&s);
+            CHECK(s.usedSize < peak);
+            CHECK(s.peakUsedSize == peak);
+            CHECK((s.usedSize + s.freeSize) == size);
+            CHECK(s.freeBlockCount == 1);
+            CHECK(s.largestFreeBlockSize < s.freeSize);
+            CHECK(s.failedAllocCount == 1);
+            pool.deallocate(a);
+            pool.deallocate(c);
+            pool.stats(&s);
+            CHECK(s.usedSize == 0);
+            CHECK(s.largestFreeBlockSize == size);
+            CHECK(s.peakUsedSize == peak);
         }
     }
 
@@ -259,3 +304,35 @@ TEST_CASE("SimpleStaticPool") {
 
     testPool<TestSimpleStaticPool>(buf.data(), buf.size());
 }
+
+TEST_CASE("AtomicAllocedPool") {
+    int disableCount = 0;
+    int enableCount = 0;
+    MockRepository mocks;
+    mocks.OnCallFunc(HAL_disable_irq).Do([&]() -> int {
+        ++disableCount;
+        return 0;
+    });
+    mocks.OnCallFunc(HAL_enable_irq).Do([&](int st) -> void {
+        ++enableCount;
+    });
+
+    AtomicAllocedPool pool;
+    REQUIRE(pool.init(DEFAULT_POOL_SIZE) == 0);
+    void* p = pool.alloc(16);
+    REQUIRE(p != nullptr);
+
+    SECTION("Statistics are read with the interrupts disabled") {
+        disableCount = 0;
+        enableCount = 0;
+        const SimpleBasePool& base = pool;
+        SimpleBasePool::Stats s = {};
+        base.stats(&s);
+        CHECK(disableCount == 1);
+        CHECK(enableCount == 1);
+        CHECK(s.totalSize == DEFAULT_POOL_SIZE);
+        CHECK(s.usedSize > 0);
+    }
+
+    pool.free(p);
+}
@@ -1,5 +1,6 @@
 
 #include <iostream>
+#include <string>
 #include <limits.h>
 #include "catch.hpp"
 
@@ -101,3 +102,67 @@ TEST_CASE("Substring with left and right after the end returns until the end of
 TEST_CASE("Substring with flipped left and right returns the correct substring") {
     REQUIRE(String("test123").substring(5, 3)==String("t1"));
 }
+
+TEST_CASE("Can concatenate a string to itself") {
+    String s("abc");
+    s += s;
+    REQUIRE(s == "abcabc");
+    s.concat(s.c_str() + 3);
+    REQUIRE(s == "abcabcabc");
+}
+
+TEST_CASE("Can convert a printable that writes unterminated data") {
+    struct : Printable {
+        size_t printTo(Print& p) const override {
+            return p.write((const uint8_t*)"abcdef", 2) + p.write((const uint8_t*)"cdef", 2);
+        }
+    } printable;
+    const String s(printable);
+    REQUIRE(s == "abcd");
+    REQUIRE(s.length() == 4);
+}
+
+TEST_CASE("Can build a long string one character at a time") {
+    String s;
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        const char c = 'a' + i % 26;
+        s += c;
+        expected += c;
+    }
+    REQUIRE(s.length() == 1000);
+    REQUIRE(s == expected.c_str());
+}
+
+namespace {
+
+struct Point {
+    int x;
+    int y;
+};
+
+// The pattern used by Arduino libraries to make their types concatenable
+StringSumHelper& operator+(const StringSumHelper& lhs, const Point& p) {
+    StringSumHelper& s = const_cast<StringSumHelper&>(lhs);
+    s += p.x;
+    s += ',';
+    s += p.y;
+    return s;
+}
+
+} // namespace
+
+TEST_CASE("Can chain a user-defined concatenation operator") {
+    const Point p = { 1, 2 };
+    const String s = String("(") + p + ")" + p;
+    REQUIRE(s == "(1,2)1,2");
+}
+
+TEST_CASE("Can chain concatenations of temporary strings") {
+    const String a("a");
+    String s = String("x") + a + "b" + 'c' + 1;
+    REQUIRE(s == "xabc1");
+    s = a + a + a;
+    REQUIRE(s == "aaa");
+    REQUIRE(a == "a");
+}
@@ -153,6 +153,11 @@ inline Checker<spark::Vector<T, AllocatorT>> check(const spark::Vector<T, Alloca
     return Checker<spark::Vector<T, AllocatorT>>(vector);
 }
 
+template<typename T, int N, typename AllocatorT>
+inline Checker<spark::SmallVector<T, N, AllocatorT>> check(const spark::SmallVector<T, N, AllocatorT> &vector) {
+    return Checker<spark::SmallVector<T, N, AllocatorT>>(vector);
+}
+
 template<typename VectorT>
 void testVector() {
     using Vector = VectorT;
@@ -314,7 +319,7 @@ void testVector() {
             REQUIRE(a.insert(0, 1)); // i = 0
             check(a).values(1, 2, 4, 5).capacity(4);
             REQUIRE(a.insert(4, 6)); // i = size()
-            check(a).values(1, 2, 4, 5, 6).capacity(5);
+            check(a).values(1, 2, 4, 5, 6).capacity(6); // capacity grows geometrically
             REQUIRE(a.insert(2, 3)); // i = size() / 2
             check(a).values(1, 2, 3, 4, 5, 6).capacity(6);
             Vector b;
@@ -670,3 +675,150 @@ TEST_CASE("Vector<NonTrivialInt>") {
     test::DefaultAllocator::check();
     CHECK(NonTrivialInt::instanceCount() == 0);
 }
+
+TEST_CASE("Vector growth") {
+    test::DefaultAllocator::reset();
+
+    using Vector = spark::Vector<int, test::DefaultAllocator>;
+
+    SECTION("append() grows the capacity geometrically") {
+        Vector a;
+        int reallocs = 0;
+        for (int i = 0; i < 1000; ++i) {
+            const int capacity = a.capacity();
+            REQUIRE(a.append(i));
+            if (a.capacity() != capacity) {
+                ++reallocs;
+            }
+        }
+        check(a).size(1000);
+        CHECK(reallocs < 20);
+        CHECK(a.capacity() < 1500);
+        REQUIRE(a.trimToSize());
+        check(a).size(1000).capacity(1000);
+    }
+
+    SECTION("reserve() and resize() allocate the exact capacity") {
+        Vector a;
+        REQUIRE(a.reserve(10));
+        check(a).size(0).capacity(10);
+        REQUIRE(a.resize(15));
+        check(a).size(15).capacity(15);
+    }
+
+    test::DefaultAllocator::check();
+}
+
+namespace {
+
+template<typename VectorT>
+void testSmallVector() {
+    using Vector = VectorT;
+    using T = typename Vector::ValueType;
+
+    SECTION("stores up to N elements inline") {
+        Vector a;
+        CHECK(a.isInline());
+        CHECK(a.capacity() == 4);
+        CHECK(a.isEmpty());
+        REQUIRE(a.append(1));
+        REQUIRE(a.append(2));
+        REQUIRE(a.append(4));
+        REQUIRE(a.insert(2, 3));
+        CHECK(a.isInline());
+        CHECK(a.capacity() == 4);
+        check(a).values(1, 2, 3, 4);
+    }
+
+    SECTION("moves the elements to the heap when the inline buffer overflows") {
+        Vector a({ 1, 2, 3, 4 });
+        const T x[] = { 5, 6 };
+        REQUIRE(a.append(x, 2));
+        CHECK(!a.isInline());
+        CHECK(a.capacity() >= 6);
+        check(a).values(1, 2, 3, 4, 5, 6);
+        a.removeAt(1, 4);
+        check(a).values(1, 6);
+        REQUIRE(a.trimToSize());
+        CHECK(a.isInline());
+        CHECK(a.capacity() == 4);
+        check(a).values(1, 6);
+    }
+
+    SECTION("removes and takes elements") {
+        Vector a({ 1, 2, 3, 4, 5 });
+        CHECK(a.takeFirst() == 1);
+        CHECK(a.takeLast() == 5);
+        CHECK(a.takeAt(1) == 3);
+        check(a).values(2, 4);
+        CHECK(a.removeOne(2));
+        CHECK(!a.removeOne(2));
+        check(a).values(4);
+        CHECK(a.first() == 4);
+        CHECK(a.last() == 4);
+        CHECK(a.contains(4));
+        CHECK(a.indexOf(4) == 0);
+        a.clear();
+        check(a).size(0);
+    }
+
+    SECTION("resize()") {
+        Vector a({ 1, 2 });
+        REQUIRE(a.resize(3));
+        check(a).values(1, 2, 0);
+        CHECK(a.isInline());
+        REQUIRE(a.resize(6));
+        check(a).values(1, 2, 0, 0, 0, 0);
+        CHECK(!a.isInline());
+        REQUIRE(a.resize(1));
+        check(a).values(1);
+    }
+
+    SECTION("copies and moves inline and heap storage") {
+        Vector a({ 1, 2 });
+        Vector b({ 1, 2, 3, 4, 5 });
+        Vector c(a);
+        Vector d(b);
+        check(c).values(1, 2);
+        check(d).values(1, 2, 3, 4, 5);
+        CHECK(c == a);
+        CHECK(d != a);
+        Vector e(std::move(a));
+        check(e).values(1, 2);
+        check(a).size(0);
+        CHECK(e.isInline());
+        const T* const data = b.data();
+        Vector f(std::move(b));
+        check(f).values(1, 2, 3, 4, 5);
+        CHECK(f.data() == data); // The buffer has been taken over
+        check(b).size(0);
+        CHECK(b.isInline());
+        f = e;
+        check(f).values(1, 2);
+        e = std::move(d);
+        check(e).values(1, 2, 3, 4, 5);
+        d = std::move(c);
+        check(d).values(1, 2);
+    }
+}
+
+} // namespace
+
+TEST_CASE("SmallVector<int>") {
+    test::DefaultAllocator::reset();
+
+    using Vector = spark::SmallVector<int, 4, test::DefaultAllocator>;
+    testSmallVector<Vector>();
+
+    test::DefaultAllocator::check();
+}
+
+TEST_CASE("SmallVector<NonTrivialInt>") {
+    test::DefaultAllocator::reset();
+
+    using Vector = spark::SmallVector<NonTrivialInt, 4, test::DefaultAllocator>;
+    testSmallVector<Vector>();
+
+    test::DefaultAllocator::check();
+    CHECK(NonTrivialInt::instanceCount() == 0);
+}
@@ -144,6 +144,7 @@ test(api_spark_publish) {
     API_COMPILE(Particle.publish("event", "data", 60, PUBLIC));
     API_COMPILE(Particle.publish("event", "data", 60, PUBLIC, NO_ACK));
     API_COMPILE(Particle.publish("event", "data", 60, PUBLIC | NO_ACK));
+    API_COMPILE(Particle.publish("event", "data", 60, PRIVATE | PERSISTENT));
 
     // Particle.publish(String, String, ...)
     API_COMPILE(Particle.publish(String("event")));
@@ -255,4 +256,5 @@ test(api_spark_misc) {
     API_COMPILE(size = Particle.maxEventDataSize());
     API_COMPILE(size = Particle.maxVariableValueSize());
     API_COMPILE(size = Particle.maxFunctionArgumentSize());
+    API_COMPILE(size = Particle.publishDelay());
 }
@@ -57,6 +57,8 @@ const PublishFlag PUBLIC(PUBLISH_EVENT_FLAG_PUBLIC);
 const PublishFlag PRIVATE(PUBLISH_EVENT_FLAG_PRIVATE);
 const PublishFlag NO_ACK(PUBLISH_EVENT_FLAG_NO_ACK);
 const PublishFlag WITH_ACK(PUBLISH_EVENT_FLAG_WITH_ACK);
+const PublishFlag BATCH(PUBLISH_EVENT_FLAG_BATCH);
+const PublishFlag PERSISTENT(PUBLISH_EVENT_FLAG_PERSISTENT);
 
 // Test if the paramater a regular C "string" literal
 template <typename T>
@@ -425,6 +427,15 @@ public:
      * @see `maxVariableValueSize()`
      */
     static int maxFunctionArgumentSize();
+    /**
+     * Get the time in milliseconds until an event can be published without being rate limited.
+     *
+     * The application can use this value to pace its events rather than have them rejected.
+     *
+     * @note This method will return an error (a negative value) if the device is not connected to
+     * the Cloud.
+     */
+    static int publishDelay();
 
 private:
 
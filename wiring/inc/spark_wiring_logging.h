@@ -20,8 +20,11 @@
 
 #include <cstring>
 #include <cstdarg>
+#include <atomic>
+#include <memory>
 
 #include "logging.h"
+#include "spsc_ringbuffer.h"
 
 #include "spark_wiring_json.h"
 #include "spark_wiring_print.h"
@@ -34,6 +37,17 @@
 #include "system_control.h"
 #endif
 
+/*
+    Number of entries in the lookaside caches mapping category name pointers to effective logging
+    levels. Set to 0 to disable caching.
+
+    Categories are cached by address, which assumes that category names are string literals, as is
+    the case with the LOG_CATEGORY() and LOG_SOURCE_CATEGORY() macros.
+*/
+#ifndef LOG_LEVEL_CACHE_SIZE
+#define LOG_LEVEL_CACHE_SIZE 16
+#endif
+
 namespace spark {
 
 class LogCategoryFilter;
@@ -42,6 +56,35 @@ typedef Vector<LogCategoryFilter> LogCategoryFilters;
 
 namespace detail {
 
+// Direct-mapped cache of effective logging levels keyed by category name pointer. Lookups are
+// lock-free and can be performed concurrently with updates
+class LogLevelCache {
+public:
+    LogLevelCache();
+
+    bool get(const char *category, LogLevel *level) const;
+    void set(const char *category, LogLevel level);
+    void clear();
+
+    // This class in non-copyable
+    LogLevelCache(const LogLevelCache&) = delete;
+    LogLevelCache& operator=(const LogLevelCache&) = delete;
+
+private:
+    struct Entry {
+        std::atomic<const char*> category;
+        std::atomic<uint8_t> level;
+    };
+
+#if LOG_LEVEL_CACHE_SIZE > 0
+    Entry entries_[LOG_LEVEL_CACHE_SIZE];
+#endif
+    std::atomic<uint8_t> nullLevel_; // Level of the null category
+    std::atomic_flag writeLock_;
+
+    static size_t index(const char *category);
+};
+
 // Internal implementation
 class LogFilter {
 public:
@@ -61,8 +104,11 @@ private:
 
     Vector<String> cats_; // Category filter strings
     Vector<Node> nodes_; // Lookup table
+    std::unique_ptr<LogLevelCache> cache_; // Allocated only if there are category filters
     LogLevel level_; // Default level
 
+    LogLevel findLevel(const char *category) const;
+
     static int nodeIndex(const Vector<Node> &nodes, const char *name, size_t size, bool &found);
 };
 
@@ -226,6 +272,101 @@ protected:
     virtual void write(const char *data, size_t size) override;
 };
 
+#if PLATFORM_THREADING
+
+namespace detail {
+
+// Output stream of AsyncLogHandler. Data written between beginRecord() and endRecord() is
+// buffered and then either published to the drain thread as a whole, or dropped if it doesn't
+// fit into the buffer. Nested records are merged into the outermost one
+class AsyncLogStream: public Print {
+public:
+    AsyncLogStream(Print &stream, size_t bufferSize);
+    ~AsyncLogStream();
+
+    bool beginRecord();
+    void endRecord();
+
+    Print* destination() const;
+
+    static unsigned droppedCount();
+
+    virtual size_t write(uint8_t c) override;
+    virtual size_t write(const uint8_t *data, size_t size) override;
+
+private:
+    std::unique_ptr<uint8_t[]> data_;
+    particle::services::SpscRingBuffer<uint8_t> buf_; // Written under the log manager's lock
+    Print *dest_;
+    os_semaphore_t sem_;
+    Thread thread_;
+    size_t recordSize_;
+    unsigned recordDepth_;
+    bool overflow_;
+    volatile bool exit_;
+
+    static os_thread_return_t run(void *param);
+};
+
+// Ensures that the stream is constructed before the handler that writes to it
+struct AsyncLogStreamHolder {
+    AsyncLogStream asyncStream;
+
+    AsyncLogStreamHolder(Print &stream, size_t bufferSize) :
+            asyncStream(stream, bufferSize) {
+    }
+};
+
+} // namespace spark::detail
+
+/*!
+    \brief Asynchronous log handler.
+
+    Wraps a stream-based handler, such as \ref spark::StreamLogHandler or
+    \ref spark::JSONStreamLogHandler, so that formatted messages are written into a fixed-size
+    buffer instead of the output stream. The buffer is drained into the stream by a dedicated
+    thread, which keeps slow streams, such as `Serial1`, from blocking the logging thread.
+
+    A message that doesn't fit into the buffer is dropped as a whole. The number of dropped
+    messages is available via \ref droppedCount() and the `log:drop` diagnostic source.
+
+    The handler registers itself in the log manager on construction.
+*/
+template<typename HandlerT = StreamLogHandler>
+class AsyncLogHandler: private detail::AsyncLogStreamHolder, public HandlerT {
+public:
+    /*!
+        \brief Default size of the message buffer.
+    */
+    static const size_t DEFAULT_BUFFER_SIZE = 1024;
+
+    /*!
+        \brief Constructor.
+        \param stream Output stream.
+        \param level Default logging level.
+        \param filters Category filters.
+        \param bufferSize Buffer size. Must be a power of two.
+    */
+    explicit AsyncLogHandler(Print &stream, LogLevel level = LOG_LEVEL_INFO, LogCategoryFilters filters = {},
+            size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    /*!
+        \brief Destructor.
+
+        Unregisters the handler and waits until the buffered messages are written.
+    */
+    virtual ~AsyncLogHandler();
+    /*!
+        \brief Returns the number of messages dropped by all asynchronous handlers.
+    */
+    static unsigned droppedCount();
+
+protected:
+    virtual void logMessage(const char *msg, LogLevel level, const char *category, const LogAttributes &attr) override;
+    virtual void write(const char *data, size_t size) override;
+};
+
+#endif // PLATFORM_THREADING
+
 class AttributedLogger;
 
 /*!
@@ -575,6 +716,7 @@ private:
     struct FactoryHandler;
 
     Vector<LogHandler*> activeHandlers_;
+    detail::LogLevelCache levelCache_; // Minimum level enabled for a category across all handlers
 
     bool outputActive_;
 
@@ -726,6 +868,55 @@ inline void spark::JSONStreamLogHandler::write(const char *data, size_t size) {
     // This handler doesn't support direct logging
 }
 
+#if PLATFORM_THREADING
+
+// spark::detail::AsyncLogStream
+inline Print* spark::detail::AsyncLogStream::destination() const {
+    return dest_;
+}
+
+inline size_t spark::detail::AsyncLogStream::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+// spark::AsyncLogHandler
+template<typename HandlerT>
+inline spark::AsyncLogHandler<HandlerT>::AsyncLogHandler(Print &stream, LogLevel level, LogCategoryFilters filters,
+        size_t bufferSize) :
+        detail::AsyncLogStreamHolder(stream, bufferSize),
+        HandlerT(this->asyncStream, level, filters) {
+    LogManager::instance()->addHandler(this);
+}
+
+template<typename HandlerT>
+inline spark::AsyncLogHandler<HandlerT>::~AsyncLogHandler() {
+    LogManager::instance()->removeHandler(this);
+}
+
+template<typename HandlerT>
+inline unsigned spark::AsyncLogHandler<HandlerT>::droppedCount() {
+    return detail::AsyncLogStream::droppedCount();
+}
+
+template<typename HandlerT>
+inline void spark::AsyncLogHandler<HandlerT>::logMessage(const char *msg, LogLevel level, const char *category,
+        const LogAttributes &attr) {
+    if (this->asyncStream.beginRecord()) {
+        HandlerT::logMessage(msg, level, category, attr);
+        this->asyncStream.endRecord();
+    }
+}
+
+template<typename HandlerT>
+inline void spark::AsyncLogHandler<HandlerT>::write(const char *data, size_t size) {
+    if (this->asyncStream.beginRecord()) {
+        HandlerT::write(data, size);
+        this->asyncStream.endRecord();
+    }
+}
+
+#endif // PLATFORM_THREADING
+
 // spark::Logger
 inline spark::Logger::Logger(const char *name) :
         name_(name) {
@@ -208,6 +208,7 @@ protected:
 	void init(void);
 	void invalidate(void);
 	unsigned char changeBuffer(unsigned int maxStrLen);
+	unsigned char grow(unsigned int maxStrLen);
 	unsigned char concat(const char *cstr, unsigned int length);
 
 	// copy and move
@@ -226,6 +227,10 @@ class StringSumHelper : public String
 {
 public:
 	StringSumHelper(const String &s) : String(s) {}
+	#ifdef __GXX_EXPERIMENTAL_CXX0X__
+	// a temporary left-hand operand is moved into the result rather than copied
+	StringSumHelper(String &&s) : String(static_cast<String&&>(s)) {}
+	#endif
 	StringSumHelper(const char *p) : String(p) {}
 	StringSumHelper(char c) : String(c) {}
 	StringSumHelper(unsigned char num) : String(num) {}
@@ -46,6 +46,9 @@ struct DefaultAllocator {
     static void free(void* ptr);
 };
 
+template<typename T, int N, typename AllocatorT = DefaultAllocator>
+class SmallVector;
+
 template<typename T, typename AllocatorT = DefaultAllocator>
 class Vector {
 public:
@@ -131,6 +134,8 @@ private:
     T* data_;
     int size_, capacity_;
 
+    bool grow(int n);
+
     template<PARTICLE_VECTOR_ENABLE_IF_TRIVIALLY_COPYABLE(T)>
     bool realloc(int n) {
         T* d = nullptr;
@@ -241,16 +246,107 @@ private:
 
     template<typename V, typename A>
     friend void swap(Vector<V, A>& vector, Vector<V, A>& vector2);
+
+    template<typename V, int N, typename A>
+    friend class SmallVector;
 };
 
 template<typename T, typename AllocatorT>
 void swap(Vector<T, AllocatorT>& vector, Vector<T, AllocatorT>& vector2);
 
+/**
+ * A vector that stores up to `N` elements in an inline buffer.
+ *
+ * The elements are moved to a dynamically allocated buffer only when the vector's size exceeds `N`.
+ * Moving a vector whose elements are stored inline moves the elements individually.
+ */
+template<typename T, int N, typename AllocatorT>
+class SmallVector {
+public:
+    typedef T ValueType;
+    typedef AllocatorT AllocatorType;
+
+    static_assert(N > 0, "Size of the inline buffer must be greater than 0");
+
+    SmallVector();
+    SmallVector(const T* values, int n);
+    SmallVector(std::initializer_list<T> values);
+    SmallVector(const SmallVector<T, N, AllocatorT>& vector);
+    SmallVector(SmallVector<T, N, AllocatorT>&& vector);
+    ~SmallVector();
+
+    bool append(T value);
+    bool append(const T* values, int n);
+
+    bool insert(int i, T value);
+    bool insert(int i, const T* values, int n);
+
+    void removeAt(int i, int n = 1);
+    bool removeOne(const T& value);
+
+    T takeFirst();
+    T takeLast();
+    T takeAt(int i);
+
+    T& first();
+    const T& first() const;
+    T& last();
+    const T& last() const;
+    T& at(int i);
+    const T& at(int i) const;
+
+    int indexOf(const T& value, int i = 0) const;
+    bool contains(const T& value) const;
+
+    bool resize(int n);
+    int size() const;
+    bool isEmpty() const;
+
+    bool reserve(int n);
+    int capacity() const;
+    bool trimToSize();
+    bool isInline() const;
+
+    void clear();
+
+    T* data();
+    const T* data() const;
+
+    T* begin();
+    const T* begin() const;
+    T* end();
+    const T* end() const;
+
+    T& operator[](int i);
+    const T& operator[](int i) const;
+
+    bool operator==(const SmallVector<T, N, AllocatorT>& vector) const;
+    bool operator!=(const SmallVector<T, N, AllocatorT>& vector) const;
+
+    SmallVector<T, N, AllocatorT>& operator=(const SmallVector<T, N, AllocatorT>& vector);
+    SmallVector<T, N, AllocatorT>& operator=(SmallVector<T, N, AllocatorT>&& vector);
+
+private:
+    typedef Vector<T, AllocatorT> VectorType;
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type buf_[N];
+    T* data_;
+    int size_, capacity_;
+
+    T* inlineData() {
+        return reinterpret_cast<T*>(buf_);
+    }
+
+    bool grow(int n);
+    bool realloc(int n);
+};
+
 } // spark
 
 namespace particle {
 
 using ::spark::Vector;
+using ::spark::SmallVector;
 
 } // particle
 
@@ -369,7 +465,7 @@ inline bool spark::Vector<T, AllocatorT>::prepend(const Vector<T, AllocatorT> &v
 
 template<typename T, typename AllocatorT>
 inline bool spark::Vector<T, AllocatorT>::insert(int i, T value) {
-    if (size_ + 1 > capacity_ && !realloc(size_ + 1)) {
+    if (!grow(size_ + 1)) {
         return false;
     }
     T* const p = data_ + i;
@@ -381,7 +477,7 @@ inline bool spark::Vector<T, AllocatorT>::insert(int i, T value) {
 
 template<typename T, typename AllocatorT>
 inline bool spark::Vector<T, AllocatorT>::insert(int i, int n, const T& value) {
-    if (size_ + n > capacity_ && !realloc(size_ + n)) {
+    if (!grow(size_ + n)) {
         return false;
     }
     T* const p = data_ + i;
@@ -393,7 +489,7 @@ inline bool spark::Vector<T, AllocatorT>::insert(int i, int n, const T& value) {
 
 template<typename T, typename AllocatorT>
 inline bool spark::Vector<T, AllocatorT>::insert(int i, const T* values, int n) {
-    if (size_ + n > capacity_ && !realloc(size_ + n)) {
+    if (!grow(size_ + n)) {
         return false;
     }
     T* const p = data_ + i;
@@ -663,6 +759,371 @@ inline spark::Vector<T, AllocatorT>& spark::Vector<T, AllocatorT>::operator=(Vec
     return *this;
 }
 
+template<typename T, typename AllocatorT>
+inline bool spark::Vector<T, AllocatorT>::grow(int n) {
+    if (n <= capacity_) {
+        return true;
+    }
+    // Grow the capacity geometrically so that appending elements one by one takes amortized
+    // constant time. If the memory is scarce, fall back to the requested capacity
+    const int c = capacity_ + capacity_ / 2;
+    if (c > n && realloc(c)) {
+        return true;
+    }
+    return realloc(n);
+}
+
+// spark::SmallVector
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::SmallVector() :
+        data_(inlineData()),
+        size_(0),
+        capacity_(N) {
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::SmallVector(const T* values, int n) : SmallVector() {
+    if (n > 0 && reserve(n)) {
+        VectorType::copy(data_, values, values + n);
+        size_ = n;
+    }
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::SmallVector(std::initializer_list<T> values) : SmallVector() {
+    const int n = values.size();
+    if (n > 0 && reserve(n)) {
+        VectorType::copy(data_, values.begin(), values.end());
+        size_ = n;
+    }
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::SmallVector(const SmallVector<T, N, AllocatorT>& vector) :
+        SmallVector(vector.data_, vector.size_) {
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::SmallVector(SmallVector<T, N, AllocatorT>&& vector) : SmallVector() {
+    *this = std::move(vector);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>::~SmallVector() {
+    VectorType::destruct(data_, data_ + size_);
+    if (!isInline()) {
+        AllocatorT::free(data_);
+    }
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::append(T value) {
+    return insert(size_, std::move(value));
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::append(const T* values, int n) {
+    return insert(size_, values, n);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::insert(int i, T value) {
+    if (!grow(size_ + 1)) {
+        return false;
+    }
+    T* const p = data_ + i;
+    VectorType::move(p + 1, p, data_ + size_);
+    new(p) T(std::move(value));
+    ++size_;
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::insert(int i, const T* values, int n) {
+    if (!grow(size_ + n)) {
+        return false;
+    }
+    T* const p = data_ + i;
+    VectorType::move(p + n, p, data_ + size_);
+    VectorType::copy(p, values, values + n);
+    size_ += n;
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline void spark::SmallVector<T, N, AllocatorT>::removeAt(int i, int n) {
+    if (n < 0 || i + n > size_) {
+        n = size_ - i;
+    }
+    T* const p = data_ + i;
+    VectorType::destruct(p, p + n);
+    VectorType::move(p, p + n, data_ + size_);
+    size_ -= n;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::removeOne(const T& value) {
+    const int i = indexOf(value);
+    if (i < 0) {
+        return false;
+    }
+    removeAt(i);
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T spark::SmallVector<T, N, AllocatorT>::takeFirst() {
+    return takeAt(0);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T spark::SmallVector<T, N, AllocatorT>::takeLast() {
+    return takeAt(size_ - 1);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T spark::SmallVector<T, N, AllocatorT>::takeAt(int i) {
+    T* const p = data_ + i;
+    T v(std::move(*p));
+    p->~T();
+    VectorType::move(p, p + 1, data_ + size_);
+    --size_;
+    return v;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T& spark::SmallVector<T, N, AllocatorT>::first() {
+    return data_[0];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T& spark::SmallVector<T, N, AllocatorT>::first() const {
+    return data_[0];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T& spark::SmallVector<T, N, AllocatorT>::last() {
+    return data_[size_ - 1];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T& spark::SmallVector<T, N, AllocatorT>::last() const {
+    return data_[size_ - 1];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T& spark::SmallVector<T, N, AllocatorT>::at(int i) {
+    return data_[i];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T& spark::SmallVector<T, N, AllocatorT>::at(int i) const {
+    return data_[i];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline int spark::SmallVector<T, N, AllocatorT>::indexOf(const T& value, int i) const {
+    const T* const p = VectorType::find(data_ + i, data_ + size_, value);
+    if (!p) {
+        return -1;
+    }
+    return p - data_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::contains(const T& value) const {
+    return indexOf(value) >= 0;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::resize(int n) {
+    if (n > size_) {
+        if (!reserve(n)) {
+            return false;
+        }
+        VectorType::construct(data_ + size_, data_ + n);
+        size_ = n;
+    } else if (n >= 0) {
+        VectorType::destruct(data_ + n, data_ + size_);
+        size_ = n;
+    }
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline int spark::SmallVector<T, N, AllocatorT>::size() const {
+    return size_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::isEmpty() const {
+    return size_ == 0;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::reserve(int n) {
+    if (n > capacity_ && !realloc(n)) {
+        return false;
+    }
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline int spark::SmallVector<T, N, AllocatorT>::capacity() const {
+    return capacity_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::trimToSize() {
+    if (capacity_ > size_ && !isInline() && !realloc(size_)) {
+        return false;
+    }
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::isInline() const {
+    return data_ == reinterpret_cast<const T*>(buf_);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline void spark::SmallVector<T, N, AllocatorT>::clear() {
+    VectorType::destruct(data_, data_ + size_);
+    size_ = 0;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T* spark::SmallVector<T, N, AllocatorT>::data() {
+    return data_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T* spark::SmallVector<T, N, AllocatorT>::data() const {
+    return data_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T* spark::SmallVector<T, N, AllocatorT>::begin() {
+    return data_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T* spark::SmallVector<T, N, AllocatorT>::begin() const {
+    return data_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T* spark::SmallVector<T, N, AllocatorT>::end() {
+    return data_ + size_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T* spark::SmallVector<T, N, AllocatorT>::end() const {
+    return data_ + size_;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline T& spark::SmallVector<T, N, AllocatorT>::operator[](int i) {
+    return data_[i];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline const T& spark::SmallVector<T, N, AllocatorT>::operator[](int i) const {
+    return data_[i];
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::operator==(const SmallVector<T, N, AllocatorT>& vector) const {
+    if (size_ != vector.size_) {
+        return false;
+    }
+    for (int i = 0; i < size_; ++i) {
+        if (data_[i] != vector.data_[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::operator!=(const SmallVector<T, N, AllocatorT>& vector) const {
+    return !(*this == vector);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>& spark::SmallVector<T, N, AllocatorT>::operator=(
+        const SmallVector<T, N, AllocatorT>& vector) {
+    if (this != &vector) {
+        clear();
+        if (reserve(vector.size_)) {
+            VectorType::copy(data_, vector.data_, vector.data_ + vector.size_);
+            size_ = vector.size_;
+        }
+    }
+    return *this;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline spark::SmallVector<T, N, AllocatorT>& spark::SmallVector<T, N, AllocatorT>::operator=(
+        SmallVector<T, N, AllocatorT>&& vector) {
+    if (this == &vector) {
+        return *this;
+    }
+    clear();
+    if (!vector.isInline()) {
+        // Take ownership of the other vector's buffer
+        if (!isInline()) {
+            AllocatorT::free(data_);
+        }
+        data_ = vector.data_;
+        size_ = vector.size_;
+        capacity_ = vector.capacity_;
+        vector.data_ = vector.inlineData();
+        vector.size_ = 0;
+        vector.capacity_ = N;
+    } else {
+        // The elements of the other vector always fit in this vector's buffer
+        VectorType::move(data_, vector.data_, vector.data_ + vector.size_);
+        size_ = vector.size_;
+        vector.size_ = 0;
+    }
+    return *this;
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::grow(int n) {
+    if (n <= capacity_) {
+        return true;
+    }
+    const int c = capacity_ + capacity_ / 2;
+    if (c > n && realloc(c)) {
+        return true;
+    }
+    return realloc(n);
+}
+
+template<typename T, int N, typename AllocatorT>
+inline bool spark::SmallVector<T, N, AllocatorT>::realloc(int n) {
+    T* d = inlineData();
+    if (n > N) {
+        d = (T*)AllocatorT::malloc(n * sizeof(T));
+        if (!d) {
+            return false;
+        }
+    } else {
+        n = N;
+    }
+    if (d != data_) {
+        VectorType::move(d, data_, data_ + size_);
+        if (!isInline()) {
+            AllocatorT::free(data_);
+        }
+        data_ = d;
+    }
+    capacity_ = n;
+    return true;
+}
+
 // spark::
 template<typename T, typename AllocatorT>
 inline void spark::swap(Vector<T, AllocatorT>& vector, Vector<T, AllocatorT>& vector2) {
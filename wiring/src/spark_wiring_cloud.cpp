@@ -70,7 +70,8 @@ bool CloudClass::register_function(cloud_function_t fn, void* data, const char*
 }
 
 Future<bool> CloudClass::publish_event(const char *eventName, const char *eventData, int ttl, PublishFlags flags) {
-    if (!connected()) {
+    // Persistent events are queued by the system while the device is offline
+    if (!connected() && !(flags.value() & PUBLISH_EVENT_FLAG_PERSISTENT)) {
         return Future<bool>(Error::INVALID_STATE);
     }
     spark_send_event_data d = {};
@@ -124,3 +125,10 @@ int CloudClass::maxFunctionArgumentSize() {
     CHECK(spark_get_connection_property(SPARK_CLOUD_MAX_FUNCTION_ARGUMENT_SIZE, &size, &n, nullptr /* reserved */));
     return size;
 }
+
+int CloudClass::publishDelay() {
+    system_tick_t delay = 0;
+    size_t n = sizeof(delay);
+    CHECK(spark_get_connection_property(SPARK_CLOUD_PUBLISH_DELAY, &delay, &n, nullptr /* reserved */));
+    return delay;
+}
@@ -30,6 +30,7 @@
 #include "spark_wiring_usbserial.h"
 #include "spark_wiring_usartserial.h"
 #include "spark_wiring_interrupts.h"
+#include "spark_wiring_diagnostics.h"
 
 // Uncomment to enable logging in interrupt handlers
 // #define LOG_FROM_ISR
@@ -372,6 +373,89 @@ const spark::Logger spark::Log("app");
     `- aa (error) - b (warn)
 */
 
+// spark::detail::LogLevelCache
+namespace {
+
+// Marks a cache entry that doesn't contain a valid level
+const uint8_t INVALID_CACHED_LEVEL = 0xff;
+
+} // namespace
+
+spark::detail::LogLevelCache::LogLevelCache() :
+        nullLevel_(INVALID_CACHED_LEVEL) {
+    writeLock_.clear();
+#if LOG_LEVEL_CACHE_SIZE > 0
+    for (Entry& e: entries_) {
+        e.category.store(nullptr, std::memory_order_relaxed);
+        e.level.store(INVALID_CACHED_LEVEL, std::memory_order_relaxed);
+    }
+#endif
+}
+
+bool spark::detail::LogLevelCache::get(const char *category, LogLevel *level) const {
+    if (!category) {
+        const uint8_t lvl = nullLevel_.load(std::memory_order_acquire);
+        if (lvl == INVALID_CACHED_LEVEL) {
+            return false;
+        }
+        *level = (LogLevel)lvl;
+        return true;
+    }
+#if LOG_LEVEL_CACHE_SIZE > 0
+    const Entry& e = entries_[index(category)];
+    if (e.category.load(std::memory_order_acquire) != category) {
+        return false;
+    }
+    const uint8_t lvl = e.level.load(std::memory_order_relaxed);
+    // Make sure the entry wasn't replaced while its level was being read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (e.category.load(std::memory_order_relaxed) != category || lvl == INVALID_CACHED_LEVEL) {
+        return false;
+    }
+    *level = (LogLevel)lvl;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void spark::detail::LogLevelCache::set(const char *category, LogLevel level) {
+    if (writeLock_.test_and_set(std::memory_order_acquire)) {
+        return; // Another thread is updating the cache, don't wait for it
+    }
+    if (!category) {
+        nullLevel_.store(level, std::memory_order_release);
+    } else {
+#if LOG_LEVEL_CACHE_SIZE > 0
+        Entry& e = entries_[index(category)];
+        e.category.store(nullptr, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.level.store(level, std::memory_order_relaxed);
+        e.category.store(category, std::memory_order_release);
+#endif
+    }
+    writeLock_.clear(std::memory_order_release);
+}
+
+void spark::detail::LogLevelCache::clear() {
+    // The caller ensures that the cache is not updated concurrently
+    nullLevel_.store(INVALID_CACHED_LEVEL, std::memory_order_release);
+#if LOG_LEVEL_CACHE_SIZE > 0
+    for (Entry& e: entries_) {
+        e.category.store(nullptr, std::memory_order_release);
+    }
+#endif
+}
+
+inline size_t spark::detail::LogLevelCache::index(const char *category) {
+#if LOG_LEVEL_CACHE_SIZE > 0
+    const uintptr_t p = (uintptr_t)category;
+    return (p ^ (p >> 5) ^ (p >> 11)) % LOG_LEVEL_CACHE_SIZE;
+#else
+    return 0;
+#endif
+}
+
 // spark::detail::LogFilter
 struct spark::detail::LogFilter::Node {
     const char *name; // Subcategory name
@@ -423,6 +507,9 @@ spark::detail::LogFilter::LogFilter(LogLevel level, LogCategoryFilters filters)
             pNodes = &node.nodes;
         }
     }
+    if (!nodes.isEmpty()) {
+        cache_.reset(new(std::nothrow) LogLevelCache());
+    }
     using std::swap;
     swap(cats_, cats);
     swap(nodes_, nodes);
@@ -433,6 +520,20 @@ spark::detail::LogFilter::~LogFilter() {
 }
 
 LogLevel spark::detail::LogFilter::level(const char *category) const {
+    if (!cache_ || !category) {
+        return findLevel(category);
+    }
+    LogLevel level = LOG_LEVEL_NONE;
+    if (!cache_->get(category, &level)) {
+        // Category filters don't change during the lifetime of the filter, so the cache never
+        // needs to be invalidated
+        level = findLevel(category);
+        cache_->set(category, level);
+    }
+    return level;
+}
+
+LogLevel spark::detail::LogFilter::findLevel(const char *category) const {
     LogLevel level = level_; // Default level
     if (!nodes_.isEmpty() && category) {
         const Vector<Node> *pNodes = &nodes_; // Root nodes
@@ -591,6 +692,107 @@ void spark::JSONStreamLogHandler::logMessage(const char *msg, LogLevel level, co
     this->stream()->write((const uint8_t*)"\r\n", 2);
 }
 
+#if PLATFORM_THREADING
+
+namespace {
+
+// Handlers are called by the log manager under its lock, so the counter doesn't need to be atomic
+particle::SimpleUnsignedIntegerDiagnosticData g_asyncLogDroppedCounter(DIAG_ID_SYSTEM_LOG_DROPPED_MESSAGES, DIAG_NAME_SYSTEM_LOG_DROPPED_MESSAGES);
+
+} // namespace
+
+// spark::detail::AsyncLogStream
+spark::detail::AsyncLogStream::AsyncLogStream(Print &stream, size_t bufferSize) :
+        dest_(&stream),
+        sem_(nullptr),
+        recordSize_(0),
+        recordDepth_(0),
+        overflow_(false),
+        exit_(false) {
+    data_.reset(new(std::nothrow) uint8_t[bufferSize]);
+    if (!data_ || buf_.init(data_.get(), bufferSize) < 0) {
+        return;
+    }
+    if (os_semaphore_create(&sem_, 1, 0) != 0) {
+        sem_ = nullptr;
+        return;
+    }
+    thread_ = Thread("log", run, this);
+}
+
+spark::detail::AsyncLogStream::~AsyncLogStream() {
+    if (thread_.isValid()) {
+        exit_ = true;
+        os_semaphore_give(sem_, false);
+        thread_.dispose();
+    }
+    if (sem_) {
+        os_semaphore_destroy(sem_);
+    }
+}
+
+bool spark::detail::AsyncLogStream::beginRecord() {
+#if PLATFORM_ID != PLATFORM_GCC
+    if (dest_ == &Serial && Network.listening()) {
+        return false; // Do not mix logging and serial console output
+    }
+#endif
+    // The wrapped handler may write a message in several calls to write(), each of which begins
+    // its own record
+    if (recordDepth_++ > 0) {
+        return true;
+    }
+    recordSize_ = 0;
+    // Without the drain thread nothing would ever be written, so count the message as dropped
+    overflow_ = !thread_.isValid();
+    return true;
+}
+
+void spark::detail::AsyncLogStream::endRecord() {
+    if (--recordDepth_ > 0) {
+        return;
+    }
+    if (overflow_) {
+        ++g_asyncLogDroppedCounter;
+    } else if (recordSize_ > 0) {
+        buf_.acquireCommit(recordSize_);
+        os_semaphore_give(sem_, false);
+    }
+    recordSize_ = 0;
+}
+
+unsigned spark::detail::AsyncLogStream::droppedCount() {
+    return g_asyncLogDroppedCounter;
+}
+
+size_t spark::detail::AsyncLogStream::write(const uint8_t *data, size_t size) {
+    if (!overflow_) {
+        if (buf_.stage(recordSize_, data, size) < 0) {
+            overflow_ = true;
+        } else {
+            recordSize_ += size;
+        }
+    }
+    return size;
+}
+
+os_thread_return_t spark::detail::AsyncLogStream::run(void *param) {
+    const auto self = static_cast<AsyncLogStream*>(param);
+    for (;;) {
+        os_semaphore_take(self->sem_, CONCURRENT_WAIT_FOREVER, false);
+        size_t n = 0;
+        while ((n = self->buf_.consumable()) > 0) {
+            self->dest_->write(self->buf_.consume(n), n);
+            self->buf_.consumeCommit(n);
+        }
+        if (self->exit_) {
+            break;
+        }
+    }
+}
+
+#endif // PLATFORM_THREADING
+
 #if Wiring_LogConfig
 
 // spark::DefaultLogHandlerFactory
@@ -706,6 +908,7 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
         if (activeHandlers_.contains(handler) || !activeHandlers_.append(handler)) {
             return false;
         }
+        levelCache_.clear();
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
@@ -715,7 +918,11 @@ bool spark::LogManager::addHandler(LogHandler *handler) {
 
 void spark::LogManager::removeHandler(LogHandler *handler) {
     LOG_WITH_LOCK(mutex_) {
-        if (activeHandlers_.removeOne(handler) && activeHandlers_.isEmpty()) {
+        if (!activeHandlers_.removeOne(handler)) {
+            return;
+        }
+        levelCache_.clear();
+        if (activeHandlers_.isEmpty()) {
             resetSystemCallbacks();
         }
     }
@@ -764,6 +971,7 @@ bool spark::LogManager::addFactoryHandler(const char *id, const char *handlerTyp
             factoryHandlers_.takeLast(); // Revert factoryHandlers_.append()
             return false;
         }
+        levelCache_.clear();
         if (activeHandlers_.size() == 1) {
             setSystemCallbacks();
         }
@@ -810,6 +1018,7 @@ void spark::LogManager::destroyFactoryHandler(const char *id) {
         const FactoryHandler &h = factoryHandlers_.at(i);
         if (h.id == id) {
             activeHandlers_.removeOne(h.handler);
+            levelCache_.clear();
             if (activeHandlers_.isEmpty()) {
                 resetSystemCallbacks();
             }
@@ -826,6 +1035,7 @@ void spark::LogManager::destroyFactoryHandler(const char *id) {
 void spark::LogManager::destroyFactoryHandlers() {
     for (const FactoryHandler &h: factoryHandlers_) {
         activeHandlers_.removeOne(h.handler);
+        levelCache_.clear();
         if (activeHandlers_.isEmpty()) {
             resetSystemCallbacks();
         }
@@ -894,14 +1104,19 @@ int spark::LogManager::logEnabled(int level, const char *category, void *reserve
     }
 #endif
     LogManager *that = instance();
-    int minLevel = LOG_LEVEL_NONE;
+    LogLevel minLevel = LOG_LEVEL_NONE;
+    if (that->levelCache_.get(category, &minLevel)) {
+        return (level >= minLevel);
+    }
     LOG_WITH_LOCK(that->mutex_) {
         for (LogHandler *handler: that->activeHandlers_) {
-            const int level = handler->level(category);
+            const LogLevel level = handler->level(category);
             if (level < minLevel) {
                 minLevel = level;
             }
         }
+        // Updated under the lock so that a concurrent invalidation can't be overwritten
+        that->levelCache_.set(category, minLevel);
     }
     return (level >= minLevel);
 }
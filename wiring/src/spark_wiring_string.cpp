@@ -213,6 +213,17 @@ unsigned char String::changeBuffer(unsigned int maxStrLen)
 	return 0;
 }
 
+unsigned char String::grow(unsigned int maxStrLen)
+{
+	if (buffer && capacity >= maxStrLen) return 1;
+	// grow the capacity geometrically so that repeated concatenations don't
+	// reallocate the buffer every time. if the memory is scarce, fall back to
+	// the requested capacity
+	unsigned int n = capacity + capacity / 2;
+	if (n > maxStrLen && reserve(n)) return 1;
+	return reserve(maxStrLen);
+}
+
 /*********************************************/
 /*  Copy and Move                            */
 /*********************************************/
@@ -309,9 +320,16 @@ unsigned char String::concat(const char *cstr, unsigned int length)
 	unsigned int newlen = len + length;
 	if (!cstr) return 0;
 	if (length == 0) return 1;
-	if (!reserve(newlen)) return 0;
-	strcpy(buffer + len, cstr);
+	if (!buffer || newlen > capacity) {
+		// the source may point into this string's buffer, e.g. s += s
+		const bool self = buffer && cstr >= buffer && cstr <= buffer + len;
+		const unsigned int offset = self ? cstr - buffer : 0;
+		if (!grow(newlen)) return 0;
+		if (self) cstr = buffer + offset;
+	}
+	memcpy(buffer + len, cstr, length);
 	len = newlen;
+	buffer[len] = 0;
 	return 1;
 }
 